@@ -0,0 +1,171 @@
+#include "access_log.h"
+#include "mono_clock.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <string>
+#include <unordered_map>
+
+static_assert(sizeof(access_log_hdr) == 32, "access log header layout changed");
+static_assert(sizeof(access_req_rec) == 56, "access log record layout changed");
+
+#if ACCESS_LOG_OPEN
+// 以下状态只由主线程访问，不需要加锁
+static int g_fd = -1;               // 当前日志文件
+static char* g_base = NULL;         // 文件映射的起始地址
+static size_t g_off = 0;            // 下一条记录的写入位置
+static time_t g_open_time = 0;      // 当前文件的创建时间
+static std::unordered_map<std::string, uint32_t> g_urls;   // 当前文件中已内部化的 URL
+
+static int64_t now_unix_us(){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// 关闭当前文件，截掉预分配但未使用的部分
+static void access_log_file_close(){
+    if(g_base){
+        munmap(g_base, ACCESS_LOG_FILE_SIZE);
+        g_base = NULL;
+    }
+    if(g_fd != -1){
+        if(ftruncate(g_fd, g_off) < 0){
+            // 截断失败不影响解码，结尾为全0
+        }
+        close(g_fd);
+        g_fd = -1;
+    }
+}
+
+// 创建新的日志文件：预分配空间、映射到内存、写入文件头
+static bool access_log_file_open(){
+    access_log_file_close();
+    g_urls.clear();         // URL 编号只在单个文件内有效
+
+    char stamp[32], name[160];
+    time_t now = time(NULL);
+    struct tm tm_now;
+    localtime_r(&now, &tm_now);
+    strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", &tm_now);
+    // 文件名精确到秒，同一秒内滚动或重启时加序号，不覆盖已有的文件
+    for(int seq = 0; seq < ACCESS_LOG_MAX_SEQ; ++seq){
+        if(seq == 0){
+            snprintf(name, sizeof(name), "%s/access_%s.bin", ACCESS_LOG_DIR, stamp);
+        }else{
+            snprintf(name, sizeof(name), "%s/access_%s_%d.bin", ACCESS_LOG_DIR, stamp, seq);
+        }
+        g_fd = open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if(g_fd != -1 || errno != EEXIST){
+            break;
+        }
+    }
+    if(g_fd == -1){
+        return false;
+    }
+    if(ftruncate(g_fd, ACCESS_LOG_FILE_SIZE) < 0){
+        close(g_fd);
+        g_fd = -1;
+        return false;
+    }
+    g_base = (char*)mmap(0, ACCESS_LOG_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, g_fd, 0);
+    if(g_base == MAP_FAILED){
+        g_base = NULL;
+        close(g_fd);
+        g_fd = -1;
+        return false;
+    }
+
+    access_log_hdr* hdr = (access_log_hdr*)g_base;
+    memcpy(hdr->magic, ACCESS_LOG_MAGIC, 4);
+    hdr->version = ACCESS_LOG_VERSION;
+    hdr->start_us = now_unix_us();
+    g_off = sizeof(access_log_hdr);
+    g_open_time = now;
+    return true;
+}
+
+// 为 size 字节的记录预留空间，至少保留8字节作为结尾标记
+static char* access_log_reserve(size_t size){
+    if(!g_base || g_off + size + 8 > ACCESS_LOG_FILE_SIZE){
+        return NULL;
+    }
+    char* p = g_base + g_off;
+    g_off += size;
+    return p;
+}
+
+// 查找 URL 的编号，第一次出现时分配编号并写入 URL 定义记录
+static uint32_t access_log_intern(const char* url){
+    size_t len = strnlen(url, ACCESS_LOG_MAX_URL_LEN - 1);
+    std::string key(url, len);
+    std::unordered_map<std::string, uint32_t>::iterator it = g_urls.find(key);
+    if(it != g_urls.end()){
+        return it->second;
+    }
+    if(g_urls.size() >= ACCESS_LOG_MAX_URLS){
+        return ACCESS_URL_UNKNOWN;
+    }
+
+    size_t size = (sizeof(access_url_rec) + len + 1 + 7) & ~(size_t)7;    // 补齐到8字节
+    char* p = access_log_reserve(size);
+    if(!p){
+        return ACCESS_URL_UNKNOWN;
+    }
+    uint32_t id = g_urls.size();
+    access_url_rec* rec = (access_url_rec*)p;
+    rec->type = ACCESS_REC_URL;
+    rec->size = size;
+    rec->url_id = id;
+    memcpy(p + sizeof(access_url_rec), url, len);  // 其余部分在预分配时已是0
+    g_urls[key] = id;
+    return id;
+}
+#endif
+
+bool access_log_init(){
+    #if ACCESS_LOG_OPEN
+    mkdir(ACCESS_LOG_DIR, 0755);
+    return access_log_file_open();
+    #else
+    return true;
+    #endif
+}
+
+void access_log_close(){
+    #if ACCESS_LOG_OPEN
+    access_log_file_close();
+    #endif
+}
+
+void access_log_append(access_req_rec& rec, const char* url, long done_mono_us){
+    #if ACCESS_LOG_OPEN
+    if(!g_base){
+        return;
+    }
+    // 一条 URL 定义加一条请求记录的最大长度，保证两者写在同一个文件中
+    const size_t max_need = sizeof(access_url_rec) + ACCESS_LOG_MAX_URL_LEN + sizeof(access_req_rec) + 8;
+    if(g_off + max_need > ACCESS_LOG_FILE_SIZE || time(NULL) - g_open_time >= ACCESS_LOG_ROTATE_SECS){
+        if(!access_log_file_open()){
+            return;
+        }
+    }
+    rec.type = ACCESS_REC_REQUEST;
+    rec.size = sizeof(access_req_rec);
+    rec.url_id = access_log_intern(url);    // URL 定义记录必须写在引用它的请求记录之前
+    rec.ts_us = now_unix_us();
+    if(done_mono_us){
+        rec.ts_us -= get_mono_us() - done_mono_us;     // 工作线程发完响应到主线程记录之间的时间
+    }
+    char* p = access_log_reserve(sizeof(access_req_rec));
+    if(p){
+        memcpy(p, &rec, sizeof(rec));
+    }
+    #endif
+}
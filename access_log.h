@@ -0,0 +1,77 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stdint.h>
+
+/*
+    二进制访问日志
+    每个完成的请求由主线程（事件循环）追加一条定长记录到内存映射的日志文件中，不做任何文本格式化。
+    URL 被内部化为编号，同一文件中某个 URL 第一次出现时先写一条 URL 定义记录。
+    文件写满或超过滚动周期后换新文件，离线用 tools/access_log_dump 解码或汇总。
+
+    文件格式：access_log_hdr，随后是若干条以 (type, size) 开头的记录，size 为8字节对齐的记录总长，
+    type 为 0 表示文件中已写数据的结尾（文件预先分配，未写部分全为0）。
+    本头文件只依赖 stdint.h，供服务器和离线工具共用。
+*/
+
+#ifndef ACCESS_LOG_OPEN                              // 可用 -DACCESS_LOG_OPEN=0 关闭
+#define ACCESS_LOG_OPEN 1                           // 是否记录访问日志
+#endif
+#define ACCESS_LOG_DIR "./log"                      // 访问日志所在目录
+#define ACCESS_LOG_FILE_SIZE (64 * 1024 * 1024)     // 单个文件的大小，写满后滚动
+#define ACCESS_LOG_ROTATE_SECS (60 * 60)            // 按时间滚动的周期：秒
+#define ACCESS_LOG_MAX_URLS 65536                   // 每个文件最多内部化的 URL 数量，超出后记为 ACCESS_URL_UNKNOWN
+#define ACCESS_LOG_MAX_URL_LEN 1024                 // 记录的 URL 最大长度
+#define ACCESS_LOG_MAX_SEQ 100                      // 同一秒内创建的文件最多加到的序号
+
+#define ACCESS_LOG_MAGIC "EMAL"
+#define ACCESS_LOG_VERSION 1
+#define ACCESS_URL_UNKNOWN 0xffffffffu
+
+enum ACCESS_REC_TYPE { ACCESS_REC_END = 0, ACCESS_REC_URL = 1, ACCESS_REC_REQUEST = 2 };
+
+// 文件头
+struct access_log_hdr {
+    char magic[4];          // "EMAL"
+    uint32_t version;       // 格式版本
+    int64_t start_us;       // 文件创建时间，Unix 时间：微秒
+    char reserved[16];
+};
+
+// URL 定义记录，后面紧跟 URL 字符串（以 \0 结尾，补齐到8字节）
+struct access_url_rec {
+    uint16_t type;          // ACCESS_REC_URL
+    uint16_t size;          // 包括字符串在内的记录总长
+    uint32_t url_id;
+};
+
+// 请求记录
+struct access_req_rec {
+    uint16_t type;          // ACCESS_REC_REQUEST
+    uint16_t size;          // sizeof(access_req_rec)
+    uint16_t status;        // HTTP 状态码，0 表示没有生成响应
+    uint8_t method;         // http_conn::METHOD
+    uint8_t flags;          // ACCESS_FLAG_*
+    uint32_t client_ip;     // 客户端地址，网络字节序
+    uint32_t url_id;        // URL 编号
+    int64_t ts_us;          // 请求完成时间，Unix 时间：微秒
+    uint64_t bytes_sent;    // 发送的字节数（响应头 + 响应体）
+    uint16_t client_port;   // 客户端端口，网络字节序
+    uint16_t reserved;
+    uint32_t read_us;       // 从收到请求的第一个字节到读完请求
+    uint32_t queue_us;      // 在线程池队列中的等待时间
+    uint32_t process_us;    // 解析请求、访问文件、生成响应的时间
+    uint32_t write_us;      // 从响应就绪到最后一个字节写入 socket
+    uint32_t reserved2;
+};
+
+#define ACCESS_FLAG_KEEPALIVE 0x01  // 响应后连接保持
+#define ACCESS_FLAG_H2 0x02         // HTTP/2 连接上的一个流
+
+bool access_log_init();             // 创建第一个日志文件
+void access_log_close();            // 截掉文件未使用的部分并关闭
+// 追加一条请求记录，url_id 和 ts_us 由本函数填写。只能由主线程调用。
+// done_mono_us 为请求完成的单调时钟时间（微秒），0 表示刚刚完成
+void access_log_append(access_req_rec& rec, const char* url, long done_mono_us = 0);
+
+#endif
@@ -0,0 +1,64 @@
+#include "admission.h"
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define ADMISSION_503_BODY "<html><body><h1>503 Service Unavailable</h1>The server is busy, please retry later.</body></html>\n"
+
+const char admission_503[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Retry-After: " ADMISSION_RETRY_AFTER "\r\n"
+    "Content-Length: 98\r\n"
+    "Content-Type:text/html\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    ADMISSION_503_BODY;
+const int admission_503_len = sizeof(admission_503) - 1;
+
+static_assert(sizeof(ADMISSION_503_BODY) - 1 == 98, "update Content-Length of the 503 response");
+
+#define ADMISSION_429_BODY "<html><body><h1>429 Too Many Requests</h1>Request rate limit exceeded.</body></html>\n"
+
+const char admission_429[] =
+    "HTTP/1.1 429 Too Many Requests\r\n"
+    "Retry-After: " ADMISSION_RETRY_AFTER "\r\n"
+    "Content-Length: 85\r\n"
+    "Content-Type:text/html\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    ADMISSION_429_BODY;
+const int admission_429_len = sizeof(admission_429) - 1;
+
+static_assert(sizeof(ADMISSION_429_BODY) - 1 == 85, "update Content-Length of the 429 response");
+
+codel::codel() : m_window_end(0), m_min_sojourn(0), m_overloaded(false), m_valid_until(0) {}
+
+bool codel::dequeue(long now_us, long sojourn_us){
+    if(now_us >= m_window_end){
+        // 窗口结束：整个窗口内排队时间都超过目标才算过载；超过一个窗口没有出队时按不过载重新开始
+        bool overloaded = m_window_end != 0 && now_us < m_window_end + ADMISSION_INTERVAL_US
+                          && m_min_sojourn > ADMISSION_TARGET_US;
+        m_overloaded.store(overloaded, std::memory_order_relaxed);
+        m_window_end = now_us + ADMISSION_INTERVAL_US;
+        m_valid_until.store(m_window_end + ADMISSION_INTERVAL_US, std::memory_order_relaxed);
+        m_min_sojourn = sojourn_us;
+    }else if(sojourn_us < m_min_sojourn){
+        m_min_sojourn = sojourn_us;
+    }
+    long limit = m_overloaded.load(std::memory_order_relaxed) ? ADMISSION_TARGET_US : ADMISSION_INTERVAL_US;
+    return sojourn_us > limit;
+}
+
+bool codel::overloaded(long now_us) const {
+    return m_overloaded.load(std::memory_order_relaxed) && now_us < m_valid_until.load(std::memory_order_relaxed);
+}
+
+void admission_reject(int fd, const char* resp, int len){
+    // 先读掉客户端可能已经发来的数据，避免 close 时因接收缓冲区非空而发送 RST，让客户端收不到 503
+    char buf[1024];
+    while(recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0){
+    }
+    if(len > 0 && send(fd, resp, len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0){
+        // 发送缓冲区满或连接已断开，直接关闭
+    }
+    close(fd);
+}
@@ -0,0 +1,57 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include "mono_clock.h"
+#include <atomic>
+
+/*
+    准入控制与过载保护
+    1. 排队时间控制（CoDel 的服务器变体）：工作线程每次出队时记录请求在队列中的等待时间。
+       在一个观察窗口（ADMISSION_INTERVAL_US）内，如果等待时间的最小值都超过目标（ADMISSION_TARGET_US），
+       说明队列一直没有排空，是持续过载而不是突发，下一个窗口内等待超过目标的请求直接回复 503；
+       否则只丢弃等待超过一个窗口的请求。突发流量可以被队列吸收，持续过载时排队时间被限制在目标附近。
+    2. 过载时（上述状态，或队列长度超过 ADMISSION_QUEUE_HIGH）暂停 accept，新连接留在内核的
+       accept 队列中，直到负载下降。
+    3. 线程池队列满、连接数达到 MAX_FD 时，回复预先生成的 503 响应（带 Retry-After），而不是挂起或直接关闭。
+    按客户端限制速率和连接数见 ratelimit.h，超限时回复 429。
+*/
+
+#ifndef ADMISSION_OPEN                  // 可用 -DADMISSION_OPEN=0 关闭
+#define ADMISSION_OPEN 1                // 是否按排队时间丢弃请求、暂停 accept
+#endif
+#define ADMISSION_TARGET_US 5000        // 排队时间目标：微秒
+#define ADMISSION_INTERVAL_US 100000    // 观察窗口：微秒
+#define ADMISSION_QUEUE_HIGH 75         // 队列长度超过最大长度的百分比时视为过载
+#define ADMISSION_PAUSE_MS 10           // 暂停 accept 期间检查负载的周期：毫秒
+#define ADMISSION_RETRY_AFTER "1"       // 503 响应中 Retry-After 的秒数
+
+// 排队时间控制，dequeue 由持有队列锁的工作线程调用，overloaded 可以在任意线程调用
+class codel {
+public:
+    codel();
+    bool dequeue(long now_us, long sojourn_us);     // 记录一次出队，返回该请求是否应当丢弃
+    bool overloaded(long now_us) const;             // 当前是否处于持续过载状态
+private:
+    long m_window_end;          // 当前观察窗口的结束时间
+    long m_min_sojourn;         // 当前窗口内的最小排队时间
+    std::atomic<bool> m_overloaded;     // 上一个窗口是否过载
+    std::atomic<long> m_valid_until;    // 过载状态的有效期，长时间没有出队时自动失效
+};
+
+// 拒绝请求的原因
+enum SHED_REASON {
+    SHED_QUEUE_DELAY = 0,       // 排队时间超过目标，503
+    SHED_QUEUE_FULL,            // 线程池队列已满，503
+    SHED_RATE_LIMIT,            // 客户端超过请求速率限制，429
+};
+
+// 预先生成的 503、429 响应（Connection: close）
+extern const char admission_503[];
+extern const int admission_503_len;
+extern const char admission_429[];
+extern const int admission_429_len;
+
+// 在 accept 后直接回复预先生成的响应并关闭，用于连接数已满或客户端连接数超限。len 为 0 时只关闭（HTTPS 连接）
+void admission_reject(int fd, const char* resp, int len);
+
+#endif
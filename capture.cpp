@@ -0,0 +1,132 @@
+#include "capture.h"
+#include "locker.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+static_assert(sizeof(capture_hdr) == 32, "capture header layout changed");
+
+#define CAPTURE_MAX_FDS 65536           // conn_id 按 fd 索引
+
+// 主线程读数据，工作线程在 process_write 失败时也会关闭连接，所以写文件要加锁
+static locker g_capture_locker("capture.locker");
+static FILE* g_fp = NULL;
+static char* g_buf = NULL;              // 文件缓冲区
+static long g_size = 0;                 // 已写入的字节数
+static int64_t g_last_us = 0;           // 上一条记录的时间
+static uint32_t g_next_id = 0;
+static uint32_t g_conn_id[CAPTURE_MAX_FDS];     // 每个 fd 上当前连接的编号，0 表示未抓取
+
+static int64_t now_unix_us(){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// 写记录头：类型、连接编号、时间增量，调用者持有锁。超过大小上限时停止抓取并返回 false
+static bool capture_begin(uint8_t type, uint32_t id, size_t payload){
+    if(!g_fp){
+        return false;
+    }
+    if(g_size + 32 + (long)payload > CAPTURE_MAX_SIZE){
+        fclose(g_fp);
+        g_fp = NULL;
+        fprintf(stderr, "capture file reached %ld bytes, capture stopped.\n", (long)CAPTURE_MAX_SIZE);
+        return false;
+    }
+    int64_t now = now_unix_us();
+    uint8_t hdr[32];
+    int n = 0;
+    hdr[n++] = type;
+    n += capture_put_varint(hdr + n, id);
+    n += capture_put_varint(hdr + n, now > g_last_us ? now - g_last_us : 0);
+    g_last_us = now > g_last_us ? now : g_last_us;
+    fwrite(hdr, 1, n, g_fp);
+    g_size += n;
+    return true;
+}
+
+bool capture_init(){
+    #if CAPTURE_OPEN
+    mkdir(CAPTURE_DIR, 0755);
+    char name[128];
+    time_t now = time(NULL);
+    struct tm tm_now;
+    localtime_r(&now, &tm_now);
+    snprintf(name, sizeof(name), "%s/capture_%04d%02d%02d_%02d%02d%02d.bin", CAPTURE_DIR,
+             tm_now.tm_year + 1900, tm_now.tm_mon + 1, tm_now.tm_mday,
+             tm_now.tm_hour, tm_now.tm_min, tm_now.tm_sec);
+    g_fp = fopen(name, "wb");
+    if(!g_fp){
+        return false;
+    }
+    g_buf = new char[CAPTURE_BUF_SIZE];
+    setvbuf(g_fp, g_buf, _IOFBF, CAPTURE_BUF_SIZE);
+
+    capture_hdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CAPTURE_MAGIC, 4);
+    hdr.version = CAPTURE_VERSION;
+    hdr.start_us = now_unix_us();
+    g_last_us = hdr.start_us;
+    fwrite(&hdr, 1, sizeof(hdr), g_fp);
+    g_size = sizeof(hdr);
+    #endif
+    return true;
+}
+
+void capture_close(){
+    g_capture_locker.lock();
+    if(g_fp){
+        fclose(g_fp);
+        g_fp = NULL;
+    }
+    g_capture_locker.unlock();
+    delete [] g_buf;
+    g_buf = NULL;
+}
+
+void capture_conn_open(int fd, uint32_t ip, uint16_t port){
+    if(fd < 0 || fd >= CAPTURE_MAX_FDS){
+        return;
+    }
+    g_capture_locker.lock();
+    uint32_t id = ++g_next_id;
+    g_conn_id[fd] = 0;
+    if(capture_begin(CAPTURE_REC_OPEN, id, 6)){
+        fwrite(&ip, 1, 4, g_fp);
+        fwrite(&port, 1, 2, g_fp);
+        g_size += 6;
+        g_conn_id[fd] = id;
+    }
+    g_capture_locker.unlock();
+}
+
+void capture_data(int fd, const char* data, int len){
+    if(fd < 0 || fd >= CAPTURE_MAX_FDS || len <= 0){
+        return;
+    }
+    g_capture_locker.lock();
+    if(g_conn_id[fd] && capture_begin(CAPTURE_REC_DATA, g_conn_id[fd], len)){
+        uint8_t buf[10];
+        int n = capture_put_varint(buf, len);
+        fwrite(buf, 1, n, g_fp);
+        fwrite(data, 1, len, g_fp);
+        g_size += n + len;
+    }
+    g_capture_locker.unlock();
+}
+
+void capture_conn_close(int fd){
+    if(fd < 0 || fd >= CAPTURE_MAX_FDS){
+        return;
+    }
+    g_capture_locker.lock();
+    if(g_conn_id[fd]){
+        capture_begin(CAPTURE_REC_CLOSE, g_conn_id[fd], 0);
+        g_conn_id[fd] = 0;
+    }
+    g_capture_locker.unlock();
+}
@@ -0,0 +1,68 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+
+/*
+    入站流量抓取（编译选项，默认关闭，-DCAPTURE_OPEN=1 打开）
+    记录每个连接的建立、每次 recv 读到的原始字节及其到达时间、连接关闭，写入 CAPTURE_DIR 下的文件，
+    用 tools/replay 按原来的时间间隔（或加速）重放到测试实例，连接复用和流水线都与原来一致。
+    文件达到 CAPTURE_MAX_SIZE 后停止抓取。
+
+    文件格式：capture_hdr，随后是若干条变长记录，整数都用 varint（每字节低7位，最高位表示后面还有）编码：
+        type(1字节)  conn_id(varint)  ts_delta(varint，距上一条记录的微秒数)  随后按类型：
+        CAPTURE_REC_OPEN   客户端地址(4字节) 端口(2字节)，网络字节序
+        CAPTURE_REC_DATA   长度(varint) 数据
+        CAPTURE_REC_CLOSE  无
+    conn_id 在文件内单调递增，不随 fd 复用。本头文件只依赖 stdint.h，供服务器和离线工具共用。
+*/
+
+#ifndef CAPTURE_OPEN
+#define CAPTURE_OPEN 0
+#endif
+#define CAPTURE_DIR "./log"                             // 抓取文件所在目录
+#define CAPTURE_MAX_SIZE (1024L * 1024 * 1024)          // 单个抓取文件的最大字节数
+#define CAPTURE_BUF_SIZE (1024 * 1024)                  // 写文件的缓冲区大小
+
+#define CAPTURE_MAGIC "EMCP"
+#define CAPTURE_VERSION 1
+
+enum CAPTURE_REC_TYPE { CAPTURE_REC_OPEN = 1, CAPTURE_REC_DATA = 2, CAPTURE_REC_CLOSE = 3 };
+
+// 文件头
+struct capture_hdr {
+    char magic[4];          // "EMCP"
+    uint32_t version;       // 格式版本
+    int64_t start_us;       // 开始抓取的时间，Unix 时间：微秒，第一条记录的 ts_delta 相对于它
+    char reserved[16];
+};
+
+// 编码一个 varint，返回写入的字节数（最多10字节）
+inline int capture_put_varint(uint8_t* p, uint64_t v){
+    int n = 0;
+    while(v >= 0x80){
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+// 解码一个 varint，数据不完整时返回 false
+inline bool capture_get_varint(const uint8_t*& p, const uint8_t* end, uint64_t& v){
+    v = 0;
+    for(int shift = 0; p < end && shift < 64; shift += 7){
+        uint8_t b = *p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if(!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+bool capture_init();                                    // 创建抓取文件
+void capture_close();                                   // 写完缓冲区并关闭
+void capture_conn_open(int fd, uint32_t ip, uint16_t port);    // 新连接，地址和端口为网络字节序
+void capture_data(int fd, const char* data, int len);  // 一次 recv 读到的数据
+void capture_conn_close(int fd);                        // 连接关闭
+
+#endif
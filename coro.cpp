@@ -0,0 +1,466 @@
+#include "coro.h"
+
+#if CORO_AVAILABLE
+
+#include "http_conn.h"
+#include <coroutine>
+#include <exception>
+#include <vector>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#define CORO_EVENTS 1024                // 每次 epoll_wait 最多返回的事件数
+
+extern void set_nonblocking(int fd);
+
+// ---------------- 帧池 ----------------
+
+// 每个线程一组空闲链表，第 i 级的帧大小为 (i + 1) * CORO_FRAME_ALIGN 字节，空闲帧的开头存放下一个空闲帧的地址。
+// 连接始终在同一个事件循环上运行，帧一般在分配它的线程上释放
+struct frame_pool {
+    void* head[CORO_FRAME_CLASSES];
+    int count[CORO_FRAME_CLASSES];
+
+    ~frame_pool(){
+        for(int i = 0; i < CORO_FRAME_CLASSES; ++i){
+            while(head[i]){
+                void* p = head[i];
+                head[i] = *(void**)p;
+                ::operator delete(p);
+            }
+        }
+    }
+};
+
+static thread_local frame_pool t_frames;
+
+static void* frame_alloc(size_t size){
+    size_t cls = (size + CORO_FRAME_ALIGN - 1) / CORO_FRAME_ALIGN - 1;
+    if(cls < CORO_FRAME_CLASSES && t_frames.head[cls]){
+        void* p = t_frames.head[cls];
+        t_frames.head[cls] = *(void**)p;
+        --t_frames.count[cls];
+        return p;
+    }
+    metrics_inc(MC_CORO_FRAME_ALLOCS);
+    return ::operator new(cls < CORO_FRAME_CLASSES ? (cls + 1) * CORO_FRAME_ALIGN : size);
+}
+
+static void frame_free(void* p, size_t size){
+    size_t cls = (size + CORO_FRAME_ALIGN - 1) / CORO_FRAME_ALIGN - 1;
+    if(cls < CORO_FRAME_CLASSES && t_frames.count[cls] < CORO_FRAME_CACHE){
+        *(void**)p = t_frames.head[cls];
+        t_frames.head[cls] = p;
+        ++t_frames.count[cls];
+        return;
+    }
+    ::operator delete(p);
+}
+
+// 连接协程的返回类型：创建后立即运行，结束时自行销毁帧，调用者不等待它
+struct coro_task {
+    struct promise_type {
+        coro_task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+        static void* operator new(size_t size){ return frame_alloc(size); }
+        static void operator delete(void* p, size_t size){ frame_free(p, size); }
+    };
+};
+
+// ---------------- 事件循环 ----------------
+
+class coro_conn;
+
+// epoll 事件的 data.ptr 指向的对象：监听套接字或连接
+struct coro_source {
+    int fd;
+    bool listener;
+};
+
+struct coro_loop {
+    int epoll_fd;
+    std::vector<coro_source*> listeners;
+    coro_conn* conns;                                   // 所有连接的双向链表，用于超时检查和退出时关闭
+    std::vector<std::coroutine_handle<>> yielded;       // 用完发送时间片、等待继续运行的协程
+    time_t now;                                         // 本轮事件循环开始的时间
+};
+
+// 一个连接：事件循环看到的状态，以及协程的挂起点。对象在协程帧中，协程结束时析构并关闭套接字
+class coro_conn : public coro_source {
+public:
+    static coro_task run(coro_loop* loop, int sock_fd, sockaddr_in addr);
+
+    coro_conn(coro_loop* loop, int sock_fd, http_conn& conn);
+    ~coro_conn();
+    void on_event(unsigned events);     // 由事件循环调用
+    bool expire();                      // 由事件循环每秒调用，超时时恢复协程并返回 true
+    void destroy(){ m_handle.destroy(); }
+
+    coro_conn* m_prev;
+    coro_conn* m_next;
+
+private:
+    // 等待套接字可读（EPOLLIN）或可写（EPOLLOUT），已知就绪时不挂起；超时返回 false
+    struct io_wait {
+        coro_conn* c;
+        unsigned ev;
+        bool await_ready() const noexcept { return c->m_ready & ev; }
+        void await_suspend(std::coroutine_handle<> h) noexcept {
+            c->m_handle = h;
+            c->m_wait = ev;
+            c->m_deadline = c->m_loop->now + IDLE_TIMEOUT;
+        }
+        bool await_resume() noexcept {
+            c->m_wait = 0;
+            return !c->m_timed_out;
+        }
+    };
+    // 让出事件循环，本轮的事件处理完后继续
+    struct yield_op {
+        coro_conn* c;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h){
+            c->m_handle = h;
+            c->m_loop->yielded.push_back(h);
+        }
+        void await_resume() noexcept {}
+    };
+    io_wait readable(){ return io_wait{this, EPOLLIN}; }
+    io_wait writable(){ return io_wait{this, EPOLLOUT}; }
+    yield_op yield(){ return yield_op{this}; }
+    void finish_request();
+
+    coro_loop* m_loop;
+    http_conn& m_conn;
+    unsigned m_ready;                   // 已知就绪的方向，系统调用返回 EAGAIN 时清除，边沿事件到来时设置
+    unsigned m_wait;                    // 正在等待的方向，0 表示没有挂起在 I/O 上
+    bool m_timed_out;
+    time_t m_deadline;
+    std::coroutine_handle<> m_handle;   // 最近一次挂起的协程
+};
+
+coro_conn::coro_conn(coro_loop* loop, int sock_fd, http_conn& conn)
+    : m_prev(NULL), m_next(loop->conns), m_loop(loop), m_conn(conn), m_ready(EPOLLOUT), m_wait(0),
+      m_timed_out(false), m_deadline(0) {
+    fd = sock_fd;
+    listener = false;
+    if(m_next) m_next->m_prev = this;
+    loop->conns = this;
+    // 只注册一次，之后由 m_ready 记录就绪状态，不再修改
+    set_nonblocking(sock_fd);
+    epoll_event event;
+    event.data.ptr = static_cast<coro_source*>(this);
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, sock_fd, &event);
+    metrics_inc(MC_EPOLL_CTL);
+    metrics_inc(MC_CONN_ACCEPTED);
+    metrics_gauge_add(MG_CONNECTIONS, 1);
+}
+
+coro_conn::~coro_conn(){
+    m_conn.unmap();
+    close(fd);                          // 同时从 epoll 中移除
+    if(m_prev) m_prev->m_next = m_next;
+    else m_loop->conns = m_next;
+    if(m_next) m_next->m_prev = m_prev;
+    metrics_gauge_add(MG_CONNECTIONS, -1);
+    metrics_inc(MC_CONN_CLOSED);
+}
+
+void coro_conn::on_event(unsigned events){
+    if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) m_ready |= EPOLLIN;    // 对方关闭或出错时由 recv / writev 返回
+    if(events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) m_ready |= EPOLLOUT;
+    if(m_ready & m_wait){
+        m_handle.resume();              // 协程可能在此期间结束，之后不能再访问本对象
+    }
+}
+
+bool coro_conn::expire(){
+    if(!m_wait || m_deadline > m_loop->now){
+        return false;
+    }
+    int phase = m_wait == EPOLLOUT ? http_conn::PHASE_SEND : m_conn.m_rd_idx ? http_conn::PHASE_HEADER : http_conn::PHASE_IDLE;
+    metrics_inc((METRIC_COUNTER)(MC_TIMEOUT_IDLE + phase));
+    m_timed_out = true;
+    m_handle.resume();
+    return true;
+}
+
+// 响应发送完毕，更新统计指标（访问日志只能由主线程追加，这里不记录）
+void coro_conn::finish_request(){
+    http_conn& h = m_conn;
+    if(h.m_status >= 500) metrics_inc(MC_RESP_5XX);
+    else if(h.m_status >= 400) metrics_inc(MC_RESP_4XX);
+    else if(h.m_status >= 200) metrics_inc(MC_RESP_2XX);
+    metrics_inc(MC_BYTES_SENT, h.bytes_have_send);
+    if(h.m_ts_start){
+        metrics_observe(MH_TOTAL, get_mono_us() - h.m_ts_start);
+    }
+}
+
+// 一个连接的全部处理过程
+coro_task coro_conn::run(coro_loop* loop, int sock_fd, sockaddr_in addr){
+    http_conn h;                        // 先于 c 构造，c 析构时仍可访问
+    coro_conn c(loop, sock_fd, h);
+    h.attach(sock_fd, addr);
+    h.init();
+    for(;;){
+        // 读取请求，数据不完整时继续读取
+        http_conn::HTTP_CODE ret = http_conn::NO_REQUEST;
+        while(ret == http_conn::NO_REQUEST){
+            if(!co_await c.readable()){
+                co_return;
+            }
+            if(h.m_rd_idx >= http_conn::RD_BUF_SIZE){
+                co_return;              // 请求超过读缓冲区
+            }
+            int n = recv(sock_fd, h.m_rd_buf + h.m_rd_idx, http_conn::RD_BUF_SIZE - h.m_rd_idx, 0);
+            if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+                c.m_ready &= ~EPOLLIN;
+                continue;
+            }
+            if(n <= 0){
+                co_return;              // 对方关闭连接或出错
+            }
+            if(h.m_rd_idx == 0){
+                h.m_ts_start = get_mono_us();
+                metrics_inc(MC_REQUESTS);
+            }
+            h.m_rd_idx += n;
+            ret = h.process_read();
+        }
+
+        // 生成响应，与线程池模型相同
+        if(!h.process_write(ret)){
+            co_return;
+        }
+
+        // 发送响应
+        int quantum_sent = 0;
+        while(h.bytes_to_send > 0){
+            if(!co_await c.writable()){
+                co_return;
+            }
+            if(h.m_iv_count == 2 && h.m_iv[1].iov_len > WRITE_QUANTUM){
+                h.m_iv[1].iov_len = WRITE_QUANTUM;
+            }
+            int n = writev(sock_fd, h.m_iv, h.m_iv_count);
+            if(n < 0){
+                if(errno != EAGAIN){
+                    co_return;
+                }
+                c.m_ready &= ~EPOLLOUT;
+                continue;
+            }
+            h.iov_advance(n);
+            quantum_sent += n;
+            if(quantum_sent >= WRITE_QUANTUM && h.bytes_to_send > 0){
+                metrics_inc(MC_WRITE_YIELDS);
+                quantum_sent = 0;
+                co_await c.yield();
+            }
+        }
+        c.finish_request();
+        h.unmap();
+        if(!h.m_linger){
+            co_return;
+        }
+        h.init();
+    }
+}
+
+coro_loop* coro_loop_create(){
+    coro_loop* loop = new coro_loop;
+    loop->epoll_fd = epoll_create1(0);
+    loop->conns = NULL;
+    loop->now = time(NULL);
+    if(loop->epoll_fd < 0){
+        delete loop;
+        return NULL;
+    }
+    return loop;
+}
+
+bool coro_loop_listen(coro_loop* loop, int listen_fd){
+    coro_source* src = new coro_source{listen_fd, true};
+    set_nonblocking(listen_fd);
+    epoll_event event;
+    event.data.ptr = src;
+    event.events = EPOLLIN;             // 水平触发，每轮最多接受 CORO_EVENTS 个连接
+    if(epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) < 0){
+        delete src;
+        return false;
+    }
+    loop->listeners.push_back(src);
+    return true;
+}
+
+void coro_spawn(coro_loop* loop, int sock_fd, const sockaddr_in& addr){
+    coro_conn::run(loop, sock_fd, addr);
+}
+
+static void accept_conns(coro_loop* loop, int listen_fd){
+    for(int i = 0; i < CORO_EVENTS; ++i){
+        struct sockaddr_in addr;
+        socklen_t addr_len = sizeof(addr);
+        int fd = accept(listen_fd, (struct sockaddr*)&addr, &addr_len);
+        if(fd < 0){
+            if(errno == EMFILE || errno == ENFILE){
+                EMlog(LOGLEVEL_WARN, "accept failed: %s\n", strerror(errno));
+            }
+            return;                     // EAGAIN：没有更多的连接
+        }
+        if(metrics_gauge_get(MG_CONNECTIONS) >= http_conn::m_max_conns){
+            metrics_inc(MC_CONN_REJECTED);
+            admission_reject(fd, admission_503, admission_503_len);
+            continue;
+        }
+        coro_spawn(loop, fd, addr);
+    }
+}
+
+void coro_loop_run(coro_loop* loop, const std::atomic<bool>* stop){
+    epoll_event events[CORO_EVENTS];
+    time_t last_scan = loop->now;
+    std::vector<std::coroutine_handle<>> runnable;
+    while(!stop->load(std::memory_order_acquire)){
+        int num = epoll_wait(loop->epoll_fd, events, CORO_EVENTS, loop->yielded.empty() ? 1000 : 0);
+        if(num < 0 && errno != EINTR){
+            EMlog(LOGLEVEL_ERROR, "EPOLL failed.\n");
+            break;
+        }
+        loop->now = time(NULL);
+        for(int i = 0; i < num; ++i){
+            coro_source* src = (coro_source*)events[i].data.ptr;
+            if(src->listener){
+                accept_conns(loop, src->fd);
+            }else{
+                static_cast<coro_conn*>(src)->on_event(events[i].events);
+            }
+        }
+        // 上一轮用完时间片的协程排在本轮的事件之后
+        runnable.swap(loop->yielded);
+        for(size_t i = 0; i < runnable.size(); ++i){
+            runnable[i].resume();
+        }
+        runnable.clear();
+        if(loop->now != last_scan){
+            last_scan = loop->now;
+            for(coro_conn* c = loop->conns; c; ){
+                coro_conn* next = c->m_next;    // 超时的协程结束时把自己从链表中移除
+                c->expire();
+                c = next;
+            }
+        }
+    }
+}
+
+void coro_loop_destroy(coro_loop* loop){
+    while(loop->conns){
+        loop->conns->destroy();         // 销毁挂起的协程，帧中的 coro_conn 析构时关闭套接字并移出链表
+    }
+    for(size_t i = 0; i < loop->listeners.size(); ++i){
+        delete loop->listeners[i];
+    }
+    close(loop->epoll_fd);
+    delete loop;
+}
+
+// ---------------- 服务器入口 ----------------
+
+struct loop_arg {
+    coro_loop* loop;
+    const std::atomic<bool>* stop;
+};
+
+static void* loop_thread(void* arg){
+    loop_arg* a = (loop_arg*)arg;
+    coro_loop_run(a->loop, a->stop);
+    return NULL;
+}
+
+// 每个事件循环一个 SO_REUSEPORT 监听套接字，由内核在它们之间分配新连接
+static int listen_port(int port){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0){
+        return -1;
+    }
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int coro_serve(int port, int loops){
+    // 信号由本线程用 sigwait 同步处理，之后创建的事件循环线程继承屏蔽字
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    std::atomic<bool> stop(false);
+    std::vector<loop_arg> args(loops);
+    std::vector<int> listen_fds;
+    std::vector<pthread_t> tids;
+    for(int i = 0; i < loops; ++i){
+        int fd = listen_port(port);
+        coro_loop* loop = fd >= 0 ? coro_loop_create() : NULL;
+        if(!loop || !coro_loop_listen(loop, fd)){
+            EMlog(LOGLEVEL_ERROR, "coroutine event loop %d init failed: %s\n", i, strerror(errno));
+            if(fd >= 0) close(fd);
+            if(loop) coro_loop_destroy(loop);
+            stop = true;
+            break;
+        }
+        listen_fds.push_back(fd);
+        args[i].loop = loop;
+        args[i].stop = &stop;
+        pthread_t tid;
+        if(pthread_create(&tid, NULL, loop_thread, &args[i]) != 0){
+            coro_loop_destroy(loop);
+            stop = true;
+            break;
+        }
+        tids.push_back(tid);
+    }
+    if(!stop){
+        EMlog(LOGLEVEL_INFO, "coroutine model: %d event loops on port %d.\n", loops, port);
+    }
+    while(!stop){
+        int sig = 0;
+        if(sigwait(&set, &sig) != 0){
+            continue;
+        }
+        if(sig == SIGUSR1){
+            if(!trace_dump_file()){
+                EMlog(LOGLEVEL_WARN, "trace dump failed.\n");
+            }
+        }else{
+            stop = true;
+        }
+    }
+    // 事件循环最多一秒后看到 stop
+    for(size_t i = 0; i < tids.size(); ++i){
+        pthread_join(tids[i], NULL);
+        coro_loop_destroy(args[i].loop);
+    }
+    for(size_t i = 0; i < listen_fds.size(); ++i){
+        close(listen_fds[i]);
+    }
+    return tids.size() == (size_t)loops ? 0 : -1;
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef CORO_H
+#define CORO_H
+
+#include <netinet/in.h>
+#include <atomic>
+
+/*
+    协程连接模型：线程池模型之外的另一种执行模型，需要 C++20（g++ -std=c++20 -DCORO_OPEN=1 ...）
+    线程池模型中一个请求要经过 主线程 read → 工作线程 process → 主线程 write，每个请求两次线程切换，
+    EPOLLONESHOT 还要求每个请求 modfd 两次。协程模型中：
+    1. CORO_LOOPS 个事件循环线程，各自有一个 epoll 和一个 SO_REUSEPORT 的监听套接字，由内核分配新连接。
+    2. 每个连接是一个协程，始终在接受它的线程上运行，读请求、解析、生成响应、发送都是顺序的代码：
+           while((n = recv(...)) < 0 && errno == EAGAIN) co_await readable();
+       套接字在接受时以 EPOLLIN | EPOLLOUT | EPOLLET 注册一次，之后不再调用 epoll_ctl；系统调用返回 EAGAIN 时
+       协程挂起，事件循环收到边沿事件后恢复它。发送满 WRITE_QUANTUM 后协程让出，排在本轮事件之后继续。
+    3. 协程帧由每个线程的帧池分配（promise_type::operator new），按 CORO_FRAME_ALIGN 字节分级，连接结束后放回
+       本线程的空闲链表，稳定状态下接受和关闭连接不调用 malloc。帧池没有可用的帧时计数 MC_CORO_FRAME_ALLOCS。
+    4. 解析和生成响应复用 http_conn 的 process_read / process_write（包括路由表），http_conn 是协程帧中的局部变量。
+    没有等待任何事件超过 IDLE_TIMEOUT 秒的连接由事件循环每秒检查一次后关闭。
+    只支持 HTTP/1.1 明文：不启用 HTTPS、HTTP/2 和反向代理（不加载 PROXY_CONF_FILE），没有线程池队列也就没有
+    准入控制；访问日志和按客户端的速率限制只能由主线程调用，协程模型中不使用。
+*/
+
+#ifndef CORO_OPEN
+#define CORO_OPEN 0                 // 1：服务器使用协程连接模型（需要 -std=c++20）
+#endif
+#define CORO_LOOPS 4                // 事件循环线程数
+#define CORO_FRAME_ALIGN 256        // 帧池的分级粒度：字节
+#define CORO_FRAME_CLASSES 64       // 帧池管理的最大帧为 CORO_FRAME_ALIGN * CORO_FRAME_CLASSES 字节，更大的直接 malloc
+#define CORO_FRAME_CACHE 4096       // 每个线程每一级最多缓存的空闲帧数
+
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#define CORO_AVAILABLE 1
+#else
+#define CORO_AVAILABLE 0
+#endif
+
+#if CORO_OPEN && !CORO_AVAILABLE
+#error "CORO_OPEN requires C++20 coroutines (-std=c++20)"
+#endif
+
+#if CORO_AVAILABLE
+
+struct coro_loop;
+
+coro_loop* coro_loop_create();
+bool coro_loop_listen(coro_loop* loop, int listen_fd);      // 由该循环接受 listen_fd 上的连接
+// 在 loop 上为已连接的套接字启动协程，只能在 loop 的线程中或 loop 运行之前调用
+void coro_spawn(coro_loop* loop, int sock_fd, const sockaddr_in& addr);
+void coro_loop_run(coro_loop* loop, const std::atomic<bool>* stop);    // 运行事件循环，直到 *stop 为 true
+void coro_loop_destroy(coro_loop* loop);                    // 关闭剩余的连接（销毁挂起的协程）
+
+// 服务器入口：在 port 上启动 loops 个事件循环线程，收到 SIGTERM 后返回
+int coro_serve(int port, int loops);
+
+#endif
+
+#endif
@@ -0,0 +1,716 @@
+#include "h2.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <sys/mman.h>
+
+// 帧类型
+enum H2_FRAME {
+    H2_DATA = 0x0, H2_HEADERS = 0x1, H2_PRIORITY = 0x2, H2_RST_STREAM = 0x3, H2_SETTINGS = 0x4,
+    H2_PUSH_PROMISE = 0x5, H2_PING = 0x6, H2_GOAWAY = 0x7, H2_WINDOW_UPDATE = 0x8, H2_CONTINUATION = 0x9
+};
+
+// 帧标志
+#define H2_FLAG_END_STREAM 0x1
+#define H2_FLAG_ACK 0x1
+#define H2_FLAG_END_HEADERS 0x4
+#define H2_FLAG_PADDED 0x8
+#define H2_FLAG_PRIORITY 0x20
+
+// SETTINGS 参数
+#define H2_SET_HEADER_TABLE_SIZE 0x1
+#define H2_SET_ENABLE_PUSH 0x2
+#define H2_SET_MAX_CONCURRENT_STREAMS 0x3
+#define H2_SET_INITIAL_WINDOW_SIZE 0x4
+#define H2_SET_MAX_FRAME_SIZE 0x5
+#define H2_SET_MAX_HEADER_LIST_SIZE 0x6
+
+#define H2_MAX_WINDOW 0x7fffffff
+#define H2_DEFAULT_WEIGHT 16
+#define H2_DEFAULT_URGENCY 3
+
+static inline uint32_t get32(const uint8_t* p){
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline void put32(uint8_t* p, uint32_t v){
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void frame_header(uint8_t* fh, int len, uint8_t type, uint8_t flags, uint32_t id){
+    fh[0] = len >> 16;
+    fh[1] = len >> 8;
+    fh[2] = len;
+    fh[3] = type;
+    fh[4] = flags;
+    put32(fh + 5, id & H2_MAX_WINDOW);
+}
+
+h2_session::h2_session() : m_need_preface(true), m_need_settings(true), m_hdr_stream(0), m_hdr_end_stream(false),
+    m_hdr_dep(0), m_hdr_weight(0), m_last_id(0), m_goaway_sent(false), m_goaway_recv(false),
+    m_send_window(65535), m_recv_window(H2_RECV_WINDOW), m_recv_unacked(0),
+    m_peer_initial_window(65535), m_peer_max_frame(16384), m_vtime(0), m_iov_cnt(0), m_iov_idx(0) {}
+
+h2_session::~h2_session(){
+    for(h2_stream* s : m_streams){
+        release(s);
+    }
+}
+
+void h2_session::release(h2_stream* s){
+    if(s->map_addr){
+        munmap(s->map_addr, s->map_len);
+    }
+    delete s;
+}
+
+void h2_session::ctrl_frame(uint8_t type, uint8_t flags, uint32_t id, const void* payload, int len){
+    uint8_t fh[9];
+    frame_header(fh, len, type, flags, id);
+    m_ctrl.append((const char*)fh, 9);
+    m_ctrl.append((const char*)payload, len);
+}
+
+void h2_session::start(){
+    // 服务端的连接前言：SETTINGS，只声明与默认值不同的参数
+    uint8_t p[12];
+    p[0] = 0; p[1] = H2_SET_MAX_CONCURRENT_STREAMS; put32(p + 2, H2_MAX_STREAMS);
+    p[6] = 0; p[7] = H2_SET_MAX_HEADER_LIST_SIZE;   put32(p + 8, H2_MAX_HEADER_BLOCK);
+    ctrl_frame(H2_SETTINGS, 0, 0, p, sizeof(p));
+}
+
+// base64url（RFC 4648 第 5 节），不带填充
+static bool base64url_decode(const char* in, std::string& out){
+    uint32_t acc = 0;
+    int bits = 0;
+    for(; *in && *in != ' ' && *in != '\t'; ++in){
+        char c = *in;
+        int v;
+        if(c >= 'A' && c <= 'Z') v = c - 'A';
+        else if(c >= 'a' && c <= 'z') v = c - 'a' + 26;
+        else if(c >= '0' && c <= '9') v = c - '0' + 52;
+        else if(c == '-') v = 62;
+        else if(c == '_') v = 63;
+        else if(c == '=') break;
+        else return false;
+        acc = acc << 6 | v;
+        bits += 6;
+        if(bits >= 8){
+            bits -= 8;
+            out.push_back((char)(acc >> bits));
+        }
+    }
+    return true;
+}
+
+h2_stream* h2_session::upgrade(const char* settings){
+    std::string payload;
+    if(!base64url_decode(settings, payload) || payload.size() % 6 != 0){
+        return NULL;
+    }
+    // 101 响应本身就是对 HTTP2-Settings 的确认，不需要发送 SETTINGS ACK
+    if(!apply_settings((const uint8_t*)payload.data(), payload.size())){
+        return NULL;
+    }
+    m_ctrl = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+    start();
+    h2_stream* s = new h2_stream();
+    s->id = 1;
+    s->end_remote = true;
+    s->send_window = m_peer_initial_window;
+    s->recv_window = H2_RECV_WINDOW;
+    s->weight = H2_DEFAULT_WEIGHT;
+    s->urgency = H2_DEFAULT_URGENCY;
+    s->incremental = true;
+    s->method = "GET";
+    m_streams.push_back(s);
+    m_last_id = 1;
+    return s;
+}
+
+bool h2_session::append_input(const char* buf, int len){
+    if(m_goaway_sent){
+        return true;            // 已发送 GOAWAY，丢弃后续输入
+    }
+    m_in.append(buf, len);
+    return m_in.size() < H2_IN_MAX;
+}
+
+h2_stream* h2_session::find(uint32_t id) const {
+    for(h2_stream* s : m_streams){
+        if(s->id == id){
+            return s;
+        }
+    }
+    return NULL;
+}
+
+int h2_session::open_streams() const {
+    int n = 0;
+    for(h2_stream* s : m_streams){
+        n += !s->end_sent && !s->reset;
+    }
+    return n;
+}
+
+bool h2_session::active() const {
+    return open_streams() > 0;
+}
+
+bool h2_session::closing() const {
+    return (m_goaway_sent || m_goaway_recv) && !active() && m_ctrl.empty() && !pending();
+}
+
+// 连接错误：取消所有流，排队 GOAWAY，之后的输入都被丢弃
+bool h2_session::goaway(H2_ERROR code){
+    if(!m_goaway_sent){
+        uint8_t p[8];
+        put32(p, m_last_id);
+        put32(p + 4, code);
+        ctrl_frame(H2_GOAWAY, 0, 0, p, sizeof(p));
+        m_goaway_sent = true;
+    }
+    for(h2_stream* s : m_streams){
+        s->reset = true;
+    }
+    m_in.clear();
+    return false;
+}
+
+void h2_session::reset_stream(h2_stream* s, H2_ERROR code){
+    if(!s->reset){
+        uint8_t p[4];
+        put32(p, code);
+        ctrl_frame(H2_RST_STREAM, 0, s->id, p, sizeof(p));
+        s->reset = true;
+    }
+}
+
+bool h2_session::apply_settings(const uint8_t* p, int len){
+    for(int i = 0; i + 6 <= len; i += 6){
+        int id = p[i] << 8 | p[i + 1];
+        uint32_t value = get32(p + i + 2);
+        switch(id){
+            case H2_SET_ENABLE_PUSH:
+                if(value > 1){
+                    return false;
+                }
+                break;
+            case H2_SET_INITIAL_WINDOW_SIZE:
+                if(value > H2_MAX_WINDOW){
+                    return false;
+                }
+                // 调整所有流的发送窗口（RFC 9113 6.9.2），窗口可能变为负数
+                for(h2_stream* s : m_streams){
+                    s->send_window += (int64_t)value - m_peer_initial_window;
+                }
+                m_peer_initial_window = value;
+                break;
+            case H2_SET_MAX_FRAME_SIZE:
+                if(value < 16384 || value > 16777215){
+                    return false;
+                }
+                m_peer_max_frame = value;
+                break;
+            default:
+                break;          // 编码器不使用动态表，不关心 HEADER_TABLE_SIZE；不推送，不关心其余参数
+        }
+    }
+    return true;
+}
+
+bool h2_session::process(std::vector<h2_stream*>& requests){
+    if(m_goaway_sent){
+        return false;
+    }
+    size_t pos = 0;
+    if(m_need_preface){
+        size_t n = std::min(m_in.size(), (size_t)H2_PREFACE_LEN);
+        if(memcmp(m_in.data(), H2_PREFACE, n) != 0){
+            return goaway(H2_PROTOCOL_ERROR);
+        }
+        if(n < H2_PREFACE_LEN){
+            return true;
+        }
+        pos = H2_PREFACE_LEN;
+        m_need_preface = false;
+    }
+    bool ok = true;
+    while(m_in.size() - pos >= 9){
+        const uint8_t* fh = (const uint8_t*)m_in.data() + pos;
+        int len = fh[0] << 16 | fh[1] << 8 | fh[2];
+        uint8_t type = fh[3];
+        uint8_t flags = fh[4];
+        uint32_t id = get32(fh + 5) & H2_MAX_WINDOW;
+        if(len > H2_MAX_FRAME){
+            return goaway(H2_FRAME_SIZE_ERROR);
+        }
+        if(m_in.size() - pos < 9 + (size_t)len){
+            break;
+        }
+        if((m_need_settings && type != H2_SETTINGS) || (m_hdr_stream && type != H2_CONTINUATION)){
+            return goaway(H2_PROTOCOL_ERROR);
+        }
+        if(!on_frame(type, flags, id, fh + 9, len, requests)){
+            ok = false;
+            break;
+        }
+        pos += 9 + len;
+    }
+    if(!ok){
+        return false;
+    }
+    m_in.erase(0, pos);
+    if(m_ctrl.size() > H2_CTRL_MAX){
+        return goaway(H2_ENHANCE_YOUR_CALM);
+    }
+    return true;
+}
+
+bool h2_session::on_frame(uint8_t type, uint8_t flags, uint32_t id, const uint8_t* p, int len, std::vector<h2_stream*>& requests){
+    switch(type){
+        case H2_DATA:
+            return on_data(flags, id, p, len, requests);
+        case H2_HEADERS:
+            return on_headers(flags, id, p, len, requests);
+        case H2_CONTINUATION:
+            if(id != m_hdr_stream){
+                return goaway(H2_PROTOCOL_ERROR);
+            }
+            if(m_hdr_block.size() + len > H2_MAX_HEADER_BLOCK){
+                return goaway(H2_ENHANCE_YOUR_CALM);   // 头部块不完整就无法继续解码，只能关闭连接
+            }
+            m_hdr_block.append((const char*)p, len);
+            if(flags & H2_FLAG_END_HEADERS){
+                m_hdr_stream = 0;
+                return on_header_block(id, m_hdr_end_stream, requests);
+            }
+            return true;
+        case H2_PRIORITY: {
+            if(id == 0){
+                return goaway(H2_PROTOCOL_ERROR);
+            }
+            if(len != 5){
+                return goaway(H2_FRAME_SIZE_ERROR);
+            }
+            h2_stream* s = find(id);
+            if(s){
+                uint32_t dep = get32(p) & H2_MAX_WINDOW;
+                if(dep == id){
+                    reset_stream(s, H2_PROTOCOL_ERROR);
+                }else{
+                    set_priority(s, dep, p[4] + 1);
+                }
+            }
+            return true;        // 尚未开启或已释放的流的优先级信息被忽略
+        }
+        case H2_RST_STREAM: {
+            if(id == 0 || id > m_last_id){
+                return goaway(H2_PROTOCOL_ERROR);
+            }
+            if(len != 4){
+                return goaway(H2_FRAME_SIZE_ERROR);
+            }
+            h2_stream* s = find(id);
+            if(s){
+                s->reset = true;    // 客户端取消，不回复 RST_STREAM
+            }
+            return true;
+        }
+        case H2_SETTINGS:
+            if(id != 0){
+                return goaway(H2_PROTOCOL_ERROR);
+            }
+            if(flags & H2_FLAG_ACK){
+                return len == 0 || goaway(H2_FRAME_SIZE_ERROR);
+            }
+            if(len % 6 != 0){
+                return goaway(H2_FRAME_SIZE_ERROR);
+            }
+            if(!apply_settings(p, len)){
+                return goaway(H2_PROTOCOL_ERROR);
+            }
+            m_need_settings = false;
+            ctrl_frame(H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+            return true;
+        case H2_PING:
+            if(id != 0){
+                return goaway(H2_PROTOCOL_ERROR);
+            }
+            if(len != 8){
+                return goaway(H2_FRAME_SIZE_ERROR);
+            }
+            if(!(flags & H2_FLAG_ACK)){
+                ctrl_frame(H2_PING, H2_FLAG_ACK, 0, p, 8);
+            }
+            return true;
+        case H2_GOAWAY:
+            if(id != 0){
+                return goaway(H2_PROTOCOL_ERROR);
+            }
+            m_goaway_recv = true;   // 不再有新的流，已开启的流发送完后关闭连接
+            return true;
+        case H2_WINDOW_UPDATE: {
+            if(len != 4){
+                return goaway(H2_FRAME_SIZE_ERROR);
+            }
+            uint32_t inc = get32(p) & H2_MAX_WINDOW;
+            if(id == 0){
+                if(inc == 0){
+                    return goaway(H2_PROTOCOL_ERROR);
+                }
+                m_send_window += inc;
+                return m_send_window <= H2_MAX_WINDOW || goaway(H2_FLOW_CONTROL_ERROR);
+            }
+            h2_stream* s = find(id);
+            if(s && !s->reset){
+                s->send_window += inc;
+                if(inc == 0){
+                    reset_stream(s, H2_PROTOCOL_ERROR);
+                }else if(s->send_window > H2_MAX_WINDOW){
+                    reset_stream(s, H2_FLOW_CONTROL_ERROR);
+                }
+            }
+            return true;
+        }
+        case H2_PUSH_PROMISE:
+            return goaway(H2_PROTOCOL_ERROR);   // 客户端不能推送
+        default:
+            return true;        // 忽略未知类型的帧
+    }
+}
+
+// 去掉 PADDED 标志带来的填充，填充长度不合法时返回 false
+static bool strip_padding(uint8_t flags, const uint8_t*& p, int& len){
+    if(!(flags & H2_FLAG_PADDED)){
+        return true;
+    }
+    if(len < 1 || p[0] >= len){
+        return false;
+    }
+    len -= 1 + p[0];
+    ++p;
+    return true;
+}
+
+bool h2_session::on_data(uint8_t flags, uint32_t id, const uint8_t* p, int len, std::vector<h2_stream*>& requests){
+    if(id == 0){
+        return goaway(H2_PROTOCOL_ERROR);
+    }
+    // 整个帧（包括填充）都计入流量控制
+    if(len > m_recv_window){
+        return goaway(H2_FLOW_CONTROL_ERROR);
+    }
+    m_recv_window -= len;
+    m_recv_unacked += len;
+    if(m_recv_unacked >= H2_RECV_WINDOW / 2){
+        uint8_t inc[4];
+        put32(inc, m_recv_unacked);
+        ctrl_frame(H2_WINDOW_UPDATE, 0, 0, inc, 4);
+        m_recv_window += m_recv_unacked;
+        m_recv_unacked = 0;
+    }
+    int frame_len = len;
+    if(!strip_padding(flags, p, len)){
+        return goaway(H2_PROTOCOL_ERROR);
+    }
+    h2_stream* s = find(id);
+    if(!s || s->end_remote || s->reset){
+        if(id > m_last_id){
+            return goaway(H2_PROTOCOL_ERROR);   // 尚未开启的流
+        }
+        if(s && !s->reset){
+            reset_stream(s, H2_STREAM_CLOSED);
+        }
+        return true;
+    }
+    if(frame_len > s->recv_window){
+        reset_stream(s, H2_FLOW_CONTROL_ERROR);
+        return true;
+    }
+    // 只支持 GET，请求体被丢弃，但要归还窗口，否则客户端会卡在发送请求体上
+    s->recv_window -= frame_len;
+    s->recv_unacked += frame_len;
+    if(flags & H2_FLAG_END_STREAM){
+        s->end_remote = true;
+        requests.push_back(s);
+    }else if(s->recv_unacked >= H2_RECV_WINDOW / 2){
+        uint8_t inc[4];
+        put32(inc, s->recv_unacked);
+        ctrl_frame(H2_WINDOW_UPDATE, 0, id, inc, 4);
+        s->recv_window += s->recv_unacked;
+        s->recv_unacked = 0;
+    }
+    return true;
+}
+
+bool h2_session::on_headers(uint8_t flags, uint32_t id, const uint8_t* p, int len, std::vector<h2_stream*>& requests){
+    if(id == 0 || id % 2 == 0){
+        return goaway(H2_PROTOCOL_ERROR);   // 客户端开启的流编号为奇数
+    }
+    if(!strip_padding(flags, p, len)){
+        return goaway(H2_PROTOCOL_ERROR);
+    }
+    m_hdr_dep = 0;
+    m_hdr_weight = 0;
+    if(flags & H2_FLAG_PRIORITY){
+        if(len < 5){
+            return goaway(H2_FRAME_SIZE_ERROR);
+        }
+        m_hdr_dep = get32(p) & H2_MAX_WINDOW;
+        m_hdr_weight = p[4] + 1;
+        p += 5;
+        len -= 5;
+    }
+    m_hdr_block.assign((const char*)p, len);
+    if(!(flags & H2_FLAG_END_HEADERS)){
+        m_hdr_stream = id;
+        m_hdr_end_stream = flags & H2_FLAG_END_STREAM;
+        return true;
+    }
+    return on_header_block(id, flags & H2_FLAG_END_STREAM, requests);
+}
+
+// 头部字段回调，把请求的伪头部和 priority 头部存入流
+static bool on_field(void* arg, const char* name, int name_len, const char* value, int value_len){
+    h2_stream* s = (h2_stream*)arg;
+    if(name_len > 0 && name[0] == ':'){
+        std::string* dst = NULL;
+        if(name_len == 7 && memcmp(name, ":method", 7) == 0) dst = &s->method;
+        else if(name_len == 5 && memcmp(name, ":path", 5) == 0) dst = &s->path;
+        else if(name_len == 10 && memcmp(name, ":authority", 10) == 0) dst = &s->authority;
+        else if(name_len == 7 && memcmp(name, ":scheme", 7) == 0) return true;
+        if(!dst || !dst->empty()){
+            s->bad = true;      // 未知或重复的伪头部
+        }else{
+            dst->assign(value, value_len);
+        }
+    }else if(name_len == 8 && memcmp(name, "priority", 8) == 0){
+        // RFC 9218：u=0~7 为 urgency，i 为 incremental，出现该头部时 incremental 默认为 false
+        std::string v(value, value_len);
+        s->incremental = false;
+        const char* u = strstr(v.c_str(), "u=");
+        if(u && u[2] >= '0' && u[2] <= '7'){
+            s->urgency = u[2] - '0';
+        }
+        for(const char* i = strchr(v.c_str(), 'i'); i; i = strchr(i + 1, 'i')){
+            bool start = i == v.c_str() || i[-1] == ',' || i[-1] == ' ';
+            if(start && (i[1] == '\0' || i[1] == ',' || i[1] == ' ' || strncmp(i + 1, "=?1", 3) == 0)){
+                s->incremental = true;
+            }
+        }
+    }
+    return true;
+}
+
+bool h2_session::on_header_block(uint32_t id, bool end_stream, std::vector<h2_stream*>& requests){
+    h2_stream* s = find(id);
+    if(id <= m_last_id){
+        // 已开启的流上的第二个头部块是 trailers，必须结束请求；解码以保持动态表同步
+        h2_stream trailer;
+        if(!m_hpack.decode((const uint8_t*)m_hdr_block.data(), m_hdr_block.size(), on_field, &trailer)){
+            return goaway(H2_COMPRESSION_ERROR);
+        }
+        if(!s || s->reset){
+            return true;        // 已取消或已结束的流
+        }
+        if(s->end_remote || !end_stream){
+            reset_stream(s, H2_PROTOCOL_ERROR);
+            return true;
+        }
+        s->end_remote = true;
+        requests.push_back(s);
+        return true;
+    }
+    m_last_id = id;
+    s = new h2_stream();
+    s->id = id;
+    s->send_window = m_peer_initial_window;
+    s->recv_window = H2_RECV_WINDOW;
+    s->weight = H2_DEFAULT_WEIGHT;
+    s->urgency = H2_DEFAULT_URGENCY;
+    s->incremental = true;
+    bool decoded = m_hpack.decode((const uint8_t*)m_hdr_block.data(), m_hdr_block.size(), on_field, s);
+    m_streams.push_back(s);     // 先加入再判断，出错时由 reap 统一释放
+    if(!decoded){
+        return goaway(H2_COMPRESSION_ERROR);
+    }
+    if(m_hdr_weight){
+        if(m_hdr_dep == id){
+            reset_stream(s, H2_PROTOCOL_ERROR);
+            return true;
+        }
+        set_priority(s, m_hdr_dep, m_hdr_weight);
+    }
+    if(m_goaway_recv || open_streams() > H2_MAX_STREAMS){
+        reset_stream(s, H2_REFUSED_STREAM);     // 客户端可以安全地重试
+        return true;
+    }
+    if(s->method.empty() || s->path.empty()){
+        s->bad = true;
+    }
+    s->end_remote = end_stream;
+    if(end_stream){
+        requests.push_back(s);
+    }
+    return true;
+}
+
+void h2_session::set_priority(h2_stream* s, uint32_t dep, int weight){
+    s->parent = dep;
+    s->weight = weight;
+}
+
+void h2_session::respond(h2_stream* s, int status, const char* content_type, const char* data, long len){
+    char num[24];
+    int n = snprintf(num, sizeof(num), "%ld", len);
+    s->header_block.clear();
+    hpack_encode_status(s->header_block, status);
+    hpack_encode_field(s->header_block, HPACK_IDX_CONTENT_LENGTH, num, n);
+    hpack_encode_field(s->header_block, HPACK_IDX_CONTENT_TYPE, content_type, strlen(content_type));
+    s->status = status;
+    s->data = data;
+    s->len = len;
+    s->sent = 0;
+    s->vtime = m_vtime;         // 新加入调度的流从当前虚拟时间开始，不会因为来得晚而独占带宽
+    s->responded = true;
+}
+
+// 候选流：已发出响应头、响应体未发完、流窗口为正。
+// 1. 只在 urgency 最小的候选流中选择；
+// 2. 依赖的父流也是候选流时先不发送（RFC 7540 的依赖关系，父流发完后才轮到子流）；
+// 3. 有非 incremental 的流时选编号最小的（依次发送），否则选虚拟时间最小的（按权重交错发送）
+h2_stream* h2_session::pick() const {
+    int urgency = 8;
+    for(h2_stream* s : m_streams){
+        if(s->headers_sent && !s->end_sent && !s->reset && s->send_window > 0 && s->urgency < urgency){
+            urgency = s->urgency;
+        }
+    }
+    h2_stream* seq = NULL;
+    h2_stream* inc = NULL;
+    for(h2_stream* s : m_streams){
+        if(!s->headers_sent || s->end_sent || s->reset || s->send_window <= 0 || s->urgency != urgency){
+            continue;
+        }
+        if(s->parent){
+            h2_stream* p = find(s->parent);
+            if(p && p->headers_sent && !p->end_sent && !p->reset && p->send_window > 0){
+                continue;
+            }
+        }
+        if(!s->incremental){
+            if(!seq || s->id < seq->id){
+                seq = s;
+            }
+        }else if(!inc || s->vtime < inc->vtime){
+            inc = s;
+        }
+    }
+    return seq ? seq : inc;
+}
+
+bool h2_session::fill(long max_bytes, bool copy){
+    m_iov_cnt = m_iov_idx = 0;
+    int frames = 0;
+    long bytes = 0;
+    // 1. 控制帧（以及 h2c 升级的 101 响应）
+    if(!m_ctrl.empty()){
+        m_ctrl_sending.swap(m_ctrl);
+        m_ctrl.clear();
+        m_iov[m_iov_cnt].iov_base = (void*)m_ctrl_sending.data();
+        m_iov[m_iov_cnt++].iov_len = m_ctrl_sending.size();
+        bytes += m_ctrl_sending.size();
+    }
+    // h2c 升级后流 1 的响应要等客户端的连接前言到达再发：有的客户端读取 101 响应时
+    // 只能缓存有限的后续数据，随 101 一起到达的大段 DATA 会被丢弃
+    if(m_need_preface){
+        return m_iov_cnt > 0;
+    }
+    // 2. 响应头不受流量控制，生成后尽快发出。头部块很短，不需要 CONTINUATION
+    for(h2_stream* s : m_streams){
+        if(frames == H2_BATCH_FRAMES){
+            break;
+        }
+        if(!s->responded || s->headers_sent || s->reset){
+            continue;
+        }
+        uint8_t flags = H2_FLAG_END_HEADERS;
+        if(s->len == 0){
+            flags |= H2_FLAG_END_STREAM;
+            s->end_sent = true;
+        }
+        frame_header(m_fh[frames], s->header_block.size(), H2_HEADERS, flags, s->id);
+        m_iov[m_iov_cnt].iov_base = m_fh[frames++];
+        m_iov[m_iov_cnt++].iov_len = 9;
+        m_iov[m_iov_cnt].iov_base = (void*)s->header_block.data();
+        m_iov[m_iov_cnt++].iov_len = s->header_block.size();
+        bytes += 9 + s->header_block.size();
+        s->headers_sent = true;
+    }
+    // 3. DATA 帧，受连接和流的发送窗口限制
+    while(frames < H2_BATCH_FRAMES && bytes < max_bytes && m_send_window > 0){
+        h2_stream* s = pick();
+        if(!s){
+            break;
+        }
+        long n = std::min(s->len - s->sent, (long)m_peer_max_frame);
+        n = std::min(n, (long)std::min(s->send_window, m_send_window));
+        n = std::min(n, max_bytes - bytes);
+        bool end = s->sent + n == s->len;
+        frame_header(m_fh[frames], n, H2_DATA, end ? H2_FLAG_END_STREAM : 0, s->id);
+        m_iov[m_iov_cnt].iov_base = m_fh[frames++];
+        m_iov[m_iov_cnt++].iov_len = 9;
+        m_iov[m_iov_cnt].iov_base = (void*)(s->data + s->sent);
+        m_iov[m_iov_cnt++].iov_len = n;
+        bytes += 9 + n;
+        s->sent += n;
+        s->send_window -= n;
+        m_send_window -= n;
+        s->vtime += (uint64_t)n * 256 / s->weight;
+        m_vtime = s->vtime;
+        s->end_sent = end;
+    }
+    if(m_iov_cnt == 0){
+        return false;
+    }
+    if(copy){
+        m_copy.clear();
+        for(int i = 0; i < m_iov_cnt; ++i){
+            m_copy.append((const char*)m_iov[i].iov_base, m_iov[i].iov_len);
+        }
+        m_iov[0].iov_base = (void*)m_copy.data();
+        m_iov[0].iov_len = m_copy.size();
+        m_iov_cnt = 1;
+    }
+    return true;
+}
+
+void h2_session::advance(long n){
+    while(n > 0 && m_iov_idx < m_iov_cnt){
+        iovec& v = m_iov[m_iov_idx];
+        if((size_t)n < v.iov_len){
+            v.iov_base = (char*)v.iov_base + n;
+            v.iov_len -= n;
+            return;
+        }
+        n -= v.iov_len;
+        ++m_iov_idx;
+    }
+}
+
+h2_stream* h2_session::reap(){
+    for(size_t i = 0; i < m_streams.size(); ++i){
+        h2_stream* s = m_streams[i];
+        if(s->end_sent || s->reset){
+            m_streams[i] = m_streams.back();
+            m_streams.pop_back();
+            return s;
+        }
+    }
+    return NULL;
+}
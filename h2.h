@@ -0,0 +1,159 @@
+#ifndef H2_H
+#define H2_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include <string>
+#include <vector>
+#include "hpack.h"
+
+/*
+    HTTP/2（RFC 9113）
+    一个连接上多个请求（流）交错进行，页面的 HTML 和图片共用一个连接和一次 TLS 握手。
+    进入方式：明文连接上直接发送连接前言（prior knowledge），或 HTTP/1.1 的 "Upgrade: h2c"；
+    HTTPS 连接在 ALPN 中协商 "h2"。
+
+    与 HTTP/1.1 连接沿用同一套线程分工，EPOLLONESHOT 保证同一时刻只有一个线程操作会话：
+    1. 主线程读取数据追加到会话的输入缓冲区；
+    2. 工作线程解析帧、维护流状态和 HPACK 动态表，对完整的请求调用原有的 do_request 生成响应；
+    3. 主线程按优先级和流量控制窗口把响应切成帧，用 writev 发送：帧头在会话内，DATA 帧的内容直接指向
+       文件映射区，不复制（OpenSSL 加密的连接先拼接成一块，减少 TLS 记录数）。
+    流的响应发送完毕或被取消后，由主线程在批次之间释放，正在发送的批次引用的内存不会被工作线程释放。
+
+    优先级：请求带 "priority" 头部（RFC 9218）时按其中的 urgency 和 incremental 调度；否则按 RFC 7540 的
+    权重和依赖关系：同一 urgency 中，依赖的父流还有数据要发送的流先不发送，其余按权重加权轮转。
+*/
+
+#ifndef H2_OPEN
+#define H2_OPEN 1
+#endif
+#define H2_MAX_STREAMS 100              // SETTINGS_MAX_CONCURRENT_STREAMS
+#define H2_MAX_FRAME 16384              // 接收的最大帧长度，即 SETTINGS_MAX_FRAME_SIZE 的默认值
+#define H2_MAX_HEADER_BLOCK 16384       // 一个头部块（HEADERS + CONTINUATION）的最大长度，同时作为 SETTINGS_MAX_HEADER_LIST_SIZE
+#define H2_RECV_WINDOW 65535            // 请求体的接收窗口，收到一半后用 WINDOW_UPDATE 归还
+#define H2_IN_MAX (1024 * 1024)         // 输入缓冲区达到该长度后暂停读取，先处理已收到的帧
+#define H2_CTRL_MAX (64 * 1024)         // 待发送的控制帧（SETTINGS/PING 应答等）上限，客户端只发不收时关闭连接
+#define H2_BATCH_FRAMES 64              // 一个发送批次最多包含的帧数
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN 24
+
+// 错误码
+enum H2_ERROR {
+    H2_NO_ERROR = 0x0, H2_PROTOCOL_ERROR = 0x1, H2_INTERNAL_ERROR = 0x2, H2_FLOW_CONTROL_ERROR = 0x3,
+    H2_STREAM_CLOSED = 0x5, H2_FRAME_SIZE_ERROR = 0x6, H2_REFUSED_STREAM = 0x7, H2_CANCEL = 0x8,
+    H2_COMPRESSION_ERROR = 0x9, H2_ENHANCE_YOUR_CALM = 0xb
+};
+
+// 一个请求/响应
+struct h2_stream {
+    uint32_t id;
+    bool end_remote;            // 已收到 END_STREAM，请求完整
+    bool responded;             // 已生成响应
+    bool headers_sent;          // 响应头已放入发送批次
+    bool end_sent;              // 最后一帧已放入发送批次，该批次发送完后可以释放
+    bool reset;                 // 被 RST_STREAM 取消（任一方）
+    int64_t send_window;        // 对端给出的发送窗口，对端缩小初始窗口时可以为负
+    int recv_window;            // 请求体的剩余接收窗口
+    int recv_unacked;           // 已接收、尚未用 WINDOW_UPDATE 归还的字节数
+
+    // 优先级
+    uint32_t parent;            // RFC 7540 依赖的流，0 表示根
+    int weight;                 // 1~256
+    int urgency;                // RFC 9218，0~7，越小越优先
+    bool incremental;           // 为 false 时同一 urgency 的流按流编号依次发送，不交错
+    uint64_t vtime;             // 加权轮转的虚拟时间，每发送一段增加 长度/权重，每次选择最小的
+
+    // 请求
+    std::string method;
+    std::string path;
+    std::string authority;
+    bool bad;                   // 伪头部缺失或重复，回复 400
+
+    // 响应
+    int status;
+    std::string header_block;   // HPACK 编码后的响应头
+    const char* data;           // 响应体：指向 map_addr 或 body
+    long len;
+    long sent;                  // 已放入发送批次的响应体字节数
+    char* map_addr;             // 文件映射区，释放流时 munmap
+    long map_len;
+    std::string body;
+
+    long ts_read;               // 请求读完、交给线程池的时间（单调时钟：微秒）
+    long ts_dequeue;            // 工作线程开始处理的时间
+    long ts_ready;              // 响应生成完毕的时间
+};
+
+class h2_session {
+public:
+    h2_session();
+    ~h2_session();              // 释放所有流
+
+    // 以下三个函数用于建立会话，由工作线程（或握手后的主线程）调用一次
+    void start();                                   // 期待客户端的连接前言，排队发送服务端的 SETTINGS
+    h2_stream* upgrade(const char* settings);       // h2c 升级：排队 101 响应和 SETTINGS，应用 HTTP2-Settings
+                                                    // 并创建流 1（请求已完整），格式错误返回 NULL
+    bool append_input(const char* buf, int len);    // 主线程追加读到的数据，缓冲区已满时返回 false（暂停读取）
+
+    // 工作线程：处理输入中所有完整的帧，新完成的请求追加到 requests。发生连接错误时排队 GOAWAY 并返回 false
+    bool process(std::vector<h2_stream*>& requests);
+    void respond(h2_stream* s, int status, const char* content_type, const char* data, long len);
+    void reset_stream(h2_stream* s, H2_ERROR code); // 取消流并排队 RST_STREAM
+
+    // 主线程：发送批次
+    bool pending() const { return m_iov_idx < m_iov_cnt; }     // 当前批次是否还有未发送的数据
+    bool fill(long max_bytes, bool copy);           // 当前批次发完后生成下一批，没有可发送的数据时返回 false
+    const iovec* batch(int* cnt) const { *cnt = m_iov_cnt - m_iov_idx; return m_iov + m_iov_idx; }
+    void advance(long n);                           // 当前批次已发送 n 字节
+    h2_stream* reap();                              // 批次之间调用，取出一个已结束的流，调用者统计后 release
+    static void release(h2_stream* s);
+
+    bool active() const;                            // 是否还有未结束的流
+    bool closing() const;                           // 已收到或发送 GOAWAY 且没有未完成的流和控制帧，可以关闭连接
+
+private:
+    std::string m_in;           // 输入缓冲区
+    bool m_need_preface;        // 尚未收到连接前言
+    bool m_need_settings;       // 连接前言之后的第一帧必须是 SETTINGS
+    hpack_decoder m_hpack;
+    std::string m_hdr_block;    // 正在接收的头部块（等待 CONTINUATION）
+    uint32_t m_hdr_stream;      // 正在接收头部块的流，0 表示没有
+    bool m_hdr_end_stream;
+    uint32_t m_hdr_dep;         // HEADERS 帧中的优先级信息，m_hdr_weight 为 0 表示没有
+    int m_hdr_weight;
+
+    std::vector<h2_stream*> m_streams;  // 未释放的流，数量不超过 H2_MAX_STREAMS 加上已结束待释放的
+    uint32_t m_last_id;         // 客户端开启的最大流编号
+    bool m_goaway_sent;
+    bool m_goaway_recv;
+
+    int64_t m_send_window;      // 连接级发送窗口
+    int m_recv_window;          // 连接级接收窗口
+    int m_recv_unacked;
+    int64_t m_peer_initial_window;  // 对端的 SETTINGS_INITIAL_WINDOW_SIZE
+    int m_peer_max_frame;           // 对端的 SETTINGS_MAX_FRAME_SIZE
+    uint64_t m_vtime;           // 加权轮转的当前虚拟时间
+
+    std::string m_ctrl;         // 待发送的控制帧
+    std::string m_ctrl_sending; // 当前批次中的控制帧
+    std::string m_copy;         // 拼接后的批次（copy 模式）
+    uint8_t m_fh[H2_BATCH_FRAMES][9];   // 当前批次的帧头
+    iovec m_iov[2 * H2_BATCH_FRAMES + 1];
+    int m_iov_cnt;
+    int m_iov_idx;
+
+    h2_stream* find(uint32_t id) const;
+    h2_stream* pick() const;    // 按优先级选择下一个发送 DATA 帧的流
+    int open_streams() const;
+    void ctrl_frame(uint8_t type, uint8_t flags, uint32_t id, const void* payload, int len);
+    bool goaway(H2_ERROR code);
+    bool apply_settings(const uint8_t* p, int len);
+    bool on_frame(uint8_t type, uint8_t flags, uint32_t id, const uint8_t* p, int len, std::vector<h2_stream*>& requests);
+    bool on_data(uint8_t flags, uint32_t id, const uint8_t* p, int len, std::vector<h2_stream*>& requests);
+    bool on_headers(uint8_t flags, uint32_t id, const uint8_t* p, int len, std::vector<h2_stream*>& requests);
+    bool on_header_block(uint32_t id, bool end_stream, std::vector<h2_stream*>& requests);
+    void set_priority(h2_stream* s, uint32_t dep, int weight);
+};
+
+#endif
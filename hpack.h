@@ -0,0 +1,51 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <stdint.h>
+#include <string>
+#include <deque>
+
+/*
+    HTTP/2 头部压缩（RFC 7541）
+    解码器维护连接的动态表，支持 Huffman 编码的字符串；一个连接的所有头部块必须按收到的顺序解码。
+    编码器只用静态表索引和"不索引的字面量"，不维护动态表，因此不受对端 SETTINGS_HEADER_TABLE_SIZE 的影响。
+    响应头只有 :status、content-length、content-type 几个字段，压缩率的损失可以忽略。
+*/
+
+#define HPACK_TABLE_SIZE 4096       // 解码端动态表的容量，即 SETTINGS_HEADER_TABLE_SIZE 的默认值
+#define HPACK_MAX_STRING 8192       // 单个名字或值的最大长度，超过时按压缩错误处理
+
+// 静态表中响应用到的名字的索引
+#define HPACK_IDX_STATUS 8          // :status 200
+#define HPACK_IDX_CONTENT_LENGTH 28
+#define HPACK_IDX_CONTENT_TYPE 31
+
+// 每解码出一个字段调用一次，name/value 不以 \0 结尾，只在回调期间有效。返回 false 停止解码
+typedef bool (*hpack_field_cb)(void* arg, const char* name, int name_len, const char* value, int value_len);
+
+class hpack_decoder {
+public:
+    hpack_decoder() : m_size(0), m_max_size(HPACK_TABLE_SIZE) {}
+    // 解码一个完整的头部块，格式错误或回调返回 false 时返回 false（连接错误 COMPRESSION_ERROR）
+    bool decode(const uint8_t* p, int len, hpack_field_cb cb, void* arg);
+
+private:
+    struct entry {
+        std::string name;
+        std::string value;
+    };
+    std::deque<entry> m_table;      // 动态表，表头为最新插入的字段
+    int m_size;                     // 动态表当前大小：每个字段为名字长度 + 值长度 + 32
+    int m_max_size;                 // 对端用"动态表大小更新"设置的容量，不超过 HPACK_TABLE_SIZE
+
+    bool lookup(int index, const char** name, int* name_len, const char** value, int* value_len) const;
+    void insert(const char* name, int name_len, const char* value, int value_len);
+    void evict(int max_size);
+};
+
+void hpack_encode_int(std::string& out, uint8_t first, int prefix_bits, uint32_t value);
+void hpack_encode_status(std::string& out, int status);
+// 名字在静态表中、值为字面量且不加入动态表的字段
+void hpack_encode_field(std::string& out, int name_index, const char* value, int value_len);
+
+#endif
@@ -6,9 +6,27 @@ http_conn::http_conn(){}
 http_conn::~http_conn(){}
 
 int http_conn::m_epoll_fd = -1;     // 类中静态成员需要外部定义
-int http_conn::m_user_cnt = 0;  
-int http_conn::m_request_cnt = 0; 
 sort_timer_lst http_conn::m_timer_lst;
+int http_conn::m_max_conns = 65535;
+int http_conn::m_done_fd = -1;
+std::atomic<http_conn*> http_conn::m_done_head(NULL);
+http_conn* http_conn::m_idle_head = NULL;
+http_conn* http_conn::m_idle_tail = NULL;
+
+// 每个 URL 最近一次响应的字节数，只由主线程读写
+struct size_hint {
+    uint32_t hash;
+    int size;
+};
+static size_hint g_size_hints[SIZE_HINT_SLOTS];
+
+static uint32_t url_hash(const char* url, int len){    // FNV-1a
+    uint32_t h = 2166136261u;
+    for(int i = 0; i < len; ++i){
+        h = (h ^ (unsigned char)url[i]) * 16777619u;
+    }
+    return h;
+}
 // locker http_conn::m_timer_lst_locker;
 
 // 网站的根目录
@@ -23,6 +41,10 @@ const char* error_404_title = "Not Found";
 const char* error_404_form = "The requested file was not found on this server.\n";
 const char* error_500_title = "Internal Error";
 const char* error_500_form = "There was an unusual problem serving the requested file.\n";
+const char* error_502_title = "Bad Gateway";
+const char* error_502_form = "The upstream server is unavailable or sent an invalid response.\n";
+const char* error_504_title = "Gateway Timeout";
+const char* error_504_form = "The upstream server did not respond in time.\n";
 
 // 设置文件描述符为非阻塞
 void set_nonblocking(int fd){
@@ -68,8 +90,7 @@ void modfd(int epoll_fd, int fd, int ev){
 
 // 初始化新的连接
 void http_conn::init(int sock_fd, const sockaddr_in& addr){ 
-    m_sock_fd = sock_fd;    // 套接字
-    m_addr = addr;          // 客户端地址
+    attach(sock_fd, addr);
 
     // 设置端口复用
     int reuse = 1;
@@ -77,22 +98,59 @@ void http_conn::init(int sock_fd, const sockaddr_in& addr){
 
     // 添加sock_fd到epoll对象中
     addfd(m_epoll_fd, sock_fd, true, ET);
-    ++m_user_cnt;
+    m_ep_events = EPOLLIN;
+    metrics_inc(MC_EPOLL_CTL);
+    metrics_inc(MC_CONN_ACCEPTED);
+    metrics_gauge_add(MG_CONNECTIONS, 1);
+    WS_PROBE2(conn_init, sock_fd, addr.sin_addr.s_addr);
+    #if CAPTURE_OPEN
+    capture_conn_open(sock_fd, addr.sin_addr.s_addr, addr.sin_port);
+    #endif
 
     char ip[16] = "";
     const char* str = inet_ntop(AF_INET, &addr.sin_addr.s_addr, ip, sizeof(ip));
-    EMlog(LOGLEVEL_INFO, "The No.%d user. sock_fd = %d, ip = %s.\n", m_user_cnt, sock_fd, str);
+    EMlog(LOGLEVEL_INFO, "The No.%ld user. sock_fd = %d, ip = %s.\n", metrics_gauge_get(MG_CONNECTIONS), sock_fd, str);
     init();             // 初始化其他信息，私有
+    m_ts_accept = get_mono_us();
+
+    sb_conn_slot* slot = scoreboard_conn(sock_fd);  // 重置记分板上的连接槽位
+    if(slot){
+        memset(slot, 0, sizeof(*slot));
+        slot->client_ip = addr.sin_addr.s_addr;
+        slot->client_port = addr.sin_port;
+        slot->since_us = m_ts_accept;
+        slot->state = SB_CONN_IDLE;
+    }
 
     // 创建定时器，设置其回调函数与超时时间，然后绑定定时器与用户数据，最后将定时器添加到链表timer_lst中
     util_timer* new_timer = new util_timer;
     new_timer->user_data = this;
     time_t curr_time = time(NULL);
-    new_timer->expire = curr_time + 3 * TIMESLOT;
+    new_timer->expire = curr_time + IDLE_TIMEOUT;
     this->timer = new_timer;
     m_timer_lst.add_timer(new_timer);  
 }
 
+// 绑定套接字和客户端地址，重置与连接（而不是单个请求）相关的成员
+void http_conn::attach(int sock_fd, const sockaddr_in& addr){
+    m_sock_fd = sock_fd;    // 套接字
+    m_addr = addr;          // 客户端地址
+    m_idle = false;         // 新连接还没有发过请求，不加入空闲链表
+    m_ep_events = 0;
+    m_settle.store(false, std::memory_order_relaxed);
+    m_h2 = NULL;
+    m_proxy = NULL;
+    m_proxy_wait = false;
+    m_proxy_buf_off = m_proxy_buf_len = 0;
+    m_cache_job = NULL;
+    #if USE_TLS
+    m_ssl = NULL;
+    m_tls_hs = false;
+    m_ktls_send = false;
+    m_file_fd = -1;
+    #endif
+}
+
 // 初始化连接之外的其他信息
 void http_conn::init(){
     m_method = GET;
@@ -101,6 +159,9 @@ void http_conn::init(){
     m_linger = false;                       // 默认不保持连接
     m_content_len = 0;
     m_host = 0;
+    m_hdr_start = 0;
+    m_h2c_upgrade = false;
+    m_h2_settings = 0;
 
     m_check_stat = CHECK_STATE_REQUESTLINE; // 初始化状态为正在解析请求首行
     m_checked_idx = 0;                      // 初始化解析字符索引
@@ -111,6 +172,22 @@ void http_conn::init(){
     bytes_have_send = 0;
     bytes_to_send = 0;
 
+    m_body.clear();
+    m_body_address = 0;
+    m_content_type = "text/html";
+    m_route_status = 200;
+    m_route_headers.clear();
+
+    m_status = 0;
+    m_ts_accept = 0;
+    m_ts_start = m_ts_read = m_ts_dequeue = m_ts_ready = 0;
+    m_ts_eagain = 0;
+    m_ts_done = 0;
+    m_trace_id = 0;
+    m_phase = PHASE_IDLE;
+    m_phase_start = 0;
+    m_phase_bytes = 0;
+
     bzero(m_rd_buf, RD_BUF_SIZE);           // 清空读缓存
     bzero(m_write_buf, WD_BUF_SIZE);        // 清空写缓存
     bzero(m_real_file, FILENAME_LEN);       // 清空文件路径
@@ -119,26 +196,57 @@ void http_conn::init(){
 // 关闭连接
 void http_conn::conn_close(){
     if(m_sock_fd != -1){
-        --m_user_cnt;   // 客户端数量减一
-        EMlog(LOGLEVEL_INFO, "closing fd: %d, rest user num :%d\n", m_sock_fd, m_user_cnt);
-        rmfd(m_epoll_fd, m_sock_fd);    // 移除epoll检测,关闭套接字
+        metrics_gauge_add(MG_CONNECTIONS, -1);  // 客户端数量减一
+        metrics_inc(MC_CONN_CLOSED);
+        scoreboard_conn_set(m_sock_fd, SB_CONN_FREE);
+        WS_PROBE1(conn_close, m_sock_fd);
+        #if CAPTURE_OPEN
+        capture_conn_close(m_sock_fd);
+        #endif
+        ratelimit_conn_close(m_addr.sin_addr.s_addr);
+        if(m_idle){
+            idle_unlink();
+        }
+        unmap();                        // 响应未发送完就关闭时释放文件映射
+        if(m_proxy){
+            proxy_finish(PROXY_CLOSE);  // 响应体未转发完，上游连接不能复用
+        }
+        m_cache.reset();
+        std::string().swap(m_proxy_buf);
+        if(m_h2){
+            delete m_h2;                // 同时释放各个流的文件映射
+            m_h2 = NULL;
+        }
+        #if USE_TLS
+        if(m_ssl){
+            if(!m_tls_hs){
+                SSL_shutdown(m_ssl);    // 尽力发送 close_notify，不等待对方回应
+            }
+            SSL_free(m_ssl);
+            m_ssl = NULL;
+        }
+        #endif
+        EMlog(LOGLEVEL_INFO, "closing fd: %d, rest user num :%ld\n", m_sock_fd, metrics_gauge_get(MG_CONNECTIONS));
+        close(m_sock_fd);               // 关闭套接字时内核自动把它从 epoll 中移除，不需要 EPOLL_CTL_DEL
         m_sock_fd = -1;
     }
 }
 
 // 循环读取客户数据，直到无数据可读 或 关闭连接
 bool http_conn::read(){
-    if(timer) {             // 更新超时时间
-        time_t curr_time = time( NULL );
-        timer->expire = curr_time + 3 * TIMESLOT;
-        m_timer_lst.adjust_timer( timer );
-    }
-    
+    if(m_h2) return h2_read();
     if(m_rd_idx >= RD_BUF_SIZE) return false;   // 超过缓冲区大小
+    long ts_enter = get_mono_us();
+    if(m_rd_idx == 0){                          // 新请求的第一次读取
+        m_ts_start = ts_enter;
+        m_trace_id = trace_sample();
+        if(m_ts_accept) TRACE_EVENT(m_trace_id, TR_ACCEPT_WAIT, m_ts_accept, m_ts_start, m_sock_fd);
+    }
+    TRACE_EVENT(m_trace_id, TR_EPOLL_DELAY, trace_epoll_wake_us, ts_enter, m_sock_fd);
 
     int bytes_rd = 0;
     while(true){    // m_sock_fd已设置非阻塞, 建立连接然后add到epoll对象的时候设置的
-        bytes_rd = recv(m_sock_fd, m_rd_buf + m_rd_idx, RD_BUF_SIZE - m_rd_idx, 0);   // 第二个参数传递的是缓冲区中开始读入的地址偏移
+        bytes_rd = sock_recv(m_rd_buf + m_rd_idx, RD_BUF_SIZE - m_rd_idx);   // 第一个参数传递的是缓冲区中开始读入的地址偏移
         if(bytes_rd == -1){
             if(errno == EAGAIN || errno == EWOULDBLOCK){ // 非阻塞的读，EAGAIN说明读完了
                 break;      // 非阻塞读取，没有数据了
@@ -147,12 +255,30 @@ bool http_conn::read(){
         }else if(bytes_rd == 0){    
             return false;   // 对方关闭连接，调用conn_close()
         }
+        #if CAPTURE_OPEN
+        capture_data(m_sock_fd, m_rd_buf + m_rd_idx, bytes_rd);
+        #endif
         m_rd_idx += bytes_rd;   // 更新下一次读取位置
     }
+    // 工作线程在请求不完整时才重新注册 EPOLLIN，此时 m_check_stat 已是本次请求解析到的位置
+    if(m_check_stat == CHECK_STATE_CONTENT){
+        set_deadline(PHASE_BODY, m_checked_idx);
+    }else{
+        set_deadline(PHASE_HEADER, 0);
+    }
 
-    ++m_request_cnt;
+    metrics_inc(MC_REQUESTS);
+    m_ts_read = get_mono_us();
+    TRACE_EVENT(m_trace_id, TR_READ, ts_enter, m_ts_read, m_sock_fd);
+    WS_PROBE2(read_done, m_sock_fd, m_rd_idx);
+    sb_conn_slot* slot = scoreboard_conn(m_sock_fd);
+    if(slot){
+        slot->bytes_in = m_rd_idx;
+        slot->bytes_out = 0;
+    }
+    scoreboard_conn_set(m_sock_fd, SB_CONN_QUEUED);     // 调用者随后把连接加入线程池队列
 
-    EMlog(LOGLEVEL_INFO, "sock_fd = %d read done. request cnt = %d\n", m_sock_fd, m_request_cnt);    // 全部读取完毕
+    EMlog(LOGLEVEL_INFO, "sock_fd = %d read done. request cnt = %ld\n", m_sock_fd, metrics_counter_get(MC_REQUESTS));    // 全部读取完毕
     
     return true;
 }
@@ -224,8 +350,14 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text){
     char* method = text;    // GET\0
     if(strcasecmp(method, "GET") == 0){
         m_method = GET;
+    }else if(strcasecmp(method, "POST") == 0){     // 以下方法只交给路由表中的处理函数（见 router.h）
+        m_method = POST;
+    }else if(strcasecmp(method, "PUT") == 0){
+        m_method = PUT;
+    }else if(strcasecmp(method, "DELETE") == 0){
+        m_method = DELETE;
     }else{
-        return BAD_REQUEST; // 非GET请求方法
+        return BAD_REQUEST; // 不支持的请求方法
     }
 
     // /index.html HTTP/1.1
@@ -244,6 +376,8 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text){
         return BAD_REQUEST;
     }
 
+    scoreboard_set_url(m_sock_fd, m_url);
+    m_hdr_start = m_checked_idx;        // 下一行是第一个头部
     m_check_stat = CHECK_STATE_HEADER;  // 主状态机状态改变为检查请求头部
     return NO_REQUEST;                  // 请求尚未解析完成
 
@@ -251,6 +385,7 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text){
 
 // 解析请求头部    
 http_conn::HTTP_CODE http_conn::parse_request_headers(char* text){      // 在枚举类型前加上 `http_conn::` 来指出它的所属作用域
+    PERF_SCOPE(PS_PARSE_HEADERS);
     // 遇到空行，表示头部字段解析完毕
     if( text[0] == '\0' ) {
         // 如果HTTP请求有消息体，则还需要读取m_content_length字节的消息体，
@@ -278,6 +413,15 @@ http_conn::HTTP_CODE http_conn::parse_request_headers(char* text){      // 在
         text += 5;
         text += strspn( text, " \t" );
         m_host = text;
+    } else if ( strncasecmp( text, "Upgrade:", 8 ) == 0 ) {
+        // Upgrade: h2c，明文连接升级到 HTTP/2
+        text += 8;
+        text += strspn( text, " \t" );
+        m_h2c_upgrade = strncasecmp( text, "h2c", 3 ) == 0 && strchr( ", \t", text[3] );
+    } else if ( strncasecmp( text, "HTTP2-Settings:", 15 ) == 0 ) {
+        text += 15;
+        text += strspn( text, " \t" );
+        m_h2_settings = text;
     } else {
         #ifdef COUT_OPEN
             EMlog(LOGLEVEL_DEBUG,"oop! unknow header: %s\n", text );
@@ -299,6 +443,7 @@ http_conn::HTTP_CODE http_conn::parse_request_content(char* text){
 
 // 从状态机解析一行数据，判断\r\n
 http_conn::LINE_STATUS http_conn::parse_one_line(){
+        PERF_SCOPE(PS_PARSE_ONE_LINE);
         char temp;
         for( ; m_checked_idx < m_rd_idx; ++m_checked_idx){  // 检查的索引 小于 读到的索引
             
@@ -332,6 +477,41 @@ http_conn::LINE_STATUS http_conn::parse_one_line(){
 // 如果目标文件存在、对所有用户可读，且不是目录，则使用mmap将其
 // 映射到内存地址m_file_address处，并告诉调用者获取文件成功
 http_conn::HTTP_CODE http_conn::do_request(){
+    trace_scope scope( m_trace_id, TR_DO_REQUEST, m_sock_fd );
+    PERF_SCOPE( PS_DO_REQUEST );
+
+    // 路由表中的处理函数（/metrics 等内部路径、/healthz 以及启动时注册的动态路由）
+    route_request req;
+    const char* query = strchr( m_url, '?' );
+    req.method = m_method;
+    req.path = m_url;
+    req.path_len = query ? query - m_url : strlen( m_url );
+    req.query = query ? query + 1 : "";
+    req.host = m_host;
+    req.body = m_content_len ? m_rd_buf + m_checked_idx : NULL;
+    req.body_len = m_content_len;
+    req.conn = this;
+    req.get_header = route_header;
+    route_handler handler = router_match( req, internal_client() );
+    if ( handler ) {
+        route_response resp( m_body, m_route_headers );
+        handler( req, resp );
+        m_route_status = resp.status;
+        m_content_type = resp.content_type;
+        return DYNAMIC_REQUEST;
+    }
+    // 反向代理和文件只支持 GET
+    if ( m_method != GET ) {
+        return BAD_REQUEST;
+    }
+    #if PROXY_OPEN
+    // 反向代理的路由优先于 doc_root 下的文件
+    const proxy_route* route = proxy_match( m_url );
+    if ( route ) {
+        return proxy_request( route );
+    }
+    #endif
+
     // "/home/cyf/Linux/webserver/resources"
     strcpy( m_real_file, doc_root );
     int len = strlen( doc_root );
@@ -353,82 +533,579 @@ http_conn::HTTP_CODE http_conn::do_request(){
 
     // 以只读方式打开文件
     int fd = open( m_real_file, O_RDONLY );
+    WS_PROBE3( file_open, m_sock_fd, m_real_file, m_file_stat.st_size );
     // 创建内存映射
     m_file_address = ( char* )mmap( 0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    #if USE_TLS
+    if ( m_ktls_send ) {
+        m_file_fd = fd;     // 内核 TLS 连接用 sendfile 发送文件内容，在 unmap 中关闭
+        return FILE_REQUEST;
+    }
+    #endif
     close( fd );
     return FILE_REQUEST;
 }  
 
+// 内部路径（/metrics、/debug/trace）默认只对本机 127.0.0.0/8 的客户端开放
+bool http_conn::internal_client(){
+    return METRICS_ALLOW_REMOTE || ( ntohl( m_addr.sin_addr.s_addr ) >> 24 ) == 127;
+}
+
 // 对内存映射区执行munmap操作
 void http_conn::unmap(){
     if(m_file_address){
         munmap(m_file_address, m_file_stat.st_size);
         m_file_address = 0;
     }
+    #if USE_TLS
+    if(m_file_fd >= 0){
+        close(m_file_fd);
+        m_file_fd = -1;
+    }
+    #endif
 }
 
 
 // 写HTTP响应数据
 bool http_conn::write(){
+    if(m_h2) return h2_write();
+    if(m_proxy || m_cache) return proxy_write();
     int temp = 0;
 
-    if(timer) {             // 更新超时时间
-        time_t curr_time = time( NULL );
-        timer->expire = curr_time + 3 * TIMESLOT;
-        m_timer_lst.adjust_timer( timer );
+    EMlog(LOGLEVEL_INFO, "sock_fd = %d writing %d bytes.\n", m_sock_fd, bytes_to_send); 
+    long ts_enter = m_trace_id ? get_mono_us() : 0;
+    if ( m_ts_eagain ) {
+        TRACE_EVENT( m_trace_id, TR_EAGAIN_WAIT, m_ts_eagain, ts_enter, m_sock_fd );
+        m_ts_eagain = 0;
+    } else if ( bytes_have_send == 0 ) {
+        TRACE_EVENT( m_trace_id, TR_RESPONSE_WAIT, m_ts_ready, ts_enter, m_sock_fd );
     }
-    EMlog(LOGLEVEL_INFO, "sock_fd = %d writing %d bytes. request cnt = %d\n", m_sock_fd, bytes_to_send, m_request_cnt); 
     if ( bytes_to_send == 0 ) {
         // 当要发送的字节为0，这一次响应结束。
-        modfd( m_epoll_fd, m_sock_fd, EPOLLIN ); // 重置EPOLLONESHOT
+        finish_request();
+        unmap();
+        if ( !m_linger ) {
+            return false;
+        }
         init();
+        set_deadline( PHASE_IDLE, 0 );
+        epoll_arm( EPOLLIN ); // 重置EPOLLONESHOT
         return true;
     }
 
+    int quantum_sent = 0;   // 本轮已发送的字节数
     while(1) {
+        if ( m_iv_count == 2 && m_iv[1].iov_len > WRITE_QUANTUM ) {
+            m_iv[1].iov_len = WRITE_QUANTUM;        // 单次 writev 不超过一个时间片，剩余部分在下面按 bytes_to_send 恢复
+        }
+        #if USE_TLS
+        if ( m_file_fd >= 0 && bytes_have_send >= m_write_idx ) {
+            // 响应头已发完，文件内容用 sendfile 从页缓存交给内核加密发送，不经过用户态
+            off_t offset = bytes_have_send - m_write_idx;
+            temp = sendfile( m_sock_fd, m_file_fd, &offset, std::min( bytes_to_send, WRITE_QUANTUM ) );
+        } else
+        #endif
         // 分散写   m_write_buf + m_file_address
-        temp = writev(m_sock_fd, m_iv, m_iv_count);
+        {
+            PERF_SCOPE(PS_WRITEV);
+            temp = sock_writev(m_iv, m_iv_count);
+        }
         if ( temp <= -1 ) {
             // 如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件，虽然在此期间，
             // 服务器无法立即接收到同一客户的下一个请求，但可以保证连接的完整性。
             if( errno == EAGAIN ) {
-                modfd( m_epoll_fd, m_sock_fd, EPOLLOUT );
+                WS_PROBE3( write_eagain, m_sock_fd, bytes_have_send, bytes_to_send );
+                if ( m_trace_id ) {
+                    m_ts_eagain = get_mono_us();
+                    TRACE_EVENT( m_trace_id, TR_WRITE, ts_enter, m_ts_eagain, m_sock_fd );
+                }
+                set_deadline( PHASE_SEND, send_acked() );      // 等待客户端接收，按最低接收速率计算期限
+                epoll_arm(EPOLLOUT);
                 return true;
             }
+            TRACE_EVENT( m_trace_id, TR_WRITE, ts_enter, get_mono_us(), m_sock_fd );
             unmap();        // 释放内存映射m_file_address空间
             return false;
         }
 
-        bytes_to_send -= temp;
-        bytes_have_send += temp;
-
-        if (bytes_have_send >= m_iv[0].iov_len){    // 发完头部了
-            m_iv[0].iov_len = 0;                    // 更新两个发送内存块的信息
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);    // 已经发了部分的响应体数据
-            m_iv[1].iov_len = bytes_to_send;
-        }else{                                      // 还没发完头部
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - temp;
+        if ( bytes_have_send == 0 && temp > 0 ) {  // 响应的第一个字节
+            long origin = m_ts_accept ? m_ts_accept : m_ts_start;
+            if ( origin ) metrics_observe( MH_FIRST_BYTE, get_mono_us() - origin );
+            m_ts_accept = 0;
         }
+        iov_advance( temp );
+        quantum_sent += temp;
+        sb_conn_slot* slot = scoreboard_conn( m_sock_fd );
+        if ( slot ) slot->bytes_out = bytes_have_send;
 
         if (bytes_to_send <= 0){
             // 没有数据要发送了
+            TRACE_EVENT( m_trace_id, TR_WRITE, ts_enter, get_mono_us(), m_sock_fd );
+            finish_request();
             unmap();
-            modfd(m_epoll_fd, m_sock_fd, EPOLLIN);
 
             if (m_linger){
                 init();
+                set_deadline(PHASE_IDLE, 0);
+                epoll_arm(EPOLLIN);     // 即将关闭的连接不再修改注册
                 return true;
             }else{
                 return false;
             }
         }
+
+        if ( quantum_sent >= WRITE_QUANTUM ) {
+            // 用完时间片，重新注册 EPOLLOUT 后让出事件循环。套接字仍可写，下一轮 epoll_wait 会立即返回该连接
+            metrics_inc( MC_WRITE_YIELDS );
+            set_deadline( PHASE_SEND, send_acked() );
+            epoll_arm(EPOLLOUT);
+            return true;
+        }
     }
     
     // printf("write done.\n");
     // return true;
 }
 
+// writev 发出 bytes 字节后，更新待发送的字节数和两个发送内存块的信息
+void http_conn::iov_advance(int bytes){
+    bytes_to_send -= bytes;
+    bytes_have_send += bytes;
+    if (bytes_have_send >= m_iv[0].iov_len){    // 发完头部了
+        m_iv[0].iov_len = 0;
+        m_iv[1].iov_base = m_body_address + (bytes_have_send - m_write_idx);    // 已经发了部分的响应体数据
+        m_iv[1].iov_len = bytes_to_send;
+    }else{                                      // 还没发完头部
+        m_iv[0].iov_base = m_write_buf + bytes_have_send;
+        m_iv[0].iov_len = m_iv[0].iov_len - bytes;
+    }
+}
+
+// 重新注册 EPOLLONESHOT 事件。注册仍然有效且事件相同时不调用 epoll_ctl。
+// 先记录再调用 modfd：注册之后主线程可能立即收到事件，调用者不能再访问连接
+void http_conn::epoll_arm(int ev){
+    if(m_sock_fd < 0 || m_ep_events == ev){
+        return;
+    }
+    m_ep_events = ev;
+    modfd(m_epoll_fd, m_sock_fd, ev);
+    metrics_inc(MC_EPOLL_CTL);
+}
+
+// 由工作线程在生成响应后调用：套接字通常可写，直接发送，省去 EPOLLOUT 的注册和主线程为它醒来的一轮
+// epoll_wait。发送完毕时把连接放入完成队列，由主线程立即补做 finish_request、set_deadline 等只能在主线程
+// 做的收尾工作（见 settle），返回 true；EAGAIN、用完时间片或不适用时返回 false，由调用者注册 EPOLLOUT
+bool http_conn::try_write(){
+    if(!TRY_WRITE_OPEN || m_done_fd < 0 || m_proxy || m_cache || bytes_to_send <= 0){
+        return false;
+    }
+    #if USE_TLS
+    if(m_file_fd >= 0){
+        return false;           // sendfile 的路径留给主线程
+    }
+    #endif
+    int quantum_sent = 0;
+    while(bytes_to_send > 0 && quantum_sent < WRITE_QUANTUM){
+        if(m_iv_count == 2 && m_iv[1].iov_len > WRITE_QUANTUM){
+            m_iv[1].iov_len = WRITE_QUANTUM;
+        }
+        int temp;
+        {
+            PERF_SCOPE(PS_WRITEV);
+            temp = sock_writev(m_iv, m_iv_count);
+        }
+        if(temp <= 0){
+            return false;       // EAGAIN 或出错，由主线程的 write 重试并处理
+        }
+        if(bytes_have_send == 0){
+            long origin = m_ts_accept ? m_ts_accept : m_ts_start;
+            if(origin) metrics_observe(MH_FIRST_BYTE, get_mono_us() - origin);
+            m_ts_accept = 0;
+        }
+        iov_advance(temp);
+        quantum_sent += temp;
+    }
+    sb_conn_slot* slot = scoreboard_conn(m_sock_fd);
+    if(slot) slot->bytes_out = bytes_have_send;
+    if(bytes_to_send > 0){
+        return false;           // 剩余部分由主线程在 EPOLLOUT 时发送
+    }
+    m_ts_done = get_mono_us();
+    TRACE_EVENT(m_trace_id, TR_WRITE, m_ts_ready, m_ts_done, m_sock_fd);
+    unmap();
+    m_settle.store(true, std::memory_order_release);
+    metrics_inc(MC_WRITE_DIRECT);
+    // 压入完成队列后主线程随时可能处理该连接，不能再访问成员
+    http_conn* head = m_done_head.load(std::memory_order_relaxed);
+    do{
+        m_done_next = head;
+    }while(!m_done_head.compare_exchange_weak(head, this, std::memory_order_release, std::memory_order_relaxed));
+    if(!head){
+        uint64_t one = 1;
+        ::write(m_done_fd, &one, sizeof(one));  // 队列原来为空时才通知，主线程醒来一次取走全部
+    }
+    return true;
+}
+
+void http_conn::drain_done(){
+    uint64_t n;
+    ::read(m_done_fd, &n, sizeof(n));           // 先清零计数器再取队列，之后压入的连接会再次通知
+    http_conn* c = m_done_head.exchange(NULL, std::memory_order_acquire);
+    http_conn* fifo = NULL;
+    while(c){                                   // 反转为完成的先后顺序
+        http_conn* next = c->m_done_next;
+        c->m_done_next = fifo;
+        fifo = c;
+        c = next;
+    }
+    while(fifo){
+        http_conn* next = fifo->m_done_next;
+        fifo->settle();
+        fifo = next;
+    }
+}
+
+// 由主线程调用，补做工作线程发完响应后推迟的收尾工作。连接在完成队列中时没有注册任何事件，不会被读写或关闭
+void http_conn::settle(){
+    if(!m_settle.exchange(false, std::memory_order_acquire)){
+        return;
+    }
+    finish_request();
+    if(!m_linger){
+        conn_close();
+        if(timer) m_timer_lst.del_timer(timer);
+        return;
+    }
+    init();
+    set_deadline(PHASE_IDLE, 0);
+    epoll_arm(EPOLLIN);
+}
+
+// 由主线程调用，进入或继续某个阶段时重新计算超时时间。bytes 为当前已读取或客户端已确认的字节数，
+// 阶段开始时记录下来，之后按传输的字节数延长期限。读请求时没有新数据超过 IDLE_TIMEOUT 也会超时
+void http_conn::set_deadline(CONN_PHASE phase, int bytes){
+    time_t now = time(NULL);
+    if(phase != m_phase){
+        m_phase = phase;
+        m_phase_start = now;
+        m_phase_bytes = bytes;
+    }
+    if(phase == PHASE_IDLE && !m_idle){
+        idle_link();
+    }else if(phase != PHASE_IDLE && m_idle){
+        idle_unlink();
+    }
+    time_t expire = now + IDLE_TIMEOUT;
+    switch(phase){
+        case PHASE_IDLE:
+            expire = now + keepalive_timeout();
+            break;
+        case PHASE_HEADER:
+            expire = std::min(expire, m_phase_start + HEADER_TIMEOUT);
+            break;
+        case PHASE_BODY:
+            expire = std::min(expire, m_phase_start + BODY_TIMEOUT + (m_rd_idx - m_phase_bytes) / BODY_MIN_RATE);
+            break;
+        case PHASE_SEND:
+            // 发送缓冲区很大时客户端接收数据不一定触发 EPOLLOUT，无法判断是否没有进展，只按速率计算
+            expire = m_phase_start + SEND_TIMEOUT + (bytes - m_phase_bytes) / SEND_MIN_RATE;
+            break;
+        default:
+            break;
+    }
+    if(timer){
+        timer->expire = expire;
+        m_timer_lst.adjust_timer(timer);
+    }
+}
+
+void http_conn::idle_link(){
+    m_idle_prev = NULL;
+    m_idle_next = m_idle_head;
+    if(m_idle_head){
+        m_idle_head->m_idle_prev = this;
+    }else{
+        m_idle_tail = this;
+    }
+    m_idle_head = this;
+    m_idle = true;
+    metrics_gauge_add(MG_IDLE_CONNECTIONS, 1);
+}
+
+void http_conn::idle_unlink(){
+    if(m_idle_prev){
+        m_idle_prev->m_idle_next = m_idle_next;
+    }else{
+        m_idle_head = m_idle_next;
+    }
+    if(m_idle_next){
+        m_idle_next->m_idle_prev = m_idle_prev;
+    }else{
+        m_idle_tail = m_idle_prev;
+    }
+    m_idle = false;
+    metrics_gauge_add(MG_IDLE_CONNECTIONS, -1);
+}
+
+int http_conn::idle_evict(int n){
+    int evicted = 0;
+    while(evicted < n && m_idle_tail){
+        http_conn* conn = m_idle_tail;
+        EMlog(LOGLEVEL_INFO, "sock_fd = %d idle keep-alive evicted.\n", conn->m_sock_fd);
+        conn->conn_close();                 // 同时从空闲链表中移除
+        m_timer_lst.del_timer(conn->timer); // 移除其对应的定时器
+        conn->timer = NULL;
+        ++evicted;
+    }
+    metrics_inc(MC_IDLE_EVICTED, evicted);
+    return evicted;
+}
+
+bool http_conn::priority_request(){
+    #if PRIORITY_OPEN
+    // 只看请求行已经完整的 GET 请求，请求体未读完的后续读取仍按原来的队列。HTTP/2 连接上的数据可能包含多个请求
+    if(m_h2 || m_check_stat != CHECK_STATE_REQUESTLINE || m_rd_idx < 5 || strncmp(m_rd_buf, "GET ", 4) != 0){
+        return false;
+    }
+    const char* url = m_rd_buf + 4;
+    const char* end = (const char*)memchr(url, ' ', m_rd_buf + m_rd_idx - url);
+    if(!end){
+        return false;
+    }
+    uint32_t h = url_hash(url, end - url);
+    const size_hint& hint = g_size_hints[h & (SIZE_HINT_SLOTS - 1)];
+    if(hint.hash != h || hint.size <= 0 || hint.size > PRIORITY_MAX_SIZE){
+        return false;
+    }
+    metrics_inc(MC_PRIORITY_REQUESTS);
+    return true;
+    #else
+    return false;
+    #endif
+}
+
+int http_conn::keepalive_timeout(){
+    long conns = metrics_gauge_get(MG_CONNECTIONS);
+    long low = (long)m_max_conns * KEEPALIVE_SHRINK_PCT / 100;
+    if(conns <= low){
+        return IDLE_TIMEOUT;
+    }
+    if(conns >= m_max_conns){
+        return KEEPALIVE_MIN_TIMEOUT;
+    }
+    return IDLE_TIMEOUT - (IDLE_TIMEOUT - KEEPALIVE_MIN_TIMEOUT) * (conns - low) / (m_max_conns - low);
+}
+
+int http_conn::sock_recv(char* buf, int len){
+    #if USE_TLS
+    if(m_ssl){
+        size_t n = 0;
+        ERR_clear_error();
+        int ret = SSL_read_ex(m_ssl, buf, len, &n);
+        if(ret == 1){
+            return n;
+        }
+        switch(SSL_get_error(m_ssl, ret)){
+            case SSL_ERROR_WANT_READ:
+            case SSL_ERROR_WANT_WRITE:
+                errno = EAGAIN;
+                return -1;
+            case SSL_ERROR_ZERO_RETURN:     // 对方发送了 close_notify
+                return 0;
+            default:
+                errno = ECONNRESET;
+                return -1;
+        }
+    }
+    #endif
+    return recv(m_sock_fd, buf, len, 0);
+}
+
+int http_conn::sock_writev(const struct iovec* iv, int cnt){
+    #if USE_TLS
+    if(m_ssl && !m_ktls_send){
+        // OpenSSL 加密：依次写各块，返回写出的总字节数，调用者按其更新 iovec 后继续。
+        // 头部和正文是两条 TLS 记录，用 TCP_CORK 合并发送，否则第二条被 Nagle 算法压住，
+        // 等客户端延迟确认（约 40ms）后才发出
+        int corked = cnt > 1 && iv[1].iov_len > 0;
+        if(corked){
+            setsockopt(m_sock_fd, IPPROTO_TCP, TCP_CORK, &corked, sizeof(corked));
+        }
+        int total = 0;
+        for(int i = 0; i < cnt; ++i){
+            if(iv[i].iov_len == 0){
+                continue;
+            }
+            size_t n = 0;
+            ERR_clear_error();
+            int ret = SSL_write_ex(m_ssl, iv[i].iov_base, iv[i].iov_len, &n);
+            if(ret == 1){
+                total += n;
+                if(n < iv[i].iov_len){
+                    break;      // 部分写入，发送缓冲区已满
+                }
+                continue;
+            }
+            int err = SSL_get_error(m_ssl, ret);
+            if(total == 0){
+                errno = err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ ? EAGAIN : EPIPE;
+                total = -1;
+            }
+            break;      // 已写出部分数据时先返回，下次从未写完的块重试（OpenSSL 要求用相同的数据重试）
+        }
+        if(corked){
+            corked = 0;
+            setsockopt(m_sock_fd, IPPROTO_TCP, TCP_CORK, &corked, sizeof(corked));
+        }
+        return total;
+    }
+    #endif
+    return writev(m_sock_fd, iv, cnt);
+}
+
+bool http_conn::tls_start(){
+    #if USE_TLS
+    m_ssl = tls_new(m_sock_fd);
+    m_tls_hs = m_ssl != NULL;
+    return m_ssl != NULL;
+    #else
+    return false;
+    #endif
+}
+
+bool http_conn::tls_handshaking() const {
+    #if USE_TLS
+    return m_tls_hs;
+    #else
+    return false;
+    #endif
+}
+
+int http_conn::tls_handshake(){
+    #if USE_TLS
+    set_deadline(PHASE_HEADER, 0);      // 握手和随后的请求头一起受 HEADER_TIMEOUT 限制
+    ERR_clear_error();
+    int ret = SSL_accept(m_ssl);
+    if(ret == 1){
+        m_tls_hs = false;
+        #if TLS_KTLS_OPEN
+        m_ktls_send = BIO_get_ktls_send(SSL_get_wbio(m_ssl));
+        #endif
+        metrics_inc(MC_TLS_HANDSHAKES);
+        if(m_ktls_send){
+            metrics_inc(MC_KTLS_CONNS);
+        }
+        #if H2_OPEN
+        const unsigned char* proto = NULL;
+        unsigned int proto_len = 0;
+        SSL_get0_alpn_selected(m_ssl, &proto, &proto_len);
+        if(proto_len == 2 && memcmp(proto, "h2", 2) == 0){
+            m_h2 = new h2_session();    // ALPN 协商了 h2，之后的数据都是 HTTP/2 帧
+            m_h2->start();
+            metrics_inc(MC_H2_CONNS);
+        }
+        #endif
+        EMlog(LOGLEVEL_INFO, "sock_fd = %d TLS handshake done: %s %s, %s.\n", m_sock_fd, SSL_get_version(m_ssl),
+              SSL_get_cipher_name(m_ssl), m_ktls_send ? "kernel TLS" : "OpenSSL");
+        if(SSL_has_pending(m_ssl)){
+            return 1;                   // 客户端随握手一起发来的请求已被 OpenSSL 读入
+        }
+        epoll_arm(EPOLLIN);
+        return 0;
+    }
+    switch(SSL_get_error(m_ssl, ret)){
+        case SSL_ERROR_WANT_READ:
+            epoll_arm(EPOLLIN);
+            return 0;
+        case SSL_ERROR_WANT_WRITE:
+            epoll_arm(EPOLLOUT);
+            return 0;
+        default: {
+            const char* reason = ERR_reason_error_string(ERR_peek_last_error());
+            metrics_inc(MC_TLS_HANDSHAKE_ERRORS);
+            EMlog(LOGLEVEL_INFO, "sock_fd = %d TLS handshake failed: %s.\n", m_sock_fd, reason ? reason : "connection closed");
+            return -1;
+        }
+    }
+    #else
+    return -1;
+    #endif
+}
+
+// 已写入内核但客户端尚未确认的字节不算发送进展，否则一开始填满发送缓冲区的几 MB 就能换来很长的期限
+int http_conn::send_acked(){
+    int unacked = 0;
+    ioctl(m_sock_fd, SIOCOUTQ, &unacked);
+    return bytes_have_send - unacked;
+}
+
+// 定时器到期时由 tick() 调用，按所处阶段计数后关闭连接。发送阶段先按客户端实际确认的字节数
+// 重新计算期限，尚未到期时返回 false，定时器留在链表中
+bool http_conn::del_fd(){
+    static const char* phase_str[] = {"idle", "header", "body", "send"};
+    if(m_settle.load(std::memory_order_acquire)){
+        timer->expire = time(NULL) + 1;     // 响应已发完，连接在完成队列中，等待主线程处理
+        m_timer_lst.adjust_timer(timer);
+        return false;
+    }
+    if(m_phase == PHASE_SEND && m_sock_fd != -1){
+        set_deadline(PHASE_SEND, send_acked());
+        if(timer->expire > time(NULL)){
+            return false;
+        }
+    }
+    metrics_inc((METRIC_COUNTER)(MC_TIMEOUT_IDLE + (int)m_phase));
+    EMlog(LOGLEVEL_INFO, "sock_fd = %d %s timeout.\n", m_sock_fd, phase_str[m_phase]);
+    if(m_phase != PHASE_IDLE && m_sock_fd != -1){
+        // 慢速客户端直接发送 RST，释放内核缓冲区中尚未发出的数据，而不是继续慢慢发给它
+        struct linger lg = {1, 0};
+        setsockopt(m_sock_fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    }
+    conn_close();
+    return true;
+}
+
+// 由主线程在响应发送完毕时调用，更新统计指标，把本次请求追加到二进制访问日志
+void http_conn::finish_request(){
+    if(m_url){
+        uint32_t h = url_hash(m_url, strlen(m_url));
+        size_hint& hint = g_size_hints[h & (SIZE_HINT_SLOTS - 1)];
+        hint.hash = h;
+        hint.size = bytes_have_send;
+    }
+    if(m_status >= 500) metrics_inc(MC_RESP_5XX);
+    else if(m_status >= 400) metrics_inc(MC_RESP_4XX);
+    else if(m_status >= 200) metrics_inc(MC_RESP_2XX);
+    metrics_inc(MC_BYTES_SENT, bytes_have_send);
+    if(m_ts_start){
+        long now = m_ts_done ? m_ts_done : get_mono_us();
+        metrics_observe(MH_TOTAL, now - m_ts_start);
+        TRACE_EVENT(m_trace_id, TR_REQUEST, m_ts_start, now, m_sock_fd);
+    }
+    sb_conn_slot* slot = scoreboard_conn(m_sock_fd);
+    if(slot) ++slot->requests;
+    scoreboard_conn_set(m_sock_fd, SB_CONN_IDLE);
+
+    #if ACCESS_LOG_OPEN
+    access_req_rec rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.status = m_status;
+    rec.method = m_method;
+    rec.flags = m_linger ? ACCESS_FLAG_KEEPALIVE : 0;
+    rec.client_ip = m_addr.sin_addr.s_addr;
+    rec.client_port = m_addr.sin_port;
+    rec.bytes_sent = bytes_have_send;
+    if(m_ts_start){
+        long now = m_ts_done ? m_ts_done : get_mono_us();
+        rec.read_us = m_ts_read - m_ts_start;
+        rec.queue_us = m_ts_dequeue ? m_ts_dequeue - m_ts_read : 0;
+        rec.process_us = m_ts_ready ? m_ts_ready - m_ts_dequeue : 0;
+        rec.write_us = m_ts_ready ? now - m_ts_ready : 0;
+    }
+    access_log_append(rec, m_url ? m_url : "-", m_ts_done);
+    #endif
+}
+
 // 往写缓冲中写入待发送的数据
 bool http_conn::add_response( const char* format, ... ) {
     if( m_write_idx >= WD_BUF_SIZE ) {      // 写缓冲区满了
@@ -447,6 +1124,7 @@ bool http_conn::add_response( const char* format, ... ) {
 
 // 添加状态码（响应行）
 bool http_conn::add_status_line( int status, const char* title ) {
+    m_status = status;
     EMlog(LOGLEVEL_DEBUG,"<<<<<<< %s %d %s\r\n", "HTTP/1.1", status, title);     
     return add_response( "%s %d %s\r\n", "HTTP/1.1", status, title );
 }
@@ -464,8 +1142,8 @@ bool http_conn::add_content_length(int content_len) {
     return add_response( "Content-Length: %d\r\n", content_len );
 }
 bool http_conn::add_content_type() {    // 响应体类型，当前文本形式
-    EMlog(LOGLEVEL_DEBUG,"<<<<<<< Content-Type:%s\r\n", "text/html");  
-    return add_response("Content-Type:%s\r\n", "text/html");    
+    EMlog(LOGLEVEL_DEBUG,"<<<<<<< Content-Type:%s\r\n", m_content_type);  
+    return add_response("Content-Type:%s\r\n", m_content_type);    
 }
 bool http_conn::add_linger(){
     EMlog(LOGLEVEL_DEBUG,"<<<<<<< Connection: %s\r\n", ( m_linger == true ) ? "keep-alive" : "close" );
@@ -484,6 +1162,7 @@ bool http_conn::add_content( const char* content ){
 
 // 根据服务器处理HTTP请求的结果，决定返回给客户端的内容
 bool http_conn::process_write(HTTP_CODE ret){
+    PERF_SCOPE(PS_PROCESS_WRITE);
     switch (ret)
     {
         case INTERNAL_ERROR:
@@ -514,18 +1193,56 @@ bool http_conn::process_write(HTTP_CODE ret){
                 return false;
             }
             break;
+        case BAD_GATEWAY:
+            add_status_line( 502, error_502_title );
+            add_headers( strlen( error_502_form ) );
+            if ( ! add_content( error_502_form ) ) {
+                return false;
+            }
+            break;
+        case GATEWAY_TIMEOUT:
+            add_status_line( 504, error_504_title );
+            add_headers( strlen( error_504_form ) );
+            if ( ! add_content( error_504_form ) ) {
+                return false;
+            }
+            break;
         case FILE_REQUEST:  // 请求文件
             add_status_line(200, ok_200_title );
             add_headers(m_file_stat.st_size);
-            EMlog(LOGLEVEL_DEBUG, "<<<<<<< %s", m_file_address);
+            EMlog(LOGLEVEL_DEBUG, "<<<<<<< %.*s", (int)m_file_stat.st_size, m_file_address);  // 映射区不以 \0 结尾
             // 封装m_iv
             m_iv[ 0 ].iov_base = m_write_buf;   // 起始地址
             m_iv[ 0 ].iov_len = m_write_idx;    // 长度
+            m_body_address = m_file_address;
             m_iv[ 1 ].iov_base = m_file_address;
             m_iv[ 1 ].iov_len = m_file_stat.st_size;
             m_iv_count = 2;                     // 两块内存
             bytes_to_send = m_write_idx + m_file_stat.st_size;  // 响应头的大小 + 文件的大小
             return true;
+        case DYNAMIC_REQUEST:   // 动态生成的响应体
+            add_status_line(m_route_status, router_status_title(m_route_status));
+            if(!m_route_headers.empty()){
+                add_response("%s", m_route_headers.c_str());
+            }
+            add_headers(m_body.size());
+            m_body_address = (char*)m_body.data();
+            m_iv[ 0 ].iov_base = m_write_buf;
+            m_iv[ 0 ].iov_len = m_write_idx;
+            m_iv[ 1 ].iov_base = m_body_address;
+            m_iv[ 1 ].iov_len = m_body.size();
+            m_iv_count = 2;
+            bytes_to_send = m_write_idx + m_body.size();
+            return true;
+        case PROXY_REQUEST:     // 响应头由上游的响应生成，和已读到的响应体一起在 m_body 中，其余部分（或缓存的响应体）由 proxy_write 发送
+            m_body_address = (char*)m_body.data();
+            m_iv[ 0 ].iov_base = m_write_buf;
+            m_iv[ 0 ].iov_len = 0;
+            m_iv[ 1 ].iov_base = m_body_address;
+            m_iv[ 1 ].iov_len = m_body.size();
+            m_iv_count = 2;
+            bytes_to_send = m_body.size() + ( m_proxy ? m_proxy->left : 0 ) + ( m_cache ? m_cache->body.size() : 0 );
+            return true;
         default:
             return false;
     }
@@ -533,29 +1250,699 @@ bool http_conn::process_write(HTTP_CODE ret){
     m_iv[ 0 ].iov_base = m_write_buf;
     m_iv[ 0 ].iov_len = m_write_idx;
     m_iv_count = 1;
+    bytes_to_send = m_write_idx;        // 错误响应只有写缓冲区中的内容
     return true;
 }
 
+// 过载时由工作线程（排队时间超过目标、超过速率限制）或主线程（队列已满）调用，复制预先生成的
+// 503/429 响应，不解析请求。发送完毕后因为 m_linger 为 false 而关闭连接
+void http_conn::shed(int reason){
+    static const char* reason_str[] = {"queue delay over target", "queue full", "rate limited"};
+    m_ts_dequeue = get_mono_us();
+    if(m_h2){
+        h2_process(reason);     // 仍然处理控制帧，新的流用 REFUSED_STREAM 拒绝，在流上计数
+        return;
+    }
+    metrics_inc((METRIC_COUNTER)(MC_SHED_QUEUE_DELAY + reason));
+    m_linger = false;
+    if(reason == SHED_RATE_LIMIT){
+        m_status = 429;
+        memcpy(m_write_buf, admission_429, admission_429_len);
+        m_write_idx = admission_429_len;
+    }else{
+        m_status = 503;
+        memcpy(m_write_buf, admission_503, admission_503_len);
+        m_write_idx = admission_503_len;
+    }
+    m_iv[ 0 ].iov_base = m_write_buf;
+    m_iv[ 0 ].iov_len = m_write_idx;
+    m_iv_count = 1;
+    bytes_to_send = m_write_idx;
+    m_ts_ready = get_mono_us();
+    scoreboard_conn_set(m_sock_fd, SB_CONN_WRITING);
+    EMlog(LOGLEVEL_INFO, "sock_fd = %d shed: %s.\n", m_sock_fd, reason_str[reason]);
+    epoll_arm(EPOLLOUT);
+}
+
 
 // 由线程池中的工作线程调用，处理HTTP请求的入口函数
 void http_conn::process(){      // 线程池中线程的业务处理
+    m_ts_dequeue = get_mono_us();
+    metrics_observe(MH_QUEUE_WAIT, m_ts_dequeue - m_ts_read);
+    scoreboard_worker_set(SB_WORKER_BUSY, m_sock_fd);
+    scoreboard_conn_set(m_sock_fd, SB_CONN_PROCESSING);
     EMlog(LOGLEVEL_DEBUG, "=======parse request, create response.=======\n");
+    #if H2_OPEN
+    if(m_h2 || h2_detect()){
+        h2_process(-1);
+        return;
+    }
+    #endif
     
     // 解析HTTP请求
     EMlog(LOGLEVEL_DEBUG,"=============process_reading=============\n");
+    TRACE_EVENT(m_trace_id, TR_QUEUE, m_ts_read, m_ts_dequeue, m_sock_fd);
+    long parse_start = get_mono_us();
     HTTP_CODE read_ret = process_read();
+    long parse_end = get_mono_us();
+    metrics_observe(MH_PARSE, parse_end - parse_start);
+    TRACE_EVENT(m_trace_id, TR_PARSE, parse_start, parse_end, m_sock_fd);
+    WS_PROBE2(process_read, m_sock_fd, read_ret);
     EMlog(LOGLEVEL_INFO,"========PROCESS_READ HTTP_CODE : %d========\n", read_ret);
     if(read_ret == NO_REQUEST){
-        modfd(m_epoll_fd, m_sock_fd, EPOLLIN);  // 继续监听EPOLLIN (| EPOLLONESHOT)
+        scoreboard_conn_set(m_sock_fd, SB_CONN_READING);
+        epoll_arm(EPOLLIN);  // 继续监听EPOLLIN (| EPOLLONESHOT)
         return;         // 返回，线程空闲
     }
+    // 请求已完整读取，每个请求消耗一个令牌（请求分成多个 TCP 段到达时只在最后这一次检查）
+    if(!ratelimit_request(client_ip())){
+        shed(SHED_RATE_LIMIT);
+        return;
+    }
+    #if H2_OPEN
+    if(m_h2c_upgrade && m_h2_settings && h2_upgrade(read_ret)){
+        return;
+    }
+    #endif
     
     // 生成响应
     bool write_ret = process_write(read_ret);
+    m_ts_ready = get_mono_us();
+    TRACE_EVENT(m_trace_id, TR_PROCESS_WRITE, parse_end, m_ts_ready, m_sock_fd);
+    scoreboard_conn_set(m_sock_fd, SB_CONN_WRITING);
     if(!write_ret){
         conn_close();
         if(timer) m_timer_lst.del_timer(timer);  // 移除其对应的定时器
     }
+    proxy_refresh* job = m_cache_job;   // 交出连接后不再访问成员
+    m_cache_job = NULL;
  
-    modfd(m_epoll_fd, m_sock_fd, EPOLLOUT);     // 重置EPOLLONESHOT
-}
\ No newline at end of file
+    if(!write_ret || !try_write()){
+        epoll_arm(EPOLLOUT);    // 重置EPOLLONESHOT，由主线程发送（剩余的）响应
+    }
+    if(job){
+        proxy_refresh_run(job);         // 客户端已经拿到旧的响应，刷新不占用它的时间
+    }
+}
+
+// 由工作线程调用：新连接的第一个请求以连接前言开头时切换到 HTTP/2，缓冲区中的数据交给会话
+bool http_conn::h2_detect(){
+    if(m_check_stat != CHECK_STATE_REQUESTLINE || m_line_start != 0 || m_rd_idx < 4
+       || memcmp(m_rd_buf, H2_PREFACE, std::min(m_rd_idx, H2_PREFACE_LEN)) != 0){
+        return false;
+    }
+    m_h2 = new h2_session();
+    m_h2->start();
+    m_h2->append_input(m_rd_buf, m_rd_idx);
+    metrics_inc(MC_H2_CONNS);
+    EMlog(LOGLEVEL_INFO, "sock_fd = %d HTTP/2 with prior knowledge.\n", m_sock_fd);
+    return true;
+}
+
+// 由工作线程调用：升级请求本身成为流 1，其响应通过 HTTP/2 发送。HTTPS 连接只能通过 ALPN 进入 HTTP/2
+bool http_conn::h2_upgrade(HTTP_CODE ret){
+    #if USE_TLS
+    if(m_ssl){
+        return false;
+    }
+    #endif
+    if(m_content_len != 0){
+        return false;           // 带请求体的请求不升级，按 HTTP/1.1 响应
+    }
+    m_h2 = new h2_session();
+    h2_stream* s = m_h2->upgrade(m_h2_settings);
+    if(!s){
+        delete m_h2;
+        m_h2 = NULL;
+        return false;
+    }
+    metrics_inc(MC_H2_CONNS);
+    metrics_inc(MC_H2_STREAMS);
+    EMlog(LOGLEVEL_INFO, "sock_fd = %d upgraded to h2c.\n", m_sock_fd);
+    s->path = m_url;
+    s->ts_read = m_ts_read;
+    s->ts_dequeue = m_ts_dequeue;
+    h2_response(s, ret);
+    // 升级请求之后已经读到的数据（客户端通常收到 101 后才发送连接前言）
+    m_h2->append_input(m_rd_buf + m_checked_idx, m_rd_idx - m_checked_idx);
+    m_url = 0;
+    h2_process(-1);
+    return true;
+}
+
+void http_conn::h2_process(int shed_reason){
+    std::vector<h2_stream*> requests;
+    long parse_start = get_mono_us();
+    if(!m_h2->process(requests)){
+        EMlog(LOGLEVEL_INFO, "sock_fd = %d HTTP/2 connection error, GOAWAY.\n", m_sock_fd);
+    }
+    metrics_observe(MH_PARSE, get_mono_us() - parse_start);
+    for(h2_stream* s : requests){
+        if(s->reset){
+            continue;           // 同一批数据中已被取消
+        }
+        metrics_inc(MC_REQUESTS);
+        metrics_inc(MC_H2_STREAMS);
+        s->ts_read = m_ts_read;
+        s->ts_dequeue = m_ts_dequeue;
+        if(shed_reason >= 0){
+            metrics_inc((METRIC_COUNTER)(MC_SHED_QUEUE_DELAY + shed_reason));
+            m_h2->reset_stream(s, H2_REFUSED_STREAM);   // 请求未被处理，客户端可以重试
+            continue;
+        }
+        if(!ratelimit_request(client_ip())){
+            // 按流限制速率；429 的响应体取自预先生成的 HTTP/1.1 响应
+            metrics_inc(MC_SHED_RATE_LIMIT);
+            const char* body = strstr(admission_429, "\r\n\r\n") + 4;
+            m_h2->respond(s, 429, "text/html", body, admission_429 + admission_429_len - body);
+            continue;
+        }
+        h2_respond(s);
+    }
+    m_ts_ready = get_mono_us();
+    scoreboard_conn_set(m_sock_fd, SB_CONN_WRITING);
+    proxy_refresh* job = m_cache_job;
+    m_cache_job = NULL;
+    epoll_arm(EPOLLOUT);     // 发送响应和控制帧；没有要发送的数据时 write 重新注册 EPOLLIN
+    if(job){
+        proxy_refresh_run(job);
+    }
+}
+
+void http_conn::h2_respond(h2_stream* s){
+    HTTP_CODE ret = BAD_REQUEST;
+    if(!s->bad && s->method == "GET" && s->path[0] == '/'){
+        m_url = (char*)s->path.c_str();     // do_request 只读取 m_url（转发给上游时还有 m_host）
+        m_host = s->authority.empty() ? 0 : (char*)s->authority.c_str();
+        scoreboard_set_url(m_sock_fd, m_url);
+        ret = do_request();
+        m_url = 0;
+        m_host = 0;
+    }
+    h2_response(s, ret);
+}
+
+void http_conn::h2_response(h2_stream* s, HTTP_CODE ret){
+    switch(ret){
+        case FILE_REQUEST:
+            s->map_addr = m_file_address;   // 映射区归流所有，流释放时 munmap
+            s->map_len = m_file_stat.st_size;
+            m_file_address = 0;
+            unmap();                        // 内核 TLS 连接保留的文件描述符不用于 HTTP/2
+            m_h2->respond(s, 200, m_content_type, s->map_addr, s->map_len);
+            break;
+        case DYNAMIC_REQUEST:
+            s->body.swap(m_body);       // 处理函数添加的响应头部不转发
+            m_h2->respond(s, m_route_status, m_content_type, s->body.data(), s->body.size());
+            break;
+        case PROXY_REQUEST:     // 代理的响应体已完整读入 m_body，只转发状态码和 Content-Type
+            s->body.swap(m_body);
+            m_h2->respond(s, m_status, m_proxy_ctype.c_str(), s->body.data(), s->body.size());
+            break;
+        case BAD_GATEWAY:
+            m_h2->respond(s, 502, "text/html", error_502_form, strlen(error_502_form));
+            break;
+        case GATEWAY_TIMEOUT:
+            m_h2->respond(s, 504, "text/html", error_504_form, strlen(error_504_form));
+            break;
+        case NO_RESOURCE:
+            m_h2->respond(s, 404, "text/html", error_404_form, strlen(error_404_form));
+            break;
+        case FORBIDDEN_REQUEST:
+            m_h2->respond(s, 403, "text/html", error_403_form, strlen(error_403_form));
+            break;
+        case INTERNAL_ERROR:
+            m_h2->respond(s, 500, "text/html", error_500_form, strlen(error_500_form));
+            break;
+        default:
+            m_h2->respond(s, 400, "text/html", error_400_form, strlen(error_400_form));
+            break;
+    }
+    m_body.clear();
+    m_content_type = "text/html";
+    m_route_status = 200;
+    m_route_headers.clear();
+    s->ts_ready = get_mono_us();
+}
+
+// 读取所有数据追加到会话的输入缓冲区，不解析
+bool http_conn::h2_read(){
+    while(true){
+        int bytes_rd = sock_recv(m_rd_buf, RD_BUF_SIZE);
+        if(bytes_rd == -1){
+            if(errno == EAGAIN || errno == EWOULDBLOCK){
+                break;
+            }
+            return false;
+        }else if(bytes_rd == 0){
+            return false;
+        }
+        #if CAPTURE_OPEN
+        capture_data(m_sock_fd, m_rd_buf, bytes_rd);
+        #endif
+        if(!m_h2->append_input(m_rd_buf, bytes_rd)){
+            break;              // 缓冲区已满，处理完后重新注册时 epoll 会再次报告可读
+        }
+    }
+    if(m_phase == PHASE_IDLE){
+        set_deadline(PHASE_HEADER, 0);
+    }
+    m_ts_read = get_mono_us();
+    scoreboard_conn_set(m_sock_fd, SB_CONN_QUEUED);
+    return true;
+}
+
+// 逐批发送：每批包含控制帧、新的响应头和按优先级选出的 DATA 帧。发送缓冲区满时同时监听
+// EPOLLIN，客户端的 WINDOW_UPDATE 和新请求不必等到当前批次发完
+bool http_conn::h2_write(){
+    bool copy = false;
+    #if USE_TLS
+    copy = m_ssl && !m_ktls_send;   // OpenSSL 加密时拼接成一块，避免每个 9 字节的帧头单独成为一条 TLS 记录
+    #endif
+    long quantum_sent = 0;
+    while(true){
+        if(!m_h2->pending()){
+            h2_reap();
+            if(quantum_sent >= WRITE_QUANTUM){
+                metrics_inc(MC_WRITE_YIELDS);
+                set_deadline(PHASE_SEND, send_acked());
+                epoll_arm(EPOLLOUT | EPOLLIN);
+                return true;
+            }
+            if(!m_h2->fill(WRITE_QUANTUM - quantum_sent, copy)){
+                if(m_h2->closing()){
+                    return false;   // GOAWAY 已发出
+                }
+                if(m_h2->active()){
+                    set_deadline(PHASE_SEND, send_acked());     // 等待客户端打开流量控制窗口
+                }else{
+                    bytes_have_send = 0;
+                    set_deadline(PHASE_IDLE, 0);
+                    scoreboard_conn_set(m_sock_fd, SB_CONN_IDLE);
+                }
+                epoll_arm(EPOLLIN);
+                return true;
+            }
+        }
+        int cnt;
+        const iovec* iv = m_h2->batch(&cnt);
+        int temp;
+        {
+            PERF_SCOPE(PS_WRITEV);
+            temp = sock_writev(iv, cnt);
+        }
+        if(temp < 0){
+            if(errno == EAGAIN){
+                set_deadline(PHASE_SEND, send_acked());
+                epoll_arm(EPOLLOUT | EPOLLIN);
+                return true;
+            }
+            return false;
+        }
+        m_h2->advance(temp);
+        bytes_have_send += temp;
+        quantum_sent += temp;
+        metrics_inc(MC_BYTES_SENT, temp);
+    }
+}
+
+void http_conn::h2_reap(){
+    while(h2_stream* s = m_h2->reap()){
+        if(s->status && !s->reset){
+            if(s->status >= 500) metrics_inc(MC_RESP_5XX);
+            else if(s->status >= 400) metrics_inc(MC_RESP_4XX);
+            else metrics_inc(MC_RESP_2XX);
+            long now = get_mono_us();
+            if(s->ts_read) metrics_observe(MH_TOTAL, now - s->ts_read);
+            sb_conn_slot* slot = scoreboard_conn(m_sock_fd);
+            if(slot) ++slot->requests;
+
+            #if ACCESS_LOG_OPEN
+            access_req_rec rec;
+            memset(&rec, 0, sizeof(rec));
+            rec.status = s->status;
+            rec.method = GET;
+            rec.flags = ACCESS_FLAG_KEEPALIVE | ACCESS_FLAG_H2;
+            rec.client_ip = m_addr.sin_addr.s_addr;
+            rec.client_port = m_addr.sin_port;
+            rec.bytes_sent = s->header_block.size() + s->len;
+            if(s->ts_read){
+                rec.queue_us = s->ts_dequeue - s->ts_read;
+                rec.process_us = s->ts_ready - s->ts_dequeue;
+                rec.write_us = now - s->ts_ready;
+            }
+            access_log_append(rec, s->path.c_str());
+            #endif
+        }
+        h2_session::release(s);
+    }
+}
+
+// 由工作线程调用：把请求转发给路由选出的上游并读取响应头。HTTP/2 的流和较短的响应体在这里读完，
+// 连接随即归还；较长的响应体留给主线程的 proxy_write 转发，上游连接保存在 m_proxy 中
+http_conn::HTTP_CODE http_conn::proxy_request(const proxy_route* route){
+    metrics_inc(MC_PROXY_REQUESTS);
+    std::string headers;
+    proxy_build_request(headers);
+    mcache_entry* e = NULL;             // 要存入缓存的响应
+    #if MCACHE_OPEN
+    // 键为方法、Host、URL 加上 Vary 中的请求头部。HTTP/2 的请求头部不转发，按没有这些头部计算
+    std::string base, key;
+    std::vector<std::string> vary;
+    auto make_key = [&](const std::vector<std::string>& names, std::string& out){
+        out = base;
+        for(const std::string& name : names){
+            const char* v = request_header(name.c_str());
+            out.append("\n").append(name).append(": ").append(v ? v : "");
+        }
+    };
+    bool fill = false;                  // 由本请求获取并填充缓存
+    if(m_content_len == 0 && !request_header("Authorization")){    // 带凭据的请求的响应因用户而异，不使用缓存
+        base.assign("GET ").append(m_host ? m_host : "").append(" ").append(m_url);
+        mcache_vary(base, vary);
+        make_key(vary, key);
+        mcache_ref ref;
+        switch(mcache_lookup(key, ref, m_cache_job == NULL)){
+            case MCACHE_HIT:
+                return cache_response(ref, "HIT");
+            case MCACHE_STALE:
+                return cache_response(ref, "STALE");
+            case MCACHE_REFRESH:
+                m_cache_job = new proxy_refresh{route, m_url, m_host ? m_host : "", headers, key, base, vary};
+                return cache_response(ref, "STALE");
+            case MCACHE_MISS:
+                fill = true;
+                break;
+            default:
+                break;
+        }
+    }
+    #endif
+
+    proxy_response resp;
+    std::string buf;
+    proxy_conn* c = proxy_start(route, m_url, m_host, headers, resp, buf);
+    if(!c){
+        int err = errno;
+        #if MCACHE_OPEN
+        if(fill) mcache_abort(key, false);
+        #endif
+        metrics_inc(MC_PROXY_ERRORS);
+        return err == ETIMEDOUT ? GATEWAY_TIMEOUT : BAD_GATEWAY;
+    }
+    m_status = resp.status;
+    #if MCACHE_OPEN
+    if(fill && !(e = proxy_cache_entry(resp))){
+        mcache_abort(key, true);        // 不可缓存，等待的请求各自转发
+    }
+    #endif
+
+    std::string body;
+    // 分块编码解码后才知道长度，HTTP/2 的流和要缓存的响应需要完整的响应体，这些情况和短响应体一样在这里读完
+    bool stream = !m_h2 && !e && !resp.chunked && resp.content_len > PROXY_BUFFER_SIZE;
+    if(stream){
+        if((long)buf.size() > resp.content_len){
+            buf.resize(resp.content_len);   // 上游多发了数据，连接不再复用
+            resp.keep_alive = false;
+        }
+        body.swap(buf);                     // 已读到的部分随响应头发送
+        c->left = resp.content_len - body.size();
+        m_proxy = c;
+        m_proxy_keep = resp.keep_alive;
+    }else{
+        if(!proxy_read_body(c, resp, buf, body, PROXY_MAX_BUFFER)){
+            int err = errno;
+            EMlog(LOGLEVEL_INFO, "sock_fd = %d proxy response from %s failed: %s.\n", m_sock_fd, proxy_upstream_name(c), strerror(err));
+            proxy_release(c, PROXY_FAILED);
+            #if MCACHE_OPEN
+            if(e){
+                delete e;
+                mcache_abort(key, false);
+            }
+            #endif
+            metrics_inc(MC_PROXY_ERRORS);
+            return err == ETIMEDOUT ? GATEWAY_TIMEOUT : BAD_GATEWAY;
+        }
+        proxy_release(c, resp.keep_alive ? PROXY_REUSE : PROXY_CLOSE);
+    }
+
+    #if MCACHE_OPEN
+    if(e){
+        if((long)body.size() > MCACHE_MAX_ENTRY){
+            delete e;                       // 分块编码的响应体超过了缓存的上限
+            mcache_abort(key, true);
+        }else{
+            make_key(e->vary, e->key);      // 按响应的 Vary 计算存入的键
+            e->body.swap(body);
+            return cache_response(mcache_store(key, base, e), "MISS");
+        }
+    }
+    #endif
+    if(m_h2){
+        m_body.swap(body);
+        m_proxy_ctype = resp.content_type.empty() ? "application/octet-stream" : resp.content_type;
+        return PROXY_REQUEST;
+    }
+    proxy_head(resp.status, resp.reason, resp.headers, stream ? resp.content_len : (long)body.size());
+    m_body.append(body);
+    return PROXY_REQUEST;
+}
+
+// 由上游（或缓存）的响应头生成 HTTP/1.1 响应头，放入 m_body
+void http_conn::proxy_head(int status, const std::string& reason, const std::string& headers, long content_len){
+    char line[64];
+    snprintf(line, sizeof(line), "HTTP/1.1 %d ", status);
+    m_body.assign(line).append(reason).append("\r\n").append(headers);
+    if(status != 204 && status != 304){
+        snprintf(line, sizeof(line), "Content-Length: %ld\r\n", content_len);
+        m_body.append(line);
+    }
+    m_body.append(m_linger ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+}
+
+http_conn::HTTP_CODE http_conn::cache_response(const mcache_ref& e, const char* state){
+    m_status = e->status;
+    if(m_h2){
+        m_body.assign(e->body);             // 流的响应体归流所有，复制一份
+        m_proxy_ctype = e->content_type.empty() ? "application/octet-stream" : e->content_type;
+        return PROXY_REQUEST;
+    }
+    char line[64];
+    snprintf(line, sizeof(line), "Age: %ld\r\nX-Cache: %s\r\n", (mcache_now_ms() - e->stored) / 1000, state);
+    proxy_head(e->status, e->reason, e->headers + line, e->body.size());
+    m_cache = e;                            // 响应体由 proxy_write 直接从条目发送
+    return PROXY_REQUEST;
+}
+
+// 请求头部行解析后以 "\0\0" 结尾（见 parse_one_line），以空行结束
+const char* http_conn::request_header(const char* name){
+    if(m_h2){
+        return NULL;
+    }
+    size_t len = strlen(name);
+    for(int i = m_hdr_start; i < m_checked_idx; ){
+        const char* line = m_rd_buf + i;
+        int n = strlen(line);
+        if(n == 0){
+            break;
+        }
+        i += n + 2;
+        if(strncasecmp(line, name, len) == 0 && line[len] == ':'){
+            return line + len + 1 + strspn(line + len + 1, " \t");
+        }
+    }
+    return NULL;
+}
+
+const char* http_conn::route_header(const void* conn, const char* name){
+    return ((http_conn*)conn)->request_header(name);
+}
+
+void http_conn::proxy_build_request(std::string& req){
+    const char* xff = NULL;
+    if(!m_h2){
+        for(int i = m_hdr_start; i < m_checked_idx; ){
+            const char* line = m_rd_buf + i;
+            int len = strlen(line);
+            if(len == 0){
+                break;
+            }
+            i += len + 2;
+            if(strncasecmp(line, "X-Forwarded-For:", 16) == 0){
+                xff = line + 16 + strspn(line + 16, " \t");   // 追加到客户端带来的列表之后
+                continue;
+            }
+            if(strncasecmp(line, "X-Forwarded-Proto:", 18) == 0 || proxy_hop_header(line)){
+                continue;
+            }
+            req.append(line, len).append("\r\n");
+        }
+    }
+    char ip[16] = "";
+    inet_ntop(AF_INET, &m_addr.sin_addr, ip, sizeof(ip));
+    req.append("X-Forwarded-For: ");
+    if(xff && *xff){
+        req.append(xff).append(", ");
+    }
+    bool https = false;
+    #if USE_TLS
+    https = m_ssl != NULL;
+    #endif
+    req.append(ip).append(https ? "\r\nX-Forwarded-Proto: https" : "\r\nX-Forwarded-Proto: http");
+    req.append("\r\nConnection: keep-alive\r\n");
+    long body_len = m_h2 ? 0 : m_content_len;
+    if(body_len > 0){
+        char line[48];
+        snprintf(line, sizeof(line), "Content-Length: %ld\r\n\r\n", body_len);
+        req.append(line).append(m_rd_buf + m_checked_idx, body_len);
+    }else{
+        req.append("\r\n");
+    }
+}
+
+// 由主线程调用：先发送 m_body 中的响应头和已读到的响应体（或缓存条目的响应体），再从上游转发其余部分。
+// 客户端发送缓冲区满时等待 EPOLLOUT；上游暂无数据时等待上游套接字可读，事件同样交给 write
+bool http_conn::proxy_write(){
+    m_proxy_wait = false;
+    int quantum_sent = 0;
+    int head_len = m_body.size();
+    int mem_len = head_len + (m_cache ? m_cache->body.size() : 0);
+    while(bytes_to_send > 0){
+        bool upstream_wait = false;
+        int temp;
+        if(bytes_have_send < mem_len){
+            struct iovec iv[2];
+            int cnt = 0;
+            if(bytes_have_send < head_len){
+                iv[cnt].iov_base = (char*)m_body.data() + bytes_have_send;
+                iv[cnt++].iov_len = head_len - bytes_have_send;
+            }
+            if(m_cache){
+                int off = std::max(bytes_have_send - head_len, 0);
+                iv[cnt].iov_base = (char*)m_cache->body.data() + off;
+                iv[cnt++].iov_len = std::min(mem_len - head_len - off, WRITE_QUANTUM);
+            }
+            temp = sock_writev(iv, cnt);
+        }else{
+            temp = proxy_pump(&upstream_wait);
+        }
+        if(temp < 0){
+            if(errno != EAGAIN){
+                return false;           // 由 conn_close 关闭上游连接
+            }
+            set_deadline(PHASE_SEND, send_acked());
+            if(upstream_wait){
+                // 上游套接字以客户端的 fd 注册，客户端套接字的 EPOLLONESHOT 已经触发，不会同时报告
+                epoll_event event;
+                event.data.fd = m_sock_fd;
+                event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+                epoll_ctl(m_epoll_fd, m_proxy->in_epoll ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, m_proxy->fd, &event);
+                metrics_inc(MC_EPOLL_CTL);
+                m_proxy->in_epoll = true;
+                m_proxy_wait = true;
+            }else{
+                epoll_arm(EPOLLOUT);
+            }
+            return true;
+        }
+        if(bytes_have_send == 0 && temp > 0){
+            long origin = m_ts_accept ? m_ts_accept : m_ts_start;
+            if(origin) metrics_observe(MH_FIRST_BYTE, get_mono_us() - origin);
+            m_ts_accept = 0;
+        }
+        bytes_to_send -= temp;
+        bytes_have_send += temp;
+        quantum_sent += temp;
+        sb_conn_slot* slot = scoreboard_conn(m_sock_fd);
+        if(slot) slot->bytes_out = bytes_have_send;
+        if(bytes_to_send > 0 && quantum_sent >= WRITE_QUANTUM){
+            metrics_inc(MC_WRITE_YIELDS);
+            set_deadline(PHASE_SEND, send_acked());
+            epoll_arm(EPOLLOUT);
+            return true;
+        }
+    }
+    finish_request();
+    if(m_proxy){
+        proxy_finish(m_proxy_keep ? PROXY_REUSE : PROXY_CLOSE);
+    }
+    m_cache.reset();
+    if(m_linger){
+        init();
+        set_deadline(PHASE_IDLE, 0);
+        epoll_arm(EPOLLIN);
+        return true;
+    }
+    return false;
+}
+
+int http_conn::proxy_pump(bool* upstream_wait){
+    proxy_conn* c = m_proxy;
+    #if USE_TLS
+    if(m_ssl && !m_ktls_send){
+        // OpenSSL 在用户态加密，只能经缓冲区转发；SSL_write 没写完时要用同一块数据重试，缓冲区发完才读下一段
+        if(m_proxy_buf_off == m_proxy_buf_len){
+            m_proxy_buf.resize(PROXY_TLS_BUF);
+            ssize_t n = recv(c->fd, &m_proxy_buf[0], std::min(c->left, (long)PROXY_TLS_BUF), 0);
+            if(n <= 0){
+                if(n == 0){
+                    errno = ECONNRESET;     // 上游提前关闭
+                }else if(errno == EAGAIN){
+                    *upstream_wait = true;
+                }
+                return -1;
+            }
+            c->left -= n;
+            m_proxy_buf_off = 0;
+            m_proxy_buf_len = n;
+        }
+        struct iovec iv = { &m_proxy_buf[m_proxy_buf_off], (size_t)(m_proxy_buf_len - m_proxy_buf_off) };
+        int n = sock_writev(&iv, 1);
+        if(n > 0){
+            m_proxy_buf_off += n;
+        }
+        return n;
+    }
+    #endif
+    // 管道清空后才从上游读入，此时 EAGAIN 只可能来自上游套接字
+    if(c->piped == 0){
+        if(c->pipe[0] < 0){
+            if(pipe2(c->pipe, O_NONBLOCK | O_CLOEXEC) < 0){
+                c->pipe[0] = c->pipe[1] = -1;
+                return -1;
+            }
+            fcntl(c->pipe[1], F_SETPIPE_SZ, PROXY_PIPE_SIZE);
+        }
+        ssize_t n = splice(c->fd, NULL, c->pipe[1], NULL, std::min(c->left, (long)PROXY_PIPE_SIZE),
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(n <= 0){
+            if(n == 0){
+                errno = ECONNRESET;
+            }else if(errno == EAGAIN){
+                *upstream_wait = true;
+            }
+            return -1;
+        }
+        c->left -= n;
+        c->piped = n;
+    }
+    ssize_t n = splice(c->pipe[0], NULL, m_sock_fd, NULL, c->piped,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK | (c->left > 0 ? SPLICE_F_MORE : 0));
+    if(n > 0){
+        c->piped -= n;
+        metrics_inc(MC_PROXY_SPLICED, n);
+    }
+    return n;
+}
+
+void http_conn::proxy_finish(PROXY_RELEASE how){
+    if(m_proxy->in_epoll){
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, m_proxy->fd, 0);
+        metrics_inc(MC_EPOLL_CTL);
+        m_proxy->in_epoll = false;
+    }
+    proxy_release(m_proxy, how);
+    m_proxy = NULL;
+    m_proxy_wait = false;
+    m_proxy_buf_off = m_proxy_buf_len = 0;
+}
@@ -14,12 +14,34 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
 #include <string.h>
 #include <time.h>
 #include <assert.h>
+#include "mono_clock.h"
 #include "locker.h"
 #include "lst_timer.h"
 #include "log.h"
+#include "access_log.h"
+#include "capture.h"
+#include "metrics.h"
+#include "scoreboard.h"
+#include "trace.h"
+#include "perf_stage.h"
+#include "probes.h"
+#include "admission.h"
+#include "ratelimit.h"
+#include "tls.h"
+#include "h2.h"
+#include "proxy.h"
+#include "microcache.h"
+#include "router.h"
+#include <string>
+#include <algorithm>
+#include <atomic>
 
 
 class sort_timer_lst;
@@ -29,14 +51,48 @@ class util_timer;
 const bool ET = true;
 #define TIMESLOT 5      // 定时器周期：秒
 
+// 连接各阶段的超时时间（秒），由定时器链表每 TIMESLOT 秒检查一次。读请求体和发送响应时，
+// 每传输 *_MIN_RATE 字节期限延长 1 秒，慢速客户端无法靠每隔一段时间传输一个字节一直占用连接
+#define IDLE_TIMEOUT (3 * TIMESLOT)     // 空闲（等待下一个请求）或没有任何进展的超时时间
+#define HEADER_TIMEOUT 10               // 从收到请求第一个字节起，收完请求头的期限，收到数据不延长
+#define BODY_TIMEOUT 10                 // 收完请求体的初始期限
+#define BODY_MIN_RATE 500               // 请求体的最低传输速率：字节/秒
+#define SEND_TIMEOUT 10                 // 客户端收完响应的初始期限
+#define SEND_MIN_RATE 1024              // 客户端接收响应的最低速率：字节/秒
+
+// 长连接的空闲超时随连接数自适应：连接数超过容量的 KEEPALIVE_SHRINK_PCT 后，新进入空闲的连接的超时时间
+// 从 IDLE_TIMEOUT 线性缩短到 KEEPALIVE_MIN_TIMEOUT；超过 KEEPALIVE_EVICT_PCT 后，每接受一个新连接，
+// 就按 LRU 顺序关闭最久空闲的长连接，新客户端优先于可能不会再发请求的空闲连接
+#define KEEPALIVE_MIN_TIMEOUT 1         // 连接数达到容量时的空闲超时：秒
+#define KEEPALIVE_SHRINK_PCT 50
+#define KEEPALIVE_EVICT_PCT 90
+#define KEEPALIVE_EVICT_BATCH 16        // 一次最多关闭的空闲连接数
+
+// 调度：同一 URL 上次的响应不超过 PRIORITY_MAX_SIZE 字节的请求进入线程池的优先队列；
+// 主线程每次为一个连接最多发送 WRITE_QUANTUM 字节，然后让出事件循环，大文件下载不会长时间占住主线程
+#ifndef PRIORITY_OPEN
+#define PRIORITY_OPEN 1
+#endif
+#define PRIORITY_MAX_SIZE 16384         // 小响应的上限：字节
+#define SIZE_HINT_SLOTS 4096            // URL 响应大小表的槽位数（直接映射，冲突时覆盖），须为 2 的幂
+#define WRITE_QUANTUM (256 * 1024)      // 每个连接每轮最多发送的字节数
+
+// 工作线程生成响应后先直接发送，发送缓冲区放不下（EAGAIN）时才注册 EPOLLOUT 交给主线程。
+// 一次写完时连接经完成队列和 eventfd 交还主线程，每个请求只需要一次 epoll_ctl（重新注册 EPOLLIN），
+// 主线程也不会为 EPOLLOUT 醒来；多个连接同时完成时共用一次 eventfd 通知
+#ifndef TRY_WRITE_OPEN
+#define TRY_WRITE_OPEN 1
+#endif
+
 // http 连接的用户数据类
 class http_conn
 {
 public:                         // 共享对象，没有线程竞争资源，所以不需要互斥
     static int m_epoll_fd;      // 所有的socket上的事件都被注册到同一个epoll对象中
-    static int m_user_cnt;      // 统计用户的数量
-    static int m_request_cnt;   // 接收到的请求次数
+                                // 用户数量、请求次数由 metrics 按线程分片统计（MG_CONNECTIONS、MC_REQUESTS）
     static sort_timer_lst m_timer_lst;// 定时器链表(对象),所有http连接共享这一个定时器链表
+    static int m_max_conns;     // 连接容量，取 MAX_FD 与进程文件描述符上限中较小的，由主线程设置
+    static int m_done_fd;       // 工作线程直接发送完响应后通知主线程的 eventfd，-1 时不直接发送（见 try_write）
     // static locker m_timer_lst_locker;  // 定时器链表互斥锁
 
     static const int RD_BUF_SIZE = 2048;    // 读缓冲区的大小
@@ -64,11 +120,19 @@ public:
         NO_RESOURCE         :   表示服务器没有资源
         FORBIDDEN_REQUEST   :   表示客户对资源没有足够的访问权限
         FILE_REQUEST        :   文件请求,获取文件成功
+        DYNAMIC_REQUEST     :   动态生成的响应，响应体在 m_body 中
         INTERNAL_ERROR      :   表示服务器内部错误
         CLOSED_CONNECTION   :   表示客户端已经关闭连接了
+        PROXY_REQUEST       :   反向代理的响应，响应头和已读到的响应体在 m_body 中，其余部分由 m_proxy 转发
+        BAD_GATEWAY         :   上游不可用或响应格式错误
+        GATEWAY_TIMEOUT     :   上游响应超时
     */
-    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION };
+    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, DYNAMIC_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION,
+                     PROXY_REQUEST, BAD_GATEWAY, GATEWAY_TIMEOUT };
     
+    // 连接所处的阶段，决定超时时间的计算方式，超时关闭时按阶段计数
+    enum CONN_PHASE { PHASE_IDLE = 0, PHASE_HEADER, PHASE_BODY, PHASE_SEND };
+
     // 从状态机的三种可能状态，即行的读取状态，分别表示
     // 1.读取到一个完整的行 2.行出错 3.行数据尚且不完整
     enum LINE_STATUS { LINE_OK = 0, LINE_BAD, LINE_OPEN };
@@ -81,7 +145,25 @@ public:
     void conn_close();  // 关闭连接
     bool read();        // 非阻塞的读
     bool write();       // 非阻塞的写
-    void del_fd();      // 定时器回调函数，被tick()调用
+    bool del_fd();      // 定时器回调函数，被tick()调用，返回 false 表示连接未关闭、定时器已重新设置
+    void shed(int reason);          // 过载或超过速率限制时不处理请求，回复预先生成的 503/429 并在发送后关闭连接
+    uint32_t client_ip() const { return m_addr.sin_addr.s_addr; }  // 客户端 IP，网络字节序
+
+    // 空闲长连接按进入空闲的先后串成 LRU 链表，只由主线程访问
+    static int idle_evict(int n);   // 关闭最久空闲的至多 n 个长连接，返回关闭的数量
+    static int keepalive_timeout(); // 按当前连接数计算的空闲超时：秒
+    bool priority_request();        // 主线程入队前调用，不解析请求，按 URL 上次的响应大小判断是否进入优先队列
+
+    // HTTPS 连接，握手和加解密都在主线程中进行（见 tls.h）
+    bool tls_start();               // 在 init 之后调用，创建 SSL 对象，失败时返回 false
+    bool tls_handshaking() const;   // 是否正在握手
+    int tls_handshake();            // 推进握手：-1 失败，0 等待后续事件（已重新注册），1 完成且请求数据已在缓冲区中
+
+    bool h2() const { return m_h2 != NULL; }    // 是否已切换到 HTTP/2（见 h2.h）
+    // 正在等待上游的响应体（见 proxy.h），此时该连接的事件来自上游套接字，由主线程交给 write 继续转发
+    bool proxy_waiting() const { return m_proxy_wait; }
+    void epoll_fired(){ m_ep_events = 0; }     // 主线程收到该连接的事件，EPOLLONESHOT 的注册已失效
+    static void drain_done();   // 主线程在 m_done_fd 可读时调用，为完成队列中的连接补做收尾工作
 
 private:
     int m_sock_fd;                  // 该http连接的socket
@@ -96,6 +178,7 @@ private:
     char* m_version;                // 协议版本，HTPP1.1
     METHOD m_method;                // 请求方法
     char* m_host;                   // 主机名
+    int m_hdr_start;                // 请求头部在读缓冲区中的起始位置，到 m_checked_idx 为止（转发请求时使用）
     long m_content_len;             // HTTP请求体的消息总长度
     bool m_linger;                  // HTTP 请求是否要保持连接 keep-alive
     char m_real_file[FILENAME_LEN]; // 客户请求的目标文件的完整路径，其内容等于 doc_root + m_url, doc_root是网站根目录
@@ -103,6 +186,11 @@ private:
 
     struct stat m_file_stat;        // 目标文件的状态。通过它我们可以判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
     char* m_file_address;           // 客户请求的目标文件被mmap到内存中的起始位置
+    std::string m_body;             // 动态生成的响应体
+    char* m_body_address;           // 响应体的起始位置，指向 m_file_address 或 m_body
+    const char* m_content_type;     // 响应体类型
+    int m_route_status;             // 路由处理函数给出的状态码（DYNAMIC_REQUEST）
+    std::string m_route_headers;    // 路由处理函数添加的响应头部
     char m_write_buf[WD_BUF_SIZE];  // 写缓冲区
     int m_write_idx;                // 写缓冲区中待发送的字节数
     struct iovec m_iv[2];           // writev来执行写操作，表示分散写两个不连续内存块的内容
@@ -110,9 +198,55 @@ private:
     int bytes_to_send;              // 将要发送的字节
     int bytes_have_send;            // 已经发送的字节
 
+    int m_status;                   // 响应的状态码，0表示尚未生成响应
+    long m_ts_accept;               // 连接建立的时间，第一个请求写出首字节后清零（单调时钟：微秒，下同）
+    long m_ts_start;                // 收到本次请求第一个字节的时间
+    long m_ts_read;                 // 请求读取完毕、加入线程池队列的时间
+    long m_ts_dequeue;              // 工作线程取出请求的时间
+    long m_ts_ready;                // 响应生成完毕的时间
+    long m_ts_eagain;               // 被采样的请求最近一次 writev 返回 EAGAIN 的时间
+    uint64_t m_trace_id;            // 追踪的请求编号，0 表示本次请求未被采样
+
+    CONN_PHASE m_phase;             // 当前阶段
+    time_t m_phase_start;           // 读请求头、读请求体、发送响应阶段的开始时间
+    int m_phase_bytes;              // 阶段开始时已读取（m_rd_idx）或已发送（bytes_have_send）的字节数
+
+    int m_ep_events;                // 在 epoll 中注册且尚未触发的事件，0 表示没有（EPOLLONESHOT 已触发）
+    std::atomic<bool> m_settle;     // 工作线程已发送完响应，连接在完成队列中等待主线程补做收尾工作
+    long m_ts_done;                 // 工作线程发送完响应的时间，0 表示由主线程发送
+    http_conn* m_done_next;         // 完成队列中的下一个连接
+    static std::atomic<http_conn*> m_done_head;    // 完成队列（无锁栈），工作线程压入，主线程一次取走全部
+
+    static http_conn* m_idle_head;  // 空闲链表表头为最近进入空闲的连接，表尾为最久空闲的连接
+    static http_conn* m_idle_tail;
+    http_conn* m_idle_prev;
+    http_conn* m_idle_next;
+    bool m_idle;                    // 是否在空闲链表中
+
+    h2_session* m_h2;               // HTTP/2 会话，HTTP/1.1 连接为 NULL
+    bool m_h2c_upgrade;             // 请求带 "Upgrade: h2c"
+    char* m_h2_settings;            // 请求的 HTTP2-Settings 头部
+
+    proxy_conn* m_proxy;            // 正在转发响应体的上游连接，NULL 表示没有
+    bool m_proxy_wait;              // 上游套接字已注册到 epoll，等待数据
+    bool m_proxy_keep;              // 响应体转发完后上游连接可以放回连接池
+    std::string m_proxy_ctype;      // HTTP/2 流的代理响应的 Content-Type
+    std::string m_proxy_buf;        // OpenSSL 加密的连接不能 splice，响应体经此缓冲区转发
+    int m_proxy_buf_off;            // 缓冲区中已发送的位置
+    int m_proxy_buf_len;            // 缓冲区中数据的长度
+    mcache_ref m_cache;             // 正在发送的缓存条目，响应体直接从条目发送
+    proxy_refresh* m_cache_job;     // 返回了过期条目，交出连接后由本工作线程刷新
+
+    #if USE_TLS
+    SSL* m_ssl;                     // HTTPS 连接的 SSL 对象，明文连接为 NULL
+    bool m_tls_hs;                  // 是否正在握手
+    bool m_ktls_send;               // 发送方向是否已交给内核 TLS，此时直接 writev / sendfile
+    int m_file_fd;                  // 内核 TLS 连接的文件响应用 sendfile 发送，保留打开的文件，-1 表示没有
+    #endif
     
 
 private:
+    void attach(int sock_fd, const sockaddr_in& addr);  // 绑定套接字和客户端地址，不注册 epoll 和定时器
     void init();                    // 私有函数，初始化连接以外的信息
     HTTP_CODE process_read();                       // 解析HTTP请求
     bool process_write(HTTP_CODE ret);              // 填充HTTP应答
@@ -135,6 +269,43 @@ private:
     bool add_content_length( int content_length );
     bool add_linger();
     bool add_blank_line(); 
+
+    void finish_request();          // 响应发送完毕，记录访问日志和统计指标
+    void epoll_arm(int ev);         // 注册 ev | EPOLLONESHOT，与已注册且尚未触发的事件相同时不调用 epoll_ctl
+    bool try_write();               // 工作线程直接发送响应，发送完毕时放入完成队列并返回 true
+    void settle();                  // 主线程补做 try_write 推迟的收尾工作，然后重新注册 EPOLLIN 或关闭连接
+    void set_deadline(CONN_PHASE phase, int bytes);     // 进入或继续某个阶段，更新定时器的超时时间
+    void iov_advance(int bytes);    // writev 发出 bytes 字节后更新 m_iv 和待发送的字节数
+    int send_acked();               // 本次响应中客户端已确认接收的字节数
+    void idle_link();               // 加入空闲链表表头
+    void idle_unlink();             // 从空闲链表中移除
+    int sock_recv(char* buf, int len);  // recv 或 SSL_read，返回值和 errno 的含义与 recv 相同
+    int sock_writev(const struct iovec* iv, int cnt);  // writev 或 SSL_write，返回值和 errno 的含义与 writev 相同
+    bool internal_client();         // 是否允许访问 /metrics 等内部路径
+
+    // HTTP/2：工作线程解析帧并生成响应，主线程读写，与 HTTP/1.1 的 read/process/write 对应
+    bool h2_detect();               // 请求以连接前言开头（prior knowledge）时切换到 HTTP/2
+    bool h2_upgrade(HTTP_CODE ret); // 处理 "Upgrade: h2c"，ret 为升级请求的处理结果，作为流 1 的响应
+    void h2_process(int shed_reason);               // shed_reason >= 0 时拒绝新的流（REFUSED_STREAM）
+    void h2_respond(h2_stream* s);                  // 对一个完整的请求调用 do_request 生成响应
+    void h2_response(h2_stream* s, HTTP_CODE ret);  // 把 do_request 的结果（文件映射、动态响应体）交给流
+    bool h2_read();
+    bool h2_write();
+    void h2_reap();                 // 释放已结束的流，记录访问日志和统计指标
+
+    // 反向代理：工作线程转发请求、读取响应头，主线程用 splice 转发较长的响应体
+    HTTP_CODE proxy_request(const proxy_route* route);
+    void proxy_build_request(std::string& req);        // Host 之后的请求头部（去掉逐跳头部）以及请求体
+    void proxy_head(int status, const std::string& reason, const std::string& headers, long content_len);
+    const char* request_header(const char* name);       // HTTP/1.1 请求头部的值，没有时返回 NULL
+    static const char* route_header(const void* conn, const char* name);    // 供 route_request::header 调用
+    HTTP_CODE cache_response(const mcache_ref& e, const char* state);   // 用缓存条目回复，state 放入 X-Cache
+    bool proxy_write();
+    int proxy_pump(bool* upstream_wait);    // 从上游转发一段响应体，返回发给客户端的字节数；上游暂无数据时置 upstream_wait
+    void proxy_finish(PROXY_RELEASE how);   // 从 epoll 中移除并归还上游连接
+
+    friend class http_conn_bench;   // 微基准测试（test_presure/microbench）直接调用解析和应答函数
+    friend class coro_conn;         // 协程连接模型（coro.cpp）自己读写套接字，调用解析和应答函数
 };
 
 
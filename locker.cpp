@@ -0,0 +1,89 @@
+#include "locker.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+// 所有同步对象的统计，只在对象构造时加锁登记，登记用原始互斥量，避免统计自身
+static lock_stats* g_lock_stats = NULL;
+static pthread_mutex_t g_lock_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+lock_stats* lock_stats_create(const char* name, const char* kind, const void* addr){
+    lock_stats* st = new lock_stats;
+    memset((void*)st, 0, sizeof(*st));      // 原子类型在此平台上与 unsigned long 布局相同
+    if(name){
+        st->name = name;
+    }else{
+        char* buf = new char[32];           // 未命名的实例用地址区分
+        snprintf(buf, 32, "%s@%p", kind, addr);
+        st->name = buf;
+    }
+    st->kind = kind;
+    pthread_mutex_lock(&g_lock_stats_mutex);
+    st->next = g_lock_stats;
+    g_lock_stats = st;
+    pthread_mutex_unlock(&g_lock_stats_mutex);
+    return st;
+}
+
+static void lock_append(std::string& out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+static void lock_append(std::string& out, const char* fmt, ...){
+    char buf[256];
+    va_list arg;
+    va_start(arg, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, arg);
+    va_end(arg);
+    out.append(buf, len < (int)sizeof(buf) ? len : sizeof(buf) - 1);
+}
+
+// 由直方图估计分位数，返回所在桶的上界：微秒
+static double lock_hist_quantile(const std::atomic<unsigned long>* hist, double q){
+    unsigned long total = 0;
+    for(int i = 0; i < LOCK_HIST_BUCKETS; ++i){
+        total += hist[i].load(std::memory_order_relaxed);
+    }
+    if(total == 0){
+        return 0;
+    }
+    unsigned long target = (unsigned long)(total * q);
+    unsigned long cum = 0;
+    for(int i = 0; i < LOCK_HIST_BUCKETS; ++i){
+        cum += hist[i].load(std::memory_order_relaxed);
+        if(cum > target){
+            return (double)(1UL << i) / 1000;
+        }
+    }
+    return (double)(1UL << (LOCK_HIST_BUCKETS - 1)) / 1000;
+}
+
+static bool by_wait(const lock_stats* a, const lock_stats* b){
+    return a->wait_ns.load() > b->wait_ns.load();
+}
+
+void lock_profile_report(std::string& out){
+    std::vector<lock_stats*> all;
+    pthread_mutex_lock(&g_lock_stats_mutex);
+    for(lock_stats* st = g_lock_stats; st; st = st->next){
+        all.push_back(st);
+    }
+    pthread_mutex_unlock(&g_lock_stats_mutex);
+    std::sort(all.begin(), all.end(), by_wait);
+
+    out.clear();
+    if(!LOCK_PROFILE){
+        out.append("lock profiling disabled, rebuild with -DLOCK_PROFILE=1\n");
+        return;
+    }
+    lock_append(out, "%-32s %-6s %12s %12s %8s %12s %10s %10s %12s %10s\n", "name", "kind", "acquires", "contended",
+                "cont%", "wait_ms", "wait_p50", "wait_p99", "hold_ms", "hold_p99");
+    for(size_t i = 0; i < all.size(); ++i){
+        lock_stats* st = all[i];
+        unsigned long acq = st->acquires.load(std::memory_order_relaxed);
+        unsigned long cont = st->contended.load(std::memory_order_relaxed);
+        lock_append(out, "%-32s %-6s %12lu %12lu %7.2f%% %12.3f %8.2fus %8.2fus %12.3f %8.2fus\n", st->name, st->kind,
+                    acq, cont, acq ? 100.0 * cont / acq : 0.0, st->wait_ns.load() / 1e6,
+                    lock_hist_quantile(st->wait_hist, 0.5), lock_hist_quantile(st->wait_hist, 0.99),
+                    st->hold_ns.load() / 1e6, lock_hist_quantile(st->hold_hist, 0.99));
+    }
+}
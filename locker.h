@@ -4,18 +4,81 @@
 #include <pthread.h>
 #include <exception>
 #include <semaphore.h>
+#include <time.h>
+#include <atomic>
+#include <string>
 // 线程同步机制封装类
 
+/*
+    锁竞争分析（编译选项，默认关闭，-DLOCK_PROFILE=1 打开）
+    打开后每个 locker/cond/sem 实例记录：获取次数、发生竞争（需要阻塞等待）的次数、
+    等待时间和持有时间（只有 locker 有）的 log2 直方图，按构造时传入的名字区分实例。
+    关闭时名字参数被忽略，各函数与原来完全相同，没有额外开销。
+    报告按总等待时间从大到小排列，服务器退出时输出到标准输出，或通过 LOCK_PROFILE_PATH 获取。
+*/
+#ifndef LOCK_PROFILE
+#define LOCK_PROFILE 0
+#endif
+#define LOCK_PROFILE_PATH "/debug/locks"    // 获取锁竞争报告的内部路径
+#define LOCK_HIST_BUCKETS 40                // 直方图第 i 个桶统计 [2^(i-1), 2^i) 纳秒
+
+// 一个同步对象实例的统计，对象销毁后仍然保留，以便退出时输出报告
+struct lock_stats {
+    const char* name;
+    const char* kind;                           // "locker" "cond" "sem"
+    std::atomic<unsigned long> acquires;        // 获取（或等待返回）的次数
+    std::atomic<unsigned long> contended;       // 需要阻塞等待的次数
+    std::atomic<unsigned long> wait_ns;         // 总等待时间
+    std::atomic<unsigned long> hold_ns;         // 总持有时间（locker）
+    std::atomic<unsigned long> wait_hist[LOCK_HIST_BUCKETS];
+    std::atomic<unsigned long> hold_hist[LOCK_HIST_BUCKETS];
+    lock_stats* next;
+};
+
+lock_stats* lock_stats_create(const char* name, const char* kind, const void* addr);  // 创建并登记
+void lock_profile_report(std::string& out);     // 按总等待时间排序输出所有实例
+
+inline unsigned long lock_now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+inline void lock_hist_add(std::atomic<unsigned long>* hist, unsigned long ns){
+    int idx = ns ? 64 - __builtin_clzl(ns) : 0;
+    hist[idx < LOCK_HIST_BUCKETS ? idx : LOCK_HIST_BUCKETS - 1].fetch_add(1, std::memory_order_relaxed);
+}
+
+// 记录一次获取，wait_ns 为阻塞等待的时间，没有阻塞时为0
+inline void lock_stats_acquired(lock_stats* st, bool contended, unsigned long wait_ns){
+    st->acquires.fetch_add(1, std::memory_order_relaxed);
+    if(contended){
+        st->contended.fetch_add(1, std::memory_order_relaxed);
+        st->wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+    }
+    lock_hist_add(st->wait_hist, wait_ns);
+}
+
 // 互斥锁类
 class locker
 {
 private:    
     pthread_mutex_t m_mutex;            // 互斥量类型
+    #if LOCK_PROFILE
+    lock_stats* m_stats;                // 竞争统计
+    unsigned long m_hold_start;         // 本次上锁的时间，只有持锁线程访问
+    #endif
 public:
-    locker(){
+    explicit locker(const char* name = NULL){   // name 用于锁竞争报告
         if(pthread_mutex_init(&m_mutex, NULL) != 0){    // 创建
             throw std::exception();
         }
+        #if LOCK_PROFILE
+        m_stats = lock_stats_create(name, "locker", this);
+        m_hold_start = 0;
+        #else
+        (void)name;
+        #endif
     }
 
     ~locker(){
@@ -23,10 +86,29 @@ public:
     }
 
     bool lock(){
+        #if LOCK_PROFILE
+        bool ok = true;
+        unsigned long wait = 0;
+        bool contended = pthread_mutex_trylock(&m_mutex) != 0;   // 先尝试，失败说明有竞争
+        if(contended){
+            unsigned long start = lock_now_ns();
+            ok = pthread_mutex_lock(&m_mutex) == 0;
+            wait = lock_now_ns() - start;
+        }
+        m_hold_start = lock_now_ns();
+        lock_stats_acquired(m_stats, contended, wait);
+        return ok;
+        #else
         return pthread_mutex_lock(&m_mutex) == 0;       // 上锁
+        #endif
     }
 
     bool unlock(){
+        #if LOCK_PROFILE
+        unsigned long hold = lock_now_ns() - m_hold_start;
+        m_stats->hold_ns.fetch_add(hold, std::memory_order_relaxed);
+        lock_hist_add(m_stats->hold_hist, hold);
+        #endif
         return pthread_mutex_unlock(&m_mutex) == 0;     // 解锁
     }
 
@@ -39,11 +121,19 @@ public:
 class cond{
 private:
     pthread_cond_t m_cond;              // 条件变量类型
+    #if LOCK_PROFILE
+    lock_stats* m_stats;                // 等待统计，每次等待都计为一次竞争
+    #endif
 public:
-    cond(){
+    explicit cond(const char* name = NULL){
         if(pthread_cond_init(&m_cond, NULL) != 0){      // 初始化
             throw std::exception();
         }
+        #if LOCK_PROFILE
+        m_stats = lock_stats_create(name, "cond", this);
+        #else
+        (void)name;
+        #endif
     }
 
     ~cond(){
@@ -51,11 +141,25 @@ public:
     }
 
     bool wait(pthread_mutex_t* mutex){              
+        #if LOCK_PROFILE
+        unsigned long start = lock_now_ns();
+        bool ok = pthread_cond_wait(&m_cond, mutex) == 0;
+        lock_stats_acquired(m_stats, true, lock_now_ns() - start);
+        return ok;
+        #else
         return pthread_cond_wait(&m_cond, mutex) == 0;  // 等待
+        #endif
     }
  
     bool timedwait(pthread_mutex_t* mutex, struct timespec t){  // 在一定时间等待
+        #if LOCK_PROFILE
+        unsigned long start = lock_now_ns();
+        bool ok = pthread_cond_timedwait(&m_cond, mutex, &t) == 0;
+        lock_stats_acquired(m_stats, true, lock_now_ns() - start);
+        return ok;
+        #else
         return pthread_cond_timedwait(&m_cond, mutex, &t) == 0;
+        #endif
     }
 
     bool signal(){
@@ -72,17 +176,37 @@ class sem
 {
 private:
     sem_t m_sem;
+    #if LOCK_PROFILE
+    lock_stats* m_stats;    // 等待统计，信号量为0需要阻塞时计为竞争
+    #endif
+
+    void profile_init(const char* name){
+        #if LOCK_PROFILE
+        m_stats = lock_stats_create(name, "sem", this);
+        #else
+        (void)name;
+        #endif
+    }
 public:
     sem(){
         if(sem_init(&m_sem, 0, 0) != 0){    // 信号量值初始化为0 （消费者信号量）
             throw std::exception();
         }
+        profile_init(NULL);
     }
 
     sem(int num){           // 传参创建
         if(sem_init(&m_sem, 0, num) != 0){
             throw std::exception();
         }
+        profile_init(NULL);
+    }
+
+    explicit sem(const char* name, int num = 0){    // 带名字创建，name 用于锁竞争报告
+        if(sem_init(&m_sem, 0, num) != 0){
+            throw std::exception();
+        }
+        profile_init(name);
     }
     
     ~sem(){                 // 释放
@@ -90,7 +214,18 @@ public:
     }
 
     bool wait(){            // 等待（减少）信号量
+        #if LOCK_PROFILE
+        if(sem_trywait(&m_sem) == 0){
+            lock_stats_acquired(m_stats, false, 0);
+            return true;
+        }
+        unsigned long start = lock_now_ns();
+        bool ok = sem_wait(&m_sem) == 0;
+        lock_stats_acquired(m_stats, true, lock_now_ns() - start);
+        return ok;
+        #else
         return sem_wait(&m_sem) == 0;
+        #endif
     }
 
     bool post(){            // 增加信号量
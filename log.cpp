@@ -1,4 +1,35 @@
 #include "log.h"
+#include <atomic>
+#include <sys/time.h>
+
+// 一条日志记录，在产生日志的线程中格式化，由后台线程统一加上时间前缀写出
+struct log_record {
+    struct timeval tv;              // 日志产生的时间
+    int len;                        // msg 的有效长度
+    char msg[LOG_MSG_SIZE];         // "[等级]\t[函数 行号]: 内容"
+};
+
+// 单生产者/单消费者无锁环形缓冲区，生产者为所属线程，消费者为后台刷盘线程
+struct log_ring {
+    std::atomic<unsigned> head;     // 下一条待消费记录的位置，只由后台线程修改
+    std::atomic<unsigned> tail;     // 下一条可写入记录的位置，只由所属线程修改
+    log_ring* next;                 // 所有线程的缓冲区串成一个单链表
+    log_record recs[LOG_RING_SIZE];
+    log_ring() : head(0), tail(0), next(NULL) {}
+};
+
+static std::atomic<log_ring*> g_rings(NULL);    // 缓冲区链表头，线程首次打日志时无锁插入
+static std::atomic<bool> g_running(false);      // 后台线程是否在运行
+static std::atomic<unsigned long> g_dropped(0); // 缓冲区满而丢弃的日志条数
+static pthread_t g_flusher;
+
+int EM_log_level = LOG_LEVEL;        // 运行时日志等级
+
+static int g_log_fd = -1;           // 当前日志文件，只由后台线程访问
+static long g_file_size = 0;        // 当前日志文件已写入的字节数
+static time_t g_file_open = 0;      // 当前日志文件的创建时间
+static char g_out_buf[64 * 1024];   // 后台线程的批量写缓冲
+static int g_out_idx = 0;
 
 char *EM_logLevelGet(const int level){  // 得到当前输入等级level的字符串
     if(level == LOGLEVEL_DEBUG){
@@ -12,18 +43,201 @@ char *EM_logLevelGet(const int level){  // 得到当前输入等级level的字
     }else{
         return (char*)"UNKNOWN";
     }
-    
+
+}
+
+#if OPEN_LOG
+static __thread log_ring* t_ring = NULL;        // 当前线程的缓冲区
+
+// 获取当前线程的缓冲区，第一次调用时创建并挂到全局链表上
+static log_ring* EM_logRingGet(){
+    if(!t_ring){
+        t_ring = new log_ring;
+        log_ring* head = g_rings.load(std::memory_order_relaxed);
+        do{
+            t_ring->next = head;
+        }while(!g_rings.compare_exchange_weak(head, t_ring, std::memory_order_release, std::memory_order_relaxed));
+    }
+    return t_ring;
+}
+#endif
+
+// 打开一个新的日志文件，文件名为创建时间
+static void EM_logFileOpen(){
+    if(g_log_fd != -1){
+        close(g_log_fd);
+    }
+    char name[128];
+    time_t now = time(NULL);
+    struct tm tm_now;
+    localtime_r(&now, &tm_now);
+    snprintf(name, sizeof(name), "%s/webserver_%04d%02d%02d_%02d%02d%02d.log", LOG_DIR,
+             tm_now.tm_year + 1900, tm_now.tm_mon + 1, tm_now.tm_mday,
+             tm_now.tm_hour, tm_now.tm_min, tm_now.tm_sec);
+    g_log_fd = open(name, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    g_file_size = 0;
+    g_file_open = now;
+}
+
+// 把批量写缓冲中的内容写出，并按大小/时间滚动日志文件
+static void EM_logOutFlush(){
+    if(g_out_idx == 0){
+        return;
+    }
+    #if LOG_SAVE
+    if(g_file_size + g_out_idx > LOG_MAX_FILE_SIZE || time(NULL) - g_file_open >= LOG_ROTATE_SECS){
+        EM_logFileOpen();
+    }
+    int fd = g_log_fd;
+    #else
+    int fd = STDOUT_FILENO;
+    #endif
+    int done = 0;
+    while(fd != -1 && done < g_out_idx){
+        int ret = ::write(fd, g_out_buf + done, g_out_idx - done);
+        if(ret < 0){
+            if(errno == EINTR) continue;
+            break;          // 写失败，丢弃本批日志
+        }
+        done += ret;
+    }
+    g_file_size += done;
+    g_out_idx = 0;
+}
+
+// 把一条日志追加到批量写缓冲，时间前缀在这里格式化
+static void EM_logOutAppend(const struct timeval& tv, const char* msg, int len){
+    if(g_out_idx + len + 64 > (int)sizeof(g_out_buf)){
+        EM_logOutFlush();
+    }
+    static time_t last_sec = 0;         // 同一秒内的日志复用已格式化的日期
+    static char last_str[32];
+    if(tv.tv_sec != last_sec){
+        struct tm tm_now;
+        localtime_r(&tv.tv_sec, &tm_now);
+        strftime(last_str, sizeof(last_str), "%Y-%m-%d %H:%M:%S", &tm_now);
+        last_sec = tv.tv_sec;
+    }
+    g_out_idx += snprintf(g_out_buf + g_out_idx, sizeof(g_out_buf) - g_out_idx, "%s.%06ld ", last_str, (long)tv.tv_usec);
+    memcpy(g_out_buf + g_out_idx, msg, len);
+    g_out_idx += len;
+    g_out_buf[g_out_idx++] = '\n';
+}
+
+// 取走所有线程缓冲区中的日志，返回取走的条数
+static int EM_logDrain(){
+    int cnt = 0;
+    for(log_ring* ring = g_rings.load(std::memory_order_acquire); ring; ring = ring->next){
+        unsigned head = ring->head.load(std::memory_order_relaxed);
+        unsigned tail = ring->tail.load(std::memory_order_acquire);
+        for( ; head != tail; ++head, ++cnt){
+            log_record& rec = ring->recs[head & (LOG_RING_SIZE - 1)];
+            EM_logOutAppend(rec.tv, rec.msg, rec.len);
+        }
+        ring->head.store(head, std::memory_order_release);  // 归还槽位给生产者
+    }
+
+    static unsigned long reported = 0;  // 已经报告过的丢弃条数
+    unsigned long dropped = g_dropped.load(std::memory_order_relaxed);
+    if(dropped != reported){
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        char msg[LOG_MSG_SIZE];
+        int len = snprintf(msg, sizeof(msg), "[%s]\t[%s %d]: %lu log records dropped, ring buffer full",
+                           EM_logLevelGet(LOGLEVEL_WARN), __FUNCTION__, __LINE__, dropped - reported);
+        EM_logOutAppend(tv, msg, len);
+        reported = dropped;
+    }
+    EM_logOutFlush();
+    return cnt;
+}
+
+// 后台刷盘线程：周期性地批量取走日志并写出，缓冲区有积压时不休眠
+static void* EM_logFlusher(void*){
+    while(g_running.load(std::memory_order_acquire)){
+        if(EM_logDrain() == 0){
+            usleep(LOG_FLUSH_MS * 1000);
+        }
+    }
+    EM_logDrain();      // 退出前写完剩余日志
+    return NULL;
+}
+
+bool EM_log_init(){
+    if(g_running.load()){
+        return true;
+    }
+    #if LOG_SAVE
+    mkdir(LOG_DIR, 0755);
+    EM_logFileOpen();
+    if(g_log_fd == -1){
+        return false;
+    }
+    #endif
+    g_running.store(true, std::memory_order_release);
+    if(pthread_create(&g_flusher, NULL, EM_logFlusher, NULL) != 0){
+        g_running.store(false);
+        return false;
+    }
+    return true;
+}
+
+void EM_log_close(){
+    if(!g_running.exchange(false)){
+        return;
+    }
+    pthread_join(g_flusher, NULL);
+    if(g_log_fd != -1){
+        close(g_log_fd);
+        g_log_fd = -1;
+    }
+}
+
+void EM_log_level_set(const int level){
+    EM_log_level = level < LOG_LEVEL ? LOG_LEVEL : level;  // 低于编译期等级的调用已被消除，调低没有意义
+}
+
+unsigned long EM_log_dropped(){
+    return g_dropped.load(std::memory_order_relaxed);
 }
 
 void EM_log(const int level, const char* fun, const int line, const char *fmt, ...){ // 日志输出函数
-    #ifdef OPEN_LOG     // 判断开关
+    #if OPEN_LOG        // 判断开关
+    if(level < EM_log_level){                       // EMlog 宏已判断过等级，这里防止直接调用
+        return;
+    }
     va_list arg;
     va_start(arg, fmt);
-    char buf[1024];     // 创建缓存字符数组
-    vsnprintf(buf, sizeof(buf), fmt, arg);          // 赋值 ftm 格式的 arg 到 buf
-    va_end(arg);   
-    if(level >= LOG_LEVEL){                         // 判断当前日志等级，与程序日志等级状态对比
+    if(!g_running.load(std::memory_order_acquire)){ // 后台线程未启动，同步输出
+        char buf[1024];     // 创建缓存字符数组
+        vsnprintf(buf, sizeof(buf), fmt, arg);      // 赋值 ftm 格式的 arg 到 buf
+        va_end(arg);
         printf("[%s]\t[%s %d]: %s \n", EM_logLevelGet(level), fun, line, buf);
-    }  
+        return;
+    }
+
+    log_ring* ring = EM_logRingGet();
+    unsigned tail = ring->tail.load(std::memory_order_relaxed);
+    if(tail - ring->head.load(std::memory_order_acquire) >= LOG_RING_SIZE){
+        va_end(arg);
+        g_dropped.fetch_add(1, std::memory_order_relaxed);  // 缓冲区满，丢弃而不是等待
+        return;
+    }
+
+    log_record& rec = ring->recs[tail & (LOG_RING_SIZE - 1)];
+    gettimeofday(&rec.tv, NULL);
+    int len = snprintf(rec.msg, LOG_MSG_SIZE, "[%s]\t[%s %d]: ", EM_logLevelGet(level), fun, line);
+    if(len < LOG_MSG_SIZE){
+        len += vsnprintf(rec.msg + len, LOG_MSG_SIZE - len, fmt, arg);
+    }
+    va_end(arg);
+    if(len >= LOG_MSG_SIZE){
+        len = LOG_MSG_SIZE - 1;                     // 被截断
+    }
+    while(len > 0 && rec.msg[len - 1] == '\n'){    // 去掉格式串末尾的换行，由后台线程统一添加
+        --len;
+    }
+    rec.len = len;
+    ring->tail.store(tail + 1, std::memory_order_release);  // 发布给后台线程
     #endif
-}
\ No newline at end of file
+}
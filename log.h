@@ -7,9 +7,20 @@
 #include "lst_timer.h"
 #include "http_conn.h"
 
-#define OPEN_LOG 1                  // 声明是否打开日志输出
-#define LOG_LEVEL LOGLEVEL_INFO     // 声明当前程序的日志等级状态，只输出等级等于或高于该值的内容
-#define LOG_SAVE 0                  // 可补充日志保存功能
+#ifndef OPEN_LOG                    // 可用 -DOPEN_LOG=0 关闭
+#define OPEN_LOG 1                  // 声明是否打开日志输出，为0时所有日志调用在编译期被消除
+#endif
+#ifndef LOG_LEVEL                   // 编译期最低日志等级，可用 -DLOG_LEVEL=LOGLEVEL_DEBUG 覆盖
+#define LOG_LEVEL LOGLEVEL_INFO     // 低于该等级的 EMlog 调用在编译期被消除，参数不会被求值
+#endif
+#define LOG_SAVE 1                  // 日志保存到文件（1），或由后台线程输出到标准输出（0）
+
+#define LOG_DIR "./log"                         // 日志文件所在目录
+#define LOG_MSG_SIZE 256                        // 单条日志的最大长度，超出部分被截断
+#define LOG_RING_SIZE 1024                      // 每个线程环形缓冲区的记录条数，必须是2的幂
+#define LOG_FLUSH_MS 100                        // 后台线程刷盘周期：毫秒
+#define LOG_MAX_FILE_SIZE (64 * 1024 * 1024)    // 单个日志文件的最大字节数，超过后滚动
+#define LOG_ROTATE_SECS (24 * 60 * 60)          // 日志文件按时间滚动的周期：秒
 
 typedef enum{                       // 日志等级，越往下等级越高
     LOGLEVEL_DEBUG = 0,
@@ -18,8 +29,38 @@ typedef enum{                       // 日志等级，越往下等级越高
     LOGLEVEL_ERROR,
 }E_LOGLEVEL;
 
-void EM_log(const int level, const char* fun, const int line, const char *fmt, ...);
+void EM_log(const int level, const char* fun, const int line, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+extern int EM_log_level;            // 运行时日志等级，默认等于 LOG_LEVEL，只能调高
+void EM_log_level_set(const int level);
+
+/*
+    异步日志：每个线程拥有一个无锁的单生产者/单消费者环形缓冲区，EM_log 只负责把日志格式化到
+    本线程的缓冲区中，由后台刷盘线程批量写入文件，缓冲区满时丢弃日志并计数，不阻塞请求处理。
+    EM_log_init 之前（或 EM_log_close 之后）的日志直接同步输出到标准输出。
+*/
+bool EM_log_init();                 // 创建日志目录和文件，启动后台刷盘线程
+void EM_log_close();                // 停止后台线程，写完所有缓冲区中的日志
+unsigned long EM_log_dropped();     // 因缓冲区满而被丢弃的日志条数
 
-#define EMlog(level, fmt...) EM_log(level, __FUNCTION__, __LINE__, fmt) // 宏定义，隐藏形参
+/*
+    宏定义，隐藏形参。等级判断在调用处完成：
+    1. level 低于编译期等级 LOG_LEVEL 时，条件为常量 false，整条语句被编译器删除；
+    2. 否则只有一次与运行时等级 EM_log_level 的比较，未通过时不求值参数、不格式化。
+*/
+#if OPEN_LOG
+#define EMlog(level, fmt...) do{                                        \
+        if((level) >= LOG_LEVEL && (level) >= EM_log_level){            \
+            EM_log(level, __FUNCTION__, __LINE__, fmt);                 \
+        }                                                               \
+    }while(0)
+#else
+#define EMlog(level, fmt...) do{                                        \
+        if(0){                                                          \
+            EM_log(level, __FUNCTION__, __LINE__, fmt);                 \
+        }                                                               \
+    }while(0)                       // 参数不求值，只保留格式检查并避免未使用变量的警告
+#endif
 
-#endif
\ No newline at end of file
+#endif
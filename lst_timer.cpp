@@ -26,7 +26,7 @@ void sort_timer_lst::add_timer( util_timer* timer ) {
 }
 
 /* 当某个定时任务发生变化时，调整对应的定时器在链表中的位置。
-这个函数只考虑被调整的定时器的超时时间延长的情况，即该定时器需要往链表的尾部移动。*/
+超时时间延长时往链表尾部移动；缩短时（如进入读请求头阶段，期限短于空闲超时）从头节点开始重新插入。*/
 void sort_timer_lst::adjust_timer(util_timer* timer)
 {
     EMlog(LOGLEVEL_DEBUG,"===========adjusting timer.=========\n");
@@ -35,8 +35,19 @@ void sort_timer_lst::adjust_timer(util_timer* timer)
         return;
     }
     util_timer* tmp = timer->next;
+    if( timer->prev && timer->expire < timer->prev->expire ) {
+        // 超时时间缩短到前一个定时器之前，取出后重新插入
+        timer->prev->next = timer->next;
+        if( tmp ) {
+            tmp->prev = timer->prev;
+        } else {
+            tail = timer->prev;
+        }
+        timer->prev = timer->next = NULL;
+        add_timer( timer );
+    }
     // 如果被调整的目标定时器处在链表的尾部，或者该定时器新的超时时间值仍然小于其下一个定时器的超时时间则不用调整
-    if( !tmp || ( timer->expire < tmp->expire ) ) {
+    else if( !tmp || ( timer->expire < tmp->expire ) ) {
         // return;
     }
     // 如果目标定时器是链表的头节点，则将该定时器从链表中取出并重新插入链表
@@ -138,9 +149,11 @@ void sort_timer_lst::tick() {
         }
 
         // 调用定时器的回调函数，以执行定时任务，关闭连接
-        tmp->user_data->conn_close();
-        // 删除定时器
-        del_timer(tmp);
+        WS_PROBE2(timer_expire, tmp->user_data, tmp->expire);
+        if(tmp->user_data->del_fd()){
+            // 删除定时器
+            del_timer(tmp);
+        }   // 否则回调延后了超时时间，定时器已移到后面
         tmp = head;
     }
 }
\ No newline at end of file
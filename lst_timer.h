@@ -6,6 +6,7 @@
 #include <arpa/inet.h>
 #include "http_conn.h"
 #include "locker.h"
+#include "probes.h"
 
 class http_conn;   // 前向声明
 
@@ -38,8 +39,7 @@ public:
     // 将目标定时器timer添加到链表中
     void add_timer( util_timer* timer ); 
     
-    /* 当某个定时任务发生变化时，调整对应的定时器在链表中的位置。这个函数只考虑被调整的定时器的
-    超时时间延长的情况，即该定时器需要往链表的尾部移动。*/
+    /* 当某个定时任务发生变化时，调整对应的定时器在链表中的位置，超时时间可以延长也可以缩短。*/
     void adjust_timer(util_timer* timer);
    
     // 将目标定时器 timer 从链表中删除
@@ -7,16 +7,20 @@
 #include <error.h>
 #include <fcntl.h>      
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <signal.h>
 #include <assert.h>
+#include <sys/resource.h>
 #include "locker.h"
 #include "threadpool.h"
 #include "http_conn.h"
 #include "lst_timer.h"
 #include "log.h"
+#include "coro.h"
 
 #define MAX_FD 65535            // 最大文件描述符（客户端）数量
 #define MAX_EVENT_SIZE 10000    // 监听的最大的事件数量
+#define FD_RESERVE 32           // 为监听、epoll、管道、日志和打开请求文件保留的文件描述符数量
 
 static int pipefd[2];           // 管道文件描述符 0为读，1为写
 // static sort_timer_lst timer_lst;// 定时器链表
@@ -52,19 +56,8 @@ extern void modfd(int epoll_fd, int fd, int ev);
 // 文件描述符设置非阻塞操作
 extern void set_nonblocking(int fd);
 
-int main(int argc, char* argv[]){
-
-    if(argc <= 1){      // 形参个数，第一个为执行命令的名称
-        EMlog(LOGLEVEL_ERROR,"run as: %s port_number\n", basename(argv[0]));      // argv[0] 可能是带路径的，用basename转换
-        exit(-1);
-    }
-
-    // 获取端口号
-    int port = atoi(argv[1]);   // 字符串转整数
-
-    // 对SIGPIE信号进行处理(捕捉忽略，默认退出)
-    addsig(SIGPIPE, SIG_IGN);           // https://blog.csdn.net/chengcheng1024/article/details/108104507
-    
+// 创建监听 port 的套接字
+static int open_listen(int port){
     int listen_fd = socket(AF_INET, SOCK_STREAM, 0);    // 监听套接字
     assert( listen_fd >= 0 );                            // ...判断是否创建成功
 
@@ -83,6 +76,95 @@ int main(int argc, char* argv[]){
     // 监听
     ret = listen(listen_fd, 8);
     assert( ret != -1 );    // ...判断是否成功
+    return listen_fd;
+}
+
+// 主进程一次性读取连接上的所有数据，然后交给线程池（速率限制在工作线程解析出完整的请求后检查）
+static void read_request(http_conn* users, int sock_fd, threadpool<http_conn>* pool){
+    if (users[sock_fd].read()){
+        if(!pool->append(users + sock_fd, users[sock_fd].priority_request())){ // 加入到线程池队列中，数组指针 + 偏移 &users[sock_fd]
+            users[sock_fd].shed(SHED_QUEUE_FULL);   // 队列已满，回复 503
+        }
+    }else{
+        users[sock_fd].conn_close();
+        http_conn::m_timer_lst.del_timer(users[sock_fd].timer);  // 移除其对应的定时器
+    }
+}
+
+int main(int argc, char* argv[]){
+
+    if(argc <= 1){      // 形参个数，第一个为执行命令的名称
+        #if USE_TLS
+        EMlog(LOGLEVEL_ERROR,"run as: %s port_number [https_port_number]\n", basename(argv[0]));
+        #else
+        EMlog(LOGLEVEL_ERROR,"run as: %s port_number\n", basename(argv[0]));      // argv[0] 可能是带路径的，用basename转换
+        #endif
+        exit(-1);
+    }
+
+    // 获取端口号
+    int port = atoi(argv[1]);   // 字符串转整数
+    int tls_port = 0;           // HTTPS 端口，0 表示不监听
+    #if USE_TLS
+    if(argc > 2){
+        tls_port = atoi(argv[2]);
+        if(!tls_init(TLS_CERT_FILE, TLS_KEY_FILE)){
+            EMlog(LOGLEVEL_ERROR,"TLS init failed, check %s and %s.\n", TLS_CERT_FILE, TLS_KEY_FILE);
+            exit(-1);
+        }
+    }
+    #endif
+
+    // 启动异步日志，失败时日志退化为同步输出
+    if(!EM_log_init()){
+        EMlog(LOGLEVEL_WARN,"async log init failed, logging to stdout.\n");
+    }
+    if(!access_log_init()){
+        EMlog(LOGLEVEL_WARN,"access log init failed, access log disabled.\n");
+    }
+    if(!capture_init()){
+        EMlog(LOGLEVEL_WARN,"traffic capture init failed, capture disabled.\n");
+    }
+    if(!scoreboard_init()){     // 必须在创建线程池之前，工作线程启动时注册槽位
+        EMlog(LOGLEVEL_WARN,"scoreboard init failed, scoreboard disabled.\n");
+    }
+    #if PROXY_OPEN && !CORO_OPEN
+    if(!proxy_init(PROXY_CONF_FILE)){
+        EMlog(LOGLEVEL_INFO,"no proxy routes in %s, reverse proxy disabled.\n", PROXY_CONF_FILE);
+    }
+    #endif
+
+    // 对SIGPIE信号进行处理(捕捉忽略，默认退出)
+    addsig(SIGPIPE, SIG_IGN);           // https://blog.csdn.net/chengcheng1024/article/details/108104507
+
+    // 连接容量受进程的文件描述符上限约束，空闲长连接的淘汰和超时按它计算
+    struct rlimit fd_limit;
+    if(getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 && fd_limit.rlim_cur != RLIM_INFINITY
+       && fd_limit.rlim_cur < MAX_FD + FD_RESERVE){
+        http_conn::m_max_conns = fd_limit.rlim_cur > 2 * FD_RESERVE ? fd_limit.rlim_cur - FD_RESERVE : fd_limit.rlim_cur / 2;
+    }else{
+        http_conn::m_max_conns = MAX_FD;
+    }
+    EMlog(LOGLEVEL_INFO, "connection capacity: %d.\n", http_conn::m_max_conns);
+
+    #if CORO_OPEN
+    // 协程连接模型（见 coro.h）：事件循环线程各自接受并处理连接，不创建线程池
+    if(tls_port){
+        EMlog(LOGLEVEL_WARN,"HTTPS is not supported by the coroutine model, port %d ignored.\n", tls_port);
+    }
+    int coro_ret = coro_serve(port, CORO_LOOPS);
+    access_log_close();
+    capture_close();
+    scoreboard_close();
+    #if USE_TLS
+    tls_close();
+    #endif
+    EM_log_close();
+    return coro_ret;
+    #endif
+
+    int listen_fd = open_listen(port);
+    int tls_listen_fd = tls_port ? open_listen(tls_port) : -1;  // HTTPS 监听套接字
 
     // 创建epoll对象，事件数组（IO多路复用，同时检测多个事件）
     epoll_event events[MAX_EVENT_SIZE]; // 结构体数组，接收检测后的数据
@@ -90,16 +172,26 @@ int main(int argc, char* argv[]){
     assert( epoll_fd != -1 );
     // 将监听的文件描述符添加到epoll对象中
     addfd(epoll_fd, listen_fd, false, false);  // 监听文件描述符不需要 ONESHOT & ET
+    if(tls_listen_fd >= 0){
+        addfd(epoll_fd, tls_listen_fd, false, false);
+    }
     
     // 创建管道
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
+    int ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
     assert( ret != -1 );
     set_nonblocking( pipefd[1] );               // 写管道非阻塞
     addfd(epoll_fd, pipefd[0], false, false ); // epoll检测读管道
 
+    // 工作线程直接发送完响应后经由 eventfd 通知主线程（见 http_conn::try_write），创建失败时由主线程发送
+    http_conn::m_done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(http_conn::m_done_fd >= 0){
+        addfd(epoll_fd, http_conn::m_done_fd, false, false);
+    }
+
     // 设置信号处理函数
     addsig(SIGALRM, sig_to_pipe);   // 定时器信号
     addsig(SIGTERM, sig_to_pipe);   // SIGTERM 关闭服务器
+    addsig(SIGUSR1, sig_to_pipe);   // SIGUSR1 导出请求追踪数据
     bool stop_server = false;       // 关闭服务器标志位
 
     // 创建一个保存所有客户端信息的数组
@@ -116,34 +208,66 @@ int main(int argc, char* argv[]){
 
     bool timeout = false;   // 定时器周期已到
     alarm(TIMESLOT);        // 定时产生SIGALRM信号
+    bool accept_paused = false; // 过载时暂停 accept，期间定期检查负载
 
     while(!stop_server){
         // 检测事件
-        int num = epoll_wait(epoll_fd, events, MAX_EVENT_SIZE, -1);     // 阻塞，返回事件数量
+        int num = epoll_wait(epoll_fd, events, MAX_EVENT_SIZE, accept_paused ? ADMISSION_PAUSE_MS : -1);     // 阻塞，返回事件数量
         if(num < 0 && errno != EINTR){
             EMlog(LOGLEVEL_ERROR,"EPOLL failed.\n");
             break;
         }
+        if(trace_sample_rate.load(std::memory_order_relaxed) > 0){
+            trace_epoll_wake_us = get_mono_us();    // 用于计算每个连接的 epoll 处理延迟
+        }
 
         // 循环遍历事件数组
         for(int i = 0; i < num; ++i){
 
             int sock_fd = events[i].data.fd;
-            if(sock_fd == listen_fd){   // 监听文件描述符的事件响应
+            if(sock_fd != listen_fd && sock_fd != tls_listen_fd && sock_fd != pipefd[0] && sock_fd != http_conn::m_done_fd){
+                users[sock_fd].epoll_fired();       // 客户端连接的 EPOLLONESHOT 注册已触发，之后的 epoll_arm 必须调用 epoll_ctl
+            }
+            if(sock_fd == listen_fd || sock_fd == tls_listen_fd){   // 监听文件描述符的事件响应
                 // 有客户端连接进来
+                bool tls = sock_fd == tls_listen_fd;
                 struct sockaddr_in client_addr;
                 socklen_t client_addr_len = sizeof(client_addr);
-                int conn_fd = accept(listen_fd,(struct sockaddr*)&client_addr, &client_addr_len);
-                // ...判断是否连接成功
+                int conn_fd = accept(sock_fd,(struct sockaddr*)&client_addr, &client_addr_len);
+                WS_PROBE3(accept, conn_fd, client_addr.sin_addr.s_addr, client_addr.sin_port);
+                if(conn_fd < 0){
+                    EMlog(LOGLEVEL_WARN,"accept failed: %s\n", strerror(errno));
+                    if(errno == EMFILE || errno == ENFILE){
+                        // 文件描述符用完，关闭最久空闲的长连接腾出位置。监听socket是水平触发，下一轮会再次 accept
+                        http_conn::idle_evict(KEEPALIVE_EVICT_BATCH);
+                    }
+                    continue;
+                }
 
-                if(http_conn::m_user_cnt >= MAX_FD){
-                    // 目前连接数满了
-                    // ...给客户端写一个信息：服务器内部正忙
-                    close(conn_fd);
+                long conns = metrics_gauge_get(MG_CONNECTIONS);
+                long evict_high = (long)http_conn::m_max_conns * KEEPALIVE_EVICT_PCT / 100;
+                if(conns >= evict_high){
+                    // 接近容量，关闭最久空闲的长连接，把位置留给新连接
+                    conns -= http_conn::idle_evict(std::min(conns - evict_high + 1, (long)KEEPALIVE_EVICT_BATCH));
+                }
+                if(conns >= http_conn::m_max_conns || conn_fd >= MAX_FD){
+                    // 目前连接数满了，给客户端回复 503：服务器内部正忙
+                    metrics_inc(MC_CONN_REJECTED);
+                    admission_reject(conn_fd, admission_503, tls ? 0 : admission_503_len); // HTTPS 连接握手前无法回复，直接关闭
+                    continue;
+                }
+                if(!ratelimit_conn_open(client_addr.sin_addr.s_addr)){
+                    // 该客户端或其所在网段的连接数超限，回复 429 后关闭，不占用 users[]
+                    metrics_inc(MC_CONN_LIMITED);
+                    admission_reject(conn_fd, admission_429, tls ? 0 : admission_429_len);
                     continue;
                 }
                 // 将新客户端数据初始化，放到数组中
                 users[conn_fd].init(conn_fd, client_addr);  // conn_fd 作为索引
+                if(tls && !users[conn_fd].tls_start()){
+                    users[conn_fd].conn_close();
+                    http_conn::m_timer_lst.del_timer(users[conn_fd].timer);
+                }
                 // 当listen_fd也注册了ONESHOT事件时(addfd)，
                 // 接受了新的连接后需要重置socket上EPOLLONESHOT事件，确保下次可读时，EPOLLIN 事件被触发
                 // modfd(epoll_fd, listen_fd, EPOLLIN); 
@@ -169,25 +293,45 @@ int main(int argc, char* argv[]){
                             break;
                         case SIGTERM:
                             stop_server = true;
+                            break;
+                        case SIGUSR1:
+                            if(!trace_dump_file()){
+                                EMlog(LOGLEVEL_WARN,"trace dump failed.\n");
+                            }
+                            break;
                         }
                     }
                 }
             }
+            else if(sock_fd == http_conn::m_done_fd){
+                http_conn::drain_done();    // 工作线程已发完响应的连接：记录请求、重新注册 EPOLLIN 或关闭
+            }
+            else if(users[sock_fd].proxy_waiting()){
+                // 代理的上游套接字有数据或被关闭（以客户端的 fd 注册），继续转发响应体
+                if(!users[sock_fd].write()){
+                    users[sock_fd].conn_close();
+                    http_conn::m_timer_lst.del_timer(users[sock_fd].timer);
+                }
+            }
             else if(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
                 // 对方异常断开 或 错误 等事件
                 EMlog(LOGLEVEL_DEBUG,"-------EPOLLRDHUP | EPOLLHUP | EPOLLERR--------\n");
                 users[sock_fd].conn_close(); 
                 http_conn::m_timer_lst.del_timer(users[sock_fd].timer);  // 移除其对应的定时器
             }
-            else if(events[i].events & EPOLLIN){
-                EMlog(LOGLEVEL_DEBUG,"-------EPOLLIN-------\n\n");
-                if (users[sock_fd].read()){         // 主进程一次性读取缓冲区的所有数据
-                    pool->append(users + sock_fd);  // 加入到线程池队列中，数组指针 + 偏移 &users[sock_fd]
-                }else{
+            else if(users[sock_fd].tls_handshaking()){
+                // TLS 握手，EPOLLIN 或 EPOLLOUT 都由 OpenSSL 决定下一步
+                int hs = users[sock_fd].tls_handshake();
+                if(hs < 0){
                     users[sock_fd].conn_close();
-                    http_conn::m_timer_lst.del_timer(users[sock_fd].timer);  // 移除其对应的定时器
+                    http_conn::m_timer_lst.del_timer(users[sock_fd].timer);
+                }else if(hs > 0){
+                    read_request(users, sock_fd, pool);
                 }
-
+            }
+            else if(events[i].events & EPOLLIN){
+                EMlog(LOGLEVEL_DEBUG,"-------EPOLLIN-------\n\n");
+                read_request(users, sock_fd, pool);
             }
             else if(events[i].events & EPOLLOUT){
                 EMlog(LOGLEVEL_DEBUG, "-------EPOLLOUT--------\n\n");
@@ -197,6 +341,23 @@ int main(int argc, char* argv[]){
                 }
             }
         }
+        // 根据线程池的负载暂停或恢复 accept，暂停期间新连接留在内核的 accept 队列中
+        bool overloaded = pool->overloaded();
+        if(overloaded != accept_paused){
+            accept_paused = overloaded;
+            epoll_event event;
+            event.data.fd = listen_fd;
+            event.events = accept_paused ? 0 : EPOLLIN | EPOLLRDHUP;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, listen_fd, &event);
+            if(tls_listen_fd >= 0){
+                event.data.fd = tls_listen_fd;
+                epoll_ctl(epoll_fd, EPOLL_CTL_MOD, tls_listen_fd, &event);
+            }
+            if(accept_paused){
+                metrics_inc(MC_ACCEPT_PAUSES);
+            }
+            EMlog(LOGLEVEL_WARN,"%s accepting new connections.\n", accept_paused ? "overloaded, pause" : "load dropped, resume");
+        }
         // 最后处理定时事件，因为I/O事件有更高的优先级。当然，这样做将导致定时任务不能精准的按照预定的时间执行。
         if(timeout) {
             // 定时处理任务，实际上就是调用tick()函数
@@ -208,9 +369,35 @@ int main(int argc, char* argv[]){
     }
     close(epoll_fd);
     close(listen_fd);
+    if(tls_listen_fd >= 0){
+        close(tls_listen_fd);
+    }
     close(pipefd[1]);
     close(pipefd[0]);
+    if(http_conn::m_done_fd >= 0){
+        close(http_conn::m_done_fd);
+    }
     delete[] users;
     delete pool;
+    #if PROXY_OPEN
+    proxy_close();
+    #endif
+    access_log_close();
+    capture_close();
+    scoreboard_close();
+    #if USE_TLS
+    tls_close();
+    #endif
+    #if PERF_STAGE_OPEN
+    std::string perf_report;    // 退出时输出各阶段的硬件计数器报告
+    perf_stage_report(perf_report);
+    fputs(perf_report.c_str(), stdout);
+    #endif
+    #if LOCK_PROFILE
+    std::string lock_report;    // 退出时输出锁竞争报告
+    lock_profile_report(lock_report);
+    fputs(lock_report.c_str(), stdout);
+    #endif
+    EM_log_close();         // 写完缓冲区中剩余的日志
     return 0;
 }
\ No newline at end of file
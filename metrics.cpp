@@ -0,0 +1,157 @@
+#include "metrics.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+__thread metrics_shard* t_metrics_shard = NULL;
+static std::atomic<metrics_shard*> g_shards(NULL);     // 所有线程分片的链表头
+
+// 导出直方图时使用的桶上界：1us、2us、4us ... 2^26us（约67秒）
+#define METRICS_EXPORT_MAX_POW 26
+
+static const char* counter_name[MC_NUM][2] = {      // 名称，说明
+    {"webserver_connections_accepted_total", "Accepted connections."},
+    {"webserver_connections_closed_total", "Closed connections."},
+    {"webserver_requests_total", "Requests read from clients."},
+    {"webserver_responses_total{code=\"2xx\"}", "Responses sent, by status class."},
+    {"webserver_responses_total{code=\"4xx\"}", NULL},
+    {"webserver_responses_total{code=\"5xx\"}", NULL},
+    {"webserver_sent_bytes_total", "Bytes written to client sockets."},
+    {"webserver_shed_requests_total{reason=\"queue_delay\"}", "Requests answered with 503 or 429 by admission control."},
+    {"webserver_shed_requests_total{reason=\"queue_full\"}", NULL},
+    {"webserver_shed_requests_total{reason=\"rate_limit\"}", NULL},
+    {"webserver_rejected_connections_total", "Connections answered with 503 because the connection table is full."},
+    {"webserver_limited_connections_total", "Connections answered with 429 because the per-client connection cap is reached."},
+    {"webserver_accept_pauses_total", "Times accepting new connections was paused because of overload."},
+    {"webserver_timeouts_total{phase=\"idle\"}", "Connections closed by the timer, by the phase they timed out in."},
+    {"webserver_timeouts_total{phase=\"header\"}", NULL},
+    {"webserver_timeouts_total{phase=\"body\"}", NULL},
+    {"webserver_timeouts_total{phase=\"send\"}", NULL},
+    {"webserver_idle_evictions_total", "Idle keep-alive connections closed to make room for new connections."},
+    {"webserver_priority_requests_total", "Requests put on the thread pool priority lane because their last response was small."},
+    {"webserver_write_yields_total", "Times a connection yielded the event loop after writing a full quantum."},
+    {"webserver_direct_writes_total", "Responses sent completely by the worker without waiting for EPOLLOUT."},
+    {"webserver_epoll_ctl_total", "epoll_ctl calls made for client connections and their upstream sockets."},
+    {"webserver_tls_handshakes_total{result=\"ok\"}", "TLS handshakes on the HTTPS listener."},
+    {"webserver_tls_handshakes_total{result=\"error\"}", NULL},
+    {"webserver_ktls_connections_total", "TLS connections whose send side was handed to kernel TLS."},
+    {"webserver_h2_connections_total", "Connections that switched to HTTP/2 (prior knowledge, h2c upgrade or ALPN)."},
+    {"webserver_h2_streams_total", "Requests received as HTTP/2 streams."},
+    {"webserver_proxy_requests_total", "Requests forwarded to an upstream."},
+    {"webserver_proxy_errors_total", "Proxied requests answered with 502 or 504."},
+    {"webserver_proxy_upstream_connects_total", "New connections opened to upstreams."},
+    {"webserver_proxy_upstream_reuses_total", "Proxied requests sent on a pooled keep-alive upstream connection."},
+    {"webserver_proxy_spliced_bytes_total", "Response body bytes moved from upstream to client sockets with splice."},
+    {"webserver_cache_hits_total", "Requests answered from the response microcache, including stale hits."},
+    {"webserver_cache_stale_total", "Cache hits served from an expired entry while it was being refreshed."},
+    {"webserver_cache_misses_total", "Cache misses fetched from the upstream by the request itself."},
+    {"webserver_cache_coalesced_total", "Requests that waited for another request's in-flight fetch instead of going upstream."},
+    {"webserver_cache_refreshes_total", "Background refreshes of stale cache entries."},
+    {"webserver_cache_evictions_total", "Cache entries evicted in LRU order to stay within the byte budget."},
+    {"webserver_coro_frame_allocs_total", "Coroutine frames allocated from the heap because the thread's frame pool was empty."},
+};
+
+static const char* gauge_name[MG_NUM][2] = {
+    {"webserver_connections", "Open client connections."},
+    {"webserver_queue_depth", "Requests waiting in the thread pool queue."},
+    {"webserver_idle_connections", "Keep-alive connections waiting for their next request."},
+    {"webserver_cache_bytes", "Bytes held by the response microcache."},
+};
+
+static const char* hist_name[MH_NUM][2] = {
+    {"webserver_first_byte_seconds", "Accept (or first request byte on keep-alive) to first response byte."},
+    {"webserver_queue_wait_seconds", "Time spent waiting in the thread pool queue."},
+    {"webserver_parse_seconds", "Time spent in process_read."},
+    {"webserver_response_seconds", "First request byte to last response byte."},
+};
+
+metrics_shard* metrics_shard_create(){
+    metrics_shard* shard = new metrics_shard;
+    memset((void*)shard, 0, sizeof(*shard));    // 原子类型在此平台上与 long 布局相同
+    metrics_shard* head = g_shards.load(std::memory_order_relaxed);
+    do{
+        shard->next = head;
+    }while(!g_shards.compare_exchange_weak(head, shard, std::memory_order_release, std::memory_order_relaxed));
+    t_metrics_shard = shard;
+    return shard;
+}
+
+long metrics_counter_get(METRIC_COUNTER c){
+    long sum = 0;
+    for(metrics_shard* s = g_shards.load(std::memory_order_acquire); s; s = s->next){
+        sum += s->counters[c].load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+long metrics_gauge_get(METRIC_GAUGE g){
+    long sum = 0;
+    for(metrics_shard* s = g_shards.load(std::memory_order_acquire); s; s = s->next){
+        sum += s->gauges[g].load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+// 追加一段格式化文本
+static void metrics_append(std::string& out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+static void metrics_append(std::string& out, const char* fmt, ...){
+    char buf[256];
+    va_list arg;
+    va_start(arg, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, arg);
+    va_end(arg);
+    out.append(buf, len < (int)sizeof(buf) ? len : sizeof(buf) - 1);
+}
+
+// 从带标签的名称中取出指标名，用于 HELP/TYPE 行
+static std::string metrics_base_name(const char* name){
+    const char* brace = strchr(name, '{');
+    return brace ? std::string(name, brace - name) : std::string(name);
+}
+
+void metrics_render(std::string& out){
+    out.clear();
+    for(int c = 0; c < MC_NUM; ++c){
+        if(counter_name[c][1]){
+            std::string base = metrics_base_name(counter_name[c][0]);
+            metrics_append(out, "# HELP %s %s\n# TYPE %s counter\n", base.c_str(), counter_name[c][1], base.c_str());
+        }
+        metrics_append(out, "%s %ld\n", counter_name[c][0], metrics_counter_get((METRIC_COUNTER)c));
+    }
+    for(int g = 0; g < MG_NUM; ++g){
+        metrics_append(out, "# HELP %s %s\n# TYPE %s gauge\n", gauge_name[g][0], gauge_name[g][1], gauge_name[g][0]);
+        metrics_append(out, "%s %ld\n", gauge_name[g][0], metrics_gauge_get((METRIC_GAUGE)g));
+    }
+
+    long buckets[METRICS_BUCKETS];
+    for(int h = 0; h < MH_NUM; ++h){
+        memset(buckets, 0, sizeof(buckets));
+        long sum = 0;
+        for(metrics_shard* s = g_shards.load(std::memory_order_acquire); s; s = s->next){
+            for(int b = 0; b < METRICS_BUCKETS; ++b){
+                buckets[b] += s->hist[h][b].load(std::memory_order_relaxed);
+            }
+            sum += s->hist_sum[h].load(std::memory_order_relaxed);
+        }
+
+        const char* name = hist_name[h][0];
+        metrics_append(out, "# HELP %s %s\n# TYPE %s histogram\n", name, hist_name[h][1], name);
+        // le 包含边界：值按 v-1 分桶，2的幂恰好是 HDR 分桶的边界，
+        // le=2^k 的累计值即 2^k 所在桶之前所有桶之和，也就是所有不超过 2^k 微秒的值
+        long cum = 0;
+        int b = 0;
+        for(int k = 0; k <= METRICS_EXPORT_MAX_POW; ++k){
+            int end = metrics_bucket(1UL << k);
+            for( ; b < end; ++b){
+                cum += buckets[b];
+            }
+            metrics_append(out, "%s_bucket{le=\"%g\"} %ld\n", name, (double)(1UL << k) / 1e6, cum);
+        }
+        for( ; b < METRICS_BUCKETS; ++b){
+            cum += buckets[b];
+        }
+        metrics_append(out, "%s_bucket{le=\"+Inf\"} %ld\n", name, cum);
+        metrics_append(out, "%s_sum %g\n", name, (double)sum / 1e6);
+        metrics_append(out, "%s_count %ld\n", name, cum);
+    }
+}
@@ -0,0 +1,136 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <string>
+
+/*
+    运行指标统计
+    每个线程第一次更新指标时创建自己的分片（shard），之后只写本线程的分片：计数器和仪表都是
+    "读-加-写" 的 relaxed 原子操作，没有锁也没有总线锁定指令。读取时把所有分片相加，
+    仪表（如连接数）可以在一个线程加、另一个线程减，各分片的值可能为负，但总和是准确的。
+    延迟直方图采用 HDR 风格的对数-线性分桶：每个2的幂区间再等分为 8 个子桶，相对误差不超过 12.5%。
+    通过 /metrics 路径以 Prometheus 文本格式输出。
+*/
+
+#define METRICS_PATH "/metrics"     // 输出指标的内部路径
+#define METRICS_ALLOW_REMOTE 0      // 是否允许非本机（127.0.0.0/8）客户端访问 /metrics
+
+// 计数器，只增不减
+enum METRIC_COUNTER {
+    MC_CONN_ACCEPTED = 0,   // 接受的连接数
+    MC_CONN_CLOSED,         // 关闭的连接数
+    MC_REQUESTS,            // 读取到的请求数
+    MC_RESP_2XX,            // 按状态码分类的响应数
+    MC_RESP_4XX,
+    MC_RESP_5XX,
+    MC_BYTES_SENT,          // 发送的字节数
+    MC_SHED_QUEUE_DELAY,    // 排队时间超过目标而回复 503 的请求数
+    MC_SHED_QUEUE_FULL,     // 线程池队列满而回复 503 的请求数
+    MC_SHED_RATE_LIMIT,     // 客户端超过请求速率而回复 429 的请求数，以上三项与 SHED_REASON 顺序一致
+    MC_CONN_REJECTED,       // 连接数已满而在 accept 后回复 503 的连接数
+    MC_CONN_LIMITED,        // 客户端（或所在网段）连接数超限而在 accept 后回复 429 的连接数
+    MC_ACCEPT_PAUSES,       // 因过载暂停 accept 的次数
+    MC_TIMEOUT_IDLE,        // 按阶段统计的超时关闭的连接数，顺序与 http_conn::CONN_PHASE 一致
+    MC_TIMEOUT_HEADER,
+    MC_TIMEOUT_BODY,
+    MC_TIMEOUT_SEND,
+    MC_IDLE_EVICTED,        // 接近连接容量时被关闭的空闲长连接数
+    MC_PRIORITY_REQUESTS,   // 进入线程池优先队列的请求数
+    MC_WRITE_YIELDS,        // 发送满一个时间片后让出事件循环的次数
+    MC_WRITE_DIRECT,        // 由工作线程直接发送完、不需要等待 EPOLLOUT 的响应数
+    MC_EPOLL_CTL,           // 客户端连接上的 epoll_ctl 调用数（注册和重新注册）
+    MC_TLS_HANDSHAKES,      // 完成的 TLS 握手数
+    MC_TLS_HANDSHAKE_ERRORS,    // 失败的 TLS 握手数
+    MC_KTLS_CONNS,          // 发送方向启用了内核 TLS 的连接数
+    MC_H2_CONNS,            // 切换到 HTTP/2 的连接数
+    MC_H2_STREAMS,          // HTTP/2 连接上的请求（流）数
+    MC_PROXY_REQUESTS,      // 转发给上游的请求数
+    MC_PROXY_ERRORS,        // 转发失败而回复 502/504 的请求数
+    MC_PROXY_CONNECTS,      // 新建的上游连接数
+    MC_PROXY_REUSES,        // 使用连接池中长连接的转发请求数
+    MC_PROXY_SPLICED,       // 用 splice 从上游转给客户端的响应体字节数
+    MC_CACHE_HITS,          // 由微缓存回复的请求数（包括过期后仍返回的）
+    MC_CACHE_STALE,         // 其中返回过期条目的请求数
+    MC_CACHE_MISSES,        // 未命中、由本请求从上游获取并填充缓存的请求数
+    MC_CACHE_COALESCED,     // 等待其他请求正在进行的获取、随后命中的请求数
+    MC_CACHE_REFRESHES,     // 后台刷新过期条目的次数
+    MC_CACHE_EVICTIONS,     // 因超过字节预算按 LRU 淘汰的条目数
+    MC_CORO_FRAME_ALLOCS,   // 帧池没有空闲帧而从堆上分配的协程帧数（见 coro.h）
+    MC_NUM
+};
+
+// 仪表，可增可减
+enum METRIC_GAUGE {
+    MG_CONNECTIONS = 0,     // 当前连接数
+    MG_QUEUE_DEPTH,         // 线程池队列中等待的请求数
+    MG_IDLE_CONNECTIONS,    // 处理完请求、等待下一个请求的长连接数
+    MG_CACHE_BYTES,         // 微缓存占用的字节数
+    MG_NUM
+};
+
+// 延迟直方图，单位微秒
+enum METRIC_HIST {
+    MH_FIRST_BYTE = 0,      // 从连接建立（长连接的后续请求为收到第一个字节）到写出响应的第一个字节
+    MH_QUEUE_WAIT,          // 在线程池队列中的等待时间
+    MH_PARSE,               // process_read 解析请求的时间
+    MH_TOTAL,               // 从收到请求第一个字节到响应发送完毕
+    MH_NUM
+};
+
+#define METRICS_SUB_BITS 3                              // 每个2的幂区间的子桶数为 2^3
+#define METRICS_SUB_CNT (1 << METRICS_SUB_BITS)
+#define METRICS_BUCKETS ((40 - METRICS_SUB_BITS + 1) * METRICS_SUB_CNT)   // 覆盖到 2^40 微秒
+
+// 值 v 所在的桶
+inline int metrics_bucket(unsigned long v){
+    if(v < METRICS_SUB_CNT){
+        return v;                                       // 最小的区间每个值一个桶
+    }
+    int msb = 63 - __builtin_clzl(v);
+    int idx = (msb - METRICS_SUB_BITS + 1) * METRICS_SUB_CNT + ((v >> (msb - METRICS_SUB_BITS)) & (METRICS_SUB_CNT - 1));
+    return idx < METRICS_BUCKETS ? idx : METRICS_BUCKETS - 1;
+}
+
+// 每个线程的指标分片，按缓存行对齐，避免不同线程的分片互相伪共享
+struct alignas(64) metrics_shard {
+    std::atomic<long> counters[MC_NUM];
+    std::atomic<long> gauges[MG_NUM];
+    std::atomic<long> hist_sum[MH_NUM];
+    std::atomic<long> hist[MH_NUM][METRICS_BUCKETS];
+    metrics_shard* next;        // 所有分片串成单链表，只增不删
+};
+
+extern __thread metrics_shard* t_metrics_shard;
+metrics_shard* metrics_shard_create();      // 创建当前线程的分片并挂到全局链表
+
+inline metrics_shard* metrics_shard_get(){
+    metrics_shard* shard = t_metrics_shard;
+    return shard ? shard : metrics_shard_create();
+}
+
+// 只有分片所属线程会写，因此无需原子的读-改-写
+inline void metrics_add(std::atomic<long>& slot, long v){
+    slot.store(slot.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+}
+
+inline void metrics_inc(METRIC_COUNTER c, long v = 1){
+    metrics_add(metrics_shard_get()->counters[c], v);
+}
+
+inline void metrics_gauge_add(METRIC_GAUGE g, long v){
+    metrics_add(metrics_shard_get()->gauges[g], v);
+}
+
+inline void metrics_observe(METRIC_HIST h, long us){
+    if(us < 0) us = 0;
+    metrics_shard* shard = metrics_shard_get();
+    metrics_add(shard->hist[h][metrics_bucket(us > 0 ? us - 1 : 0)], 1);    // 按 us-1 分桶，桶是左开右闭区间，与 le 的含义一致
+    metrics_add(shard->hist_sum[h], us);
+}
+
+long metrics_counter_get(METRIC_COUNTER c);     // 所有分片求和
+long metrics_gauge_get(METRIC_GAUGE g);
+void metrics_render(std::string& out);          // 以 Prometheus 文本格式输出所有指标
+
+#endif
@@ -0,0 +1,243 @@
+#include "microcache.h"
+#include "locker.h"
+#include "metrics.h"
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <time.h>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+
+#define MCACHE_VARY_MAX 1024            // 每个分片记录的 Vary 头部名的 URL 数，超过时清空重新记录
+#define MCACHE_ENTRY_OVERHEAD 128       // 每个条目在键和内容之外的估计开销：字节
+
+struct mcache_slot {
+    mcache_ref e;
+    long bytes;
+    std::list<std::string>::iterator lru;
+};
+
+struct mcache_shard {
+    locker lock;
+    cond done;                          // 获取结束（存入或放弃），唤醒等待的请求
+    std::unordered_map<std::string, mcache_slot> entries;
+    std::list<std::string> lru;         // 最近使用的在前
+    std::unordered_set<std::string> inflight;   // 正在获取或刷新的键
+    std::unordered_map<std::string, std::vector<std::string>> vary;  // 以 base 为键
+    long bytes;
+
+    mcache_shard() : lock("mcache.shard"), done("mcache.done"), bytes(0) {}
+};
+
+static mcache_shard g_shards[MCACHE_SHARDS];
+
+static mcache_shard& shard_of(const std::string& key){
+    return g_shards[std::hash<std::string>()(key) % MCACHE_SHARDS];
+}
+
+// 以下函数调用时持有分片的锁
+static void remove_slot(mcache_shard& sh, std::unordered_map<std::string, mcache_slot>::iterator it){
+    sh.bytes -= it->second.bytes;
+    metrics_gauge_add(MG_CACHE_BYTES, -it->second.bytes);
+    sh.lru.erase(it->second.lru);
+    sh.entries.erase(it);
+}
+
+static void insert_slot(mcache_shard& sh, const mcache_ref& ref){
+    auto it = sh.entries.find(ref->key);
+    if(it != sh.entries.end()){
+        remove_slot(sh, it);            // 替换旧的条目，正在发送它的连接仍持有引用
+    }
+    long bytes = 2 * ref->key.size() + ref->reason.size() + ref->headers.size() + ref->content_type.size()
+                 + ref->body.size() + MCACHE_ENTRY_OVERHEAD;
+    if(bytes > MCACHE_MAX_BYTES / MCACHE_SHARDS){
+        return;
+    }
+    sh.lru.push_front(ref->key);
+    mcache_slot& slot = sh.entries[ref->key];
+    slot.e = ref;
+    slot.bytes = bytes;
+    slot.lru = sh.lru.begin();
+    sh.bytes += bytes;
+    metrics_gauge_add(MG_CACHE_BYTES, bytes);
+    while(sh.bytes > MCACHE_MAX_BYTES / MCACHE_SHARDS){
+        remove_slot(sh, sh.entries.find(sh.lru.back()));
+        metrics_inc(MC_CACHE_EVICTIONS);
+    }
+}
+
+void mcache_vary(const std::string& base, std::vector<std::string>& names){
+    names.clear();
+    mcache_shard& sh = shard_of(base);
+    sh.lock.lock();
+    auto it = sh.vary.find(base);
+    if(it != sh.vary.end()){
+        names = it->second;
+    }
+    sh.lock.unlock();
+}
+
+MCACHE_RESULT mcache_lookup(const std::string& key, mcache_ref& ref, bool can_refresh){
+    mcache_shard& sh = shard_of(key);
+    long deadline = 0;
+    sh.lock.lock();
+    for(;;){
+        long now = mcache_now_ms();
+        auto it = sh.entries.find(key);
+        if(it != sh.entries.end()){
+            const mcache_ref& e = it->second.e;
+            if(e->pass && now < e->fresh_until){
+                sh.lock.unlock();
+                return MCACHE_PASS;
+            }
+            if(!e->pass && now < e->stale_until){
+                sh.lru.splice(sh.lru.begin(), sh.lru, it->second.lru);
+                ref = e;
+                MCACHE_RESULT ret = MCACHE_HIT;
+                if(now >= e->fresh_until){
+                    ret = can_refresh && sh.inflight.insert(key).second ? MCACHE_REFRESH : MCACHE_STALE;
+                }
+                sh.lock.unlock();
+                metrics_inc(MC_CACHE_HITS);
+                if(ret != MCACHE_HIT) metrics_inc(MC_CACHE_STALE);
+                if(deadline) metrics_inc(MC_CACHE_COALESCED);
+                return ret;
+            }
+            remove_slot(sh, it);        // 超过了可以返回旧响应的期限
+        }
+        if(sh.inflight.insert(key).second){
+            sh.lock.unlock();
+            metrics_inc(MC_CACHE_MISSES);
+            return MCACHE_MISS;
+        }
+        // 其他请求正在获取，等待其结果
+        if(!deadline){
+            deadline = now + MCACHE_WAIT_MS;
+        }else if(now >= deadline){
+            sh.lock.unlock();
+            return MCACHE_PASS;
+        }
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);     // 条件变量使用系统时钟的绝对时间
+        long ns = ts.tv_nsec + (deadline - now) % 1000 * 1000000L;
+        ts.tv_sec += (deadline - now) / 1000 + ns / 1000000000L;
+        ts.tv_nsec = ns % 1000000000L;
+        sh.done.timedwait(sh.lock.get(), ts);
+    }
+}
+
+// Cache-Control 中 "名字=秒数" 形式的指令，没有时返回 -1
+static long directive_secs(const char* p, const char* name){
+    size_t len = strlen(name);
+    if(strncasecmp(p, name, len) != 0 || p[len] != '='){
+        return -1;
+    }
+    p += len + 1;
+    if(*p == '"') ++p;
+    return atol(p);
+}
+
+bool mcache_policy(int status, const std::string& headers, mcache_entry* e){
+    switch(status){
+        case 200: case 203: case 204: case 300: case 301: case 308: case 404: case 410:
+            break;
+        default:
+            return false;       // 其他状态码（包括错误）不缓存
+    }
+    long ttl = -1, s_maxage = -1, stale = MCACHE_STALE_TTL;
+    e->vary.clear();
+    for(size_t pos = 0; pos < headers.size(); ){
+        size_t end = headers.find("\r\n", pos);
+        if(end == std::string::npos) end = headers.size();
+        std::string line = headers.substr(pos, end - pos);
+        pos = end + 2;
+        size_t colon = line.find(':');
+        if(colon == std::string::npos) continue;
+        std::string name = line.substr(0, colon);
+        const char* value = line.c_str() + colon + 1;
+        if(strcasecmp(name.c_str(), "Set-Cookie") == 0){
+            return false;       // 针对单个客户端的响应
+        }
+        bool cc = strcasecmp(name.c_str(), "Cache-Control") == 0;
+        bool vary = strcasecmp(name.c_str(), "Vary") == 0;
+        if(!cc && !vary) continue;
+        // 逗号分隔的列表
+        for(const char* p = value; *p; ){
+            p += strspn(p, " \t,");
+            size_t n = strcspn(p, ",");
+            std::string item(p, n);
+            while(!item.empty() && (item.back() == ' ' || item.back() == '\t')) item.pop_back();
+            p += n;
+            if(item.empty()) continue;
+            if(vary){
+                if(item == "*") return false;
+                for(char& ch : item) ch = tolower((unsigned char)ch);
+                e->vary.push_back(item);
+                continue;
+            }
+            if(strcasecmp(item.c_str(), "private") == 0 || strcasecmp(item.c_str(), "no-store") == 0
+               || strncasecmp(item.c_str(), "no-cache", 8) == 0){
+                return false;
+            }
+            long v;
+            if((v = directive_secs(item.c_str(), "s-maxage")) >= 0) s_maxage = v;
+            else if((v = directive_secs(item.c_str(), "max-age")) >= 0) ttl = v;
+            else if((v = directive_secs(item.c_str(), "stale-while-revalidate")) >= 0) stale = v;
+        }
+    }
+    if(s_maxage >= 0) ttl = s_maxage;       // 共享缓存优先使用 s-maxage
+    if(ttl < 0) ttl = MCACHE_TTL;
+    if(ttl == 0){
+        return false;
+    }
+    e->pass = false;
+    e->stored = mcache_now_ms();
+    e->fresh_until = e->stored + ttl * 1000;
+    e->stale_until = e->fresh_until + stale * 1000;
+    return true;
+}
+
+mcache_ref mcache_store(const std::string& key, const std::string& base, mcache_entry* e){
+    mcache_ref ref(e);
+    if(!e->vary.empty()){
+        mcache_shard& vs = shard_of(base);
+        vs.lock.lock();
+        if(vs.vary.size() >= MCACHE_VARY_MAX && vs.vary.find(base) == vs.vary.end()){
+            vs.vary.clear();
+        }
+        vs.vary[base] = e->vary;
+        vs.lock.unlock();
+    }
+    mcache_shard& es = shard_of(e->key);
+    es.lock.lock();
+    insert_slot(es, ref);
+    es.lock.unlock();
+
+    // 键随 Vary 改变时，等待原来的键的请求被唤醒后重新获取
+    mcache_shard& sh = shard_of(key);
+    sh.lock.lock();
+    sh.inflight.erase(key);
+    sh.done.broadcast();
+    sh.lock.unlock();
+    return ref;
+}
+
+void mcache_abort(const std::string& key, bool pass){
+    mcache_shard& sh = shard_of(key);
+    sh.lock.lock();
+    sh.inflight.erase(key);
+    // 获取失败（pass 为 false）时保留过期的条目，下一个请求重新获取
+    if(pass){
+        mcache_entry* e = new mcache_entry();
+        e->key = key;
+        e->status = 0;
+        e->pass = true;
+        e->stored = mcache_now_ms();
+        e->fresh_until = e->stale_until = e->stored + MCACHE_PASS_TTL * 1000;
+        insert_slot(sh, mcache_ref(e));
+    }
+    sh.done.broadcast();
+    sh.lock.unlock();
+}
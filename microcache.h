@@ -0,0 +1,73 @@
+#ifndef MICROCACHE_H
+#define MICROCACHE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include "mono_clock.h"
+
+/*
+    响应微缓存
+    热门的动态资源在流量突增时，大量并发请求同时未命中，全部落到后端。微缓存把可缓存的响应在内存中保留
+    很短的时间（默认 MCACHE_TTL 秒），后端的负载只取决于不同 URL 的数量，与请求数无关。
+
+    1. 键：方法、Host 和 URL，加上响应 Vary 中列出的请求头部的值。同一 URL 的 Vary 头部名在第一次
+       存入时记录（mcache_vary），之后的请求先取出头部名再计算完整的键。Vary: * 的响应不缓存。
+    2. 合并请求（single-flight）：同一个键同时只有一个请求向后端获取，其余的等待它的结果（最长
+       MCACHE_WAIT_MS），随后直接命中。获取到不可缓存的响应时记录一个"不缓存"标记（MCACHE_PASS_TTL 秒），
+       期间的请求不再排队等待，直接转发。
+    3. 期限：响应的 Cache-Control 中有 s-maxage / max-age 时使用它，否则为 MCACHE_TTL；过期后
+       MCACHE_STALE_TTL 秒内（或 stale-while-revalidate 给出的时间）仍返回旧的响应，同时由第一个发现过期的
+       请求刷新，其他请求不等待。private、no-store、no-cache 以及带 Set-Cookie 的响应不缓存。
+    4. 按键的哈希分成 MCACHE_SHARDS 个分片，各自加锁，总字节数超过 MCACHE_MAX_BYTES 时按 LRU 淘汰。
+       条目以 shared_ptr 共享，正在发送的响应引用的条目被淘汰或替换后，在发送完毕时才释放。
+*/
+
+#ifndef MCACHE_OPEN
+#define MCACHE_OPEN 1
+#endif
+#define MCACHE_SHARDS 16                    // 分片数
+#define MCACHE_MAX_BYTES (64 * 1024 * 1024) // 字节预算，平均分给各分片
+#define MCACHE_MAX_ENTRY (1024 * 1024)      // 单个响应体的上限，更大的响应不缓存
+#define MCACHE_TTL 1                        // 响应没有给出 max-age 时的缓存时间：秒
+#define MCACHE_STALE_TTL 10                 // 过期后仍可返回旧响应（同时刷新）的时间：秒
+#define MCACHE_PASS_TTL 5                   // "不缓存"标记的有效时间：秒
+#define MCACHE_WAIT_MS 10000                // 等待其他请求获取结果的最长时间，超时后自行转发
+
+// 一个缓存的响应，存入后只读
+struct mcache_entry {
+    std::string key;
+    int status;
+    std::string reason;
+    std::string headers;                // 原样转发的响应头部（"名字: 值\r\n"）
+    std::string content_type;
+    std::string body;
+    std::vector<std::string> vary;      // Vary 中的请求头部名，小写
+    bool pass;                          // "不缓存"标记，没有响应
+    long stored;                        // 存入的时间（单调时钟：毫秒，下同）
+    long fresh_until;
+    long stale_until;
+};
+typedef std::shared_ptr<const mcache_entry> mcache_ref;
+
+enum MCACHE_RESULT {
+    MCACHE_HIT = 0,     // 新鲜的条目
+    MCACHE_STALE,       // 过期的条目，已有其他请求在刷新
+    MCACHE_REFRESH,     // 过期的条目，由调用者负责刷新，完成后调用 mcache_store 或 mcache_abort
+    MCACHE_MISS,        // 没有可用的条目，由调用者获取，完成后调用 mcache_store 或 mcache_abort
+    MCACHE_PASS,        // 不使用缓存：最近的响应不可缓存，或者等待其他请求超时
+};
+
+inline long mcache_now_ms(){ return get_mono_us() / 1000; }    // 条目时间戳使用的单调时钟：毫秒
+// 取出 base（方法、Host 和 URL）记录的 Vary 头部名，没有记录时为空
+void mcache_vary(const std::string& base, std::vector<std::string>& names);
+// 查找完整的键。同一个键正在获取时等待其结果；can_refresh 为 false 时过期的条目只返回 MCACHE_STALE
+MCACHE_RESULT mcache_lookup(const std::string& key, mcache_ref& ref, bool can_refresh);
+// 按状态码和响应头部决定是否可以缓存，可以时设置 e 的期限和 Vary 头部名
+bool mcache_policy(int status, const std::string& headers, mcache_entry* e);
+// 结束 key 的获取并存入 e（e->key 为按响应的 Vary 重新计算的键，可以与 key 不同），唤醒等待的请求
+mcache_ref mcache_store(const std::string& key, const std::string& base, mcache_entry* e);
+// 结束 key 的获取但不存入；pass 为 true 时响应不可缓存，记录"不缓存"标记并替换旧的条目
+void mcache_abort(const std::string& key, bool pass);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef MONO_CLOCK_H
+#define MONO_CLOCK_H
+
+#include <time.h>
+
+// 单调时钟的当前时间：微秒，用于统计耗时和计算期限。clock_gettime 经由 vDSO 完成，不陷入内核
+inline long get_mono_us(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+#endif
@@ -0,0 +1,175 @@
+#include "perf_stage.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <atomic>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// 计数方式
+enum PERF_MODE { PM_UNINIT = 0, PM_PERF, PM_TSC };
+
+// 每个线程的计数器组和统计结果
+struct perf_thread {
+    int mode;                               // PERF_MODE
+    int leader_fd;                          // 计数器组的组长（cycles）
+    int tid;
+    uint64_t calls[PS_NUM];
+    uint64_t sums[PS_NUM][PC_NUM];
+    perf_thread* next;
+};
+
+static std::atomic<perf_thread*> g_threads(NULL);
+static __thread perf_thread* t_perf = NULL;
+
+static const char* stage_name[PS_NUM] = {"parse_one_line", "parse_request_headers", "do_request", "process_write", "writev"};
+
+static const uint64_t counter_config[PC_NUM] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+static uint64_t perf_tsc(){
+    #if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+    #else
+    struct timespec ts;                     // 没有 rdtsc 的平台用纳秒代替
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    #endif
+}
+
+static int perf_open(uint64_t config, int group_fd, bool exclude_kernel){
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.disabled = group_fd == -1;         // 组长先关闭，整组创建完后再打开
+    attr.exclude_kernel = exclude_kernel;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);     // 只统计当前线程
+}
+
+// 为当前线程创建计数器组，先尝试包括内核态（writev 的开销主要在内核），失败则只统计用户态
+static bool perf_open_group(perf_thread* t){
+    for(int exclude_kernel = 0; exclude_kernel <= 1; ++exclude_kernel){
+        int fds[PC_NUM];
+        int n = 0;
+        for( ; n < PC_NUM; ++n){
+            fds[n] = perf_open(counter_config[n], n == 0 ? -1 : fds[0], exclude_kernel);
+            if(fds[n] == -1) break;
+        }
+        if(n == PC_NUM){
+            t->leader_fd = fds[0];
+            ioctl(t->leader_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(t->leader_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+            return true;
+        }
+        for(int i = 0; i < n; ++i){
+            close(fds[i]);
+        }
+    }
+    return false;
+}
+
+static perf_thread* perf_thread_get(){
+    if(!t_perf){
+        perf_thread* t = new perf_thread;
+        memset(t, 0, sizeof(*t));
+        t->leader_fd = -1;
+        t->tid = syscall(SYS_gettid);
+        t->mode = perf_open_group(t) ? PM_PERF : PM_TSC;
+        perf_thread* head = g_threads.load(std::memory_order_relaxed);
+        do{
+            t->next = head;
+        }while(!g_threads.compare_exchange_weak(head, t, std::memory_order_release, std::memory_order_relaxed));
+        t_perf = t;
+    }
+    return t_perf;
+}
+
+void perf_stage_read(uint64_t* values){
+    perf_thread* t = perf_thread_get();
+    if(t->mode == PM_PERF){
+        struct { uint64_t nr; uint64_t values[PC_NUM]; } data;
+        if(read(t->leader_fd, &data, sizeof(data)) == (ssize_t)sizeof(data)){
+            memcpy(values, data.values, sizeof(data.values));
+            return;
+        }
+    }
+    memset(values, 0, sizeof(uint64_t) * PC_NUM);
+    values[PC_CYCLES] = perf_tsc();
+}
+
+void perf_stage_add(PERF_STAGE stage, const uint64_t* start){
+    uint64_t now[PC_NUM];
+    perf_stage_read(now);
+    perf_thread* t = t_perf;
+    // 只有所属线程写，报告时读到的可能是稍旧的值
+    ++t->calls[stage];
+    for(int c = 0; c < PC_NUM; ++c){
+        t->sums[stage][c] += now[c] - start[c];
+    }
+}
+
+static void perf_append(std::string& out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+static void perf_append(std::string& out, const char* fmt, ...){
+    char buf[256];
+    va_list arg;
+    va_start(arg, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, arg);
+    va_end(arg);
+    out.append(buf, len < (int)sizeof(buf) ? len : sizeof(buf) - 1);
+}
+
+static void perf_report_line(std::string& out, const char* name, int tid, uint64_t calls, const uint64_t* sums, bool tsc){
+    double n = calls ? calls : 1;
+    if(tsc){
+        perf_append(out, "%-22s %8d %12lu %14.1f %10s %10s %12s %12s\n", name, tid, (unsigned long)calls,
+                    sums[PC_CYCLES] / n, "-", "-", "-", "-");
+        return;
+    }
+    perf_append(out, "%-22s %8d %12lu %14.1f %10.1f %10.2f %12.3f %12.3f\n", name, tid, (unsigned long)calls,
+                sums[PC_CYCLES] / n, sums[PC_INSTRUCTIONS] / n,
+                sums[PC_CYCLES] ? (double)sums[PC_INSTRUCTIONS] / sums[PC_CYCLES] : 0.0,
+                sums[PC_CACHE_MISSES] / n, sums[PC_BRANCH_MISSES] / n);
+}
+
+void perf_stage_report(std::string& out){
+    out.clear();
+    uint64_t calls[PS_NUM] = {0};
+    uint64_t sums[PS_NUM][PC_NUM] = {{0}};
+    bool tsc = false;                   // 有线程退化为 rdtsc 时，汇总只有周期数有意义
+    for(perf_thread* t = g_threads.load(std::memory_order_acquire); t; t = t->next){
+        tsc = tsc || t->mode == PM_TSC;
+        for(int s = 0; s < PS_NUM; ++s){
+            calls[s] += t->calls[s];
+            for(int c = 0; c < PC_NUM; ++c){
+                sums[s][c] += t->sums[s][c];
+            }
+        }
+    }
+
+    perf_append(out, "per-stage counters (%s), averages per call\n",
+                tsc ? "rdtsc fallback, perf_event_open unavailable" : "perf_event_open");
+    perf_append(out, "%-22s %8s %12s %14s %10s %10s %12s %12s\n", "stage", "tid", "calls",
+                "cycles", "instr", "IPC", "cache-miss", "branch-miss");
+    for(int s = 0; s < PS_NUM; ++s){
+        perf_report_line(out, stage_name[s], 0, calls[s], sums[s], tsc);
+    }
+    out.append("\nper thread\n");
+    for(perf_thread* t = g_threads.load(std::memory_order_acquire); t; t = t->next){
+        for(int s = 0; s < PS_NUM; ++s){
+            if(t->calls[s]){
+                perf_report_line(out, stage_name[s], t->tid, t->calls[s], t->sums[s], t->mode == PM_TSC);
+            }
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef PERF_STAGE_H
+#define PERF_STAGE_H
+
+#include <stdint.h>
+#include <string>
+
+/*
+    热点阶段的硬件计数器统计（编译选项，默认关闭，-DPERF_STAGE_OPEN=1 打开）
+    在 parse_one_line、parse_request_headers、do_request、process_write、writev 外包一个作用域计数器，
+    进入和离开作用域时读取本线程的 perf_event_open 计数器组（cycles、instructions、cache-misses、
+    branch-misses），差值累加到本线程的统计中。perf_event_open 不可用时（内核不支持或权限不足）
+    退化为只用 rdtsc 统计周期数。关闭时 PERF_SCOPE 展开为空，没有任何开销。
+    每次进出作用域各有一次 read 系统调用，只适合用来找热点，不适合压测时长期打开。
+    报告在服务器退出时输出到标准输出，或通过 PERF_PATH 获取。
+*/
+
+#ifndef PERF_STAGE_OPEN
+#define PERF_STAGE_OPEN 0
+#endif
+
+#define PERF_PATH "/debug/perf"     // 获取报告的内部路径
+
+enum PERF_STAGE {
+    PS_PARSE_ONE_LINE = 0,
+    PS_PARSE_HEADERS,
+    PS_DO_REQUEST,
+    PS_PROCESS_WRITE,
+    PS_WRITEV,
+    PS_NUM
+};
+
+enum PERF_COUNTER { PC_CYCLES = 0, PC_INSTRUCTIONS, PC_CACHE_MISSES, PC_BRANCH_MISSES, PC_NUM };
+
+void perf_stage_read(uint64_t* values);                 // 读取本线程的当前计数
+void perf_stage_add(PERF_STAGE stage, const uint64_t* start);   // 累加从 start 到现在的差值
+void perf_stage_report(std::string& out);               // 按阶段输出每次调用的平均值、IPC 和各线程的分项
+
+// 作用域计数器
+class perf_scope {
+public:
+    explicit perf_scope(PERF_STAGE stage) : m_stage(stage) {
+        perf_stage_read(m_start);
+    }
+    ~perf_scope(){
+        perf_stage_add(m_stage, m_start);
+    }
+private:
+    PERF_STAGE m_stage;
+    uint64_t m_start[PC_NUM];
+};
+
+#if PERF_STAGE_OPEN
+#define PERF_SCOPE(stage) perf_scope perf_scope_guard(stage)
+#else
+#define PERF_SCOPE(stage) do{}while(0)
+#endif
+
+#endif
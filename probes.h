@@ -0,0 +1,44 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+    USDT 静态探针（provider 名为 webserver）
+    使用 systemtap-sdt-dev 提供的 <sys/sdt.h>，它只在代码中插入一条 nop 并在 ELF 的 .note.stapsdt
+    段中登记探针位置，没有运行时依赖；没有挂载探针时只有一条 nop 的开销。
+    编译环境没有 sys/sdt.h，或者定义了 NO_USDT 时，所有探针展开为空。
+
+    探针及参数：
+    accept          (fd, 客户端地址 网络字节序, 客户端端口 网络字节序)   main 中 accept 返回后
+    conn_init       (fd, 客户端地址 网络字节序)                         http_conn::init
+    read_done       (fd, 已读入的字节数)                               http_conn::read 读完本次数据
+    queue_enqueue   (任务指针, 入队后的队列长度)                        threadpool::append
+    queue_dequeue   (任务指针, 出队后的队列长度)                        threadpool::run 取出任务
+    process_read    (fd, HTTP_CODE)                                    http_conn::process 解析完请求
+    file_open       (fd, 文件路径, 文件大小)                            http_conn::do_request 打开目标文件
+    write_eagain    (fd, 已发送字节数, 剩余字节数)                      http_conn::write 遇到 EAGAIN
+    conn_close      (fd)                                               http_conn::conn_close
+    timer_expire    (连接指针, 超时时间)                               sort_timer_lst::tick 关闭超时连接
+
+    例如统计请求在队列中的等待时间：
+    bpftrace -e 'usdt:./webserver:webserver:queue_enqueue { @t[arg0] = nsecs; }
+                 usdt:./webserver:webserver:queue_dequeue /@t[arg0]/ { @us = hist((nsecs - @t[arg0]) / 1000); delete(@t[arg0]); }'
+*/
+
+#if !defined(NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define WS_USDT 1
+#endif
+#endif
+
+#ifdef WS_USDT
+#define WS_PROBE1(name, a1) DTRACE_PROBE1(webserver, name, a1)
+#define WS_PROBE2(name, a1, a2) DTRACE_PROBE2(webserver, name, a1, a2)
+#define WS_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(webserver, name, a1, a2, a3)
+#else
+#define WS_PROBE1(name, a1) do{}while(0)
+#define WS_PROBE2(name, a1, a2) do{}while(0)
+#define WS_PROBE3(name, a1, a2, a3) do{}while(0)
+#endif
+
+#endif
@@ -0,0 +1,735 @@
+#include "proxy.h"
+#include "locker.h"
+#include "log.h"
+#include "metrics.h"
+#include "microcache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <atomic>
+#include <vector>
+#include <climits>
+#include <algorithm>
+
+#define PROXY_READ_CHUNK 16384          // 每次从上游读取的最大字节数
+#define PROXY_HEALTH_TIMEOUT_MS 1000    // 健康检查等待响应的超时时间
+
+static_assert(PROXY_MAX_UPSTREAMS <= 32, "tried upstreams are tracked in a 32-bit mask");
+
+struct proxy_upstream {
+    std::string name;                   // 配置中的地址，用于日志和缺省的 Host
+    sockaddr_storage addr;
+    socklen_t addr_len;
+    std::atomic<int> outstanding;       // 进行中的请求数
+    std::atomic<int> fails;             // 连续失败次数
+    std::atomic<bool> healthy;
+    locker lock;                        // 保护 idle
+    std::vector<proxy_conn*> idle;      // 空闲连接，末尾为最近放回的
+
+    proxy_upstream() : addr_len(0), outstanding(0), fails(0), healthy(true), lock("proxy.pool") {}
+};
+
+struct proxy_route {
+    std::string prefix;
+    std::vector<proxy_upstream*> ups;
+    mutable std::atomic<unsigned> rr;   // 负载相同时的轮询起点
+
+    proxy_route() : rr(0) {}
+};
+
+static std::vector<proxy_route*> g_routes;
+static std::vector<proxy_upstream*> g_upstreams;    // 所有路由的上游，地址相同的共用一个连接池
+static pthread_t g_checker;
+static std::atomic<bool> g_running(false);
+
+// 逐跳头部只对一个连接有效，不转发；Content-Length 和 Host 由转发方重新生成
+static const char* hop_headers[] = {
+    "Connection", "Keep-Alive", "Proxy-Connection", "TE", "Trailer", "Transfer-Encoding", "Upgrade",
+    "HTTP2-Settings", "Expect", "Content-Length", "Host", NULL
+};
+
+bool proxy_hop_header(const char* line){
+    const char* colon = strchr(line, ':');
+    if(!colon){
+        return true;        // 格式错误的行不转发
+    }
+    size_t len = colon - line;
+    for(const char** h = hop_headers; *h; ++h){
+        if(strlen(*h) == len && strncasecmp(line, *h, len) == 0){
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_addr(const char* s, proxy_upstream* up){
+    memset(&up->addr, 0, sizeof(up->addr));
+    if(strncmp(s, "unix:", 5) == 0){
+        sockaddr_un* un = (sockaddr_un*)&up->addr;
+        if(strlen(s + 5) == 0 || strlen(s + 5) >= sizeof(un->sun_path)){
+            return false;
+        }
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, s + 5);
+        up->addr_len = sizeof(sockaddr_un);
+        return true;
+    }
+    const char* colon = strrchr(s, ':');
+    if(!colon || colon == s){
+        return false;
+    }
+    std::string host(s, colon - s);
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host.c_str(), colon + 1, &hints, &res) != 0){
+        return false;
+    }
+    memcpy(&up->addr, res->ai_addr, res->ai_addrlen);
+    up->addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+static proxy_upstream* find_upstream(const char* name){
+    for(proxy_upstream* up : g_upstreams){
+        if(up->name == name){
+            return up;
+        }
+    }
+    proxy_upstream* up = new proxy_upstream;
+    up->name = name;
+    if(!parse_addr(name, up)){
+        delete up;
+        return NULL;
+    }
+    g_upstreams.push_back(up);
+    return up;
+}
+
+// 等待 fd 可读或可写，超时返回 false 并把 errno 设为 ETIMEDOUT
+static bool wait_fd(int fd, short events, int timeout_ms){
+    struct pollfd p = {fd, events, 0};
+    int n;
+    do{
+        n = poll(&p, 1, timeout_ms);
+    }while(n < 0 && errno == EINTR);
+    if(n == 0){
+        errno = ETIMEDOUT;
+    }
+    return n > 0;
+}
+
+// 非阻塞地连接上游，等待不超过 timeout_ms，返回非阻塞的套接字
+static int connect_upstream(const proxy_upstream* up, int timeout_ms){
+    int fd = socket(up->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0){
+        return -1;
+    }
+    if(connect(fd, (const sockaddr*)&up->addr, up->addr_len) < 0){
+        int err = errno;
+        if(err == EINPROGRESS){
+            socklen_t len = sizeof(err);
+            if(!wait_fd(fd, POLLOUT, timeout_ms)){
+                err = errno;
+            }else if(getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0){
+                err = errno;
+            }
+        }
+        if(err != 0){
+            close(fd);
+            errno = err;
+            return -1;
+        }
+    }
+    if(up->addr.ss_family == AF_INET){
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+// 池中的连接没有可读数据且未被关闭才能复用；有数据说明上游发来了意外的内容或关闭通知
+static bool conn_alive(const proxy_conn* c){
+    char b;
+    ssize_t n = recv(c->fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+static void close_conn(proxy_conn* c){
+    close(c->fd);
+    if(c->pipe[0] >= 0){
+        close(c->pipe[0]);
+        close(c->pipe[1]);
+    }
+    delete c;
+}
+
+static void upstream_failed(proxy_upstream* up){
+    if(up->fails.fetch_add(1, std::memory_order_relaxed) + 1 >= PROXY_MAX_FAILS && up->healthy.exchange(false)){
+        EMlog(LOGLEVEL_WARN, "proxy: upstream %s marked down after %d failures.\n", up->name.c_str(), PROXY_MAX_FAILS);
+    }
+}
+
+static proxy_conn* pool_get(proxy_upstream* up){
+    while(true){
+        proxy_conn* c = NULL;
+        up->lock.lock();
+        if(!up->idle.empty()){
+            c = up->idle.back();
+            up->idle.pop_back();
+        }
+        up->lock.unlock();
+        if(!c || conn_alive(c)){
+            return c;
+        }
+        close_conn(c);
+    }
+}
+
+// 关闭池中空闲过久或已被上游关闭的连接
+static void pool_reap(proxy_upstream* up){
+    std::vector<proxy_conn*> dead;
+    time_t now = time(NULL);
+    up->lock.lock();
+    auto keep = std::partition(up->idle.begin(), up->idle.end(), [&](proxy_conn* c){
+        return now - c->idle_since < PROXY_IDLE_TIMEOUT && conn_alive(c);
+    });
+    dead.assign(keep, up->idle.end());
+    up->idle.erase(keep, up->idle.end());
+    up->lock.unlock();
+    for(proxy_conn* c : dead){
+        close_conn(c);
+    }
+}
+
+// 在健康的上游中选择进行中请求数最少的，跳过 tried 中已尝试过的，没有可选的返回 -1
+static int pick(const proxy_route* r, unsigned tried){
+    int n = r->ups.size();
+    unsigned start = r->rr.fetch_add(1, std::memory_order_relaxed);
+    int best = -1, best_load = INT_MAX;
+    for(int i = 0; i < n; ++i){
+        int k = (start + i) % n;
+        const proxy_upstream* up = r->ups[k];
+        if((tried >> k & 1) || !up->healthy.load(std::memory_order_relaxed)){
+            continue;
+        }
+        int load = up->outstanding.load(std::memory_order_relaxed);
+        if(load < best_load){
+            best = k;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+proxy_conn* proxy_acquire(const proxy_route* route, bool fresh){
+    unsigned tried = 0;
+    while(true){
+        int k = pick(route, tried);
+        if(k < 0){
+            return NULL;
+        }
+        tried |= 1u << k;
+        proxy_upstream* up = route->ups[k];
+        up->outstanding.fetch_add(1, std::memory_order_relaxed);
+        proxy_conn* c = fresh ? NULL : pool_get(up);
+        if(c){
+            c->reused = true;
+            metrics_inc(MC_PROXY_REUSES);
+            return c;
+        }
+        int fd = connect_upstream(up, PROXY_CONNECT_TIMEOUT_MS);
+        if(fd >= 0){
+            metrics_inc(MC_PROXY_CONNECTS);
+            c = new proxy_conn;
+            c->fd = fd;
+            c->pipe[0] = c->pipe[1] = -1;
+            c->up = up;
+            c->left = 0;
+            c->piped = 0;
+            c->reused = false;
+            c->in_epoll = false;
+            c->idle_since = 0;
+            return c;
+        }
+        // 连接失败，换下一个上游
+        EMlog(LOGLEVEL_WARN, "proxy: connect to %s failed: %s.\n", up->name.c_str(), strerror(errno));
+        up->outstanding.fetch_sub(1, std::memory_order_relaxed);
+        upstream_failed(up);
+    }
+}
+
+void proxy_release(proxy_conn* c, PROXY_RELEASE how){
+    proxy_upstream* up = c->up;
+    up->outstanding.fetch_sub(1, std::memory_order_relaxed);
+    if(how == PROXY_FAILED){
+        upstream_failed(up);
+    }
+    if(how == PROXY_REUSE && c->left == 0 && c->piped == 0){
+        c->idle_since = time(NULL);
+        up->lock.lock();
+        if(up->idle.size() < PROXY_POOL_SIZE){
+            up->idle.push_back(c);
+            c = NULL;
+        }
+        up->lock.unlock();
+    }
+    if(c){
+        close_conn(c);
+    }
+}
+
+const char* proxy_upstream_name(const proxy_conn* c){
+    return c->up->name.c_str();
+}
+
+const proxy_route* proxy_match(const char* url){
+    const proxy_route* best = NULL;
+    for(const proxy_route* r : g_routes){
+        if(strncmp(url, r->prefix.c_str(), r->prefix.size()) == 0 && (!best || r->prefix.size() > best->prefix.size())){
+            best = r;
+        }
+    }
+    return best;
+}
+
+static bool send_all(int fd, const char* data, long len, int timeout_ms){
+    while(len > 0){
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if(n < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            if(errno != EAGAIN || !wait_fd(fd, POLLOUT, timeout_ms)){
+                return false;
+            }
+            continue;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool proxy_send(proxy_conn* c, const char* data, long len){
+    return send_all(c->fd, data, len, PROXY_TIMEOUT_MS);
+}
+
+// 追加读取一次，最多 max 字节。返回读到的字节数，上游关闭时返回 0 并把 errno 设为 ECONNRESET
+static long recv_more(int fd, std::string& buf, long max, int timeout_ms){
+    size_t old = buf.size();
+    buf.resize(old + max);
+    while(true){
+        ssize_t n = recv(fd, &buf[old], max, 0);
+        if(n > 0){
+            buf.resize(old + n);
+            return n;
+        }
+        if(n == 0){
+            errno = ECONNRESET;
+        }else if(errno == EINTR || (errno == EAGAIN && wait_fd(fd, POLLIN, timeout_ms))){
+            continue;
+        }
+        int err = errno;
+        buf.resize(old);
+        errno = err;
+        return n < 0 ? -1 : 0;
+    }
+}
+
+// 解析响应头，[p, end) 为状态行到最后一个头部行的 "\r\n"（不含结束的空行）
+static bool parse_head(const char* p, const char* end, proxy_response& resp){
+    resp.status = 0;
+    resp.reason.clear();
+    resp.headers.clear();
+    resp.content_type.clear();
+    resp.content_len = -1;
+    resp.chunked = false;
+    // HTTP/1.x 200 OK
+    if(end - p < 12 || strncmp(p, "HTTP/1.", 7) != 0 || p[8] != ' '){
+        return false;
+    }
+    resp.keep_alive = p[7] != '0';      // HTTP/1.0 默认不保持连接
+    char* num_end;
+    resp.status = strtol(p + 9, &num_end, 10);
+    if(num_end != p + 12 || resp.status < 100 || resp.status > 999){
+        return false;
+    }
+    const char* eol = (const char*)memmem(p, end - p, "\r\n", 2);
+    const char* reason = p + 12 + (p[12] == ' ');
+    resp.reason.assign(reason, eol > reason ? eol - reason : 0);
+
+    for(const char* line = eol + 2; line < end; line = eol + 2){
+        eol = (const char*)memmem(line, end - line, "\r\n", 2);
+        const char* colon = (const char*)memchr(line, ':', eol - line);
+        if(!colon){
+            return false;
+        }
+        const char* value = colon + 1;
+        while(value < eol && (*value == ' ' || *value == '\t')){
+            ++value;
+        }
+        std::string v(value, eol - value);
+        int name_len = colon - line;
+        if(name_len == 14 && strncasecmp(line, "Content-Length", 14) == 0){
+            char* e;
+            resp.content_len = strtol(v.c_str(), &e, 10);
+            if(e == v.c_str() || resp.content_len < 0){
+                return false;
+            }
+        }else if(name_len == 17 && strncasecmp(line, "Transfer-Encoding", 17) == 0){
+            resp.chunked = strcasestr(v.c_str(), "chunked") != NULL;
+            if(!resp.chunked){
+                resp.keep_alive = false;        // 其他传输编码读到连接关闭为止
+            }
+        }else if(name_len == 10 && strncasecmp(line, "Connection", 10) == 0){
+            if(strcasestr(v.c_str(), "close")){
+                resp.keep_alive = false;
+            }else if(strcasestr(v.c_str(), "keep-alive")){
+                resp.keep_alive = true;
+            }
+        }else if(!proxy_hop_header(line)){
+            if(name_len == 12 && strncasecmp(line, "Content-Type", 12) == 0){
+                resp.content_type = v;
+            }
+            resp.headers.append(line, eol + 2 - line);
+        }
+    }
+    if(resp.chunked){
+        resp.content_len = -1;
+    }
+    if(resp.status < 200 || resp.status == 204 || resp.status == 304){
+        resp.content_len = 0;           // 没有响应体
+        resp.chunked = false;
+    }else if(!resp.chunked && resp.content_len < 0){
+        resp.keep_alive = false;        // 没有长度，响应体到连接关闭为止
+    }
+    return true;
+}
+
+static bool read_head(proxy_conn* c, proxy_response& resp, std::string& buf, int timeout_ms){
+    buf.clear();
+    while(true){
+        size_t end;
+        while((end = buf.find("\r\n\r\n")) == std::string::npos){
+            if(buf.size() >= PROXY_HEADER_MAX){
+                errno = EMSGSIZE;
+                return false;
+            }
+            if(recv_more(c->fd, buf, PROXY_READ_CHUNK, timeout_ms) <= 0){
+                return false;
+            }
+        }
+        if(!parse_head(buf.data(), buf.data() + end + 2, resp) || resp.status == 101){
+            errno = EPROTO;
+            return false;
+        }
+        buf.erase(0, end + 4);
+        if(resp.status >= 200){
+            return true;
+        }
+        // 1xx 中间响应，继续读取最终响应
+    }
+}
+
+static bool proxy_read_head(proxy_conn* c, proxy_response& resp, std::string& buf){
+    if(!read_head(c, resp, buf, PROXY_TIMEOUT_MS)){
+        return false;
+    }
+    c->up->fails.store(0, std::memory_order_relaxed);
+    return true;
+}
+
+proxy_conn* proxy_start(const proxy_route* route, const char* url, const char* host, const std::string& headers,
+                        proxy_response& resp, std::string& buf){
+    std::string req;
+    for(int attempt = 0; ; ++attempt){
+        proxy_conn* c = proxy_acquire(route, attempt > 0);
+        if(!c){
+            errno = ECONNREFUSED;       // 没有健康的上游，或者都连接失败
+            return NULL;
+        }
+        req.assign("GET ").append(url).append(" HTTP/1.1\r\nHost: ").append(host ? host : c->up->name.c_str());
+        req.append("\r\n").append(headers);
+        if(proxy_send(c, req.data(), req.size()) && proxy_read_head(c, resp, buf)){
+            return c;
+        }
+        int err = errno;
+        // 池中的连接可能刚被上游关闭，没有收到任何响应时换一条新连接重试（只转发 GET，重试是安全的）
+        bool retry = attempt == 0 && c->reused && err != ETIMEDOUT && buf.empty();
+        EMlog(LOGLEVEL_INFO, "proxy: %s to %s failed: %s%s.\n", url, c->up->name.c_str(), strerror(err), retry ? ", retry" : "");
+        proxy_release(c, retry ? PROXY_CLOSE : PROXY_FAILED);
+        if(!retry){
+            errno = err;
+            return NULL;
+        }
+    }
+}
+
+static bool fill(proxy_conn* c, std::string& buf){
+    return recv_more(c->fd, buf, PROXY_READ_CHUNK, PROXY_TIMEOUT_MS) > 0;
+}
+
+// 分块编码：块大小（十六进制）\r\n 数据 \r\n ... 0\r\n 尾部字段 \r\n
+static bool read_chunked(proxy_conn* c, proxy_response& resp, std::string& buf, std::string& body, long max){
+    size_t pos = 0;
+    while(true){
+        size_t eol;
+        while((eol = buf.find("\r\n", pos)) == std::string::npos){
+            if(buf.size() - pos > 1024){
+                errno = EPROTO;
+                return false;
+            }
+            if(!fill(c, buf)){
+                return false;
+            }
+        }
+        char* end;
+        long size = strtol(buf.c_str() + pos, &end, 16);
+        if(end == buf.c_str() + pos || size < 0 || !strchr(";\t \r", *end)){
+            errno = EPROTO;
+            return false;
+        }
+        if(size == 0){
+            // 最后一块之后是可选的尾部字段，以空行结束，尾部字段不转发
+            size_t t;
+            while((t = buf.find("\r\n\r\n", eol)) == std::string::npos){
+                if(buf.size() - eol > PROXY_HEADER_MAX){
+                    errno = EPROTO;
+                    return false;
+                }
+                if(!fill(c, buf)){
+                    return false;
+                }
+            }
+            if(t + 4 != buf.size()){
+                resp.keep_alive = false;    // 响应之后还有数据，连接状态未知
+            }
+            buf.clear();
+            return true;
+        }
+        if((long)body.size() + size > max){
+            errno = EMSGSIZE;
+            return false;
+        }
+        size_t need = eol + 2 + size + 2;
+        while(buf.size() < need){
+            if(!fill(c, buf)){
+                return false;
+            }
+        }
+        if(buf.compare(need - 2, 2, "\r\n") != 0){
+            errno = EPROTO;
+            return false;
+        }
+        body.append(buf, eol + 2, size);
+        pos = need;
+        if(pos >= PROXY_READ_CHUNK){
+            buf.erase(0, pos);      // 丢弃已解码的部分
+            pos = 0;
+        }
+    }
+}
+
+bool proxy_read_body(proxy_conn* c, proxy_response& resp, std::string& buf, std::string& body, long max){
+    if(resp.chunked){
+        return read_chunked(c, resp, buf, body, max);
+    }
+    if(resp.content_len >= 0){
+        if(resp.content_len > max){
+            errno = EMSGSIZE;
+            return false;
+        }
+        while((long)buf.size() < resp.content_len){
+            if(recv_more(c->fd, buf, std::min((long)PROXY_READ_CHUNK, resp.content_len - (long)buf.size()), PROXY_TIMEOUT_MS) <= 0){
+                return false;
+            }
+        }
+        if((long)buf.size() > resp.content_len){
+            buf.resize(resp.content_len);
+            resp.keep_alive = false;
+        }
+    }else{
+        // 没有长度，读到上游关闭连接
+        while(true){
+            if((long)buf.size() > max){
+                errno = EMSGSIZE;
+                return false;
+            }
+            if(recv_more(c->fd, buf, PROXY_READ_CHUNK, PROXY_TIMEOUT_MS) <= 0){
+                if(errno != ECONNRESET){
+                    return false;
+                }
+                break;
+            }
+        }
+    }
+    if(body.empty()){
+        body.swap(buf);
+    }else{
+        body.append(buf);
+    }
+    buf.clear();
+    return true;
+}
+
+mcache_entry* proxy_cache_entry(const proxy_response& resp){
+    if(resp.content_len > MCACHE_MAX_ENTRY){
+        return NULL;
+    }
+    mcache_entry* e = new mcache_entry();
+    if(!mcache_policy(resp.status, resp.headers, e)){
+        delete e;
+        return NULL;
+    }
+    e->status = resp.status;
+    e->reason = resp.reason;
+    e->headers = resp.headers;
+    e->content_type = resp.content_type;
+    return e;
+}
+
+void proxy_refresh_run(proxy_refresh* job){
+    proxy_response resp;
+    std::string buf, body;
+    bool pass = false;
+    proxy_conn* c = proxy_start(job->route, job->url.c_str(), job->host.empty() ? NULL : job->host.c_str(),
+                                job->headers, resp, buf);
+    if(c){
+        mcache_entry* e = proxy_cache_entry(resp);
+        pass = e == NULL;       // 响应变为不可缓存，替换旧的条目
+        // Vary 变化时新的响应属于另一个键，留给之后未命中的请求
+        if(e && e->vary == job->vary){
+            if(proxy_read_body(c, resp, buf, body, MCACHE_MAX_ENTRY)){
+                proxy_release(c, resp.keep_alive ? PROXY_REUSE : PROXY_CLOSE);
+                e->key = job->key;
+                e->body.swap(body);
+                mcache_store(job->key, job->base, e);
+                metrics_inc(MC_CACHE_REFRESHES);
+                delete job;
+                return;
+            }
+            pass = errno == EMSGSIZE;   // 分块编码的响应体超过了缓存的上限
+        }
+        delete e;
+        proxy_release(c, PROXY_CLOSE);
+    }
+    mcache_abort(job->key, pass);
+    delete job;
+}
+
+// 健康检查：建立新连接发送 GET PROXY_HEALTH_PATH，状态码小于 500 即为健康
+static bool health_check(proxy_upstream* up){
+    int fd = connect_upstream(up, PROXY_CONNECT_TIMEOUT_MS);
+    if(fd < 0){
+        return false;
+    }
+    std::string req = "GET " PROXY_HEALTH_PATH " HTTP/1.1\r\nHost: " + up->name + "\r\nConnection: close\r\n\r\n";
+    proxy_conn c;
+    c.fd = fd;
+    c.up = up;
+    proxy_response resp;
+    std::string buf;
+    bool ok = send_all(fd, req.data(), req.size(), PROXY_HEALTH_TIMEOUT_MS)
+              && read_head(&c, resp, buf, PROXY_HEALTH_TIMEOUT_MS) && resp.status < 500;
+    close(fd);
+    return ok;
+}
+
+static void* health_loop(void*){
+    while(g_running.load(std::memory_order_acquire)){
+        for(proxy_upstream* up : g_upstreams){
+            if(health_check(up)){
+                up->fails.store(0, std::memory_order_relaxed);
+                if(!up->healthy.exchange(true)){
+                    EMlog(LOGLEVEL_WARN, "proxy: upstream %s is up.\n", up->name.c_str());
+                }
+            }else if(up->healthy.exchange(false)){
+                EMlog(LOGLEVEL_WARN, "proxy: upstream %s failed health check, marked down.\n", up->name.c_str());
+            }
+            pool_reap(up);
+        }
+        for(int i = 0; i < PROXY_HEALTH_INTERVAL * 10 && g_running.load(std::memory_order_acquire); ++i){
+            usleep(100000);
+        }
+    }
+    return NULL;
+}
+
+bool proxy_init(const char* conf_file){
+    FILE* f = fopen(conf_file, "r");
+    if(!f){
+        return false;
+    }
+    char line[1024];
+    int lineno = 0;
+    while(fgets(line, sizeof(line), f)){
+        ++lineno;
+        char* hash = strchr(line, '#');
+        if(hash){
+            *hash = '\0';
+        }
+        char* save = NULL;
+        char* prefix = strtok_r(line, " \t\r\n", &save);
+        if(!prefix){
+            continue;
+        }
+        proxy_route* r = new proxy_route;
+        r->prefix = prefix;
+        while(char* addr = strtok_r(NULL, " \t\r\n", &save)){
+            proxy_upstream* up = find_upstream(addr);
+            if(!up || r->ups.size() == PROXY_MAX_UPSTREAMS){
+                EMlog(LOGLEVEL_WARN, "proxy: %s:%d: upstream %s ignored.\n", conf_file, lineno, addr);
+                continue;
+            }
+            r->ups.push_back(up);
+        }
+        if(prefix[0] != '/' || r->ups.empty()){
+            EMlog(LOGLEVEL_WARN, "proxy: %s:%d: route %s ignored.\n", conf_file, lineno, prefix);
+            delete r;
+            continue;
+        }
+        EMlog(LOGLEVEL_INFO, "proxy: %s -> %d upstream(s).\n", r->prefix.c_str(), (int)r->ups.size());
+        g_routes.push_back(r);
+    }
+    fclose(f);
+    if(g_routes.empty()){
+        return false;
+    }
+    g_running.store(true, std::memory_order_release);
+    if(pthread_create(&g_checker, NULL, health_loop, NULL) != 0){
+        g_running.store(false);
+        EMlog(LOGLEVEL_WARN, "proxy: health check thread not started.\n");
+    }
+    return true;
+}
+
+void proxy_close(){
+    if(g_running.exchange(false)){
+        pthread_join(g_checker, NULL);
+    }
+    for(proxy_upstream* up : g_upstreams){
+        for(proxy_conn* c : up->idle){
+            close_conn(c);
+        }
+        delete up;
+    }
+    for(proxy_route* r : g_routes){
+        delete r;
+    }
+    g_upstreams.clear();
+    g_routes.clear();
+}
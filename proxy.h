@@ -0,0 +1,115 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <time.h>
+#include <string>
+#include <vector>
+
+/*
+    反向代理
+    配置文件（PROXY_CONF_FILE）每行一条路由：URL 前缀，后面是一个或多个上游地址，# 开头为注释，例如
+        /api/   127.0.0.1:8080  127.0.0.1:8081
+        /app/   unix:/run/app.sock
+    URL 以某个前缀开头的请求转发给该路由的上游，有多条路由匹配时取最长的前缀。没有配置文件时不启用代理。
+
+    1. 连接池：每个上游保留至多 PROXY_POOL_SIZE 条空闲的长连接，请求优先复用，不必每个请求一次 TCP 握手。
+       取出时先检查连接是否已被上游关闭；复用的连接在收到响应之前失败时，换一条新连接重试一次。
+    2. 负载均衡：在健康的上游中选择进行中的请求数最少的，数量相同时轮流选择。
+    3. 健康检查：后台线程每 PROXY_HEALTH_INTERVAL 秒向每个上游发送 GET PROXY_HEALTH_PATH，状态码小于 500 为健康；
+       转发时连续失败 PROXY_MAX_FAILS 次也标记为不健康，直到下一次检查成功。路由的上游都不健康时直接回复 502。
+       检查线程同时关闭池中空闲超过 PROXY_IDLE_TIMEOUT 秒或已被上游关闭的连接。
+    4. 工作线程发送请求、读取响应头。响应体不超过 PROXY_BUFFER_SIZE、使用分块编码或客户端是 HTTP/2 时，
+       一并读完（不超过 PROXY_MAX_BUFFER）并立即归还连接；更长的响应体由主线程用 splice 经连接自带的管道
+       从上游套接字转到客户端套接字，数据不经过用户态。等待上游数据期间客户端套接字不注册事件（EPOLLONESHOT），
+       上游套接字以客户端的 fd 注册到 epoll，事件按客户端连接处理。OpenSSL 加密的客户端连接改为 recv + SSL_write。
+    5. 可缓存的响应存入微缓存（microcache.h），命中时不访问上游；要存入的响应在工作线程中读完。
+       返回过期条目的工作线程在交出客户端连接后用 proxy_refresh_run 刷新。
+    上游连接和管道占用进程的文件描述符，池的大小应与连接容量一起考虑。
+*/
+
+#ifndef PROXY_OPEN
+#define PROXY_OPEN 1
+#endif
+#define PROXY_CONF_FILE "./proxy.conf"      // 路由配置
+#define PROXY_MAX_UPSTREAMS 16              // 每条路由的最大上游数
+#define PROXY_POOL_SIZE 32                  // 每个上游保留的最大空闲连接数
+#define PROXY_CONNECT_TIMEOUT_MS 1000       // 连接上游的超时时间
+#define PROXY_TIMEOUT_MS 10000              // 发送请求、等待响应头和缓冲响应体时，两次读写之间的最长等待
+#define PROXY_HEADER_MAX 8192               // 上游响应头的最大长度
+#define PROXY_BUFFER_SIZE (64 * 1024)       // 不超过该长度的响应体在工作线程中读完
+#define PROXY_MAX_BUFFER (8 * 1024 * 1024)  // 必须读完的响应体（分块编码、HTTP/2）的上限，超过时回复 502
+#define PROXY_PIPE_SIZE (256 * 1024)        // splice 管道的容量，设置失败时使用系统默认值
+#define PROXY_TLS_BUF 16384                 // OpenSSL 加密的客户端连接转发响应体的缓冲区（一条 TLS 记录）
+#define PROXY_HEALTH_INTERVAL 2             // 健康检查周期：秒
+#define PROXY_HEALTH_PATH "/health"
+#define PROXY_MAX_FAILS 3
+#define PROXY_IDLE_TIMEOUT 30               // 池中空闲连接的最长保留时间：秒，应小于上游的 keep-alive 超时
+
+struct proxy_upstream;
+struct proxy_route;
+struct mcache_entry;
+
+// 一条上游连接，取出后只由一个连接（工作线程或主线程）使用
+struct proxy_conn {
+    int fd;
+    int pipe[2];                // splice 用的管道，第一次需要时创建，随连接一起关闭
+    proxy_upstream* up;
+    long left;                  // 响应体尚未从上游读出的字节数
+    int piped;                  // 管道中尚未发给客户端的字节数
+    bool reused;                // 取自连接池
+    bool in_epoll;              // 已注册到 epoll（等待上游数据），归还前移除
+    time_t idle_since;          // 放回连接池的时间
+};
+
+// 上游的响应头
+struct proxy_response {
+    int status;
+    std::string reason;
+    std::string headers;        // 转发给客户端的头部（"名字: 值\r\n"），已去掉逐跳头部和 Content-Length
+    std::string content_type;
+    long content_len;           // -1 表示没有 Content-Length
+    bool chunked;
+    bool keep_alive;            // 响应结束后连接是否可以放回连接池
+};
+
+// 归还连接的方式
+enum PROXY_RELEASE {
+    PROXY_REUSE = 0,            // 响应完整，放回连接池
+    PROXY_CLOSE,                // 关闭，不计为上游的失败（上游要求关闭、客户端中途断开）
+    PROXY_FAILED,               // 关闭，计一次失败
+};
+
+bool proxy_init(const char* conf_file);     // 读取配置并启动健康检查线程，没有可用的路由时返回 false
+void proxy_close();
+const proxy_route* proxy_match(const char* url);    // 没有匹配的路由返回 NULL
+// 按负载均衡选择上游并取出一条连接，fresh 为 true 时不使用连接池。都不可用时返回 NULL
+proxy_conn* proxy_acquire(const proxy_route* route, bool fresh);
+void proxy_release(proxy_conn* c, PROXY_RELEASE how);
+const char* proxy_upstream_name(const proxy_conn* c);
+bool proxy_hop_header(const char* line);          // 请求头部行 "名字: 值" 是否为不转发的逐跳头部
+
+// 以下由工作线程调用，阻塞到完成或超过 PROXY_TIMEOUT_MS，失败时 errno 为 ETIMEDOUT 表示超时
+// 取出连接，发送 "GET url" 请求行、Host（为 NULL 时使用上游的地址）和 headers（其余头部及请求体），
+// 读取响应头（跳过 1xx），buf 中保留其后已读到的数据。复用的连接在收到响应之前失败时换一条新连接重试一次。
+// 失败返回 NULL，连接已归还
+proxy_conn* proxy_start(const proxy_route* route, const char* url, const char* host, const std::string& headers,
+                        proxy_response& resp, std::string& buf);
+// 读完响应体，buf 为 proxy_start 留下的数据，解码后的响应体追加到 body。连接不可再复用时清除 keep_alive
+bool proxy_read_body(proxy_conn* c, proxy_response& resp, std::string& buf, std::string& body, long max);
+
+// 微缓存：响应可以缓存时创建条目（不含响应体和键），否则返回 NULL
+mcache_entry* proxy_cache_entry(const proxy_response& resp);
+
+// 刷新过期的缓存条目所需的请求副本，由返回旧响应的工作线程在交出连接后执行
+struct proxy_refresh {
+    const proxy_route* route;
+    std::string url;
+    std::string host;                   // 为空时使用上游的地址
+    std::string headers;
+    std::string key;                    // 缓存键及计算它用到的 Vary 头部名
+    std::string base;
+    std::vector<std::string> vary;
+};
+void proxy_refresh_run(proxy_refresh* job);     // 执行并释放 job
+
+#endif
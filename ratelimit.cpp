@@ -0,0 +1,197 @@
+#include "ratelimit.h"
+#include "locker.h"
+#include "admission.h"
+#include <arpa/inet.h>
+#include <unordered_map>
+#include <algorithm>
+
+static_assert((RATELIMIT_SHARDS & (RATELIMIT_SHARDS - 1)) == 0, "RATELIMIT_SHARDS must be a power of 2");
+
+#define RL_TOKEN 1000000L               // 令牌以百万分之一为单位，每微秒补充 rate 个单位
+#define RL_EVICT_SCAN 8                 // 淘汰时从 LRU 尾部最多查找的记录数，优先淘汰没有连接的记录
+#define RL_SHARD_ENTRIES (RATELIMIT_ENTRIES / RATELIMIT_SHARDS)
+
+#if RATELIMIT_OPEN
+// 一个 IP 或网段的记录，key 的高 32 位区分 IP(0) 和网段(1)，低 32 位为主机字节序的地址
+struct rl_entry {
+    uint64_t key;
+    long tokens;                // 剩余令牌
+    long last_us;               // 上次补充令牌的时间
+    int conns;                  // 当前连接数
+    rl_entry* prev;             // LRU 链表，表头为最近访问
+    rl_entry* next;
+};
+
+struct rl_shard {
+    locker lock;
+    std::unordered_map<uint64_t, rl_entry*> map;
+    rl_entry* pool;             // 预先分配的记录
+    int used;                   // 记录池中已使用的数量
+    rl_entry lru;               // LRU 链表的哨兵
+
+    rl_shard() : lock("ratelimit.shard"), pool(new rl_entry[RL_SHARD_ENTRIES]), used(0) {
+        map.reserve(RL_SHARD_ENTRIES);
+        lru.prev = lru.next = &lru;
+    }
+};
+
+static rl_shard g_shards[RATELIMIT_SHARDS];
+
+static inline void lru_unlink(rl_entry* e){
+    e->prev->next = e->next;
+    e->next->prev = e->prev;
+}
+
+static inline void lru_push_front(rl_shard& s, rl_entry* e){
+    e->prev = &s.lru;
+    e->next = s.lru.next;
+    s.lru.next->prev = e;
+    s.lru.next = e;
+}
+
+static inline rl_shard& shard_of(uint64_t key){
+    return g_shards[(key * 0x9E3779B97F4A7C15ULL) >> 32 & (RATELIMIT_SHARDS - 1)];
+}
+
+// 查找记录并移到 LRU 表头，不存在且 create 为 true 时新建（令牌桶为满），调用者持有分片锁
+static rl_entry* lookup(rl_shard& s, uint64_t key, long burst, long now_us, bool create){
+    auto it = s.map.find(key);
+    if(it != s.map.end()){
+        rl_entry* e = it->second;
+        lru_unlink(e);
+        lru_push_front(s, e);
+        return e;
+    }
+    if(!create){
+        return NULL;
+    }
+    rl_entry* e;
+    if(s.used < RL_SHARD_ENTRIES){
+        e = &s.pool[s.used++];
+    }else{
+        // 记录池已满，淘汰 LRU 尾部的记录。仍有连接的记录被淘汰后其连接数不再受限，直到重新计数
+        e = s.lru.prev;
+        rl_entry* c = e;
+        for(int i = 0; i < RL_EVICT_SCAN && c != &s.lru; ++i, c = c->prev){
+            if(c->conns == 0){
+                e = c;
+                break;
+            }
+        }
+        lru_unlink(e);
+        s.map.erase(e->key);
+    }
+    e->key = key;
+    e->tokens = burst * RL_TOKEN;
+    e->last_us = now_us;
+    e->conns = 0;
+    s.map.emplace(key, e);
+    lru_push_front(s, e);
+    return e;
+}
+
+static inline uint64_t ip_key(uint32_t ip){
+    return ntohl(ip);
+}
+
+static inline uint64_t net_key(uint32_t ip){
+    return 1ULL << 32 | (ntohl(ip) & 0xFFFFFF00);
+}
+
+static inline bool exempt(uint32_t ip){
+    #if RATELIMIT_EXEMPT_LOOPBACK
+    return (ntohl(ip) >> 24) == 127;
+    #else
+    (void)ip;
+    return false;
+    #endif
+}
+
+// 连接数加一，超过上限时不计数并返回 false
+static bool conn_inc(uint64_t key, int limit){
+    rl_shard& s = shard_of(key);
+    s.lock.lock();
+    rl_entry* e = lookup(s, key, key >> 32 ? RATELIMIT_NET_BURST : RATELIMIT_IP_BURST, get_mono_us(), true);
+    bool ok = e->conns < limit;
+    if(ok){
+        ++e->conns;
+    }
+    s.lock.unlock();
+    return ok;
+}
+
+static void conn_dec(uint64_t key){
+    rl_shard& s = shard_of(key);
+    s.lock.lock();
+    rl_entry* e = lookup(s, key, 0, 0, false);
+    if(e && e->conns > 0){
+        --e->conns;
+    }
+    s.lock.unlock();
+}
+
+// 补充令牌后消耗一个，令牌不足时返回 false
+static bool take_token(uint64_t key, long rate, long burst, long now_us){
+    rl_shard& s = shard_of(key);
+    s.lock.lock();
+    rl_entry* e = lookup(s, key, burst, now_us, true);
+    long elapsed = now_us - e->last_us;
+    if(elapsed > 0){
+        // 空闲超过 burst/rate 秒后令牌桶必然为满，避免 elapsed * rate 溢出
+        e->tokens = elapsed >= burst * RL_TOKEN / rate ? burst * RL_TOKEN
+                  : std::min(burst * RL_TOKEN, e->tokens + elapsed * rate);
+        e->last_us = now_us;
+    }
+    bool ok = e->tokens >= RL_TOKEN;
+    if(ok){
+        e->tokens -= RL_TOKEN;
+    }
+    s.lock.unlock();
+    return ok;
+}
+#endif
+
+bool ratelimit_conn_open(uint32_t ip){
+    #if RATELIMIT_OPEN
+    if(exempt(ip)){
+        return true;
+    }
+    if(!conn_inc(ip_key(ip), RATELIMIT_IP_CONNS)){
+        return false;
+    }
+    if(!conn_inc(net_key(ip), RATELIMIT_NET_CONNS)){
+        conn_dec(ip_key(ip));
+        return false;
+    }
+    #else
+    (void)ip;
+    #endif
+    return true;
+}
+
+void ratelimit_conn_close(uint32_t ip){
+    #if RATELIMIT_OPEN
+    if(exempt(ip)){
+        return;
+    }
+    conn_dec(ip_key(ip));
+    conn_dec(net_key(ip));
+    #else
+    (void)ip;
+    #endif
+}
+
+bool ratelimit_request(uint32_t ip){
+    #if RATELIMIT_OPEN
+    if(exempt(ip)){
+        return true;
+    }
+    // 先检查 IP 再检查网段，IP 超限的请求不消耗网段的令牌，避免单个客户端挤占同网段其他客户端的配额
+    long now = get_mono_us();
+    return take_token(ip_key(ip), RATELIMIT_IP_RATE, RATELIMIT_IP_BURST, now)
+        && take_token(net_key(ip), RATELIMIT_NET_RATE, RATELIMIT_NET_BURST, now);
+    #else
+    (void)ip;
+    return true;
+    #endif
+}
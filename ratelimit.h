@@ -0,0 +1,35 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdint.h>
+
+/*
+    按客户端限制请求速率和并发连接数
+    每个来源 IP 及其所在的 /24 网段各有一条记录：令牌桶限制请求速率，计数器限制并发连接数。
+    1. accept 后、初始化连接前检查连接数，超限时直接回复 429 并关闭，不占用 users[] 和解析器。
+    2. 工作线程解析出完整的请求后、生成响应前消耗令牌，令牌不足时回复 429。每个请求消耗一个令牌，
+       与请求分成几次读取无关；HTTP/2 连接按流消耗。
+    记录按 IP 哈希分散到多个分片，每个分片一把锁、固定大小的记录池和一条 LRU 链表，
+    记录用完时淘汰最久未访问的记录，内存占用有上限。
+    服务器只监听 IPv4，因此不处理 IPv6 /64 前缀。
+*/
+
+#ifndef RATELIMIT_OPEN
+#define RATELIMIT_OPEN 1
+#endif
+#define RATELIMIT_IP_RATE 100           // 每个 IP 每秒的请求数
+#define RATELIMIT_IP_BURST 200          // 每个 IP 的令牌桶容量（允许的突发请求数）
+#define RATELIMIT_NET_RATE 1000         // 每个 /24 网段每秒的请求数
+#define RATELIMIT_NET_BURST 2000        // 每个 /24 网段的令牌桶容量
+#define RATELIMIT_IP_CONNS 256          // 每个 IP 的最大并发连接数
+#define RATELIMIT_NET_CONNS 1024        // 每个 /24 网段的最大并发连接数
+#define RATELIMIT_ENTRIES 65536         // 记录总数上限（IP 和网段合计）
+#define RATELIMIT_SHARDS 16             // 分片数，须为 2 的幂
+#define RATELIMIT_EXEMPT_LOOPBACK 1     // 本机（127.0.0.0/8）客户端不受限制
+
+// 以下 IP 均为网络字节序（sockaddr_in::sin_addr.s_addr）
+bool ratelimit_conn_open(uint32_t ip);      // 新连接，连接数未超限时计数并返回 true
+void ratelimit_conn_close(uint32_t ip);     // 连接关闭，与返回 true 的 ratelimit_conn_open 一一对应
+bool ratelimit_request(uint32_t ip);        // 新请求，消耗一个令牌，令牌不足时返回 false
+
+#endif
@@ -0,0 +1,258 @@
+#include "router.h"
+#include "metrics.h"
+#include "trace.h"
+#include "locker.h"
+#include "perf_stage.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+// ---------------- 内置的处理函数 ----------------
+
+static void handle_health(const route_request&, route_response& resp){
+    resp.body = "ok\n";
+}
+
+static void handle_metrics(const route_request&, route_response& resp){
+    metrics_render(resp.body);
+    resp.content_type = "text/plain; version=0.0.4";
+}
+
+// 导出追踪数据，或者用 "?sample=N" 修改采样率
+static void handle_trace(const route_request& req, route_response& resp){
+    if(strncmp(req.query, "sample=", 7) == 0){
+        int rate = atoi(req.query + 7);
+        trace_sample_rate.store(rate, std::memory_order_relaxed);
+        char buf[64];
+        snprintf(buf, sizeof(buf), "trace sample rate = %d\n", rate);
+        resp.body = buf;
+    }else{
+        trace_dump(resp.body);
+        resp.content_type = "application/json";
+    }
+}
+
+// 锁竞争报告
+static void handle_locks(const route_request&, route_response& resp){
+    lock_profile_report(resp.body);
+}
+
+// 热点阶段的硬件计数器报告
+static void handle_perf(const route_request&, route_response& resp){
+    perf_stage_report(resp.body);
+}
+
+static void handle_not_allowed(const route_request& req, route_response& resp){
+    static const char* names[] = {"GET", "POST", "HEAD", "PUT", "DELETE"};
+    std::string allow;
+    for(int i = 0; i < 5; ++i){
+        if(req.allow >> i & 1){
+            allow.append(allow.empty() ? "" : ", ").append(names[i]);
+        }
+    }
+    resp.status = 405;
+    resp.header("Allow", allow.c_str());
+    resp.body = "The request method is not allowed for this resource.\n";
+}
+
+// ---------------- 静态路由 ----------------
+
+struct static_route {
+    const char* path;
+    unsigned methods;
+    bool internal;
+    route_handler handler;
+};
+
+static constexpr static_route g_static[] = {
+    { ROUTER_HEALTH_PATH,   RM_GET, false, handle_health },
+    { METRICS_PATH,         RM_GET, true,  handle_metrics },
+    { TRACE_PATH,           RM_GET, true,  handle_trace },
+    { LOCK_PROFILE_PATH,    RM_GET, true,  handle_locks },
+    { PERF_PATH,            RM_GET, true,  handle_perf },
+};
+static constexpr int STATIC_COUNT = sizeof(g_static) / sizeof(g_static[0]);
+
+// 字典树的节点，子节点以 child / sibling 串成单链表
+struct trie_node {
+    char ch = 0;
+    short child = -1;           // 第一个子节点，-1 表示没有
+    short sibling = -1;         // 同一父节点的下一个子节点
+    short route = -1;           // 路径在此结束的路由
+    short prefix = -1;          // 以此为前缀的路由（模式以 '*' 结尾）
+};
+
+constexpr int trie_capacity(){
+    int n = 1;
+    for(const static_route& r : g_static){
+        for(const char* p = r.path; *p; ++p) ++n;
+    }
+    return n;
+}
+
+struct route_trie {
+    trie_node node[trie_capacity()];
+    int count;
+
+    constexpr route_trie() : node{}, count(1) {
+        for(int i = 0; i < STATIC_COUNT; ++i){
+            int cur = 0;
+            bool prefix = false;
+            for(const char* p = g_static[i].path; *p; ++p){
+                if(*p == '*' && p[1] == '\0'){
+                    prefix = true;
+                    break;
+                }
+                int c = node[cur].child;
+                while(c >= 0 && node[c].ch != *p){
+                    c = node[c].sibling;
+                }
+                if(c < 0){
+                    c = count++;
+                    node[c] = trie_node{*p, -1, node[cur].child, -1, -1};
+                    node[cur].child = c;
+                }
+                cur = c;
+            }
+            short& slot = prefix ? node[cur].prefix : node[cur].route;
+            if(slot >= 0){
+                throw "duplicate static route";     // 常量求值中抛出异常即编译错误
+            }
+            slot = i;
+        }
+    }
+};
+
+static constexpr route_trie g_trie;
+
+// 返回匹配的静态路由的下标，精确匹配优先于前缀，较长的前缀优先，没有匹配时返回 -1
+static int trie_match(const char* path, int len){
+    int cur = 0;
+    int best = g_trie.node[0].prefix;
+    for(int i = 0; i < len; ++i){
+        int c = g_trie.node[cur].child;
+        while(c >= 0 && g_trie.node[c].ch != path[i]){
+            c = g_trie.node[c].sibling;
+        }
+        if(c < 0){
+            return best;
+        }
+        cur = c;
+        if(g_trie.node[cur].prefix >= 0){
+            best = g_trie.node[cur].prefix;
+        }
+    }
+    return g_trie.node[cur].route >= 0 ? g_trie.node[cur].route : best;
+}
+
+// ---------------- 动态路由 ----------------
+
+struct dynamic_route {
+    std::string pattern;
+    unsigned methods;
+    bool internal;
+    route_handler handler;
+};
+
+static std::vector<dynamic_route> g_dynamic;
+
+bool router_add(unsigned methods, const char* pattern, route_handler handler, bool internal){
+    if(!pattern || pattern[0] != '/' || !handler){
+        return false;
+    }
+    int params = 0;
+    for(const char* p = pattern; *p; ++p){
+        if(*p == ':' && p[-1] == '/'){
+            ++params;
+        }else if(*p == '*'){
+            if(p[1] != '\0') return false;      // '*' 只能在结尾
+            ++params;
+        }
+    }
+    if(params > ROUTER_MAX_PARAMS){
+        return false;
+    }
+    g_dynamic.push_back(dynamic_route{pattern, methods, internal, handler});
+    return true;
+}
+
+static bool dynamic_match(const char* pat, route_request& req){
+    const char* u = req.path;
+    const char* end = req.path + req.path_len;
+    int n = 0;
+    while(*pat){
+        if(*pat == '*'){
+            req.params[n].p = u;                // 其余部分，可以为空
+            req.params[n++].len = end - u;
+            u = end;
+            break;
+        }
+        if(*pat == ':' && pat[-1] == '/'){
+            while(*pat && *pat != '/') ++pat;   // 跳过参数名
+            const char* seg = u;
+            while(u < end && *u != '/') ++u;
+            if(u == seg){
+                return false;                   // 空的路径段
+            }
+            req.params[n].p = seg;
+            req.params[n++].len = u - seg;
+            continue;
+        }
+        if(u == end || *u != *pat){
+            return false;
+        }
+        ++u;
+        ++pat;
+    }
+    req.param_count = n;
+    return u == end;
+}
+
+route_handler router_match(route_request& req, bool internal_client){
+    unsigned bit = 1u << req.method;
+    req.param_count = 0;
+    req.allow = 0;
+    int i = trie_match(req.path, req.path_len);
+    if(i >= 0 && (!g_static[i].internal || internal_client)){
+        if(g_static[i].methods & bit){
+            return g_static[i].handler;
+        }
+        req.allow = g_static[i].methods;
+        return handle_not_allowed;
+    }
+    for(const dynamic_route& r : g_dynamic){
+        if((r.internal && !internal_client) || !dynamic_match(r.pattern.c_str(), req)){
+            continue;
+        }
+        if(r.methods & bit){
+            return r.handler;
+        }
+        req.allow |= r.methods;             // 同一路径可能按方法注册了多个处理函数，继续查找
+    }
+    req.param_count = 0;
+    return req.allow ? handle_not_allowed : NULL;
+}
+
+const char* router_status_title(int status){
+    switch(status){
+        case 200: return "OK";
+        case 201: return "Created";
+        case 202: return "Accepted";
+        case 204: return "No Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 409: return "Conflict";
+        case 413: return "Content Too Large";
+        case 429: return "Too Many Requests";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        default:  return status < 400 ? "OK" : "Error";
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <string>
+
+/*
+    路由：按方法和路径把请求交给 C++ 处理函数，处理函数生成的响应按 DYNAMIC_REQUEST 发送
+    1. 静态路由：router.cpp 中的 constexpr 表，编译时构建成字典树（constexpr 构造函数），运行时不做任何初始化。
+       分派时沿路径逐字符走一遍树，每个字符比较同一节点下的几个分支，不分配内存。路径以 '*' 结尾时匹配该前缀。
+       表中的路径重复时编译失败。
+    2. 动态路由：启动时（创建线程池之前）用 router_add 注册，模式中 ":名字" 匹配一个路径段，结尾的 "*"
+       匹配其余部分，匹配到的值按顺序放入 route_request::params。静态路由没有匹配时按注册顺序逐个比较。
+    路径匹配时不包括 '?' 之后的查询串。路径匹配但方法不在允许的集合中时回复 405。
+    标记为 internal 的路由只对本机客户端开放（同 METRICS_ALLOW_REMOTE），其他客户端按没有匹配处理。
+*/
+
+#define ROUTER_MAX_PARAMS 4             // 动态路由最多捕获的路径段数
+#define ROUTER_HEALTH_PATH "/healthz"   // 服务器自身的健康检查，供负载均衡器使用
+
+// 方法集合，位的顺序与 http_conn::METHOD 一致
+enum ROUTE_METHOD {
+    RM_GET = 1 << 0, RM_POST = 1 << 1, RM_HEAD = 1 << 2, RM_PUT = 1 << 3, RM_DELETE = 1 << 4,
+    RM_ANY = 0xff
+};
+
+// 请求视图，指向连接的缓冲区，只在处理函数执行期间有效
+struct route_request {
+    int method;                         // http_conn::METHOD
+    const char* path;                   // 不以 '\0' 结尾，长度为 path_len
+    int path_len;
+    const char* query;                  // '?' 之后的部分，没有时为 ""
+    const char* host;                   // 没有时为 NULL
+    const char* body;                   // 请求体，须能放入连接的读缓冲区（HTTP/2 的请求没有）
+    long body_len;
+    struct { const char* p; int len; } params[ROUTER_MAX_PARAMS];
+    int param_count;
+    unsigned allow;                     // 路径匹配而方法不匹配时，路径允许的方法（用于 405 的 Allow）
+    const void* conn;
+    const char* (*get_header)(const void* conn, const char* name);
+
+    const char* header(const char* name) const { return get_header(conn, name); }   // 没有时返回 NULL
+};
+
+// 响应构建器，直接写入连接的响应字段
+struct route_response {
+    int status;                         // 默认 200
+    const char* content_type;           // 默认 "text/plain"，须指向静态字符串
+    std::string& body;
+    std::string& headers;               // 额外的响应头部，与状态行等一起放入写缓冲区，应尽量短
+
+    route_response(std::string& b, std::string& h) : status(200), content_type("text/plain"), body(b), headers(h) {}
+    void header(const char* name, const char* value){
+        headers.append(name).append(": ").append(value).append("\r\n");
+    }
+};
+
+typedef void (*route_handler)(const route_request& req, route_response& resp);
+
+// 注册动态路由，只能在启动时调用。模式必须以 '/' 开头，":名字" 段不超过 ROUTER_MAX_PARAMS 个，格式错误时返回 false
+bool router_add(unsigned methods, const char* pattern, route_handler handler, bool internal = false);
+// 按 req 的方法和路径查找处理函数并填写路径参数；internal_client 为 false 时跳过内部路由。
+// 路径匹配而方法不匹配时返回回复 405 的处理函数，没有匹配时返回 NULL
+route_handler router_match(route_request& req, bool internal_client);
+const char* router_status_title(int status);    // 状态码的原因短语
+
+#endif
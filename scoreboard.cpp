@@ -0,0 +1,74 @@
+#include "scoreboard.h"
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <atomic>
+
+static_assert(sizeof(sb_header) == 64, "scoreboard header layout changed");
+static_assert(sizeof(sb_worker_slot) == 128, "scoreboard worker slot layout changed");
+static_assert(sizeof(sb_conn_slot) == 128, "scoreboard connection slot layout changed");
+
+sb_header* g_sb = NULL;
+sb_conn_slot* g_sb_conns = NULL;
+__thread int t_sb_worker = -1;
+static std::atomic<int> g_sb_next_worker(0);    // 下一个可分配的工作线程槽位
+
+bool scoreboard_init(){
+    #if SCOREBOARD_OPEN
+    shm_unlink(SCOREBOARD_NAME);    // 删除上次异常退出残留的共享内存
+    int fd = shm_open(SCOREBOARD_NAME, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if(fd == -1){
+        return false;
+    }
+    if(ftruncate(fd, SCOREBOARD_SIZE) < 0){
+        close(fd);
+        shm_unlink(SCOREBOARD_NAME);
+        return false;
+    }
+    void* base = mmap(0, SCOREBOARD_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED){
+        shm_unlink(SCOREBOARD_NAME);
+        return false;
+    }
+
+    // 新建的共享内存全为0，即所有槽位都是 FREE/NONE
+    sb_header* hdr = (sb_header*)base;
+    hdr->version = SCOREBOARD_VERSION;
+    hdr->pid = getpid();
+    hdr->worker_slots = SCOREBOARD_WORKERS;
+    hdr->conn_slots = SCOREBOARD_CONNS;
+    hdr->start_mono_us = get_mono_us();
+    g_sb_conns = sb_conn_slots(base);
+    g_sb = hdr;
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(hdr->magic, SCOREBOARD_MAGIC, 4);    // 最后写入魔数，读者据此判断内容已初始化
+    #endif
+    return true;
+}
+
+void scoreboard_close(){
+    if(!g_sb){
+        return;
+    }
+    void* base = g_sb;
+    g_sb = NULL;
+    g_sb_conns = NULL;
+    munmap(base, SCOREBOARD_SIZE);
+    shm_unlink(SCOREBOARD_NAME);
+}
+
+void scoreboard_worker_register(){
+    if(!g_sb || t_sb_worker >= 0){
+        return;
+    }
+    int idx = g_sb_next_worker.fetch_add(1);
+    if(idx >= SCOREBOARD_WORKERS){
+        return;                     // 槽位不够，该线程不出现在记分板中
+    }
+    t_sb_worker = idx;
+    g_sb->workers = idx + 1 > (int)g_sb->workers ? idx + 1 : g_sb->workers;
+    scoreboard_worker_set(SB_WORKER_WAITING, -1);
+}
@@ -0,0 +1,150 @@
+#ifndef SCOREBOARD_H
+#define SCOREBOARD_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "mono_clock.h"
+
+/*
+    共享内存记分板
+    服务器启动时创建一个 POSIX 共享内存段，其中是定长的工作线程槽位数组和连接槽位数组（按 socket fd 索引）。
+    事件循环和线程池中的工作线程在状态变化时直接对槽位做普通的内存写入：状态、当前 URL、字节数、
+    进入该状态的时间（单调时钟），不加锁也不产生系统调用。tools/webtop 以只读方式映射同一段内存，
+    实时显示每个连接和工作线程在做什么。读者可能看到写了一半的槽位，这对于观察来说可以接受。
+    本头文件只依赖标准库，供服务器和 webtop 共用。
+*/
+
+#ifndef SCOREBOARD_OPEN                          // 可用 -DSCOREBOARD_OPEN=0 关闭
+#define SCOREBOARD_OPEN 1                       // 是否启用记分板
+#endif
+#define SCOREBOARD_NAME "/webserver_scoreboard" // 共享内存名称，对应 /dev/shm/webserver_scoreboard
+#define SCOREBOARD_WORKERS 64                   // 工作线程槽位数
+#define SCOREBOARD_CONNS 65536                  // 连接槽位数，不小于 MAX_FD
+#define SCOREBOARD_URL_LEN 64                   // 槽位中保存的 URL 最大长度
+
+#define SCOREBOARD_MAGIC "EMSB"
+#define SCOREBOARD_VERSION 1
+
+// 连接状态
+enum SB_CONN_STATE {
+    SB_CONN_FREE = 0,       // 槽位未使用
+    SB_CONN_IDLE,           // 已连接，等待请求（包括长连接的空闲期）
+    SB_CONN_READING,        // 已读到部分请求，等待剩余数据
+    SB_CONN_QUEUED,         // 请求读完，在线程池队列中等待
+    SB_CONN_PROCESSING,     // 工作线程正在解析请求、生成响应
+    SB_CONN_WRITING,        // 正在发送响应
+    SB_CONN_STATE_NUM
+};
+
+// 工作线程状态
+enum SB_WORKER_STATE {
+    SB_WORKER_NONE = 0,     // 槽位未使用
+    SB_WORKER_WAITING,      // 等待任务
+    SB_WORKER_BUSY,         // 正在处理请求
+    SB_WORKER_STATE_NUM
+};
+
+struct sb_header {
+    char magic[4];
+    uint32_t version;
+    int32_t pid;            // 服务器进程号
+    uint32_t worker_slots;  // 工作线程槽位数
+    uint32_t conn_slots;    // 连接槽位数
+    uint32_t workers;       // 已注册的工作线程数
+    int64_t start_mono_us;  // 服务器启动时间（单调时钟：微秒）
+    char reserved[32];
+};
+
+struct sb_worker_slot {
+    uint32_t state;             // SB_WORKER_STATE
+    int32_t fd;                 // 正在处理的连接，-1 表示没有
+    int64_t since_us;           // 进入当前状态的时间（单调时钟：微秒）
+    uint64_t requests;          // 处理过的请求数
+    char url[SCOREBOARD_URL_LEN];
+    char reserved[40];
+};
+
+struct sb_conn_slot {
+    uint32_t state;             // SB_CONN_STATE
+    uint32_t client_ip;         // 网络字节序
+    uint16_t client_port;       // 网络字节序
+    uint16_t worker;            // 最近处理该连接的工作线程槽位
+    uint32_t requests;          // 该连接上的请求数
+    int64_t since_us;           // 进入当前状态的时间（单调时钟：微秒）
+    uint64_t bytes_in;          // 当前请求已读入的字节数
+    uint64_t bytes_out;         // 当前响应已发送的字节数
+    char url[SCOREBOARD_URL_LEN];
+    char reserved[24];
+};
+
+// 共享内存段的总大小
+#define SCOREBOARD_SIZE (sizeof(sb_header) + SCOREBOARD_WORKERS * sizeof(sb_worker_slot) \
+                         + SCOREBOARD_CONNS * sizeof(sb_conn_slot))
+
+inline sb_worker_slot* sb_worker_slots(void* base){
+    return (sb_worker_slot*)((char*)base + sizeof(sb_header));
+}
+
+inline sb_conn_slot* sb_conn_slots(void* base){
+    return (sb_conn_slot*)((char*)base + sizeof(sb_header) + SCOREBOARD_WORKERS * sizeof(sb_worker_slot));
+}
+
+// 以下为服务器端接口，记分板未创建时全部为空操作
+extern sb_header* g_sb;                 // 共享内存段，未启用时为 NULL
+extern sb_conn_slot* g_sb_conns;
+extern __thread int t_sb_worker;        // 当前线程的工作线程槽位，-1 表示不是工作线程
+
+bool scoreboard_init();                 // 创建并映射共享内存段
+void scoreboard_close();                // 解除映射并删除共享内存段
+void scoreboard_worker_register();      // 工作线程启动时调用，分配一个槽位
+
+inline sb_worker_slot* scoreboard_worker(){
+    if(!g_sb || t_sb_worker < 0) return NULL;
+    return sb_worker_slots(g_sb) + t_sb_worker;
+}
+
+inline sb_conn_slot* scoreboard_conn(int fd){
+    if(!g_sb_conns || fd < 0 || fd >= SCOREBOARD_CONNS) return NULL;
+    return g_sb_conns + fd;
+}
+
+inline void scoreboard_copy_url(char* dst, const char* url){
+    if(url){
+        strncpy(dst, url, SCOREBOARD_URL_LEN - 1);
+    }else{
+        dst[0] = '\0';
+    }
+}
+
+// 更新当前工作线程的状态，进入 BUSY 时计数
+inline void scoreboard_worker_set(uint32_t state, int fd){
+    sb_worker_slot* w = scoreboard_worker();
+    if(!w) return;
+    w->state = state;
+    w->fd = fd;
+    w->since_us = get_mono_us();
+    if(state == SB_WORKER_BUSY){
+        ++w->requests;
+        w->url[0] = '\0';
+    }
+}
+
+// 更新连接状态，由工作线程更新时同时记录工作线程槽位
+inline void scoreboard_conn_set(int fd, uint32_t state){
+    sb_conn_slot* c = scoreboard_conn(fd);
+    if(!c) return;
+    c->state = state;
+    c->since_us = get_mono_us();
+    if(t_sb_worker >= 0) c->worker = t_sb_worker;
+}
+
+// 请求行解析完毕后记录 URL
+inline void scoreboard_set_url(int fd, const char* url){
+    sb_conn_slot* c = scoreboard_conn(fd);
+    if(c) scoreboard_copy_url(c->url, url);
+    sb_worker_slot* w = scoreboard_worker();
+    if(w) scoreboard_copy_url(w->url, url);
+}
+
+#endif
@@ -0,0 +1,595 @@
+// 基于 epoll 的多线程 HTTP 压测工具
+// 编译：g++ -O2 -pthread test_presure/loadgen/loadgen.cpp -o loadgen
+//
+// 与 webbench 相比：
+//  - 每个线程一个 epoll，连接数与线程数无关，支持长连接（keep-alive）和流水线（pipelining）；
+//  - 开环模式（-R）按固定速率发出请求，延迟从请求"应当发出"的时刻算起，修正协调遗漏（coordinated omission）；
+//  - 按 Zipf 分布从生成的语料文件中选择 URL；
+//  - 输出 p50/p90/p99/p99.9/max 延迟，可以输出 JSON 以便对比不同提交的结果。
+//
+// 用法：loadgen [选项] host:port
+//   -c N      连接总数（默认 64）
+//   -t N      线程数（默认 4）
+//   -d N      持续时间：秒（默认 10）
+//   -p N      每个连接的流水线深度，即同时在途的请求数（默认 1）
+//   -R N      开环模式，总请求速率：请求/秒（默认 0，闭环：每个响应返回后立即发出下一个请求）
+//   -k 0|1    是否使用长连接（默认 1），0 时每个请求一个连接
+//   -u URL    请求的 URL（默认 /index.html），与 -n 互斥
+//   -n N      使用语料中的 N 个 URL，按 Zipf 分布选择
+//   -s S      Zipf 分布的指数（默认 1.0）
+//   -P PATH   语料在 doc_root 下的路径前缀（默认 /corpus）
+//   -T MS     请求超时：毫秒（默认 5000），超时的连接被关闭重连
+//   -j FILE   把结果以 JSON 格式写入 FILE，"-" 表示标准输出
+//   -g DIR    生成 -n 个语料文件到 DIR 后退出，文件大小大致服从对数正态分布（几百字节到几百KB）
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+// 运行参数
+static int g_conns = 64;
+static int g_threads = 4;
+static int g_duration = 10;
+static int g_depth = 1;
+static double g_rate = 0;
+static bool g_keepalive = true;
+static std::string g_url = "/index.html";
+static int g_zipf_n = 0;
+static double g_zipf_s = 1.0;
+static std::string g_prefix = "/corpus";
+static long g_timeout_ms = 5000;
+static const char* g_json = NULL;
+static const char* g_gen_dir = NULL;
+
+static struct sockaddr_in g_addr;
+static std::string g_host;
+static std::vector<std::string> g_requests;     // 每个 URL 预先格式化好的请求
+static std::vector<double> g_zipf_cdf;          // Zipf 分布的累积概率
+
+static long now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// 对数-线性直方图，单位微秒，每个2的幂区间 16 个子桶，相对误差约 6%
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((40 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct histogram {
+    unsigned long counts[HIST_BUCKETS];
+    unsigned long total;
+    double sum;
+    long max;
+    histogram() : total(0), sum(0), max(0) { memset(counts, 0, sizeof(counts)); }
+
+    static int bucket(long v){
+        if(v < HIST_SUB) return v < 0 ? 0 : v;
+        int msb = 63 - __builtin_clzl(v);
+        int idx = (msb - HIST_SUB_BITS + 1) * HIST_SUB + ((v >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+        return idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1;
+    }
+    // 桶的上界
+    static long bucket_high(int idx){
+        if(idx < HIST_SUB) return idx;
+        int group = idx / HIST_SUB, sub = idx % HIST_SUB;
+        return ((long)(HIST_SUB + sub + 1) << (group - 1)) - 1;
+    }
+    void add(long us){
+        ++counts[bucket(us)];
+        ++total;
+        sum += us;
+        if(us > max) max = us;
+    }
+    void merge(const histogram& o){
+        for(int i = 0; i < HIST_BUCKETS; ++i) counts[i] += o.counts[i];
+        total += o.total;
+        sum += o.sum;
+        if(o.max > max) max = o.max;
+    }
+    long percentile(double p) const {
+        if(total == 0) return 0;
+        unsigned long target = (unsigned long)ceil(total * p / 100.0);
+        unsigned long cum = 0;
+        for(int i = 0; i < HIST_BUCKETS; ++i){
+            cum += counts[i];
+            if(cum >= target) return std::min(bucket_high(i), max);
+        }
+        return max;
+    }
+};
+
+// 一个客户端连接
+struct client {
+    int fd;
+    bool connecting;            // 非阻塞 connect 尚未完成
+    std::deque<long> inflight;  // 在途请求的起始时间（开环模式为应当发出的时间）
+    std::string out;            // 待发送的数据
+    size_t out_off;
+    char hdr[8192];             // 正在解析的响应头
+    int hdr_len;
+    bool in_body;
+    long body_left;             // 响应体剩余字节数，-1 表示读到连接关闭为止
+    int status;
+    bool server_close;          // 响应头中有 Connection: close
+    long last_active;           // 最近一次收到数据的时间
+};
+
+// 每个线程的状态和统计
+struct worker {
+    int id;
+    int epfd;
+    int nconns;
+    double rate;                // 本线程的开环速率
+    std::vector<client*> clients;
+    std::deque<long> backlog;   // 开环模式下已到发送时间、但暂时没有空闲连接的请求
+    long next_send;             // 开环模式下一个请求应当发出的时间
+    unsigned long rng;
+    histogram hist;
+    unsigned long completed, errors, timeouts, connects, status[6];
+    unsigned long bytes_in;
+    pthread_t tid;
+};
+
+static long g_end_ns;
+
+static unsigned long xorshift(unsigned long& s){
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+// 选择一个请求：Zipf 分布时按累积概率二分查找
+static const std::string& pick_request(worker* w){
+    if(g_zipf_cdf.empty()) return g_requests[0];
+    double u = (xorshift(w->rng) >> 11) * (1.0 / 9007199254740992.0);
+    size_t idx = std::lower_bound(g_zipf_cdf.begin(), g_zipf_cdf.end(), u) - g_zipf_cdf.begin();
+    return g_requests[std::min(idx, g_requests.size() - 1)];
+}
+
+static void client_close(worker* w, client* c){
+    if(c->fd != -1){
+        epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->fd, 0);
+        close(c->fd);
+    }
+    c->fd = -1;
+    c->inflight.clear();
+    c->out.clear();
+    c->out_off = 0;
+    c->hdr_len = 0;
+    c->in_body = false;
+    c->server_close = false;
+}
+
+static bool client_connect(worker* w, client* c){
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(c->fd == -1) return false;
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int ret = connect(c->fd, (struct sockaddr*)&g_addr, sizeof(g_addr));
+    if(ret == -1 && errno != EINPROGRESS){
+        close(c->fd);
+        c->fd = -1;
+        return false;
+    }
+    c->connecting = true;
+    c->last_active = now_ns();
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = c;
+    epoll_ctl(w->epfd, EPOLL_CTL_ADD, c->fd, &ev);
+    ++w->connects;
+    return true;
+}
+
+// 尽量把 out 中的数据发出去，发送错误返回 false
+static bool client_flush(client* c){
+    while(c->out_off < c->out.size()){
+        ssize_t n = send(c->fd, c->out.data() + c->out_off, c->out.size() - c->out_off, MSG_NOSIGNAL);
+        if(n < 0){
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return true;    // 等待 EPOLLOUT
+            return false;
+        }
+        c->out_off += n;
+    }
+    c->out.clear();
+    c->out_off = 0;
+    return true;
+}
+
+// 连接是否可以再发出一个请求
+static bool client_can_send(client* c){
+    if(c->fd == -1 || c->connecting || c->server_close) return false;
+    if(!g_keepalive) return c->inflight.empty() && !c->in_body && c->hdr_len == 0;
+    return (int)c->inflight.size() < g_depth;
+}
+
+static void client_send(worker* w, client* c, long start){
+    c->out.append(pick_request(w));
+    c->inflight.push_back(start);
+}
+
+// 闭环模式把连接填满到流水线深度；开环模式从积压队列中取请求
+static void client_fill(worker* w, client* c){
+    bool sent = false;
+    while(client_can_send(c) && now_ns() < g_end_ns){
+        if(w->rate > 0){
+            if(w->backlog.empty()) break;
+            client_send(w, c, w->backlog.front());
+            w->backlog.pop_front();
+        }else{
+            client_send(w, c, now_ns());
+        }
+        sent = true;
+        if(!g_keepalive) break;
+    }
+    if(sent && !client_flush(c)){
+        ++w->errors;
+        client_close(w, c);
+    }
+}
+
+// 一个响应接收完毕
+static void response_done(worker* w, client* c){
+    long now = now_ns();
+    if(!c->inflight.empty()){
+        w->hist.add((now - c->inflight.front()) / 1000);
+        c->inflight.pop_front();
+        ++w->completed;
+        int cls = c->status / 100;
+        ++w->status[cls >= 1 && cls <= 5 ? cls : 0];
+    }
+    c->hdr_len = 0;
+    c->in_body = false;
+    if(c->server_close || !g_keepalive){
+        if(!c->inflight.empty()) w->errors += c->inflight.size();   // 流水线中剩下的请求不会有响应
+        client_close(w, c);
+    }
+}
+
+// 解析响应头，取出状态码、Content-Length 和 Connection
+static void parse_headers(client* c){
+    c->hdr[c->hdr_len] = '\0';
+    c->status = 0;
+    sscanf(c->hdr, "HTTP/%*d.%*d %d", &c->status);
+    c->body_left = -1;
+    for(char* line = strstr(c->hdr, "\r\n"); line; line = strstr(line + 2, "\r\n")){
+        char* p = line + 2;
+        if(strncasecmp(p, "Content-Length:", 15) == 0){
+            c->body_left = atol(p + 15);
+        }else if(strncasecmp(p, "Connection:", 11) == 0){
+            p += 11;
+            p += strspn(p, " \t");
+            if(strncasecmp(p, "close", 5) == 0) c->server_close = true;
+        }
+    }
+    c->in_body = true;
+}
+
+static void client_on_data(worker* w, client* c, const char* buf, size_t n){
+    size_t i = 0;
+    while(i < n && c->fd != -1){
+        if(!c->in_body){
+            while(i < n && !c->in_body){
+                if(c->hdr_len >= (int)sizeof(c->hdr) - 1){
+                    ++w->errors;                    // 响应头过长
+                    client_close(w, c);
+                    return;
+                }
+                c->hdr[c->hdr_len++] = buf[i++];
+                if(c->hdr_len >= 4 && memcmp(c->hdr + c->hdr_len - 4, "\r\n\r\n", 4) == 0){
+                    parse_headers(c);
+                    if(c->body_left == 0) response_done(w, c);
+                }
+            }
+        }else if(c->body_left < 0){
+            i = n;                                  // 没有 Content-Length，读到连接关闭
+        }else{
+            long take = std::min((long)(n - i), c->body_left);
+            i += take;
+            c->body_left -= take;
+            if(c->body_left == 0) response_done(w, c);
+        }
+    }
+}
+
+static void client_on_event(worker* w, client* c, uint32_t events){
+    if(c->connecting && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))){
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if(err != 0){
+            ++w->errors;
+            client_close(w, c);
+            return;
+        }
+        c->connecting = false;
+        client_fill(w, c);
+    }
+    if(c->fd != -1 && (events & EPOLLIN)){
+        char buf[65536];
+        while(c->fd != -1){
+            ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+            if(n > 0){
+                w->bytes_in += n;
+                c->last_active = now_ns();
+                client_on_data(w, c, buf, n);
+                continue;
+            }
+            if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            // 对方关闭连接：没有 Content-Length 的响应到此结束，其余在途请求算作错误
+            if(c->in_body && c->body_left < 0){
+                c->server_close = true;
+                response_done(w, c);
+            }
+            if(c->fd != -1){
+                w->errors += c->inflight.size();
+                client_close(w, c);
+            }
+            break;
+        }
+    }
+    if(c->fd != -1 && (events & EPOLLOUT) && !client_flush(c)){
+        ++w->errors;
+        client_close(w, c);
+    }
+    if(c->fd != -1){
+        client_fill(w, c);
+    }
+}
+
+static void* worker_run(void* arg){
+    worker* w = (worker*)arg;
+    w->epfd = epoll_create1(0);
+    for(int i = 0; i < w->nconns; ++i){
+        client* c = new client;
+        c->fd = -1;
+        c->out_off = 0;
+        client_close(w, c);
+        w->clients.push_back(c);
+        if(!client_connect(w, c)) ++w->errors;
+    }
+    w->next_send = now_ns();
+    long interval = w->rate > 0 ? (long)(1e9 / w->rate) : 0;
+    epoll_event events[1024];
+    long last_check = now_ns();
+
+    while(true){
+        long now = now_ns();
+        if(now >= g_end_ns) break;
+
+        if(interval){
+            while(w->next_send <= now){         // 到了发送时间的请求进入积压队列
+                w->backlog.push_back(w->next_send);
+                w->next_send += interval;
+            }
+            for(size_t i = 0; i < w->clients.size() && !w->backlog.empty(); ++i){
+                if(client_can_send(w->clients[i])) client_fill(w, w->clients[i]);
+            }
+        }
+
+        // 每 100ms 检查一次超时和断开的连接
+        if(now - last_check > 100000000L){
+            last_check = now;
+            for(size_t i = 0; i < w->clients.size(); ++i){
+                client* c = w->clients[i];
+                if(c->fd != -1 && (!c->inflight.empty() || c->connecting)
+                   && now - c->last_active > g_timeout_ms * 1000000L){
+                    w->timeouts += c->inflight.empty() ? 1 : c->inflight.size();
+                    client_close(w, c);
+                }
+                if(c->fd == -1 && !client_connect(w, c)) ++w->errors;
+            }
+        }
+
+        int wait_ms = 100;
+        if(interval){
+            wait_ms = (int)((w->next_send - now) / 1000000L);
+            if(wait_ms < 0) wait_ms = 0;
+            if(wait_ms > 100) wait_ms = 100;
+        }
+        int n = epoll_wait(w->epfd, events, 1024, wait_ms);
+        for(int i = 0; i < n; ++i){
+            client* c = (client*)events[i].data.ptr;
+            if(c->fd == -1) continue;
+            client_on_event(w, c, events[i].events);
+        }
+        // 非长连接模式下，响应结束后连接被关闭，立即重连
+        for(size_t i = 0; i < w->clients.size(); ++i){
+            if(w->clients[i]->fd == -1 && !g_keepalive && !client_connect(w, w->clients[i])) ++w->errors;
+        }
+    }
+    for(size_t i = 0; i < w->clients.size(); ++i){
+        client_close(w, w->clients[i]);
+        delete w->clients[i];
+    }
+    close(w->epfd);
+    return NULL;
+}
+
+// 生成语料文件：大小服从对数正态分布，中位数约 8KB
+static int gen_corpus(const char* dir, int n){
+    if(n <= 0) n = 1000;
+    mkdir(dir, 0755);
+    unsigned long rng = 88172645463325252UL;
+    std::string page;
+    for(int i = 0; i < n; ++i){
+        double u1 = ((xorshift(rng) >> 11) + 1) * (1.0 / 9007199254740992.0);
+        double u2 = (xorshift(rng) >> 11) * (1.0 / 9007199254740992.0);
+        double z = sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+        long size = (long)exp(log(8192.0) + 1.2 * z);
+        size = std::max(256L, std::min(size, 4L * 1024 * 1024));
+        page.assign("<html><body>\n");
+        while((long)page.size() < size - 16){
+            page.append("lorem ipsum dolor sit amet consectetur adipiscing elit\n");
+        }
+        page.resize(size - 15);
+        page.append("</body></html>\n");
+        char path[512];
+        snprintf(path, sizeof(path), "%s/f%05d.html", dir, i);
+        FILE* fp = fopen(path, "w");
+        if(!fp){
+            perror(path);
+            return 1;
+        }
+        fwrite(page.data(), 1, page.size(), fp);
+        fclose(fp);
+    }
+    printf("generated %d files in %s, request them with -n %d -P <path under doc_root>\n", n, dir, n);
+    return 0;
+}
+
+static void build_requests(){
+    const char* conn = g_keepalive ? "keep-alive" : "close";
+    char buf[1024];
+    if(g_zipf_n <= 0){
+        snprintf(buf, sizeof(buf), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n\r\n", g_url.c_str(), g_host.c_str(), conn);
+        g_requests.push_back(buf);
+        return;
+    }
+    double sum = 0;
+    for(int i = 0; i < g_zipf_n; ++i){
+        snprintf(buf, sizeof(buf), "GET %s/f%05d.html HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\n\r\n",
+                 g_prefix.c_str(), i, g_host.c_str(), conn);
+        g_requests.push_back(buf);
+        sum += 1.0 / pow(i + 1, g_zipf_s);
+        g_zipf_cdf.push_back(sum);
+    }
+    for(size_t i = 0; i < g_zipf_cdf.size(); ++i){
+        g_zipf_cdf[i] /= sum;
+    }
+}
+
+static void usage(const char* prog){
+    fprintf(stderr, "usage: %s [-c conns] [-t threads] [-d seconds] [-p depth] [-R rate] [-k 0|1]\n"
+                    "          [-u url | -n urls [-s zipf_s] [-P prefix]] [-T timeout_ms] [-j json] host:port\n"
+                    "       %s -g dir -n files\n", prog, prog);
+}
+
+int main(int argc, char* argv[]){
+    int opt;
+    while((opt = getopt(argc, argv, "c:t:d:p:R:k:u:n:s:P:T:j:g:h")) != -1){
+        switch(opt){
+            case 'c': g_conns = atoi(optarg); break;
+            case 't': g_threads = atoi(optarg); break;
+            case 'd': g_duration = atoi(optarg); break;
+            case 'p': g_depth = atoi(optarg); break;
+            case 'R': g_rate = atof(optarg); break;
+            case 'k': g_keepalive = atoi(optarg) != 0; break;
+            case 'u': g_url = optarg; break;
+            case 'n': g_zipf_n = atoi(optarg); break;
+            case 's': g_zipf_s = atof(optarg); break;
+            case 'P': g_prefix = optarg; break;
+            case 'T': g_timeout_ms = atol(optarg); break;
+            case 'j': g_json = optarg; break;
+            case 'g': g_gen_dir = optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if(g_gen_dir){
+        return gen_corpus(g_gen_dir, g_zipf_n);
+    }
+    if(optind >= argc || g_conns <= 0 || g_threads <= 0 || g_depth <= 0){
+        usage(argv[0]);
+        return 1;
+    }
+    if(g_threads > g_conns) g_threads = g_conns;
+    if(!g_keepalive) g_depth = 1;
+
+    // 解析 host:port
+    g_host = argv[optind];
+    size_t colon = g_host.rfind(':');
+    int port = colon == std::string::npos ? 80 : atoi(g_host.c_str() + colon + 1);
+    std::string host = g_host.substr(0, colon);
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host.c_str(), NULL, &hints, &res) != 0){
+        fprintf(stderr, "cannot resolve %s\n", host.c_str());
+        return 1;
+    }
+    g_addr = *(struct sockaddr_in*)res->ai_addr;
+    g_addr.sin_port = htons(port);
+    freeaddrinfo(res);
+    build_requests();
+
+    std::vector<worker*> workers;
+    long start = now_ns();
+    g_end_ns = start + g_duration * 1000000000L;
+    for(int i = 0; i < g_threads; ++i){
+        worker* w = new worker;
+        w->id = i;
+        w->nconns = g_conns / g_threads + (i < g_conns % g_threads ? 1 : 0);
+        w->rate = g_rate / g_threads;
+        w->rng = 0x9E3779B97F4A7C15UL * (i + 1);
+        w->completed = w->errors = w->timeouts = w->connects = w->bytes_in = 0;
+        memset(w->status, 0, sizeof(w->status));
+        pthread_create(&w->tid, NULL, worker_run, w);
+        workers.push_back(w);
+    }
+
+    histogram hist;
+    unsigned long completed = 0, errors = 0, timeouts = 0, connects = 0, bytes_in = 0, status[6] = {0};
+    unsigned long backlog = 0;
+    for(size_t i = 0; i < workers.size(); ++i){
+        worker* w = workers[i];
+        pthread_join(w->tid, NULL);
+        hist.merge(w->hist);
+        completed += w->completed;
+        errors += w->errors;
+        timeouts += w->timeouts;
+        connects += w->connects;
+        bytes_in += w->bytes_in;
+        backlog += w->backlog.size();
+        for(int s = 0; s < 6; ++s) status[s] += w->status[s];
+    }
+    double secs = (now_ns() - start) / 1e9;
+
+    printf("%s %s, %d threads, %d connections, depth %d, %s, %.1fs\n", g_rate > 0 ? "open-loop" : "closed-loop",
+           g_keepalive ? "keep-alive" : "close", g_threads, g_conns, g_depth, argv[optind], secs);
+    if(g_rate > 0) printf("target rate %.0f req/s, %lu requests still queued at end\n", g_rate, backlog);
+    printf("requests %lu, %.1f req/s, %.2f MB/s, connects %lu, errors %lu, timeouts %lu\n",
+           completed, completed / secs, bytes_in / secs / 1048576, connects, errors, timeouts);
+    printf("status 2xx %lu, 3xx %lu, 4xx %lu, 5xx %lu, other %lu\n", status[2], status[3], status[4], status[5], status[0] + status[1]);
+    printf("latency us: mean %.0f, p50 %ld, p90 %ld, p99 %ld, p99.9 %ld, max %ld\n", hist.total ? hist.sum / hist.total : 0.0,
+           hist.percentile(50), hist.percentile(90), hist.percentile(99), hist.percentile(99.9), hist.max);
+
+    if(g_json){
+        FILE* fp = strcmp(g_json, "-") == 0 ? stdout : fopen(g_json, "w");
+        if(!fp){
+            perror(g_json);
+            return 1;
+        }
+        fprintf(fp, "{\"target\":\"%s\",\"mode\":\"%s\",\"keepalive\":%s,\"threads\":%d,\"connections\":%d,\"depth\":%d,"
+                    "\"rate\":%.0f,\"zipf_urls\":%d,\"zipf_s\":%.2f,\"duration_s\":%.3f,\n"
+                    " \"requests\":%lu,\"rps\":%.1f,\"bytes\":%lu,\"connects\":%lu,\"errors\":%lu,\"timeouts\":%lu,\"backlog\":%lu,\n"
+                    " \"status\":{\"2xx\":%lu,\"3xx\":%lu,\"4xx\":%lu,\"5xx\":%lu,\"other\":%lu},\n"
+                    " \"latency_us\":{\"mean\":%.1f,\"p50\":%ld,\"p90\":%ld,\"p99\":%ld,\"p999\":%ld,\"max\":%ld}}\n",
+                argv[optind], g_rate > 0 ? "open" : "closed", g_keepalive ? "true" : "false", g_threads, g_conns, g_depth,
+                g_rate, g_zipf_n, g_zipf_s, secs, completed, completed / secs, bytes_in, connects, errors, timeouts, backlog,
+                status[2], status[3], status[4], status[5], status[0] + status[1], hist.total ? hist.sum / hist.total : 0.0,
+                hist.percentile(50), hist.percentile(90), hist.percentile(99), hist.percentile(99.9), hist.max);
+        if(fp != stdout) fclose(fp);
+    }
+    return 0;
+}
@@ -0,0 +1,425 @@
+// 进程内回环压测：不经过网卡和 TCP 协议栈，测量服务器自身每个请求的 CPU 开销
+// 编译（在仓库根目录）：
+//   g++ -O2 -pthread -I. test_presure/loopback/loopback_bench.cpp http_conn.cpp lst_timer.cpp log.cpp access_log.cpp
+//       metrics.cpp scoreboard.cpp trace.cpp perf_stage.cpp locker.cpp capture.cpp admission.cpp ratelimit.cpp tls.cpp h2.cpp hpack.cpp proxy.cpp microcache.cpp router.cpp coro.cpp -o loopback_bench
+//   加上 -std=c++20 时可以用 -m coro 测试协程连接模型（见 coro.h）
+//
+// 用法：loopback_bench [-m pool|coro] [-w 1,2,4,8] [-c 连接数] [-t 客户端线程数] [-n 请求数] [-u URL] [-r doc_root] [-L] [-j]
+//   -m MODEL  pool：线程池模型（默认）；coro：协程模型，-w 为事件循环线程数，连接轮流分给各个事件循环
+//   -w LIST   依次测试的工作线程数（默认 1,2,4,8）
+//   -c N      连接数（默认 64），每个连接是一对 UNIX socketpair，一端交给 http_conn，一端由客户端线程读写
+//   -t N      客户端线程数（默认 1）
+//   -n N      每种配置的请求总数（默认 200000），按请求数而不是时间计量，结果可重复
+//   -u URL    请求的 URL（默认 /index.html）
+//   -r DIR    替换 http_conn.cpp 中写死的 doc_root
+//   -L        保留 INFO 级别的日志（写入 ./log），默认把运行时日志等级调到 WARN
+//   -j        每种配置输出一行 JSON
+//
+// 每种配置在 fork 出的子进程中运行，主线程执行与 main.cpp 相同的事件循环，线程池与服务器相同
+// （协程模型中主线程运行第一个事件循环，其余的各占一个线程）；
+// 客户端是长连接的闭环客户端。服务器 CPU = 进程 CPU（getrusage）- 客户端线程 CPU（CLOCK_THREAD_CPUTIME_ID）。
+// epctl/req 为每个请求在客户端连接上调用 epoll_ctl 的次数（MC_EPOLL_CTL），events/req 为主线程 epoll_wait
+// 返回的事件数（只统计线程池模型），两者是 EPOLLONESHOT 模型中每个请求的主要系统调用开销。
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "http_conn.h"
+#include "threadpool.h"
+#include "log.h"
+#include "coro.h"
+
+extern const char* doc_root;
+extern void addfd(int epoll_fd, int fd, bool one_shot, bool et);
+
+static std::vector<int> g_workers;
+static int g_conns = 64;
+static int g_client_threads = 1;
+static long g_requests = 200000;
+static std::string g_url = "/index.html";
+static bool g_keep_log = false;
+static bool g_json = false;
+static bool g_coro = false;
+
+static long now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static long thread_cpu_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// 客户端一侧的连接
+struct lb_client {
+    int fd;
+    char hdr[4096];
+    int hdr_len;
+    bool in_body;
+    long body_left;
+    int status;
+};
+
+static std::string g_request;
+static std::atomic<long> g_to_send(0);      // 尚未发出的请求数
+static std::atomic<long> g_done(0);         // 已收到的响应数
+static std::atomic<long> g_bad(0);          // 非 2xx 响应或错误
+static std::atomic<long> g_client_cpu(0);   // 客户端线程的 CPU 时间
+static std::atomic<bool> g_clients_done(false);
+static long g_server_events = 0;            // 服务器主线程 epoll_wait 返回的事件数
+
+struct client_arg {
+    std::vector<lb_client*> clients;
+};
+
+static bool client_send(lb_client* c){
+    if(g_to_send.fetch_sub(1, std::memory_order_relaxed) <= 0){
+        return false;
+    }
+    // 请求很小，UNIX socket 的缓冲区一定放得下
+    if(send(c->fd, g_request.data(), g_request.size(), MSG_NOSIGNAL) != (ssize_t)g_request.size()){
+        g_bad.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+// 收到数据，返回本次完成的响应数
+static int client_on_data(lb_client* c, const char* buf, size_t n){
+    int done = 0;
+    size_t i = 0;
+    while(i < n){
+        if(!c->in_body){
+            if(c->hdr_len >= (int)sizeof(c->hdr) - 1){
+                c->hdr_len = 0;
+                g_bad.fetch_add(1, std::memory_order_relaxed);
+                return done;
+            }
+            c->hdr[c->hdr_len++] = buf[i++];
+            if(c->hdr_len >= 4 && memcmp(c->hdr + c->hdr_len - 4, "\r\n\r\n", 4) == 0){
+                c->hdr[c->hdr_len] = '\0';
+                c->status = 0;
+                sscanf(c->hdr, "HTTP/%*d.%*d %d", &c->status);
+                const char* cl = strcasestr(c->hdr, "\r\nContent-Length:");
+                c->body_left = cl ? atol(cl + 17) : 0;
+                c->in_body = true;
+            }
+        }else{
+            long take = std::min((long)(n - i), c->body_left);
+            i += take;
+            c->body_left -= take;
+        }
+        if(c->in_body && c->body_left == 0){
+            if(c->status / 100 != 2) g_bad.fetch_add(1, std::memory_order_relaxed);
+            c->in_body = false;
+            c->hdr_len = 0;
+            ++done;
+        }
+    }
+    return done;
+}
+
+static void* client_run(void* arg){
+    client_arg* a = (client_arg*)arg;
+    int epfd = epoll_create1(0);
+    int outstanding = 0;
+    for(size_t i = 0; i < a->clients.size(); ++i){
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = a->clients[i];
+        epoll_ctl(epfd, EPOLL_CTL_ADD, a->clients[i]->fd, &ev);
+        if(client_send(a->clients[i])) ++outstanding;
+    }
+    epoll_event events[256];
+    char buf[65536];
+    long last_progress = now_ns();
+    while(outstanding > 0){
+        int n = epoll_wait(epfd, events, 256, 100);
+        if(n == 0 && now_ns() - last_progress > 2000000000L){
+            fprintf(stderr, "no response for 2s, is %s%s readable?\n", doc_root, g_url.c_str());
+            g_bad.fetch_add(outstanding, std::memory_order_relaxed);
+            break;
+        }
+        for(int i = 0; i < n; ++i){
+            lb_client* c = (lb_client*)events[i].data.ptr;
+            ssize_t len = recv(c->fd, buf, sizeof(buf), MSG_DONTWAIT);
+            if(len <= 0){
+                if(len < 0 && errno == EAGAIN) continue;
+                epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, 0);   // 服务器关闭了连接
+                g_bad.fetch_add(1, std::memory_order_relaxed);
+                --outstanding;
+                continue;
+            }
+            last_progress = now_ns();
+            int done = client_on_data(c, buf, len);
+            g_done.fetch_add(done, std::memory_order_relaxed);
+            for(int d = 0; d < done; ++d){
+                --outstanding;
+                if(client_send(c)) ++outstanding;
+            }
+        }
+    }
+    close(epfd);
+    g_client_cpu.fetch_add(thread_cpu_ns(), std::memory_order_relaxed);
+    return NULL;
+}
+
+// 与 main.cpp 相同的事件分发
+static void server_loop(int epoll_fd, http_conn* users, threadpool<http_conn>* pool){
+    epoll_event events[1024];
+    while(!g_clients_done.load(std::memory_order_acquire)){
+        int num = epoll_wait(epoll_fd, events, 1024, 10);
+        if(num > 0) g_server_events += num;
+        for(int i = 0; i < num; ++i){
+            int sock_fd = events[i].data.fd;
+            if(sock_fd == http_conn::m_done_fd){
+                http_conn::drain_done();
+                continue;
+            }
+            users[sock_fd].epoll_fired();
+            if(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+                users[sock_fd].conn_close();
+                http_conn::m_timer_lst.del_timer(users[sock_fd].timer);
+            }else if(events[i].events & EPOLLIN){
+                if(users[sock_fd].read()){
+                    if(!pool->append(users + sock_fd, users[sock_fd].priority_request())){
+                        users[sock_fd].shed(SHED_QUEUE_FULL);
+                    }
+                }else{
+                    users[sock_fd].conn_close();
+                    http_conn::m_timer_lst.del_timer(users[sock_fd].timer);
+                }
+            }else if(events[i].events & EPOLLOUT){
+                if(!users[sock_fd].write()){
+                    users[sock_fd].conn_close();
+                    http_conn::m_timer_lst.del_timer(users[sock_fd].timer);
+                }
+            }
+        }
+    }
+}
+
+#if CORO_AVAILABLE
+static void* coro_loop_main(void* arg){
+    coro_loop_run((coro_loop*)arg, &g_clients_done);
+    return NULL;
+}
+#endif
+
+struct run_result {
+    int workers;
+    long requests, bad;
+    double wall_s, server_cpu_s, client_cpu_s;
+    long ctx_switches;
+    long epoll_ctls, events;
+};
+
+static void* clients_wait(void* arg){
+    std::vector<pthread_t>* tids = (std::vector<pthread_t>*)arg;
+    for(size_t i = 0; i < tids->size(); ++i){
+        pthread_join((*tids)[i], NULL);
+    }
+    g_clients_done.store(true, std::memory_order_release);
+    return NULL;
+}
+
+// 在子进程中运行一种配置
+static run_result run_one(int workers){
+    g_request = "GET " + g_url + " HTTP/1.1\r\nHost: loopback\r\nConnection: keep-alive\r\n\r\n";
+    g_to_send = g_requests;
+
+    int epoll_fd = epoll_create(5);
+    http_conn::m_epoll_fd = epoll_fd;
+    if(!g_coro){
+        http_conn::m_done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        addfd(epoll_fd, http_conn::m_done_fd, false, false);
+    }
+    http_conn* users = new http_conn[65536];
+    // 线程池的构造函数会逐个打印创建的线程
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    threadpool<http_conn>* pool = g_coro ? NULL : new threadpool<http_conn>(workers, 10000);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    close(null_fd);
+
+    #if CORO_AVAILABLE
+    std::vector<coro_loop*> loops;
+    for(int i = 0; g_coro && i < workers; ++i){
+        loops.push_back(coro_loop_create());
+    }
+    #endif
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    std::vector<client_arg> args(g_client_threads);
+    for(int i = 0; i < g_conns; ++i){
+        int sv[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1 || sv[0] >= 65536){
+            perror("socketpair");
+            exit(1);
+        }
+        addr.sin_port = htons(10000 + i);
+        #if CORO_AVAILABLE
+        if(g_coro){
+            coro_spawn(loops[i % workers], sv[0], addr);
+        }else
+        #endif
+        users[sv[0]].init(sv[0], addr);
+        lb_client* c = new lb_client;
+        memset(c, 0, sizeof(*c));
+        c->fd = sv[1];
+        args[i % g_client_threads].clients.push_back(c);
+    }
+
+    long ctl_start = metrics_counter_get(MC_EPOLL_CTL);     // 不计建立连接时的 EPOLL_CTL_ADD
+    struct rusage ru_start, ru_end;
+    getrusage(RUSAGE_SELF, &ru_start);
+    long start = now_ns();
+    std::vector<pthread_t> tids(g_client_threads);
+    for(int i = 0; i < g_client_threads; ++i){
+        pthread_create(&tids[i], NULL, client_run, &args[i]);
+    }
+    pthread_t waiter;
+    pthread_create(&waiter, NULL, clients_wait, &tids);
+    #if CORO_AVAILABLE
+    if(g_coro){
+        std::vector<pthread_t> loop_tids(workers - 1);
+        for(int i = 1; i < workers; ++i){
+            pthread_create(&loop_tids[i - 1], NULL, coro_loop_main, loops[i]);
+        }
+        coro_loop_run(loops[0], &g_clients_done);
+        for(int i = 1; i < workers; ++i){
+            pthread_join(loop_tids[i - 1], NULL);
+        }
+    }else
+    #endif
+    server_loop(epoll_fd, users, pool);
+    pthread_join(waiter, NULL);
+    long wall = now_ns() - start;
+    getrusage(RUSAGE_SELF, &ru_end);
+
+    run_result r;
+    r.workers = workers;
+    r.requests = g_done.load();
+    r.bad = g_bad.load();
+    r.wall_s = wall / 1e9;
+    double cpu = (ru_end.ru_utime.tv_sec - ru_start.ru_utime.tv_sec) + (ru_end.ru_utime.tv_usec - ru_start.ru_utime.tv_usec) / 1e6
+               + (ru_end.ru_stime.tv_sec - ru_start.ru_stime.tv_sec) + (ru_end.ru_stime.tv_usec - ru_start.ru_stime.tv_usec) / 1e6;
+    r.client_cpu_s = g_client_cpu.load() / 1e9;
+    r.server_cpu_s = cpu - r.client_cpu_s;
+    r.ctx_switches = (ru_end.ru_nvcsw - ru_start.ru_nvcsw) + (ru_end.ru_nivcsw - ru_start.ru_nivcsw);
+    r.epoll_ctls = metrics_counter_get(MC_EPOLL_CTL) - ctl_start;
+    r.events = g_server_events;
+    return r;
+}
+
+static void report(const run_result& r){
+    double n = r.requests ? r.requests : 1;
+    if(g_json){
+        printf("{\"workers\":%d,\"connections\":%d,\"requests\":%ld,\"bad\":%ld,\"wall_s\":%.3f,\"rps\":%.1f,"
+               "\"server_cpu_us_per_req\":%.3f,\"client_cpu_us_per_req\":%.3f,\"ctx_switches_per_req\":%.3f,"
+               "\"epoll_ctl_per_req\":%.3f,\"events_per_req\":%.3f}\n",
+               r.workers, g_conns, r.requests, r.bad, r.wall_s, r.requests / r.wall_s,
+               r.server_cpu_s * 1e6 / n, r.client_cpu_s * 1e6 / n, r.ctx_switches / n, r.epoll_ctls / n, r.events / n);
+    }else{
+        printf("%8d %10ld %6ld %10.3f %12.1f %14.3f %14.3f %12.3f %11.3f %10.3f\n", r.workers, r.requests, r.bad, r.wall_s,
+               r.requests / r.wall_s, r.server_cpu_s * 1e6 / n, r.client_cpu_s * 1e6 / n, r.ctx_switches / n,
+               r.epoll_ctls / n, r.events / n);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[]){
+    const char* workers = "1,2,4,8";
+    int opt;
+    while((opt = getopt(argc, argv, "m:w:c:t:n:u:r:Lj")) != -1){
+        switch(opt){
+            case 'm': g_coro = strcmp(optarg, "coro") == 0; break;
+            case 'w': workers = optarg; break;
+            case 'c': g_conns = atoi(optarg); break;
+            case 't': g_client_threads = atoi(optarg); break;
+            case 'n': g_requests = atol(optarg); break;
+            case 'u': g_url = optarg; break;
+            case 'r': doc_root = optarg; break;
+            case 'L': g_keep_log = true; break;
+            case 'j': g_json = true; break;
+            default:
+                fprintf(stderr, "usage: %s [-m pool|coro] [-w 1,2,4,8] [-c conns] [-t client_threads] [-n requests] [-u url] [-r doc_root] [-L] [-j]\n", argv[0]);
+                return 1;
+        }
+    }
+    for(const char* p = workers; *p; ){
+        g_workers.push_back(atoi(p));
+        p += strcspn(p, ",");
+        p += *p == ',';
+    }
+    #if !CORO_AVAILABLE
+    if(g_coro){
+        fprintf(stderr, "-m coro needs a C++20 build (-std=c++20)\n");
+        return 1;
+    }
+    #endif
+    if(g_conns <= 0 || g_client_threads <= 0 || g_client_threads > g_conns){
+        fprintf(stderr, "need 0 < client threads <= connections\n");
+        return 1;
+    }
+    if(!g_json){
+        printf("%s model, %d connections, %d client threads, %ld requests per run, GET %s%s\n", g_coro ? "coroutine" : "thread pool",
+               g_conns, g_client_threads, g_requests, doc_root, g_url.c_str());
+        printf("%8s %10s %6s %10s %12s %14s %14s %12s %11s %10s\n", "workers", "requests", "bad", "wall_s", "req/s",
+               "srv_cpu_us/req", "cli_cpu_us/req", "ctxsw/req", "epctl/req", "events/req");
+        fflush(stdout);
+    }
+
+    for(size_t i = 0; i < g_workers.size(); ++i){
+        int pfd[2];
+        if(pipe(pfd) == -1) return 1;
+        pid_t pid = fork();
+        if(pid == 0){
+            close(pfd[0]);
+            if(g_keep_log){
+                EM_log_init();
+            }else{
+                EM_log_level_set(LOGLEVEL_WARN);
+            }
+            run_result r = run_one(g_workers[i]);
+            if(g_keep_log){
+                EM_log_close();
+            }
+            if(write(pfd[1], &r, sizeof(r)) != (ssize_t)sizeof(r)) _exit(1);
+            _exit(0);               // 线程池的工作线程不会退出，直接结束子进程
+        }
+        close(pfd[1]);
+        run_result r;
+        ssize_t n = read(pfd[0], &r, sizeof(r));
+        close(pfd[0]);
+        waitpid(pid, NULL, 0);
+        if(n != (ssize_t)sizeof(r)){
+            fprintf(stderr, "run with %d workers failed\n", g_workers[i]);
+            continue;
+        }
+        report(r);
+    }
+    return 0;
+}
@@ -0,0 +1,414 @@
+// 组件级微基准测试：请求解析、定时器链表、线程池任务交接、应答生成
+// 编译（在仓库根目录）：
+//   g++ -O2 -pthread -I. test_presure/microbench/microbench.cpp http_conn.cpp lst_timer.cpp log.cpp access_log.cpp
+//       metrics.cpp scoreboard.cpp trace.cpp perf_stage.cpp locker.cpp capture.cpp admission.cpp ratelimit.cpp tls.cpp h2.cpp hpack.cpp proxy.cpp microcache.cpp router.cpp -o microbench
+//
+// 用法：microbench [-j] [-f 名字前缀] [-t 毫秒] [-r 请求语料文件]
+//   -j        每个结果输出一行 JSON，便于在不同提交之间对比
+//   -f NAME   只运行名字以 NAME 开头的测试
+//   -t MS     每个测试的计时时长（默认 200ms），线程池测试按固定任务数计时
+//   -r FILE   请求语料：抓取到的原始请求依次拼接，以空行分隔；默认使用内置的几种典型请求
+//
+// 输出 ns/op 和 allocs/op，allocs/op 统计的是 operator new 的调用次数（包括线程池中其他线程的分配）。
+// 解析测试的每次操作包含把请求复制到读缓冲区，与 read() 中的 recv 相当。
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <atomic>
+#include <new>
+#include <string>
+#include <vector>
+#include "http_conn.h"
+#include "lst_timer.h"
+#include "threadpool.h"
+
+// 统计 operator new 的调用次数
+static std::atomic<unsigned long> g_allocs(0);
+
+void* operator new(size_t size){
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+void* operator new[](size_t size){
+    return operator new(size);
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+static bool g_json = false;
+static const char* g_filter = "";
+static long g_budget_ns = 200000000L;
+
+static long now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static bool selected(const char* name){
+    return strncmp(name, g_filter, strlen(g_filter)) == 0;
+}
+
+static void report(const char* name, const char* param, unsigned long ops, long ns, unsigned long allocs){
+    double ns_op = ops ? (double)ns / ops : 0;
+    double allocs_op = ops ? (double)allocs / ops : 0;
+    if(g_json){
+        printf("{\"bench\":\"%s\",\"param\":\"%s\",\"ops\":%lu,\"ns_per_op\":%.2f,\"allocs_per_op\":%.3f}\n",
+               name, param, ops, ns_op, allocs_op);
+    }else{
+        printf("%-24s %-22s %12lu %12.2f %12.3f\n", name, param, ops, ns_op, allocs_op);
+    }
+    fflush(stdout);
+}
+
+// 在计时时长内重复执行 op，每批次的次数翻倍，以减少读时钟的开销
+template<typename F>
+static void run_timed(const char* name, const char* param, F op){
+    unsigned long ops = 0, batch = 1;
+    unsigned long allocs = g_allocs.load(std::memory_order_relaxed);
+    long start = now_ns(), elapsed = 0;
+    while(elapsed < g_budget_ns){
+        for(unsigned long i = 0; i < batch; ++i){
+            op();
+        }
+        ops += batch;
+        elapsed = now_ns() - start;
+        if(batch < (1UL << 20)) batch *= 2;
+    }
+    report(name, param, ops, elapsed, g_allocs.load(std::memory_order_relaxed) - allocs);
+}
+
+// 内置的典型请求：压测工具、curl、浏览器
+static const char* builtin_requests[] = {
+    "GET /index.html HTTP/1.0\r\nUser-Agent: WebBench 1.5\r\nHost: 127.0.0.1\r\n\r\n",
+    "GET /index.html HTTP/1.1\r\nHost: 127.0.0.1:9999\r\nUser-Agent: curl/7.88.1\r\nAccept: */*\r\n\r\n",
+    "GET /images/image1.jpg HTTP/1.1\r\nHost: 192.168.15.128:9999\r\nConnection: keep-alive\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+    "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+    "Referer: http://192.168.15.128:9999/index.html\r\nAccept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\nCookie: session=0123456789abcdef0123456789abcdef\r\n\r\n",
+};
+
+static std::vector<std::string> g_corpus;
+
+static bool load_corpus(const char* path){
+    FILE* fp = fopen(path, "rb");
+    if(!fp){
+        perror(path);
+        return false;
+    }
+    std::string data;
+    char buf[65536];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), fp)) > 0){
+        data.append(buf, n);
+    }
+    fclose(fp);
+    size_t pos = 0;
+    while(pos < data.size()){
+        size_t end = data.find("\r\n\r\n", pos);
+        if(end == std::string::npos) break;
+        std::string req = data.substr(pos, end + 4 - pos);
+        if(req.size() < (size_t)http_conn::RD_BUF_SIZE){     // 超过读缓冲区的请求服务器也无法解析
+            g_corpus.push_back(req);
+        }
+        pos = end + 4;
+    }
+    return !g_corpus.empty();
+}
+
+// 通过友元访问 http_conn 的私有成员
+class http_conn_bench {
+public:
+    http_conn conn;
+
+    http_conn_bench(){
+        conn.init();
+        conn.m_sock_fd = -1;
+    }
+
+    void load(const std::string& req){
+        memcpy(conn.m_rd_buf, req.data(), req.size());
+        conn.m_rd_idx = req.size();
+        conn.m_checked_idx = 0;
+        conn.m_line_start = 0;
+        conn.m_check_stat = http_conn::CHECK_STATE_REQUESTLINE;
+    }
+
+    // 只切分行，返回行数
+    int split_lines(const std::string& req){
+        load(req);
+        int lines = 0;
+        while(conn.parse_one_line() == http_conn::LINE_OK){
+            conn.m_line_start = conn.m_checked_idx;
+            ++lines;
+        }
+        return lines;
+    }
+
+    // 与 process_read 相同的解析过程，但不调用 do_request
+    http_conn::HTTP_CODE parse(const std::string& req){
+        load(req);
+        conn.m_linger = false;
+        conn.m_content_len = 0;
+        conn.m_host = 0;
+        while(conn.parse_one_line() == http_conn::LINE_OK){
+            char* text = conn.get_line();
+            conn.m_line_start = conn.m_checked_idx;
+            http_conn::HTTP_CODE ret;
+            if(conn.m_check_stat == http_conn::CHECK_STATE_REQUESTLINE){
+                ret = conn.parse_request_line(text);
+            }else{
+                ret = conn.parse_request_headers(text);
+            }
+            if(ret != http_conn::NO_REQUEST) return ret;
+        }
+        return http_conn::NO_REQUEST;
+    }
+
+    int add_response(int len){
+        conn.m_write_idx = 0;
+        conn.add_response("Content-Length: %d\r\n", len);
+        return conn.m_write_idx;
+    }
+
+    // 文件请求的完整响应头：状态行 + add_headers
+    int response_headers(int len){
+        conn.m_write_idx = 0;
+        conn.m_linger = true;
+        conn.add_status_line(200, "OK");
+        conn.add_headers(len);
+        return conn.m_write_idx;
+    }
+};
+
+static volatile long g_sink;
+
+static void bench_parser(){
+    http_conn_bench b;
+    size_t lines = 0;
+    for(size_t i = 0; i < g_corpus.size(); ++i){
+        lines += b.split_lines(g_corpus[i]);
+        if(b.parse(g_corpus[i]) != http_conn::GET_REQUEST){
+            fprintf(stderr, "corpus request %zu does not parse as a GET request\n", i);
+        }
+    }
+    char param[64];
+    snprintf(param, sizeof(param), "%zu reqs/%zu lines", g_corpus.size(), lines);
+
+    // 每次操作处理语料中的一个请求，轮流使用
+    size_t idx = 0;
+    if(selected("parse_one_line")){
+        run_timed("parse_one_line", param, [&]{
+            g_sink += b.split_lines(g_corpus[idx]);
+            if(++idx == g_corpus.size()) idx = 0;
+        });
+    }
+    if(selected("parse_request")){
+        run_timed("parse_request", param, [&]{
+            g_sink += b.parse(g_corpus[idx]);
+            if(++idx == g_corpus.size()) idx = 0;
+        });
+    }
+    if(selected("add_response")){
+        int len = 0;
+        run_timed("add_response", "content-length", [&]{
+            g_sink += b.add_response(len++ & 0xfffff);
+        });
+    }
+    if(selected("response_headers")){
+        int len = 0;
+        run_timed("response_headers", "200 keep-alive", [&]{
+            g_sink += b.response_headers(len++ & 0xfffff);
+        });
+    }
+}
+
+static void bench_timer(){
+    static const long sizes[] = {1000, 10000, 100000, 1000000};
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s){
+        long n = sizes[s];
+        char param[32];
+        snprintf(param, sizeof(param), "n=%ld", n);
+
+        // 按超时时间从大到小加入，每次都插在头部，预填充是 O(n) 的
+        sort_timer_lst lst;
+        std::vector<util_timer*> timers(n);
+        for(long i = n - 1; i >= 0; --i){
+            timers[i] = new util_timer;
+            timers[i]->expire = i;
+            timers[i]->user_data = NULL;
+            lst.add_timer(timers[i]);
+        }
+        long max_expire = n;
+        long head = 0;          // timers 当作环形队列，[head, head + n) 是按超时时间排列的链表
+
+        // 稳态的新连接：新定时器的超时时间最大，插入到尾部（add_timer 从头遍历整个链表），最早的定时器到期删除
+        if(selected("timer_add_del")){
+            run_timed("timer_add_del", param, [&]{
+                util_timer* t = new util_timer;
+                t->expire = max_expire++;
+                t->user_data = NULL;
+                lst.add_timer(t);
+                lst.del_timer(timers[head % n]);
+                timers[head % n] = t;
+                ++head;
+            });
+        }
+        // 连接上有数据到达：定时器延长到最大超时时间，adjust_timer 把它移到尾部
+        if(selected("timer_adjust")){
+            run_timed("timer_adjust", param, [&]{
+                util_timer* t = timers[head % n];
+                t->expire = max_expire++;
+                lst.adjust_timer(t);
+                ++head;
+            });
+        }
+        // 删除任意一个定时器再插入头部，都是 O(1)
+        if(selected("timer_del_add_head")){
+            long min_expire = -1;
+            unsigned long rng = 88172645463325252UL;
+            run_timed("timer_del_add_head", param, [&]{
+                rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+                long idx = rng % n;
+                lst.del_timer(timers[idx]);
+                util_timer* t = new util_timer;
+                t->expire = min_expire--;
+                t->user_data = NULL;
+                lst.add_timer(t);
+                timers[idx] = t;
+            });
+        }
+        // lst 析构时删除剩下的定时器
+    }
+}
+
+// 线程池的任务：只增加计数
+struct bench_task {
+    std::atomic<long>* done;
+    void process(){
+        done->fetch_add(1, std::memory_order_relaxed);
+    }
+    void shed(int){
+        done->fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+struct producer_arg {
+    threadpool<bench_task>* pool;
+    bench_task* task;
+    long count;
+    long rejected;
+};
+
+static void* producer_run(void* arg){
+    producer_arg* p = (producer_arg*)arg;
+    for(long i = 0; i < p->count; ){
+        if(p->pool->append(p->task)){
+            ++i;
+        }else{
+            ++p->rejected;              // 队列满了，让出 CPU 后重试
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+// 每个配置投递 tasks 个任务，计时到最后一个任务执行完毕
+static void bench_threadpool_one(int producers, int consumers, long tasks){
+    char param[32];
+    snprintf(param, sizeof(param), "p=%d c=%d", producers, consumers);
+    std::atomic<long> done(0);
+    // 线程池没有停止工作线程的接口，工作线程阻塞在信号量上，线程池对象不释放
+    // 构造函数会逐个打印创建的线程，暂时把标准输出重定向到 /dev/null，以免混入结果
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    threadpool<bench_task>* pool = new threadpool<bench_task>(consumers, 10000);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    close(null_fd);
+    bench_task task;
+    task.done = &done;
+
+    std::vector<producer_arg> args(producers);
+    std::vector<pthread_t> tids(producers);
+    unsigned long allocs = g_allocs.load(std::memory_order_relaxed);
+    long start = now_ns();
+    for(int i = 0; i < producers; ++i){
+        args[i].pool = pool;
+        args[i].task = &task;
+        args[i].count = tasks / producers;
+        args[i].rejected = 0;
+        pthread_create(&tids[i], NULL, producer_run, &args[i]);
+    }
+    long total = 0, rejected = 0;
+    for(int i = 0; i < producers; ++i){
+        pthread_join(tids[i], NULL);
+        total += args[i].count;
+        rejected += args[i].rejected;
+    }
+    while(done.load(std::memory_order_relaxed) < total){
+        sched_yield();
+    }
+    long elapsed = now_ns() - start;
+    report("threadpool_handoff", param, total, elapsed, g_allocs.load(std::memory_order_relaxed) - allocs);
+    if(rejected && !g_json){
+        printf("%-24s %-22s %12ld appends rejected (queue full)\n", "", "", rejected);
+    }
+}
+
+static void bench_threadpool(){
+    if(!selected("threadpool_handoff")) return;
+    static const int threads[] = {1, 2, 4, 8, 16, 32, 64};
+    long tasks = g_budget_ns / 1000;        // 默认 20 万个任务
+    for(size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); ++i){
+        bench_threadpool_one(1, threads[i], tasks);             // 与服务器相同：主线程单独投递
+    }
+    for(size_t i = 1; i < sizeof(threads) / sizeof(threads[0]); ++i){
+        bench_threadpool_one(threads[i], threads[i], tasks);    // 多个生产者竞争同一把锁
+    }
+}
+
+int main(int argc, char* argv[]){
+    const char* corpus = NULL;
+    int opt;
+    while((opt = getopt(argc, argv, "jf:t:r:")) != -1){
+        switch(opt){
+            case 'j': g_json = true; break;
+            case 'f': g_filter = optarg; break;
+            case 't': g_budget_ns = atol(optarg) * 1000000L; break;
+            case 'r': corpus = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-j] [-f name_prefix] [-t ms] [-r corpus]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(corpus){
+        if(!load_corpus(corpus)){
+            fprintf(stderr, "no request found in %s\n", corpus);
+            return 1;
+        }
+    }else{
+        for(size_t i = 0; i < sizeof(builtin_requests) / sizeof(builtin_requests[0]); ++i){
+            g_corpus.push_back(builtin_requests[i]);
+        }
+    }
+    if(!g_json){
+        printf("%-24s %-22s %12s %12s %12s\n", "bench", "param", "ops", "ns/op", "allocs/op");
+    }
+    bench_parser();
+    bench_timer();
+    bench_threadpool();
+    return 0;
+}
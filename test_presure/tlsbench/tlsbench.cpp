@@ -0,0 +1,298 @@
+// HTTPS 压测：对比内核 TLS 与 OpenSSL 用户态加密的吞吐和服务器 CPU 开销
+// 编译：g++ -O2 -pthread test_presure/tlsbench/tlsbench.cpp -lssl -lcrypto -o tlsbench
+//
+// 每个线程一个阻塞的 TLS 长连接，收到完整响应后立即发出下一个请求。
+// 指定 -p 时读取服务器进程 /proc/<pid>/stat 中的 utime + stime，换算成每 GB 响应消耗的 CPU 秒数，
+// 分别用 -DTLS_KTLS_OPEN=1（默认）和 -DTLS_KTLS_OPEN=0 编译服务器，在相同参数下运行即可比较。
+// 服务器日志中 webserver_ktls_connections_total 为 0 说明内核不支持 TLS ULP，已退回到用户态加密。
+//
+// 用法：tlsbench [-t 线程数] [-d 秒] [-u URL] [-p 服务器pid] [-j] host:port
+//       tlsbench -g 文件 [-s MB]
+//   -t N      线程数即连接数（默认 4）
+//   -d N      持续时间：秒（默认 10）
+//   -u URL    请求的 URL（默认 /index.html），用大文件测试吞吐，用小文件测试握手后的每请求开销
+//   -p PID    服务器进程号，用于统计服务器 CPU 时间
+//   -j        以一行 JSON 输出结果
+//   -g FILE   生成测吞吐用的大文件后退出，放到服务器 resources 目录下再用 -u 请求
+//   -s N      -g 生成的文件大小：MB（默认 4）
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <atomic>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+static const char* g_host = NULL;
+static const char* g_port = NULL;
+static const char* g_url = "/index.html";
+static int g_threads = 4;
+static int g_duration = 10;
+static SSL_CTX* g_ctx = NULL;
+static std::atomic<bool> g_stop(false);
+
+struct worker {
+    pthread_t tid;
+    long requests;
+    long bytes;             // 响应总字节数（头部 + 正文）
+    long errors;
+};
+
+static double now_sec(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 服务器进程累计的 CPU 时间：秒，读取失败返回 -1
+static double proc_cpu(int pid){
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE* f = fopen(path, "r");
+    if(!f){
+        return -1;
+    }
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    // comm 字段可能含空格，从最后一个 ')' 之后开始数：state 是第 3 个字段，utime/stime 是第 14/15 个
+    char* p = strrchr(buf, ')');
+    if(!p){
+        return -1;
+    }
+    unsigned long utime = 0, stime = 0;
+    if(sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2){
+        return -1;
+    }
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static double self_cpu(){
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static SSL* connect_tls(){
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(g_host, g_port, &hints, &res) != 0){
+        return NULL;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, res->ai_addr, res->ai_addrlen) < 0){
+        freeaddrinfo(res);
+        if(fd >= 0){
+            close(fd);
+        }
+        return NULL;
+    }
+    freeaddrinfo(res);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    // 读超时，服务器异常时线程不会永久阻塞
+    struct timeval tv = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    SSL* ssl = SSL_new(g_ctx);
+    SSL_set_fd(ssl, fd);
+    SSL_set_tlsext_host_name(ssl, g_host);
+    if(SSL_connect(ssl) != 1){
+        SSL_free(ssl);
+        close(fd);
+        return NULL;
+    }
+    return ssl;
+}
+
+static void disconnect(SSL* ssl){
+    int fd = SSL_get_fd(ssl);
+    SSL_free(ssl);
+    close(fd);
+}
+
+// 读取一个完整响应，返回总字节数，出错返回 -1。服务器总是带 Content-Length
+static long read_response(SSL* ssl, char* buf, int size){
+    int len = 0;
+    char* end = NULL;
+    while(!end){
+        if(len == size){
+            return -1;
+        }
+        int n = SSL_read(ssl, buf + len, size - len);
+        if(n <= 0){
+            return -1;
+        }
+        len += n;
+        buf[len < size ? len : size - 1] = '\0';
+        end = strstr(buf, "\r\n\r\n");
+    }
+    long header = end + 4 - buf;
+    char* cl = strcasestr(buf, "Content-Length:");
+    long body = cl && cl < end ? atol(cl + 15) : 0;
+    long left = header + body - len;
+    while(left > 0){
+        int n = SSL_read(ssl, buf, left < size ? left : size);
+        if(n <= 0){
+            return -1;
+        }
+        left -= n;
+    }
+    return header + body;
+}
+
+static void* run(void* arg){
+    worker* w = (worker*)arg;
+    char req[1024];
+    int req_len = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n", g_url, g_host);
+    static const int BUF_SIZE = 64 * 1024;
+    char* buf = (char*)malloc(BUF_SIZE);
+    SSL* ssl = NULL;
+    while(!g_stop.load(std::memory_order_relaxed)){
+        if(!ssl && !(ssl = connect_tls())){
+            ++w->errors;
+            usleep(10000);
+            continue;
+        }
+        long n = -1;
+        if(SSL_write(ssl, req, req_len) == req_len){
+            n = read_response(ssl, buf, BUF_SIZE);
+        }
+        if(n < 0){
+            ++w->errors;
+            disconnect(ssl);
+            ssl = NULL;
+            continue;
+        }
+        ++w->requests;
+        w->bytes += n;
+    }
+    if(ssl){
+        disconnect(ssl);
+    }
+    free(buf);
+    return NULL;
+}
+
+// 生成 mb MB 的文件，内容为伪随机字节，避免被压缩或去重
+static int gen_file(const char* path, int mb){
+    FILE* fp = fopen(path, "w");
+    if(!fp){
+        perror(path);
+        return 1;
+    }
+    unsigned long rng = 88172645463325252UL;
+    static unsigned long block[8192];
+    for(int i = 0; i < mb * 16; ++i){       // 每块 64KB
+        for(int j = 0; j < 8192; ++j){
+            rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+            block[j] = rng;
+        }
+        fwrite(block, 1, sizeof(block), fp);
+    }
+    fclose(fp);
+    printf("generated %s (%d MB)\n", path, mb);
+    return 0;
+}
+
+static void usage(const char* prog){
+    fprintf(stderr, "usage: %s [-t threads] [-d seconds] [-u url] [-p server_pid] [-j] host:port\n"
+                    "       %s -g file [-s mb]\n", prog, prog);
+    exit(1);
+}
+
+int main(int argc, char* argv[]){
+    int pid = 0;
+    bool json = false;
+    const char* gen_path = NULL;
+    int gen_mb = 4;
+    int opt;
+    while((opt = getopt(argc, argv, "t:d:u:p:jg:s:")) != -1){
+        switch(opt){
+            case 't': g_threads = atoi(optarg); break;
+            case 'd': g_duration = atoi(optarg); break;
+            case 'u': g_url = optarg; break;
+            case 'p': pid = atoi(optarg); break;
+            case 'j': json = true; break;
+            case 'g': gen_path = optarg; break;
+            case 's': gen_mb = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if(gen_path){
+        return gen_mb > 0 ? gen_file(gen_path, gen_mb) : 1;
+    }
+    if(optind >= argc || g_threads <= 0 || g_duration <= 0){
+        usage(argv[0]);
+    }
+    static char hostport[256];
+    snprintf(hostport, sizeof(hostport), "%s", argv[optind]);
+    char* colon = strrchr(hostport, ':');
+    if(!colon){
+        usage(argv[0]);
+    }
+    *colon = '\0';
+    g_host = hostport;
+    g_port = colon + 1;
+
+    g_ctx = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_verify(g_ctx, SSL_VERIFY_NONE, NULL);      // 测试环境多为自签名证书
+
+    worker* ws = (worker*)calloc(g_threads, sizeof(worker));
+    double cpu0 = pid ? proc_cpu(pid) : -1;
+    double self0 = self_cpu();
+    double t0 = now_sec();
+    for(int i = 0; i < g_threads; ++i){
+        pthread_create(&ws[i].tid, NULL, run, &ws[i]);
+    }
+    sleep(g_duration);
+    g_stop.store(true);
+    for(int i = 0; i < g_threads; ++i){
+        pthread_join(ws[i].tid, NULL);
+    }
+    double elapsed = now_sec() - t0;
+    double self_used = self_cpu() - self0;
+    double cpu1 = pid ? proc_cpu(pid) : -1;
+    double server_used = cpu0 >= 0 && cpu1 >= 0 ? cpu1 - cpu0 : -1;
+
+    long requests = 0, bytes = 0, errors = 0;
+    for(int i = 0; i < g_threads; ++i){
+        requests += ws[i].requests;
+        bytes += ws[i].bytes;
+        errors += ws[i].errors;
+    }
+    double gb = bytes / 1e9;
+    double rps = requests / elapsed;
+    double mbps = bytes / elapsed / 1e6;
+    double server_per_gb = server_used >= 0 && gb > 0 ? server_used / gb : -1;
+    double client_per_gb = gb > 0 ? self_used / gb : -1;
+    if(json){
+        printf("{\"url\":\"%s\",\"threads\":%d,\"seconds\":%.2f,\"requests\":%ld,\"errors\":%ld,"
+               "\"rps\":%.1f,\"mb_per_sec\":%.2f,\"client_cpu_sec\":%.3f,\"server_cpu_sec\":%.3f,"
+               "\"client_cpu_per_gb\":%.3f,\"server_cpu_per_gb\":%.3f}\n",
+               g_url, g_threads, elapsed, requests, errors, rps, mbps, self_used, server_used,
+               client_per_gb, server_per_gb);
+    }else{
+        printf("url %s, %d connections, %.2fs\n", g_url, g_threads, elapsed);
+        printf("requests   %ld (%ld errors)\n", requests, errors);
+        printf("req/s      %.1f\n", rps);
+        printf("MB/s       %.2f\n", mbps);
+        printf("client cpu %.3fs (%.3f s/GB)\n", self_used, client_per_gb);
+        if(server_used >= 0){
+            printf("server cpu %.3fs (%.3f s/GB, %.1f us/req)\n", server_used, server_per_gb,
+                   requests ? server_used * 1e6 / requests : 0.0);
+        }
+    }
+    SSL_CTX_free(g_ctx);
+    free(ws);
+    return 0;
+}
@@ -0,0 +1,234 @@
+// 反向代理测试用的上游服务：每个连接一个线程的 HTTP/1.1 长连接服务，统计建立的连接数和处理的请求数
+// 编译：g++ -O2 -pthread test_presure/upstream/upstream_stub.cpp -o upstream_stub
+//
+// 用法：upstream_stub [-i 名字] [-u unix套接字路径] [端口]
+//   -i NAME   响应头 X-Upstream 的值，用于观察负载均衡（默认 "stub"）
+//   -u PATH   监听 unix 域套接字而不是 TCP 端口
+// 请求：
+//   /health                   健康检查，回复 200
+//   /stats                    回复 "connections=N requests=M"
+//   其他路径                  可带参数 ?size=N（响应体长度，默认 100）&chunked=1（分块编码）
+//                             &delay=MS（先等待）&close=1（回复后关闭连接）
+//                             &cc=VALUE（Cache-Control 头部，如 max-age=5、no-store）&vary=NAME（Vary 头部，
+//                             响应体末尾附上该请求头部的值）
+// 退出（Ctrl-C）时输出统计。配合服务器的 proxy.conf（例如 "/api/ 127.0.0.1:9001"）和压测工具使用，
+// 连接池生效时 connections 远小于 requests。
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+
+static const char* g_name = "stub";
+static std::atomic<long> g_conns(0);
+static std::atomic<long> g_reqs(0);
+static volatile sig_atomic_t g_stop = 0;
+
+static void on_signal(int){
+    g_stop = 1;
+}
+
+static bool query_str(const std::string& url, const char* key, std::string& value){
+    size_t q = url.find('?');
+    if(q == std::string::npos) return false;
+    std::string k = std::string(key) + "=";
+    for(size_t p = q + 1; p < url.size(); ){
+        size_t e = url.find('&', p);
+        if(e == std::string::npos) e = url.size();
+        if(url.compare(p, k.size(), k) == 0){
+            value = url.substr(p + k.size(), e - p - k.size());
+            return true;
+        }
+        p = e + 1;
+    }
+    return false;
+}
+
+static long query_param(const std::string& url, const char* key, long def){
+    std::string value;
+    return query_str(url, key, value) ? atol(value.c_str()) : def;
+}
+
+// 请求头部的值，没有时为空
+static std::string header_value(const std::string& head, const std::string& name){
+    std::string pat = "\r\n" + name + ":";
+    const char* p = strcasestr(head.c_str(), pat.c_str());
+    if(!p) return "";
+    p += pat.size();
+    p += strspn(p, " \t");
+    return std::string(p, strcspn(p, "\r"));
+}
+
+static bool send_all(int fd, const char* p, size_t len){
+    while(len > 0){
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if(n <= 0){
+            if(n < 0 && errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+// 处理一个请求，返回 false 时关闭连接
+static bool handle(int fd, const std::string& head, const std::string& url){
+    ++g_reqs;
+    char hdr[512];
+    std::string body;
+    bool close_after = query_param(url, "close", 0) != 0;
+    bool chunked = false;
+    if(url == "/health"){
+        body = "ok\n";
+    }else if(url == "/stats"){
+        snprintf(hdr, sizeof(hdr), "connections=%ld requests=%ld\n", g_conns.load(), g_reqs.load());
+        body = hdr;
+    }else{
+        long delay = query_param(url, "delay", 0);
+        if(delay > 0) usleep(delay * 1000);
+        long size = query_param(url, "size", 100);
+        chunked = query_param(url, "chunked", 0) != 0;
+        body.resize(size);
+        for(long i = 0; i < size; ++i){
+            body[i] = 'a' + i % 26;
+        }
+    }
+    // 请求是 Connection: close 时回复后关闭
+    if(strcasestr(head.c_str(), "\r\nConnection: close")) close_after = true;
+
+    int n = snprintf(hdr, sizeof(hdr), "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nX-Upstream: %s\r\n%s", g_name,
+                     close_after ? "Connection: close\r\n" : "");
+    std::string out(hdr, n);
+    std::string cc, vary;
+    if(query_str(url, "cc", cc)){
+        out += "Cache-Control: " + cc + "\r\n";
+    }
+    if(query_str(url, "vary", vary)){
+        out += "Vary: " + vary + "\r\n";
+        body += "\n" + vary + "=" + header_value(head, vary);
+    }
+    if(chunked){
+        out += "Transfer-Encoding: chunked\r\n\r\n";
+        for(size_t off = 0; off < body.size(); off += 4096){
+            size_t len = std::min(body.size() - off, (size_t)4096);
+            snprintf(hdr, sizeof(hdr), "%zx\r\n", len);
+            out.append(hdr).append(body, off, len).append("\r\n");
+        }
+        out += "0\r\n\r\n";
+    }else{
+        snprintf(hdr, sizeof(hdr), "Content-Length: %zu\r\n\r\n", body.size());
+        out.append(hdr).append(body);
+    }
+    return send_all(fd, out.data(), out.size()) && !close_after;
+}
+
+static void* conn_thread(void* arg){
+    int fd = (int)(long)arg;
+    std::string in;
+    char buf[16384];
+    for(;;){
+        size_t end = in.find("\r\n\r\n");
+        if(end == std::string::npos){
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if(n <= 0) break;
+            in.append(buf, n);
+            continue;
+        }
+        std::string head = in.substr(0, end + 2);
+        long body_len = 0;
+        const char* cl = strcasestr(head.c_str(), "\r\nContent-Length:");
+        if(cl) body_len = atol(cl + 17);
+        while(in.size() < end + 4 + body_len){
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if(n <= 0) goto done;
+            in.append(buf, n);
+        }
+        in.erase(0, end + 4 + body_len);
+        size_t sp1 = head.find(' ');
+        size_t sp2 = head.find(' ', sp1 + 1);
+        if(sp1 == std::string::npos || sp2 == std::string::npos) break;
+        if(!handle(fd, head, head.substr(sp1 + 1, sp2 - sp1 - 1))) break;
+    }
+done:
+    close(fd);
+    return NULL;
+}
+
+int main(int argc, char* argv[]){
+    const char* unix_path = NULL;
+    int opt;
+    while((opt = getopt(argc, argv, "i:u:")) != -1){
+        switch(opt){
+            case 'i': g_name = optarg; break;
+            case 'u': unix_path = optarg; break;
+            default:
+                fprintf(stderr, "usage: %s [-i name] [-u unix_path] [port]\n", argv[0]);
+                return 1;
+        }
+    }
+    int lfd;
+    if(unix_path){
+        lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, unix_path, sizeof(addr.sun_path) - 1);
+        unlink(unix_path);
+        if(bind(lfd, (sockaddr*)&addr, sizeof(addr)) < 0){
+            perror("bind");
+            return 1;
+        }
+    }else{
+        int port = optind < argc ? atoi(argv[optind]) : 9001;
+        lfd = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        if(bind(lfd, (sockaddr*)&addr, sizeof(addr)) < 0){
+            perror("bind");
+            return 1;
+        }
+    }
+    listen(lfd, 128);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;      // 不设置 SA_RESTART，accept 被信号打断后退出
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    while(!g_stop){
+        int fd = accept(lfd, NULL, NULL);
+        if(fd < 0) continue;
+        ++g_conns;
+        if(!unix_path){
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        }
+        pthread_t tid;
+        if(pthread_create(&tid, NULL, conn_thread, (void*)(long)fd) != 0){
+            close(fd);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+    close(lfd);
+    if(unix_path) unlink(unix_path);
+    printf("%s: connections=%ld requests=%ld\n", g_name, g_conns.load(), g_reqs.load());
+    return 0;
+}
@@ -4,20 +4,38 @@
 #include <pthread.h>
 #include <list>
 #include "locker.h"
+#include "metrics.h"
+#include "scoreboard.h"
+#include "probes.h"
+#include "admission.h"
 #include <cstdio>
+#include <atomic>
+
+#define THREADPOOL_PRIORITY_BURST 8     // 普通队列非空时，每连续从优先队列取出这么多任务后从普通队列取一个，避免饿死
 
 // 线程池类，定义成模板类，为了代码的复用，模板参数T是任务类
+// 任务类需要提供 process()（处理请求）和 shed()（过载时拒绝请求）
+// 有两个队列：优先队列（预计很快处理完的小请求）和普通队列，工作线程优先从优先队列取任务
 template<typename T>
 class threadpool
 {
 private:
+    struct task {
+        T* request;
+        long enqueue_us;            // 入队时间，用于计算排队时间
+    };
+
     int m_thread_num;               // 线程数量
     pthread_t * m_threads;          // 线程池数组，大小为m_thread_num，声明为指针，后面动态创建数组
     int m_max_requests;             // 请求队列中的最大等待数量
-    std::list<T*> m_workqueue;      // 请求队列
+    std::list<task> m_workqueue;    // 请求队列
+    std::list<task> m_priority_queue;   // 优先队列
     locker m_queue_locker;          // 互斥锁
     sem m_queue_stat;               // 信号量
+    int m_priority_run;             // 普通队列非空时连续从优先队列取出的任务数，在持有 m_queue_locker 时更新
     bool m_stop;                    // 是否结束线程，线程根据该值判断是否要停止
+    codel m_codel;                  // 普通队列的排队时间控制，在持有 m_queue_locker 时更新
+    std::atomic<int> m_queue_len;   // 队列长度，供主线程无锁读取
 
     static void* worker(void* arg); // 静态函数，线程调用，不能访问非静态成员
     void run();                     // 线程池已启动，执行函数
@@ -25,14 +43,16 @@ private:
 public:
     threadpool(int thread_num = 8, int max_requests = 10000);
     ~threadpool();
-    bool append(T* request);    // 添加任务的函数
+    bool append(T* request, bool priority = false);     // 添加任务的函数，队列已满时返回 false
+    bool overloaded() const;    // 是否过载：排队时间持续超过目标或队列接近满，主线程据此暂停 accept
 };
 
 
 template<typename T>
 threadpool<T>::threadpool(int thread_num, int max_requests) :   // 构造函数，初始化
         m_thread_num(thread_num), m_max_requests(max_requests),
-        m_stop(false), m_threads(NULL)
+        m_queue_locker("threadpool.queue_locker"), m_queue_stat("threadpool.queue_stat"),
+        m_priority_run(0), m_stop(false), m_threads(NULL), m_queue_len(0)
 {
     if(thread_num <= 0 || max_requests <= 0){
         throw std::exception();
@@ -67,15 +87,20 @@ threadpool<T>::~threadpool(){       // 析构函数
 }
 
 template<typename T>
-bool threadpool<T>::append(T* request){     // 添加请求队列
+bool threadpool<T>::append(T* request, bool priority){     // 添加请求队列
       m_queue_locker.lock();                // 队列为共享队列，上锁
-      if(m_workqueue.size() > m_max_requests){
+      int queue_len = m_workqueue.size() + m_priority_queue.size();
+      if(queue_len > m_max_requests){
         m_queue_locker.unlock();            // 队列元素已满
         return false;                       // 添加失败
       }
 
-      m_workqueue.push_back(request);       // 将任务加入队列
+      task t = { request, get_mono_us() };
+      (priority ? m_priority_queue : m_workqueue).push_back(t);    // 将任务加入队列
+      m_queue_len.store(queue_len + 1, std::memory_order_relaxed);
+      WS_PROBE2(queue_enqueue, request, queue_len + 1);
       m_queue_locker.unlock();              // 解锁
+      metrics_gauge_add(MG_QUEUE_DEPTH, 1);
       m_queue_stat.post();                  // 增加信号量，线程根据信号量判断阻塞还是继续往下执行
       return true;
 }
@@ -89,24 +114,57 @@ void* threadpool<T>::worker(void* arg){     // arg 为线程创建时传递的th
 
 template<typename T>
 void threadpool<T>::run(){              // 线程实际执行函数
+    scoreboard_worker_register();       // 在记分板中占用一个工作线程槽位
     while(!m_stop){                     // 判断停止标记
         m_queue_stat.wait();            // 等待信号量有数值（减一）
         m_queue_locker.lock();          // 上锁
-        if(m_workqueue.empty()){        // 空队列
+        if(m_workqueue.empty() && m_priority_queue.empty()){    // 空队列
             m_queue_locker.unlock();    // 解锁
             continue;
         }
 
-        T* request = m_workqueue.front();   // 取出任务
-        m_workqueue.pop_front();            // 移出队列
+        // 优先队列非空时先取优先队列，但普通队列也有任务时每 THREADPOOL_PRIORITY_BURST 个让普通队列取一次
+        bool from_priority = !m_priority_queue.empty()
+                             && (m_workqueue.empty() || m_priority_run < THREADPOOL_PRIORITY_BURST);
+        m_priority_run = from_priority && !m_workqueue.empty() ? m_priority_run + 1 : 0;
+        std::list<task>& queue = from_priority ? m_priority_queue : m_workqueue;
+        task t = queue.front();             // 取出任务
+        T* request = t.request;
+        queue.pop_front();                  // 移出队列
+        int queue_len = m_workqueue.size() + m_priority_queue.size();
+        m_queue_len.store(queue_len, std::memory_order_relaxed);
+        bool drop = false;
+        #if ADMISSION_OPEN
+        if(!from_priority){                 // 优先队列中的请求处理很快，拒绝它们腾不出多少时间，只控制普通队列
+            long now = get_mono_us();
+            drop = m_codel.dequeue(now, now - t.enqueue_us);   // 排队太久的请求直接拒绝
+        }
+        #endif
+        WS_PROBE2(queue_dequeue, request, queue_len);
         m_queue_locker.unlock();            // 解锁
+        metrics_gauge_add(MG_QUEUE_DEPTH, -1);
         if(!request){
             continue;
         }
 
-        request->process();             // 任务类 T 的执行函数
+        if(drop){
+            request->shed(SHED_QUEUE_DELAY);       // 回复 503，不解析请求
+        }else{
+            request->process();         // 任务类 T 的执行函数
+        }
+        scoreboard_worker_set(SB_WORKER_WAITING, -1);
     }
 
 }
 
+template<typename T>
+bool threadpool<T>::overloaded() const {
+    #if ADMISSION_OPEN
+    return m_codel.overloaded(get_mono_us())
+        || m_queue_len.load(std::memory_order_relaxed) * 100L >= (long)m_max_requests * ADMISSION_QUEUE_HIGH;
+    #else
+    return false;
+    #endif
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,61 @@
+#include "tls.h"
+#include "h2.h"
+
+#if USE_TLS
+#include <stdio.h>
+
+static SSL_CTX* g_ctx = NULL;
+
+// ALPN 中服务端支持的协议，按优先顺序
+#if H2_OPEN
+static const unsigned char g_alpn[] = "\x02h2\x08http/1.1";
+#else
+static const unsigned char g_alpn[] = "\x08http/1.1";
+#endif
+
+static int alpn_select(SSL*, const unsigned char** out, unsigned char* outlen, const unsigned char* in, unsigned int inlen, void*){
+    if(SSL_select_next_proto((unsigned char**)out, outlen, g_alpn, sizeof(g_alpn) - 1, in, inlen) != OPENSSL_NPN_NEGOTIATED){
+        return SSL_TLSEXT_ERR_NOACK;    // 没有共同支持的协议，不回应 ALPN，按 HTTP/1.1 处理
+    }
+    return SSL_TLSEXT_ERR_OK;
+}
+
+bool tls_init(const char* cert_file, const char* key_file){
+    g_ctx = SSL_CTX_new(TLS_server_method());
+    if(!g_ctx){
+        ERR_print_errors_fp(stderr);
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(g_ctx, TLS1_2_VERSION);
+    // 非阻塞套接字上 SSL_write 可以只写出一部分；重试时 iov 的地址不变，但允许移动以防万一
+    SSL_CTX_set_mode(g_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    SSL_CTX_set_mode(g_ctx, SSL_MODE_RELEASE_BUFFERS);     // 空闲长连接不保留读写缓冲区
+    SSL_CTX_set_alpn_select_cb(g_ctx, alpn_select, NULL);
+    #if TLS_KTLS_OPEN && defined(SSL_OP_ENABLE_KTLS)
+    SSL_CTX_set_options(g_ctx, SSL_OP_ENABLE_KTLS);
+    #endif
+    if(SSL_CTX_use_certificate_chain_file(g_ctx, cert_file) != 1
+       || SSL_CTX_use_PrivateKey_file(g_ctx, key_file, SSL_FILETYPE_PEM) != 1
+       || SSL_CTX_check_private_key(g_ctx) != 1){
+        ERR_print_errors_fp(stderr);
+        SSL_CTX_free(g_ctx);
+        g_ctx = NULL;
+        return false;
+    }
+    return true;
+}
+
+void tls_close(){
+    SSL_CTX_free(g_ctx);
+    g_ctx = NULL;
+}
+
+SSL* tls_new(int fd){
+    SSL* ssl = SSL_new(g_ctx);
+    if(ssl && SSL_set_fd(ssl, fd) != 1){
+        SSL_free(ssl);
+        return NULL;
+    }
+    return ssl;
+}
+#endif
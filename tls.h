@@ -0,0 +1,33 @@
+#ifndef TLS_H
+#define TLS_H
+
+/*
+    HTTPS 监听
+    握手由 OpenSSL 在主线程中非阻塞地完成。握手后如果内核支持 TLS（TCP_ULP "tls"），
+    OpenSSL 把会话密钥交给内核（SSL_OP_ENABLE_KTLS），之后记录的加密由内核完成：
+    原有的 writev 路径直接写明文，文件响应用 sendfile 从页缓存发送，用户态没有复制和加密。
+    内核不支持时退回到 SSL_write / SSL_read，由 OpenSSL 在用户态加密。读取始终经过 SSL_read。
+
+    编译时加 -DUSE_TLS=1 并链接 -lssl -lcrypto，运行时指定第二个端口：./ws 端口 HTTPS端口
+    证书和私钥（PEM）默认从 ./cert 读取，可以用 openssl req -x509 生成自签名证书用于测试。
+*/
+
+#ifndef USE_TLS
+#define USE_TLS 0
+#endif
+#ifndef TLS_KTLS_OPEN
+#define TLS_KTLS_OPEN 1                     // 握手后是否尝试启用内核 TLS，为 0 时总是由 OpenSSL 加密
+#endif
+#define TLS_CERT_FILE "./cert/server.crt"   // 证书链
+#define TLS_KEY_FILE "./cert/server.key"    // 私钥
+
+#if USE_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+bool tls_init(const char* cert_file, const char* key_file);    // 创建全局 SSL_CTX，失败时输出原因并返回 false
+void tls_close();
+SSL* tls_new(int fd);       // 为新连接创建服务端 SSL 对象，关联到 fd
+#endif
+
+#endif
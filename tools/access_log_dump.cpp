@@ -0,0 +1,173 @@
+// 二进制访问日志的离线解码工具
+// 编译：g++ -O2 tools/access_log_dump.cpp -o access_log_dump
+// 用法：access_log_dump [-s] file...
+//      默认逐条打印请求记录；-s 按 URL 和状态码汇总请求数、字节数和各阶段平均耗时
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "../access_log.h"
+
+static const char* method_name[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT"};
+
+// 汇总统计的一项
+struct summary {
+    unsigned long cnt;
+    unsigned long bytes;
+    unsigned long read_us, queue_us, process_us, write_us;
+    unsigned long max_total_us;
+    summary() : cnt(0), bytes(0), read_us(0), queue_us(0), process_us(0), write_us(0), max_total_us(0) {}
+    void add(const access_req_rec* rec){
+        unsigned long total = (unsigned long)rec->read_us + rec->queue_us + rec->process_us + rec->write_us;
+        ++cnt;
+        bytes += rec->bytes_sent;
+        read_us += rec->read_us;
+        queue_us += rec->queue_us;
+        process_us += rec->process_us;
+        write_us += rec->write_us;
+        if(total > max_total_us) max_total_us = total;
+    }
+};
+
+static std::map<std::string, summary> g_by_url;
+static std::map<int, summary> g_by_status;
+static summary g_total;
+
+static void print_record(const access_req_rec* rec, const char* url){
+    char ip[16] = "";
+    inet_ntop(AF_INET, &rec->client_ip, ip, sizeof(ip));
+    time_t sec = rec->ts_us / 1000000;
+    struct tm tm_ts;
+    localtime_r(&sec, &tm_ts);
+    char ts[32];
+    strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", &tm_ts);
+    printf("%s.%06ld %s:%d %s %s %d %lu%s%s read=%uus queue=%uus process=%uus write=%uus\n",
+           ts, (long)(rec->ts_us % 1000000), ip, ntohs(rec->client_port),
+           rec->method < 8 ? method_name[rec->method] : "?", url, rec->status,
+           (unsigned long)rec->bytes_sent, (rec->flags & ACCESS_FLAG_KEEPALIVE) ? " keep-alive" : "",
+           (rec->flags & ACCESS_FLAG_H2) ? " h2" : "",
+           rec->read_us, rec->queue_us, rec->process_us, rec->write_us);
+}
+
+// 解码一个文件，返回解码出的请求记录数，格式错误返回 -1
+static long decode_file(const char* path, bool summarize){
+    int fd = open(path, O_RDONLY);
+    if(fd == -1){
+        perror(path);
+        return -1;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    if((size_t)st.st_size < sizeof(access_log_hdr)){
+        fprintf(stderr, "%s: file too short\n", path);
+        close(fd);
+        return -1;
+    }
+    char* base = (char*)mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED){
+        perror(path);
+        return -1;
+    }
+
+    const access_log_hdr* hdr = (const access_log_hdr*)base;
+    if(memcmp(hdr->magic, ACCESS_LOG_MAGIC, 4) != 0 || hdr->version != ACCESS_LOG_VERSION){
+        fprintf(stderr, "%s: not an access log or unsupported version\n", path);
+        munmap(base, st.st_size);
+        return -1;
+    }
+
+    std::vector<std::string> urls;      // 编号 -> URL
+    long cnt = 0;
+    size_t off = sizeof(access_log_hdr);
+    while(off + 4 <= (size_t)st.st_size){
+        uint16_t type = *(const uint16_t*)(base + off);
+        uint16_t size = *(const uint16_t*)(base + off + 2);
+        if(type == ACCESS_REC_END){
+            break;                      // 已写数据的结尾
+        }
+        if(size < 8 || off + size > (size_t)st.st_size){
+            fprintf(stderr, "%s: corrupt record at offset %lu\n", path, (unsigned long)off);
+            break;
+        }
+        if(type == ACCESS_REC_URL){
+            const access_url_rec* rec = (const access_url_rec*)(base + off);
+            const char* str = base + off + sizeof(access_url_rec);
+            if(urls.size() <= rec->url_id) urls.resize(rec->url_id + 1);
+            urls[rec->url_id].assign(str, strnlen(str, size - sizeof(access_url_rec)));
+        }else if(type == ACCESS_REC_REQUEST && size >= sizeof(access_req_rec)){
+            const access_req_rec* rec = (const access_req_rec*)(base + off);
+            const char* url = rec->url_id < urls.size() ? urls[rec->url_id].c_str() : "?";
+            if(summarize){
+                g_by_url[url].add(rec);
+                g_by_status[rec->status].add(rec);
+                g_total.add(rec);
+            }else{
+                print_record(rec, url);
+            }
+            ++cnt;
+        }
+        off += size;                    // 跳过未知类型的记录
+    }
+    munmap(base, st.st_size);
+    return cnt;
+}
+
+static void print_summary_line(const char* key, const summary& s){
+    unsigned long n = s.cnt ? s.cnt : 1;
+    printf("%-40s %10lu %14lu %10lu %10lu %10lu %10lu %10lu\n", key, s.cnt, s.bytes,
+           s.read_us / n, s.queue_us / n, s.process_us / n, s.write_us / n, s.max_total_us);
+}
+
+static void print_summary(){
+    printf("%-40s %10s %14s %10s %10s %10s %10s %10s\n", "url/status", "requests", "bytes",
+           "read_us", "queue_us", "proc_us", "write_us", "max_us");
+    for(std::map<std::string, summary>::iterator it = g_by_url.begin(); it != g_by_url.end(); ++it){
+        print_summary_line(it->first.c_str(), it->second);
+    }
+    printf("\n");
+    for(std::map<int, summary>::iterator it = g_by_status.begin(); it != g_by_status.end(); ++it){
+        char key[16];
+        snprintf(key, sizeof(key), "%d", it->first);
+        print_summary_line(key, it->second);
+    }
+    printf("\n");
+    print_summary_line("total", g_total);
+}
+
+int main(int argc, char* argv[]){
+    bool summarize = false;
+    int opt;
+    while((opt = getopt(argc, argv, "s")) != -1){
+        if(opt == 's'){
+            summarize = true;
+        }else{
+            fprintf(stderr, "usage: %s [-s] file...\n", argv[0]);
+            return 1;
+        }
+    }
+    if(optind >= argc){
+        fprintf(stderr, "usage: %s [-s] file...\n", argv[0]);
+        return 1;
+    }
+
+    int ret = 0;
+    for(int i = optind; i < argc; ++i){
+        if(decode_file(argv[i], summarize) < 0){
+            ret = 1;
+        }
+    }
+    if(summarize){
+        print_summary();
+    }
+    return ret;
+}
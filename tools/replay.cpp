@@ -0,0 +1,478 @@
+// 流量重放工具：把服务器抓取的入站流量（-DCAPTURE_OPEN=1，见 capture.h）按原来的时间重放到测试实例
+// 编译：g++ -O2 -I. tools/replay.cpp -o replay
+//
+// 用法：replay [-x 倍速] [-w] [-T 毫秒] [-j 文件] capture_xxx.bin host:port
+//       replay -i capture_xxx.bin
+//   -x S      重放速度，1 为原速（默认），2 为两倍速，0 表示不等待、尽快发送
+//   -w        发送下一段数据前等待之前的请求全部得到响应（闭环），用于被测实例比原来慢得多时
+//   -T MS     抓取中连接关闭后，等待未完成响应的最长时间（默认 5000ms）
+//   -j FILE   把结果以 JSON 格式写入 FILE，"-" 表示标准输出
+//   -i        只输出抓取文件的概况，不重放
+//
+// 每个抓取到的连接对应一个新连接，在原来的相对时间建立；每次 recv 读到的数据作为一段，在原来的相对时间原样发出，
+// 所以长连接的复用、一段数据中包含多个请求（流水线）都与原来一致；在原来的关闭时间关闭连接。
+// 请求按 "\r\n\r\n" 计数（服务器只支持 GET），延迟从请求最后一段发出到响应接收完毕。
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "capture.h"
+
+static double g_speed = 1.0;
+static bool g_wait = false;
+static long g_timeout_ms = 5000;
+static const char* g_json = NULL;
+static struct sockaddr_in g_addr;
+
+static long now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// 对数-线性直方图，单位微秒，每个2的幂区间 16 个子桶
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((40 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct histogram {
+    unsigned long counts[HIST_BUCKETS];
+    unsigned long total;
+    double sum;
+    long max;
+    histogram() : total(0), sum(0), max(0) { memset(counts, 0, sizeof(counts)); }
+
+    static int bucket(long v){
+        if(v < HIST_SUB) return v < 0 ? 0 : v;
+        int msb = 63 - __builtin_clzl(v);
+        int idx = (msb - HIST_SUB_BITS + 1) * HIST_SUB + ((v >> (msb - HIST_SUB_BITS)) & (HIST_SUB - 1));
+        return idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1;
+    }
+    static long bucket_high(int idx){
+        if(idx < HIST_SUB) return idx;
+        int group = idx / HIST_SUB, sub = idx % HIST_SUB;
+        return ((long)(HIST_SUB + sub + 1) << (group - 1)) - 1;
+    }
+    void add(long us){
+        ++counts[bucket(us)];
+        ++total;
+        sum += us;
+        if(us > max) max = us;
+    }
+    long percentile(double p) const {
+        if(total == 0) return 0;
+        unsigned long target = (unsigned long)ceil(total * p / 100.0);
+        unsigned long cum = 0;
+        for(int i = 0; i < HIST_BUCKETS; ++i){
+            cum += counts[i];
+            if(cum >= target) return std::min(bucket_high(i), max);
+        }
+        return max;
+    }
+};
+
+// 抓取文件中的一条记录
+struct event {
+    long ts_us;             // 相对于抓取开始的时间
+    uint32_t conn;          // conns 中的下标
+    uint8_t type;           // CAPTURE_REC_TYPE
+    size_t off, len;        // DATA 记录的数据在文件中的位置
+};
+
+// 重放中的一个连接
+struct rconn {
+    int fd;
+    bool opened, connecting, closing, done;
+    long close_deadline;
+    std::deque<event*> pending;     // 到了发送时间但还不能发送的数据
+    std::string out;
+    size_t out_off;
+    int crlf_state;                 // 在发出的数据中匹配 "\r\n\r\n" 的进度
+    std::deque<long> sent;          // 已发出、尚未收到响应的请求的发出时间
+    char hdr[8192];
+    int hdr_len;
+    bool in_body;
+    long body_left;
+    int status;
+
+    rconn() : fd(-1), opened(false), connecting(false), closing(false), done(false), close_deadline(0), out_off(0),
+              crlf_state(0), hdr_len(0), in_body(false), body_left(0), status(0) {}
+};
+
+static std::string g_data;          // 整个抓取文件
+static std::vector<event> g_events;
+static std::vector<rconn> g_conns;
+static int g_epfd;
+
+// 统计
+static histogram g_hist;
+static unsigned long g_requests, g_responses, g_status[6], g_unanswered, g_dropped, g_errors, g_bytes_out, g_bytes_in;
+
+static bool load(const char* path){
+    FILE* fp = fopen(path, "rb");
+    if(!fp){
+        perror(path);
+        return false;
+    }
+    char buf[65536];
+    size_t n;
+    while((n = fread(buf, 1, sizeof(buf), fp)) > 0){
+        g_data.append(buf, n);
+    }
+    fclose(fp);
+    if(g_data.size() < sizeof(capture_hdr) || memcmp(g_data.data(), CAPTURE_MAGIC, 4) != 0){
+        fprintf(stderr, "%s: not a capture file\n", path);
+        return false;
+    }
+    const capture_hdr* hdr = (const capture_hdr*)g_data.data();
+    if(hdr->version != CAPTURE_VERSION){
+        fprintf(stderr, "%s: unsupported version %u\n", path, hdr->version);
+        return false;
+    }
+
+    std::unordered_map<uint64_t, uint32_t> ids;     // 文件中的 conn_id -> g_conns 下标
+    const uint8_t* base = (const uint8_t*)g_data.data();
+    const uint8_t* p = base + sizeof(capture_hdr);
+    const uint8_t* end = base + g_data.size();
+    long ts = 0;
+    while(p < end){
+        event ev;
+        ev.type = *p++;
+        uint64_t id, delta, len = 0;
+        if(!capture_get_varint(p, end, id) || !capture_get_varint(p, end, delta)) break;
+        ts += delta;
+        ev.ts_us = ts;
+        ev.off = ev.len = 0;
+        if(ev.type == CAPTURE_REC_OPEN){
+            if(end - p < 6) break;
+            p += 6;
+            ids[id] = g_conns.size();
+            g_conns.push_back(rconn());
+        }else if(ev.type == CAPTURE_REC_DATA){
+            if(!capture_get_varint(p, end, len) || (uint64_t)(end - p) < len) break;
+            ev.off = p - base;
+            ev.len = len;
+            p += len;
+        }else if(ev.type != CAPTURE_REC_CLOSE){
+            fprintf(stderr, "bad record type %d at offset %ld\n", ev.type, (long)(p - 1 - base));
+            break;
+        }
+        std::unordered_map<uint64_t, uint32_t>::iterator it = ids.find(id);
+        if(it == ids.end()) continue;       // 抓取开始前已经建立的连接不完整，忽略
+        ev.conn = it->second;
+        g_events.push_back(ev);
+    }
+    return true;
+}
+
+static void info(){
+    unsigned long bytes = 0, chunks = 0, requests = 0;
+    int state = 0;
+    for(size_t i = 0; i < g_events.size(); ++i){
+        if(g_events[i].type != CAPTURE_REC_DATA) continue;
+        ++chunks;
+        bytes += g_events[i].len;
+        for(size_t j = 0; j < g_events[i].len; ++j){
+            char ch = g_data[g_events[i].off + j];
+            if(ch == '\r') state = state == 2 ? 3 : 1;
+            else if(ch == '\n' && state == 3){ ++requests; state = 0; }
+            else state = ch == '\n' && state == 1 ? 2 : 0;
+        }
+    }
+    double span = g_events.empty() ? 0 : g_events.back().ts_us / 1e6;
+    printf("connections %zu, chunks %lu, bytes %lu, requests %lu, span %.3fs\n", g_conns.size(), chunks, bytes, requests, span);
+    if(span > 0) printf("average %.1f req/s, %.1f connections/s\n", requests / span, g_conns.size() / span);
+}
+
+static void conn_finish(rconn* c){
+    if(c->fd != -1){
+        epoll_ctl(g_epfd, EPOLL_CTL_DEL, c->fd, 0);
+        close(c->fd);
+        c->fd = -1;
+    }
+    g_unanswered += c->sent.size();
+    c->sent.clear();
+    g_dropped += c->pending.size();
+    c->pending.clear();
+    c->done = true;
+}
+
+static void conn_open(rconn* c){
+    c->opened = true;
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(c->fd == -1){
+        ++g_errors;
+        c->done = true;
+        return;
+    }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if(connect(c->fd, (struct sockaddr*)&g_addr, sizeof(g_addr)) == -1 && errno != EINPROGRESS){
+        ++g_errors;
+        close(c->fd);
+        c->fd = -1;
+        c->done = true;
+        return;
+    }
+    c->connecting = true;
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = c;
+    epoll_ctl(g_epfd, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+// 发送 pending 中允许发送的数据
+static void conn_send(rconn* c){
+    if(c->done || c->connecting) return;
+    long now = now_ns();
+    while(!c->pending.empty() && (!g_wait || c->sent.empty())){
+        event* ev = c->pending.front();
+        c->pending.pop_front();
+        const char* data = g_data.data() + ev->off;
+        c->out.append(data, ev->len);
+        for(size_t i = 0; i < ev->len; ++i){    // 数据中每出现一个空行，就是一个完整的请求
+            char ch = data[i];
+            if(ch == '\r') c->crlf_state = c->crlf_state == 2 ? 3 : 1;
+            else if(ch == '\n' && c->crlf_state == 3){ c->sent.push_back(now); ++g_requests; c->crlf_state = 0; }
+            else c->crlf_state = ch == '\n' && c->crlf_state == 1 ? 2 : 0;
+        }
+    }
+    while(c->out_off < c->out.size()){
+        ssize_t n = send(c->fd, c->out.data() + c->out_off, c->out.size() - c->out_off, MSG_NOSIGNAL);
+        if(n < 0){
+            if(errno == EAGAIN || errno == EWOULDBLOCK) return;
+            ++g_errors;
+            conn_finish(c);
+            return;
+        }
+        c->out_off += n;
+        g_bytes_out += n;
+    }
+    c->out.clear();
+    c->out_off = 0;
+    // 原连接已关闭：数据都发完、响应都收到（或等待超时）后关闭
+    if(c->closing && c->pending.empty() && (c->sent.empty() || now > c->close_deadline)){
+        conn_finish(c);
+    }
+}
+
+static void response_done(rconn* c){
+    if(!c->sent.empty()){
+        g_hist.add((now_ns() - c->sent.front()) / 1000);
+        c->sent.pop_front();
+    }
+    ++g_responses;
+    int cls = c->status / 100;
+    ++g_status[cls >= 1 && cls <= 5 ? cls : 0];
+    c->hdr_len = 0;
+    c->in_body = false;
+}
+
+static void conn_on_data(rconn* c, const char* buf, size_t n){
+    size_t i = 0;
+    while(i < n){
+        if(!c->in_body){
+            if(c->hdr_len >= (int)sizeof(c->hdr) - 1){
+                ++g_errors;
+                conn_finish(c);
+                return;
+            }
+            c->hdr[c->hdr_len++] = buf[i++];
+            if(c->hdr_len >= 4 && memcmp(c->hdr + c->hdr_len - 4, "\r\n\r\n", 4) == 0){
+                c->hdr[c->hdr_len] = '\0';
+                c->status = 0;
+                sscanf(c->hdr, "HTTP/%*d.%*d %d", &c->status);
+                c->body_left = -1;
+                const char* cl = strcasestr(c->hdr, "\r\nContent-Length:");
+                if(cl) c->body_left = atol(cl + 17);
+                c->in_body = true;
+                if(c->body_left == 0) response_done(c);
+            }
+        }else if(c->body_left < 0){
+            i = n;                          // 没有 Content-Length，读到连接关闭
+        }else{
+            long take = std::min((long)(n - i), c->body_left);
+            i += take;
+            c->body_left -= take;
+            if(c->body_left == 0) response_done(c);
+        }
+    }
+}
+
+static void conn_on_event(rconn* c, uint32_t events){
+    if(c->connecting && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))){
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if(err != 0){
+            ++g_errors;
+            conn_finish(c);
+            return;
+        }
+        c->connecting = false;
+    }
+    if(events & EPOLLIN){
+        char buf[65536];
+        while(!c->done){
+            ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+            if(n > 0){
+                g_bytes_in += n;
+                conn_on_data(c, buf, n);
+                continue;
+            }
+            if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if(c->in_body && c->body_left < 0) response_done(c);
+            conn_finish(c);                 // 服务器关闭了连接
+            return;
+        }
+    }
+    conn_send(c);
+}
+
+static void usage(const char* prog){
+    fprintf(stderr, "usage: %s [-x speed] [-w] [-T timeout_ms] [-j json] capture.bin host:port\n"
+                    "       %s -i capture.bin\n", prog, prog);
+}
+
+int main(int argc, char* argv[]){
+    bool only_info = false;
+    int opt;
+    while((opt = getopt(argc, argv, "x:wT:j:ih")) != -1){
+        switch(opt){
+            case 'x': g_speed = atof(optarg); break;
+            case 'w': g_wait = true; break;
+            case 'T': g_timeout_ms = atol(optarg); break;
+            case 'j': g_json = optarg; break;
+            case 'i': only_info = true; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if(optind >= argc || (!only_info && optind + 1 >= argc)){
+        usage(argv[0]);
+        return 1;
+    }
+    if(!load(argv[optind])){
+        return 1;
+    }
+    info();
+    if(only_info){
+        return 0;
+    }
+
+    std::string target = argv[optind + 1];
+    size_t colon = target.rfind(':');
+    std::string host = target.substr(0, colon);
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host.c_str(), NULL, &hints, &res) != 0){
+        fprintf(stderr, "cannot resolve %s\n", host.c_str());
+        return 1;
+    }
+    g_addr = *(struct sockaddr_in*)res->ai_addr;
+    g_addr.sin_port = htons(colon == std::string::npos ? 80 : atoi(target.c_str() + colon + 1));
+    freeaddrinfo(res);
+
+    g_epfd = epoll_create1(0);
+    epoll_event events[1024];
+    size_t next = 0;
+    long start = now_ns();
+    while(true){
+        long now = now_ns();
+        // 重放时间轴上的当前位置：微秒
+        long pos = g_speed > 0 ? (long)((now - start) / 1000 * g_speed) : g_events.empty() ? 0 : g_events.back().ts_us;
+        for( ; next < g_events.size() && g_events[next].ts_us <= pos; ++next){
+            event* ev = &g_events[next];
+            rconn* c = &g_conns[ev->conn];
+            if(ev->type == CAPTURE_REC_OPEN){
+                conn_open(c);
+            }else if(c->done){
+                if(ev->type == CAPTURE_REC_DATA) ++g_dropped;   // 连接已被服务器关闭，数据无法发送
+            }else if(ev->type == CAPTURE_REC_DATA){
+                c->pending.push_back(ev);
+                conn_send(c);
+            }else{
+                c->closing = true;
+                c->close_deadline = now + g_timeout_ms * 1000000L;
+                conn_send(c);
+            }
+        }
+
+        bool active = false;
+        for(size_t i = 0; i < g_conns.size(); ++i){
+            rconn* c = &g_conns[i];
+            if(!c->opened || c->done) continue;
+            if(c->closing && now > c->close_deadline){
+                conn_finish(c);             // 等待响应超时
+                continue;
+            }
+            active = true;
+        }
+        if(next == g_events.size() && !active) break;
+
+        int wait_ms = 100;
+        if(next < g_events.size() && g_speed > 0){
+            long due_ns = start + (long)(g_events[next].ts_us / g_speed * 1000);
+            wait_ms = std::max(0L, std::min(100L, (due_ns - now) / 1000000L));
+        }else if(next < g_events.size()){
+            wait_ms = 0;
+        }
+        int n = epoll_wait(g_epfd, events, 1024, wait_ms);
+        for(int i = 0; i < n; ++i){
+            rconn* c = (rconn*)events[i].data.ptr;
+            if(!c->done) conn_on_event(c, events[i].events);
+        }
+        // 等待响应的连接（-w 或原连接已关闭）在收到响应后继续发送
+        for(size_t i = 0; i < g_conns.size(); ++i){
+            rconn* c = &g_conns[i];
+            if(c->opened && !c->done && (!c->pending.empty() || c->closing)) conn_send(c);
+        }
+    }
+    double secs = (now_ns() - start) / 1e9;
+    double span = g_events.empty() ? 0 : g_events.back().ts_us / 1e6;
+
+    char speed[32] = "full speed";
+    if(g_speed > 0) snprintf(speed, sizeof(speed), "%gx", g_speed);
+    printf("replayed at %s in %.3fs (capture span %.3fs)\n", speed, secs, span);
+    printf("requests %lu, responses %lu, unanswered %lu, dropped chunks %lu, errors %lu, sent %lu bytes, received %lu bytes\n",
+           g_requests, g_responses, g_unanswered, g_dropped, g_errors, g_bytes_out, g_bytes_in);
+    printf("status 2xx %lu, 3xx %lu, 4xx %lu, 5xx %lu, other %lu\n", g_status[2], g_status[3], g_status[4], g_status[5], g_status[0] + g_status[1]);
+    printf("latency us: mean %.0f, p50 %ld, p90 %ld, p99 %ld, p99.9 %ld, max %ld\n", g_hist.total ? g_hist.sum / g_hist.total : 0.0,
+           g_hist.percentile(50), g_hist.percentile(90), g_hist.percentile(99), g_hist.percentile(99.9), g_hist.max);
+
+    if(g_json){
+        FILE* fp = strcmp(g_json, "-") == 0 ? stdout : fopen(g_json, "w");
+        if(!fp){
+            perror(g_json);
+            return 1;
+        }
+        fprintf(fp, "{\"capture\":\"%s\",\"target\":\"%s\",\"speed\":%.2f,\"wait\":%s,\"duration_s\":%.3f,\"span_s\":%.3f,\n"
+                    " \"connections\":%zu,\"requests\":%lu,\"responses\":%lu,\"unanswered\":%lu,\"dropped\":%lu,\"errors\":%lu,\n"
+                    " \"status\":{\"2xx\":%lu,\"3xx\":%lu,\"4xx\":%lu,\"5xx\":%lu,\"other\":%lu},\n"
+                    " \"latency_us\":{\"mean\":%.1f,\"p50\":%ld,\"p90\":%ld,\"p99\":%ld,\"p999\":%ld,\"max\":%ld}}\n",
+                argv[optind], argv[optind + 1], g_speed, g_wait ? "true" : "false", secs, span,
+                g_conns.size(), g_requests, g_responses, g_unanswered, g_dropped, g_errors,
+                g_status[2], g_status[3], g_status[4], g_status[5], g_status[0] + g_status[1],
+                g_hist.total ? g_hist.sum / g_hist.total : 0.0, g_hist.percentile(50), g_hist.percentile(90),
+                g_hist.percentile(99), g_hist.percentile(99.9), g_hist.max);
+        if(fp != stdout) fclose(fp);
+    }
+    close(g_epfd);
+    return 0;
+}
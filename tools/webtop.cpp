@@ -0,0 +1,127 @@
+// 记分板查看工具，以只读方式映射服务器的共享内存记分板，类似 top 周期性刷新显示
+// 编译：g++ -O2 tools/webtop.cpp -o webtop
+// 用法：webtop [-d 刷新间隔秒] [-n 刷新次数] [-c 显示的连接数] [-a]
+//      默认按进入当前状态的时间从长到短显示连接，-a 显示包括空闲在内的所有连接（默认隐藏 IDLE）
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <vector>
+#include "../scoreboard.h"
+
+static const char* conn_state_name[SB_CONN_STATE_NUM] = {"FREE", "IDLE", "READING", "QUEUED", "PROCESSING", "WRITING"};
+static const char* worker_state_name[SB_WORKER_STATE_NUM] = {"NONE", "WAITING", "BUSY"};
+
+// 记分板只在 webtop 中定义，服务器端的全局变量不会被链接进来
+sb_header* g_sb = NULL;
+sb_conn_slot* g_sb_conns = NULL;
+__thread int t_sb_worker = -1;
+
+// 把微秒格式化为易读的时长
+static const char* fmt_duration(int64_t us, char* buf, size_t len){
+    if(us < 1000) snprintf(buf, len, "%ldus", (long)us);
+    else if(us < 1000000) snprintf(buf, len, "%.1fms", us / 1e3);
+    else snprintf(buf, len, "%.1fs", us / 1e6);
+    return buf;
+}
+
+static bool by_since(const std::pair<int, sb_conn_slot>& a, const std::pair<int, sb_conn_slot>& b){
+    return a.second.since_us < b.second.since_us;
+}
+
+static void show(void* base, int max_conns, bool show_idle){
+    sb_header* hdr = (sb_header*)base;
+    sb_worker_slot* workers = sb_worker_slots(base);
+    sb_conn_slot* conns = sb_conn_slots(base);
+    int64_t now = get_mono_us();
+    char dur[32];
+
+    // 先拷贝一份快照，再统计和排序，减少读到正在修改的槽位的机会
+    int state_cnt[SB_CONN_STATE_NUM] = {0};
+    std::vector<std::pair<int, sb_conn_slot> > active;
+    for(uint32_t fd = 0; fd < hdr->conn_slots; ++fd){
+        sb_conn_slot slot = conns[fd];
+        if(slot.state == SB_CONN_FREE || slot.state >= SB_CONN_STATE_NUM) continue;
+        ++state_cnt[slot.state];
+        if(slot.state != SB_CONN_IDLE || show_idle){
+            active.push_back(std::make_pair((int)fd, slot));
+        }
+    }
+    std::sort(active.begin(), active.end(), by_since);
+
+    printf("\033[H\033[2J");    // 清屏
+    printf("webserver pid %d  uptime %s  connections:", hdr->pid, fmt_duration(now - hdr->start_mono_us, dur, sizeof(dur)));
+    for(int s = SB_CONN_IDLE; s < SB_CONN_STATE_NUM; ++s){
+        printf(" %s=%d", conn_state_name[s], state_cnt[s]);
+    }
+    printf("\n\n%-6s %-8s %-6s %10s %12s  %s\n", "WORKER", "STATE", "FD", "TIME", "REQUESTS", "URL");
+    for(uint32_t i = 0; i < hdr->workers && i < hdr->worker_slots; ++i){
+        sb_worker_slot w = workers[i];
+        w.url[SCOREBOARD_URL_LEN - 1] = '\0';
+        printf("%-6u %-8s %-6d %10s %12lu  %s\n", i, w.state < SB_WORKER_STATE_NUM ? worker_state_name[w.state] : "?",
+               w.fd, fmt_duration(now - w.since_us, dur, sizeof(dur)), (unsigned long)w.requests,
+               w.state == SB_WORKER_BUSY ? w.url : "");
+    }
+
+    printf("\n%-6s %-21s %-10s %10s %6s %10s %12s %6s  %s\n", "FD", "CLIENT", "STATE", "TIME", "REQS",
+           "BYTES_IN", "BYTES_OUT", "WORKER", "URL");
+    for(int i = 0; i < (int)active.size() && i < max_conns; ++i){
+        sb_conn_slot& c = active[i].second;
+        c.url[SCOREBOARD_URL_LEN - 1] = '\0';
+        char ip[16] = "", client[32];
+        inet_ntop(AF_INET, &c.client_ip, ip, sizeof(ip));
+        snprintf(client, sizeof(client), "%s:%d", ip, ntohs(c.client_port));
+        printf("%-6d %-21s %-10s %10s %6u %10lu %12lu %6u  %s\n", active[i].first, client, conn_state_name[c.state],
+               fmt_duration(now - c.since_us, dur, sizeof(dur)), c.requests, (unsigned long)c.bytes_in,
+               (unsigned long)c.bytes_out, c.worker, c.url);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[]){
+    double delay = 1.0;
+    int count = -1, max_conns = 40;
+    bool show_idle = false;
+    int opt;
+    while((opt = getopt(argc, argv, "d:n:c:a")) != -1){
+        switch(opt){
+            case 'd': delay = atof(optarg); break;
+            case 'n': count = atoi(optarg); break;
+            case 'c': max_conns = atoi(optarg); break;
+            case 'a': show_idle = true; break;
+            default:
+                fprintf(stderr, "usage: %s [-d seconds] [-n iterations] [-c connections] [-a]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    int fd = shm_open(SCOREBOARD_NAME, O_RDONLY, 0);
+    if(fd == -1){
+        perror("shm_open " SCOREBOARD_NAME);
+        return 1;
+    }
+    void* base = mmap(0, SCOREBOARD_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED){
+        perror("mmap");
+        return 1;
+    }
+    sb_header* hdr = (sb_header*)base;
+    if(memcmp(hdr->magic, SCOREBOARD_MAGIC, 4) != 0 || hdr->version != SCOREBOARD_VERSION
+        || hdr->worker_slots != SCOREBOARD_WORKERS || hdr->conn_slots != SCOREBOARD_CONNS){
+        fprintf(stderr, "scoreboard layout mismatch, rebuild webtop with the server's scoreboard.h\n");
+        return 1;
+    }
+
+    for(int i = 0; count < 0 || i < count; ++i){
+        if(i > 0) usleep(delay * 1e6);
+        show(base, max_conns, show_idle);
+    }
+    munmap(base, SCOREBOARD_SIZE);
+    return 0;
+}
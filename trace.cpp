@@ -0,0 +1,155 @@
+#include "trace.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <atomic>
+
+// 一个阶段的起止时间
+struct trace_event {
+    uint64_t req;           // 请求编号
+    int64_t start_us;
+    int64_t end_us;
+    int32_t fd;
+    int32_t phase;          // TRACE_PHASE
+};
+
+// 每个线程的环形缓冲区，只有所属线程写入，满了覆盖最旧的事件
+struct trace_ring {
+    std::atomic<unsigned long> tail;    // 已写入的事件总数
+    int tid;                            // 线程号
+    trace_ring* next;
+    trace_event evs[TRACE_RING_SIZE];
+};
+
+std::atomic<int> trace_sample_rate(TRACE_SAMPLE_RATE);
+long trace_epoll_wake_us = 0;
+
+static std::atomic<unsigned long> g_req_seq(0);     // 请求计数，用于采样和生成请求编号
+static std::atomic<trace_ring*> g_rings(NULL);
+static __thread trace_ring* t_ring = NULL;
+
+static const char* phase_name[TR_PHASE_NUM] = {
+    "request", "accept_wait", "epoll_delay", "read", "queue", "process_read",
+    "do_request", "process_write", "response_wait", "write", "eagain_wait",
+};
+
+// 在某个线程上执行（而不是等待）的阶段，额外输出到该线程的轨道上
+static const bool phase_on_thread[TR_PHASE_NUM] = {
+    false, false, false, true, false, true, true, true, false, true, false,
+};
+
+uint64_t trace_sample(){
+    #if TRACE_OPEN
+    int rate = trace_sample_rate.load(std::memory_order_relaxed);
+    if(rate <= 0){
+        return 0;
+    }
+    unsigned long seq = g_req_seq.fetch_add(1, std::memory_order_relaxed) + 1;
+    return seq % rate == 0 ? seq : 0;
+    #else
+    return 0;               // 未编译追踪功能时不采样任何请求
+    #endif
+}
+
+static trace_ring* trace_ring_get(){
+    if(!t_ring){
+        trace_ring* ring = new trace_ring;
+        ring->tail.store(0);
+        ring->tid = syscall(SYS_gettid);    // 每个线程只调用一次
+        trace_ring* head = g_rings.load(std::memory_order_relaxed);
+        do{
+            ring->next = head;
+        }while(!g_rings.compare_exchange_weak(head, ring, std::memory_order_release, std::memory_order_relaxed));
+        t_ring = ring;
+    }
+    return t_ring;
+}
+
+void trace_record(uint64_t req, TRACE_PHASE phase, long start_us, long end_us, int fd){
+    if(start_us <= 0 || end_us < start_us){
+        return;             // 阶段的起点没有记录到
+    }
+    trace_ring* ring = trace_ring_get();
+    unsigned long tail = ring->tail.load(std::memory_order_relaxed);
+    trace_event& ev = ring->evs[tail & (TRACE_RING_SIZE - 1)];
+    ev.req = req;
+    ev.start_us = start_us;
+    ev.end_us = end_us;
+    ev.fd = fd;
+    ev.phase = phase;
+    ring->tail.store(tail + 1, std::memory_order_release);
+}
+
+static void trace_append(std::string& out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+static void trace_append(std::string& out, const char* fmt, ...){
+    char buf[512];
+    va_list arg;
+    va_start(arg, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, arg);
+    va_end(arg);
+    out.append(buf, len < (int)sizeof(buf) ? len : sizeof(buf) - 1);
+}
+
+/*
+    导出时各线程可能仍在写入，最旧的一部分事件可能在拷贝过程中被覆盖，
+    所以只导出距离写入位置半个缓冲区以内的事件。
+*/
+void trace_dump(std::string& out){
+    out.assign("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for(trace_ring* ring = g_rings.load(std::memory_order_acquire); ring; ring = ring->next){
+        trace_append(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                     first ? "" : ",\n", ring->tid, ring->tid);
+        first = false;
+
+        unsigned long tail = ring->tail.load(std::memory_order_acquire);
+        unsigned long head = tail > TRACE_RING_SIZE / 2 ? tail - TRACE_RING_SIZE / 2 : 0;
+        for(unsigned long i = head; i < tail; ++i){
+            trace_event ev = ring->evs[i & (TRACE_RING_SIZE - 1)];
+            if(ev.phase < 0 || ev.phase >= TR_PHASE_NUM) continue;
+            const char* name = phase_name[ev.phase];
+            // 请求轨道上的嵌套异步片段
+            trace_append(out, ",\n{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"b\",\"id\":%lu,\"pid\":1,\"tid\":%d,\"ts\":%ld,"
+                         "\"args\":{\"fd\":%d,\"tid\":%d}}", name, (unsigned long)ev.req, ring->tid, (long)ev.start_us, ev.fd, ring->tid);
+            trace_append(out, ",\n{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"e\",\"id\":%lu,\"pid\":1,\"tid\":%d,\"ts\":%ld}",
+                         name, (unsigned long)ev.req, ring->tid, (long)ev.end_us);
+            if(phase_on_thread[ev.phase]){
+                trace_append(out, ",\n{\"name\":\"%s\",\"cat\":\"thread\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%ld,\"dur\":%ld,"
+                             "\"args\":{\"req\":%lu,\"fd\":%d}}", name, ring->tid, (long)ev.start_us,
+                             (long)(ev.end_us - ev.start_us), (unsigned long)ev.req, ev.fd);
+            }
+        }
+    }
+    out.append("\n]}\n");
+}
+
+bool trace_dump_file(){
+    std::string out;
+    trace_dump(out);
+
+    char name[128];
+    time_t now = time(NULL);
+    struct tm tm_now;
+    localtime_r(&now, &tm_now);
+    mkdir(TRACE_DIR, 0755);
+    snprintf(name, sizeof(name), "%s/trace_%04d%02d%02d_%02d%02d%02d.json", TRACE_DIR,
+             tm_now.tm_year + 1900, tm_now.tm_mon + 1, tm_now.tm_mday,
+             tm_now.tm_hour, tm_now.tm_min, tm_now.tm_sec);
+    int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd == -1){
+        return false;
+    }
+    size_t done = 0;
+    while(done < out.size()){
+        ssize_t ret = write(fd, out.data() + done, out.size() - done);
+        if(ret <= 0) break;
+        done += ret;
+    }
+    close(fd);
+    return done == out.size();
+}
@@ -0,0 +1,79 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <string>
+#include <atomic>
+#include "mono_clock.h"
+
+/*
+    请求生命周期追踪
+    按采样率选中的请求在各阶段开始和结束时记录时间（单调时钟：微秒），事件写入所在线程的环形缓冲区，
+    缓冲区写满后覆盖最旧的事件，相当于一个飞行记录仪。收到 SIGUSR1 或访问 TRACE_PATH 时，
+    把所有线程缓冲区中的事件导出为 Chrome trace_event 格式的 JSON，可以直接在 Perfetto/chrome://tracing 中打开。
+    每个请求对应一条异步轨道（id 为请求编号），各阶段是其上的嵌套片段，args.tid 为执行该阶段的线程。
+    未被采样的请求只多一次整数比较。
+*/
+
+#ifndef TRACE_OPEN                      // 是否编译追踪功能，可用 -DTRACE_OPEN=0 关闭
+#define TRACE_OPEN 1
+#endif
+#define TRACE_SAMPLE_RATE 0             // 默认采样率：每 N 个请求追踪一个，0 表示关闭
+#define TRACE_RING_SIZE 4096            // 每个线程环形缓冲区的事件数，必须是2的幂
+#define TRACE_PATH "/debug/trace"       // 导出追踪数据的内部路径，"?sample=N" 修改采样率
+#define TRACE_DIR "./log"               // 收到 SIGUSR1 时导出文件的目录
+
+// 请求生命周期的各个阶段
+enum TRACE_PHASE {
+    TR_REQUEST = 0,     // 整个请求：收到第一个字节到响应发送完毕
+    TR_ACCEPT_WAIT,     // 连接建立到收到第一个字节（只有连接上的第一个请求有）
+    TR_EPOLL_DELAY,     // epoll_wait 返回到事件循环开始处理该连接
+    TR_READ,            // read() 中的 recv 循环
+    TR_QUEUE,           // 在线程池队列中等待
+    TR_PARSE,           // process_read
+    TR_DO_REQUEST,      // do_request：stat/open/mmap 目标文件
+    TR_PROCESS_WRITE,   // process_write：生成响应
+    TR_RESPONSE_WAIT,   // 响应就绪到主线程开始 write()
+    TR_WRITE,           // write() 中的 writev 循环
+    TR_EAGAIN_WAIT,     // writev 返回 EAGAIN 后等待下一次 EPOLLOUT
+    TR_PHASE_NUM
+};
+
+extern std::atomic<int> trace_sample_rate;  // 当前采样率，可由工作线程修改（见 TRACE_PATH 的 ?sample=N）
+extern long trace_epoll_wake_us;        // 主线程最近一次 epoll_wait 返回的时间
+
+uint64_t trace_sample();                // 新请求开始时调用，被采样时返回非0的请求编号
+void trace_record(uint64_t req, TRACE_PHASE phase, long start_us, long end_us, int fd);
+void trace_dump(std::string& out);      // 导出所有线程缓冲区中的事件
+bool trace_dump_file();                 // 导出到 TRACE_DIR 下的文件
+
+// 记录一个作用域的起止时间，用于有多个返回点的函数
+#if TRACE_OPEN
+struct trace_scope {
+    uint64_t req;
+    TRACE_PHASE phase;
+    int fd;
+    long start_us;
+    trace_scope(uint64_t r, TRACE_PHASE p, int f) : req(r), phase(p), fd(f), start_us(r ? get_mono_us() : 0) {}
+    ~trace_scope(){
+        if(req) trace_record(req, phase, start_us, get_mono_us(), fd);
+    }
+};
+#else
+struct trace_scope {
+    trace_scope(uint64_t, TRACE_PHASE, int) {}
+};
+#endif
+
+// 被采样的请求才记录，未采样时只有一次比较
+#if TRACE_OPEN
+#define TRACE_EVENT(req, phase, start_us, end_us, fd) do{               \
+        if(req) trace_record(req, phase, start_us, end_us, fd);         \
+    }while(0)
+#else
+#define TRACE_EVENT(req, phase, start_us, end_us, fd) do{               \
+        (void)sizeof((req), (start_us), (end_us), (fd));                \
+    }while(0)                           // 参数不求值，只为避免未使用变量的警告
+#endif
+
+#endif